@@ -0,0 +1,166 @@
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+
+#include "motor.hpp"
+#include "pump_calibration.hpp"
+#include "sensors/sensor_array.hpp"
+
+//!##################################################
+//!######## Board descriptors #######################
+//! Everything wiring-specific lives in one constexpr
+//! struct per board; main.cpp only ever says Board::.
+//! Probe counts are array sizes, so adding a probe is
+//! one edit here and the sensor arrays, filters and
+//! conversion loops all follow at compile time.
+//!
+//! The board is picked from the core's board macro.
+//! New board: add a struct + a branch below.
+//!
+//! A board runs NUM_ZONES reservoirs (zone.hpp). Each
+//! zone has its own probes and mixer; the dosing pumps
+//! are shared and reach a zone through its valve on
+//! the dosing manifold. Probe counts are per zone.
+//! Boards run one tank unless a multi-tank layout is
+//! picked with its build flag.
+//!##################################################
+
+#if defined(ARDUINO_FEATHER_M4)
+
+// Feather M4 Express bench rig: fewer probes, TMC2209 UART on the SDA/SCL SERCOM (no I2C)
+struct FeatherM4 {
+    static constexpr size_t NUM_ZONES = 1;
+    static constexpr size_t NUM_EC    = 2;
+    static constexpr size_t NUM_PH    = 1;
+    static constexpr size_t NUM_TEMP  = 1;
+
+    struct ZonePins {
+        std::array<uint8_t, NUM_EC>   ec;
+        std::array<float,   NUM_EC>   ec_scale;
+        std::array<uint8_t, NUM_PH>   ph;
+        std::array<uint8_t, NUM_TEMP> temp;
+        uint8_t mix_in1, mix_in2, mix_ena;
+        int8_t  valve;  // manifold outlet to this reservoir, -1 = pumps plumbed straight in
+    };
+
+    static constexpr std::array<ZonePins, NUM_ZONES> ZONES = {{
+        { {{ A0, A1 }}, filled<NUM_EC>(650.0f) /* nominal until calibrated */, {{ A2 }}, {{ A3 }}, A4, A5, 13, -1 },
+    }};
+
+    // PumpId order
+    static constexpr std::array<PumpPins, NUM_PUMPS> PUMP_PINS = {{
+        { 5, 6 }, { 9, 10 }, { 11, 12 }, { 24, 23 }, { 25, 4 }
+    }};
+
+    static constexpr uint8_t TMC_RX_PIN = 22; // SCL
+    static constexpr uint8_t TMC_TX_PIN = 21; // SDA
+    static constexpr auto    TMC_RX_PAD = SERCOM_RX_PAD_1;
+    static constexpr auto    TMC_TX_PAD = UART_TX_PAD_0;
+    static constexpr bool    HAS_I2C    = false;
+
+    static constexpr int8_t  BUS_DE_PIN = -1; // RS-485 driver enable for COMM_PORT, -1 = none
+};
+
+using Board = FeatherM4;
+#define BOARD_TMC_SERCOM sercom2
+#define BOARD_TMC_SERCOM_HANDLER(n) SERCOM2_##n##_Handler
+
+
+#elif defined(BOARD_TWO_TANKS)
+
+// Grand Central M4 running two tanks (-DBOARD_TWO_TANKS, env adafruit_grandcentral_m4_two_tank).
+// Sixteen analog inputs make 3 EC / 2 pH / 3 temperature per tank, three so the median still
+// outvotes one bad probe. Zone 0 keeps the production probes but EC A1 and temperature A14,
+// which move to zone 1; zone 1's other inputs, its mixer and both manifold valves are the
+// expansion wiring below. Probe calibrations have to be redone after switching.
+struct GrandCentralM4TwoTank {
+    static constexpr size_t NUM_ZONES = 2;
+    static constexpr size_t NUM_EC    = 3;
+    static constexpr size_t NUM_PH    = 2;
+    static constexpr size_t NUM_TEMP  = 3;
+
+    struct ZonePins {
+        std::array<uint8_t, NUM_EC>   ec;
+        std::array<float,   NUM_EC>   ec_scale;
+        std::array<uint8_t, NUM_PH>   ph;
+        std::array<uint8_t, NUM_TEMP> temp;
+        uint8_t mix_in1, mix_in2, mix_ena;
+        int8_t  valve;  // manifold outlet to this reservoir, -1 = pumps plumbed straight in
+    };
+
+    static constexpr std::array<ZonePins, NUM_ZONES> ZONES = {{
+        { {{ A5, A9, A13 }}, {{ 660.37735849f, 2456.14035088f, 633.4841629f }}, {{ A3, A15 }}, {{ A2, A6, A10 }},
+          37, 39, 35, 47 },
+        { {{ A1, A7, A8 }},  {{ 583.33333333f, 650.0f, 650.0f }} /* nominal until calibrated */, {{ A0, A4 }},
+          {{ A14, A11, A12 }}, 41, 43, 45, 49 },
+    }};
+
+    // PumpId order
+    static constexpr std::array<PumpPins, NUM_PUMPS> PUMP_PINS = {{
+        { 50, 52 }, // pH up
+        { 48, 46 }, // pH down
+        { 36, 34 }, // gro
+        { 38, 40 }, // micro
+        { 42, 44 }, // bloom
+    }};
+
+    static constexpr uint8_t TMC_RX_PIN = 17;
+    static constexpr uint8_t TMC_TX_PIN = 16;
+    static constexpr auto    TMC_RX_PAD = SERCOM_RX_PAD_1;
+    static constexpr auto    TMC_TX_PAD = UART_TX_PAD_0;
+    static constexpr bool    HAS_I2C    = true;
+
+    static constexpr int8_t  BUS_DE_PIN = -1; // RS-485 driver enable for COMM_PORT, -1 = none
+};
+
+using Board = GrandCentralM4TwoTank;
+#define BOARD_TMC_SERCOM sercom1
+#define BOARD_TMC_SERCOM_HANDLER(n) SERCOM1_##n##_Handler
+
+#else
+
+// Grand Central M4: the production controller, one tank
+struct GrandCentralM4 {
+    static constexpr size_t NUM_ZONES = 1;
+    static constexpr size_t NUM_EC    = 4;
+    static constexpr size_t NUM_PH    = 2;
+    static constexpr size_t NUM_TEMP  = 4;
+
+    struct ZonePins {
+        std::array<uint8_t, NUM_EC>   ec;
+        std::array<float,   NUM_EC>   ec_scale;
+        std::array<uint8_t, NUM_PH>   ph;
+        std::array<uint8_t, NUM_TEMP> temp;
+        uint8_t mix_in1, mix_in2, mix_ena;
+        int8_t  valve;  // manifold outlet to this reservoir, -1 = pumps plumbed straight in
+    };
+
+    static constexpr std::array<ZonePins, NUM_ZONES> ZONES = {{
+        { {{ A5, A9, A13, A1 }}, {{ 660.37735849f, 2456.14035088f, 633.4841629f, 583.33333333f }}, {{ A3, A15 }},
+          {{ A2, A6, A10, A14 }}, 37, 39, 35, -1 },
+    }};
+
+    // PumpId order
+    static constexpr std::array<PumpPins, NUM_PUMPS> PUMP_PINS = {{
+        { 50, 52 }, // pH up
+        { 48, 46 }, // pH down
+        { 36, 34 }, // gro
+        { 38, 40 }, // micro
+        { 42, 44 }, // bloom
+    }};
+
+    static constexpr uint8_t TMC_RX_PIN = 17;
+    static constexpr uint8_t TMC_TX_PIN = 16;
+    static constexpr auto    TMC_RX_PAD = SERCOM_RX_PAD_1;
+    static constexpr auto    TMC_TX_PAD = UART_TX_PAD_0;
+    static constexpr bool    HAS_I2C    = true;
+
+    static constexpr int8_t  BUS_DE_PIN = -1; // RS-485 driver enable for COMM_PORT, -1 = none
+};
+
+using Board = GrandCentralM4;
+#define BOARD_TMC_SERCOM sercom1
+#define BOARD_TMC_SERCOM_HANDLER(n) SERCOM1_##n##_Handler
+
+#endif
@@ -0,0 +1,1078 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <math.h>
+#include <string.h>
+
+#include "serial_comm.hpp"
+#include "bus_master.hpp"
+#include "profile_catalog.hpp"
+#include "mqtt_link.hpp"
+#include "sensor_history.hpp"
+#include "ws_frames.hpp"
+#include "mem_watch.hpp"
+#include "ts_codec.hpp"
+
+#if !defined(ESP32)
+#include <mutex>
+#endif
+
+//!##################################################
+//!######## Bridge core #############################
+//! What the bridge does between its web clients and
+//! the bus, with nothing of the ESP32 in it: the
+//! route handlers, the pending command slots, and
+//! loop()'s side of the UART. web_host.cpp wires it
+//! to ESPAsyncWebServer, Serial2 and LittleFS;
+//! tools/bridge_loadgen.cpp to a socket server and
+//! the MCU firmware on a pty, so handler changes can
+//! be load-tested on a PC before flashing.
+//!
+//! Handlers run on the web server's task (async_tcp
+//! on the ESP32), service() and mcu_line() on
+//! loop()'s. They meet in the pending slots, the
+//! catalog select and the sensor history, under the
+//! bridge lock.
+//!
+//! A slot holds one command per kind until loop()
+//! queues it for the bus; a second POST of the same
+//! kind before then replaces the first, which counts
+//! in `overwritten`.
+//!
+//! A node/zone with no history yet (the bridge just
+//! started) has its MCU's sample log read back first,
+//! a block per M:2018, oldest to newest; its live
+//! readings go to the charts once that is done, or
+//! after BACKFILL_TIMEOUT_MS without an answer.
+//!##################################################
+
+static constexpr unsigned long BRIDGE_POLL_MS      = 2000;
+static constexpr unsigned long RECIPE_LINE_GAP_MS  = 50;    // between M:2011 lines of an upload
+static constexpr unsigned long RECIPE_ANSWER_MS    = 10000; // for the MCU's M:2013 to each of them
+static constexpr unsigned long MEM_SAMPLE_MS       = 1000;
+static constexpr unsigned long MEM_POLL_MS         = 60000; // M:2016 to every online node
+static constexpr unsigned long BACKFILL_TIMEOUT_MS = 10000; // per M:2018; a poll cycle of a full bus and then some
+
+static constexpr uint16_t PROFILES_PER_PAGE     = 20;
+static constexpr uint16_t PROFILES_MAX_PER_PAGE = 50;
+
+#if defined(ESP32)
+class BridgeLock {
+    public:
+        void lock()   { portENTER_CRITICAL(&mux); }
+        void unlock() { portEXIT_CRITICAL(&mux); }
+
+    private:
+        portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+#else
+class BridgeLock {
+    public:
+        void lock()   { m.lock(); }
+        void unlock() { m.unlock(); }
+
+    private:
+        std::mutex m;
+};
+#endif
+
+// Last readings of one zone
+struct NodeReading {
+    float ph;
+    float ec;
+    float temp;
+};
+
+// One command a handler built, waiting for loop()
+template <size_t N>
+struct CommandSlot {
+    const char *what;
+    bool        pending;
+    char        json[N];
+};
+
+// What a handler sees of a request: its query parameters and, for a POST, the whole body
+class BridgeRequest {
+    public:
+        const char *body = "";
+        size_t      len  = 0;
+
+        virtual bool        has(const char *name) const = 0;
+        virtual const char *param(const char *name) const = 0; // "" when absent
+
+        long number(const char *name, long fallback) const { return has(name) ? atol(param(name)) : fallback; }
+
+        // ?node=N; default 1, the only node of a point-to-point link
+        uint8_t node() const {
+            long n = number("node", 1);
+            return (n >= 1 && n <= NODE_MAX) ? static_cast<uint8_t>(n) : 1;
+        }
+
+        // ?zone=Z; default 0, the only zone of a single-reservoir controller
+        uint8_t zone() const {
+            long z = number("zone", 0);
+            return (z >= 0 && z < ZONE_MAX) ? static_cast<uint8_t>(z) : 0;
+        }
+
+    protected:
+        ~BridgeRequest() = default;
+};
+
+class BridgeCore {
+    public:
+        BusMaster      bus;
+        ProfileCatalog catalog;  // opened by the platform; only read from the handlers
+        SensorHistory  history;
+        Telemetry     *telemetry = nullptr;
+        Print         *log       = nullptr;
+
+        // Where MCU replies go: server-sent events, and the /ws clients as text or binary frames
+        void (*sse)(const char *event, const char *data)   = nullptr;
+        void (*ws_text)(const char *line)                  = nullptr;
+        void (*ws_binary)(const uint8_t *frame, size_t len) = nullptr;
+
+        BridgeLock lock;
+
+        // JsonDocuments in the handlers count as "web", loop()'s as "bus" (mem_watch.hpp)
+        CountingAllocator webAlloc { "web" };
+        CountingAllocator busAlloc { "bus" };
+        MemWatch          mem;
+
+        uint32_t overwritten = 0; // commands replaced in their slot before loop() took them
+        uint32_t forwarded   = 0; // commands loop() took from a slot
+        uint32_t backfilled  = 0; // samples read back from the MCUs' logs into the history
+
+        // By node address ([0] unused) and zone; an unaddressed MCU is node 1
+        NodeReading readings[NODE_MAX + 1][ZONE_MAX] = {};
+        uint8_t     nodeZones[NODE_MAX + 1]          = {}; // in its last M:1002
+        int16_t     nodeDuty[NODE_MAX + 1]           = {}; // awake per-mille, -1 until reported
+
+        void begin();
+
+        // From loop(): pending commands onto the bus, the recipe upload, watermarks, the bus itself
+        void service(unsigned long now);
+
+        // From loop(): one line from the MCUs
+        void mcu_line(const char *line, unsigned long now);
+
+        // A command for the node in its "N" (none: node 1); false when the bus queue is full
+        bool queue_to_mcu(const char *line);
+
+        // One /ws command; the status its ack carries
+        uint8_t ws_command(const WsCommand &cmd);
+
+        // Routes: the reply goes to out, the status code is returned
+        int get_data(const BridgeRequest &rq, Print &out);
+        int get_nodes(const BridgeRequest &rq, Print &out);
+        int get_mem(const BridgeRequest &rq, Print &out);
+        int get_history(const BridgeRequest &rq, Print &out);
+        int get_crops(const BridgeRequest &rq, Print &out);
+        int get_profiles(const BridgeRequest &rq, Print &out);
+        int post_dose(const BridgeRequest &rq, Print &out);
+        int post_state(const BridgeRequest &rq, Print &out);
+        int post_profile(const BridgeRequest &rq, Print &out);
+        int post_pump_cal(const BridgeRequest &rq, Print &out);
+        int post_cancel(const BridgeRequest &rq, Print &out);
+        int post_probe_cal(const BridgeRequest &rq, Print &out);
+        int post_recipe(const BridgeRequest &rq, Print &out);
+        int post_select(const BridgeRequest &rq, Print &out);
+
+    private:
+        CommandSlot<256>  dose     = { "loading dose", false, {} };
+        CommandSlot<128>  state    = { "system state", false, {} };
+        CommandSlot<192>  profile  = { "profile", false, {} };
+        CommandSlot<96>   cal      = { "pump cal", false, {} };
+        CommandSlot<48>   cancel   = { "cancel", false, {} };
+        CommandSlot<96>   probeCal = { "probe cal", false, {} };
+        CommandSlot<1024> recipe   = { "recipe", false, {} }; // loop() turns it into M:2011 lines or an M:2012
+
+        // Recipe upload in progress: a few steps per M:2011 line, the next once the MCU has taken
+        // the last, so a rejection stops the rest
+        JsonDocument  recipeUpload { &busAlloc };
+        size_t        recipeNext       = 0;
+        uint8_t       recipeNode       = 1;
+        bool          recipeAwaiting   = false;
+        unsigned long lastRecipeLineMs = 0;
+
+        // Catalog profile picked by a handler, and the last one sent to each node's zones, for
+        // when it replies that it doesn't have it cached
+        bool           pendingSelect        = false;
+        CatalogProfile pendingSelectProfile = {};
+        uint8_t        pendingSelectNode    = 1;
+        uint8_t        pendingSelectZone    = 0;
+        CatalogProfile selectedProfile[NODE_MAX + 1][ZONE_MAX] = {};
+
+        // Each node's last M:2017 as it came in, and when
+        char          nodeMem[NODE_MAX + 1][COMM_BUF_SIZE] = {};
+        unsigned long nodeMemMs[NODE_MAX + 1]              = {};
+
+        unsigned long lastMemSampleMs = 0;
+        unsigned long lastMemPollMs   = 0;
+
+        // Sample log read back, per node/zone: once, from the first reading; the block asked for and when
+        struct Backfill {
+            bool          active;
+            bool          done;
+            uint32_t      seq;
+            unsigned long asked;
+            uint32_t      samples;
+        };
+        Backfill backfill[NODE_MAX + 1][ZONE_MAX] = {};
+
+        template <size_t N> void stage(const JsonDocument &cmd, CommandSlot<N> &slot);
+        template <size_t N> void forward(CommandSlot<N> &slot);
+
+        bool parse_body(const BridgeRequest &rq, JsonDocument &in, Print &out);
+        void select(const CatalogProfile &p, uint8_t node, uint8_t zone);
+        void send_recipe_lines(unsigned long now);
+        void sensor_response(JsonDocument &doc, uint8_t node, unsigned long now);
+        void request_block(uint8_t node, uint8_t zone, uint32_t seq, unsigned long now);
+        void history_block(JsonDocument &doc, uint8_t node, uint8_t zone, unsigned long now);
+        void profile_status(JsonDocument &doc, const char *line, uint8_t node, uint8_t zone);
+        void recipe_status(JsonDocument &doc, const char *line, uint8_t node);
+        void abandon_recipe(const char *why, int step);
+        void event(const char *name, const char *line);
+};
+
+// Path, method, body limit (longer is cut, and won't parse) and whether the reply is streamed.
+// Matched in order: the ESP32's server takes "/profiles" for everything under it too.
+typedef int (BridgeCore::*BridgeHandler)(const BridgeRequest &rq, Print &out);
+
+struct BridgeRoute {
+    const char   *path;
+    bool          post;
+    uint16_t      body_max;
+    bool          stream;
+    BridgeHandler handler;
+};
+
+static const BridgeRoute BRIDGE_ROUTES[] = {
+    { "/data",            false, 0,    false, &BridgeCore::get_data },
+    { "/nodes",           false, 0,    false, &BridgeCore::get_nodes },
+    { "/mem",             false, 0,    false, &BridgeCore::get_mem },
+    { "/history",         false, 0,    true,  &BridgeCore::get_history },
+    { "/loading-dose",    true,  256,  false, &BridgeCore::post_dose },
+    { "/set-state",       true,  128,  false, &BridgeCore::post_state },
+    { "/set-profile",     true,  192,  false, &BridgeCore::post_profile },
+    { "/pump-cal",        true,  96,   false, &BridgeCore::post_pump_cal },
+    { "/cancel-job",      true,  48,   false, &BridgeCore::post_cancel },
+    { "/probe-cal",       true,  96,   false, &BridgeCore::post_probe_cal },
+    { "/recipe",          true,  1024, false, &BridgeCore::post_recipe },
+    { "/profiles/crops",  false, 0,    false, &BridgeCore::get_crops },
+    { "/profiles/select", true,  32,   false, &BridgeCore::post_select },
+    { "/profiles",        false, 0,    false, &BridgeCore::get_profiles },
+};
+
+//!##################################################
+//!######## loop() side #############################
+//!##################################################
+
+void BridgeCore::begin() {
+    bus.poll_ms = BRIDGE_POLL_MS;
+    mem.track(webAlloc);
+    mem.track(busAlloc);
+    for (int16_t &d : nodeDuty) d = -1;
+}
+
+bool BridgeCore::queue_to_mcu(const char *line) {
+    uint8_t node = line_node(line);
+    if (bus.queue(node ? node : 1, line)) return true;
+    if (log) {
+        log->print("Bus queue full, dropped -> ");
+        log->println(line);
+    }
+    return false;
+}
+
+// Copied out under the lock, so a handler staging the next one can't tear it
+template <size_t N>
+void BridgeCore::forward(CommandSlot<N> &slot) {
+    char line[N];
+    lock.lock();
+    bool has = slot.pending;
+    if (has) {
+        memcpy(line, slot.json, N);
+        slot.pending = false;
+    }
+    lock.unlock();
+    if (!has) return;
+
+    forwarded++;
+    queue_to_mcu(line);
+    if (log) {
+        log->print("Forwarded ");
+        log->print(slot.what);
+        log->print(" -> ");
+        log->println(line);
+    }
+}
+
+void BridgeCore::service(unsigned long now) {
+    forward(dose);
+    forward(state);
+    forward(profile);
+    forward(cal);
+    forward(cancel);
+    forward(probeCal);
+
+    char body[sizeof(recipe.json)];
+    lock.lock();
+    bool hasRecipe = recipe.pending;
+    if (hasRecipe) {
+        memcpy(body, recipe.json, sizeof(body));
+        recipe.pending = false;
+    }
+    lock.unlock();
+
+    if (hasRecipe) {
+        forwarded++;
+        JsonDocument in(&busAlloc);
+        deserializeJson(in, body);
+
+        if (in["steps"].is<JsonArray>()) {
+            // A new upload replaces one still in flight
+            recipeUpload.clear();
+            recipeUpload.set(in["steps"]);
+            recipeNext       = 0;
+            recipeNode       = in["N"] | 1;
+            recipeAwaiting   = false;
+            if (log) {
+                log->print("Uploading recipe, ");
+                log->print(static_cast<unsigned>(recipeUpload.size()));
+                log->println(" steps");
+            }
+        } else {
+            // Runs on the zone it was started from
+            JsonDocument out(&busAlloc);
+            out["M"] = MSG_RECIPE_CTRL;
+            out["N"] = in["N"] | 1;
+            if (in["Z"].is<int>())    out["Z"]   = in["Z"];
+            if (in["run"].is<bool>()) out["run"] = in["run"];
+
+            char line[48];
+            serializeJson(out, line, sizeof(line));
+            queue_to_mcu(line);
+            if (log) {
+                log->print("Forwarded recipe control -> ");
+                log->println(line);
+            }
+        }
+    }
+    send_recipe_lines(now);
+
+    lock.lock();
+    bool    hasSelect  = pendingSelect;
+    uint8_t selectNode = pendingSelectNode;
+    uint8_t selectZone = pendingSelectZone;
+    if (hasSelect) {
+        selectedProfile[selectNode][selectZone] = pendingSelectProfile;
+        pendingSelect = false;
+    }
+    lock.unlock();
+
+    if (hasSelect) {
+        forwarded++;
+        const CatalogProfile &p = selectedProfile[selectNode][selectZone];
+        char line[72];
+        snprintf(line, sizeof(line), "{\"M\":%u,\"N\":%u,\"Z\":%u,\"id\":%u,\"crc\":%u}", MSG_PROFILE_SELECT,
+                 selectNode, selectZone, p.id, profile_crc(p));
+        queue_to_mcu(line);
+        if (log) {
+            log->print("Forwarded profile select -> ");
+            log->println(line);
+        }
+    }
+
+    // Own watermarks every second; the nodes' when the bus has room for a line each
+    if (now - lastMemSampleMs >= MEM_SAMPLE_MS) {
+        mem_sample(mem);
+        lastMemSampleMs = now;
+    }
+    if (now - lastMemPollMs >= MEM_POLL_MS) {
+        for (uint8_t a = 1; a <= NODE_MAX; ++a) {
+            if (!bus.node(a).online) continue;
+            char line[24];
+            snprintf(line, sizeof(line), "{\"M\":%u,\"N\":%u}", MSG_MEM_REQUEST, a);
+            queue_to_mcu(line);
+        }
+        lastMemPollMs = now;
+    }
+
+    for (uint8_t a = 1; a <= NODE_MAX; ++a) {
+        for (uint8_t z = 0; z < ZONE_MAX; ++z) {
+            Backfill &b = backfill[a][z];
+            if (!b.active || now - b.asked < BACKFILL_TIMEOUT_MS) continue;
+            b.active = false;
+            b.done   = true;
+            if (log) {
+                log->print("Backfill: no answer from node ");
+                log->println(a);
+            }
+        }
+    }
+
+    bus.service(now);
+}
+
+// As many steps per M:2011 as fit the MCU's line buffer; "at" 0 starts a new table there
+void BridgeCore::send_recipe_lines(unsigned long now) {
+    // The last line is waited for too: the upload only ends on its answer
+    if (recipeAwaiting) {
+        if (now - lastRecipeLineMs >= RECIPE_ANSWER_MS) abandon_recipe("no answer", -1);
+        return;
+    }
+    if (recipeNext >= recipeUpload.size()) return;
+    if (now - lastRecipeLineMs < RECIPE_LINE_GAP_MS) return;
+
+    JsonDocument out(&busAlloc);
+    out["M"]  = MSG_RECIPE_LOAD;
+    out["N"]  = recipeNode;
+    out["at"] = recipeNext;
+    JsonArray steps = out["s"].to<JsonArray>();
+
+    size_t first = recipeNext;
+    while (recipeNext < recipeUpload.size()) {
+        steps.add(recipeUpload[recipeNext]);
+        if (measureJson(out) >= COMM_BUF_SIZE - 1) {
+            steps.remove(steps.size() - 1);
+            break;
+        }
+        recipeNext++;
+    }
+
+    // One step that can't fit on its own would stall the upload
+    if (recipeNext == first) {
+        abandon_recipe("step too long", static_cast<int>(first));
+    } else {
+        char line[COMM_BUF_SIZE];
+        serializeJson(out, line, sizeof(line));
+        queue_to_mcu(line);
+        lastRecipeLineMs = now;
+        recipeAwaiting   = true;
+    }
+}
+
+// An MCU reply for the dashboards, as-is: an SSE event and a /ws text frame
+void BridgeCore::event(const char *name, const char *line) {
+    if (sse) sse(name, line);
+    if (ws_text) ws_text(line);
+}
+
+void BridgeCore::mcu_line(const char *line, unsigned long now) {
+    JsonDocument doc(&busAlloc);
+    if (deserializeJson(doc, line)) return;
+
+    uint16_t msgType = doc["M"] | 0;
+    uint8_t  node    = doc["N"] | 1;
+    if (node > NODE_MAX) node = 1;
+    uint8_t  zone    = doc["Z"] | 0;
+    if (zone >= ZONE_MAX) zone = 0;
+    bus.received(node, msgType, now);
+
+    switch (msgType) {
+        case MSG_SENSOR_RESPONSE:   // 1002
+            sensor_response(doc, node, now);
+            break;
+
+        case MSG_MEM_REPORT:        // 2017
+            lock.lock();
+            strncpy(nodeMem[node], line, sizeof(nodeMem[node]) - 1);
+            nodeMemMs[node] = now;
+            lock.unlock();
+            break;
+
+        case MSG_PUMP_CAL_STATUS:   // 2006, the dashboard shows the prompt / result as-is
+            event("pumpcal", line);
+            break;
+
+        case MSG_DOSE_REPORT:       // 2007
+            event("dose", line);
+            if (telemetry) {
+                telemetry->dose(now, node, zone, doc["id"] | 0, doc["pump"] | "", doc["req"] | 0.0f,
+                                doc["ml"] | 0.0f, doc["aborted"] | false);
+            }
+            break;
+
+        case MSG_PROBE_CAL_STATUS:  // 2010
+            event("probecal", line);
+            break;
+
+        case MSG_RECIPE_STATUS:     // 2013
+            recipe_status(doc, line, node);
+            break;
+
+        case MSG_PROFILE_STATUS:    // 2015
+            profile_status(doc, line, node, zone);
+            break;
+
+        case MSG_HISTORY_BLOCK:     // 2019
+            history_block(doc, node, zone, now);
+            break;
+    }
+}
+
+void BridgeCore::sensor_response(JsonDocument &doc, uint8_t node, unsigned long now) {
+    // Several zones: every one in "zones"; otherwise just the top level, zone 0
+    JsonArray zones = doc["zones"];
+    size_t n = zones.isNull() ? 1 : zones.size();
+    if (n > ZONE_MAX) n = ZONE_MAX;
+    nodeZones[node] = n;
+    nodeDuty[node]  = doc["duty"] | -1;
+
+    WsSampleFrame<ZONE_MAX> frame;
+    frame.begin(now);
+
+    for (uint8_t z = 0; z < n; ++z) {
+        NodeReading &v = readings[node][z];
+        if (zones.isNull()) {
+            v.ph   = doc["pH"]   | v.ph;
+            v.ec   = doc["ec"]   | v.ec;
+            v.temp = doc["temp"] | v.temp;
+        } else {
+            v.ph   = zones[z][0] | v.ph;
+            v.ec   = zones[z][1] | v.ec;
+            v.temp = zones[z][2] | v.temp;
+        }
+
+        char text[96];
+        if (log) {
+            snprintf(text, sizeof(text), "<- [%u.%u] pH %.2f  EC %.1f  Temp %.2f", node, z, v.ph, v.ec, v.temp);
+            log->println(text);
+        }
+        if (telemetry) telemetry->sample(now, node, z, v.ph, v.ec, v.temp);
+
+        // The MCU's log covers what arrives while it is read back
+        if (!backfill[node][z].done && !backfill[node][z].active) request_block(node, z, 0, now);
+        if (!backfill[node][z].active) {
+            lock.lock();
+            history.add(now, node, z, v.ph, v.ec, v.temp);
+            lock.unlock();
+        }
+        frame.add(node, z, v.ph, v.ec, v.temp);
+
+        if (sse) {
+            snprintf(text, sizeof(text), "{\"node\":%u,\"zone\":%u,\"ph\":%.2f,\"ec\":%.1f,\"temp\":%.2f}",
+                     node, z, v.ph, v.ec, v.temp);
+            sse("sensor", text);
+        }
+    }
+    if (ws_binary) ws_binary(frame.data(), frame.size());
+}
+
+void BridgeCore::request_block(uint8_t node, uint8_t zone, uint32_t seq, unsigned long now) {
+    char line[64];
+    snprintf(line, sizeof(line), "{\"M\":%u,\"N\":%u,\"Z\":%u,\"seq\":%lu}", MSG_HISTORY_REQUEST, node, zone,
+             static_cast<unsigned long>(seq));
+    Backfill &b = backfill[node][zone];
+    b.active = queue_to_mcu(line);
+    b.done   = !b.active;
+    b.seq    = seq;
+    b.asked  = now;
+}
+
+// Samples are placed by their age on the MCU's clock when it answered
+void BridgeCore::history_block(JsonDocument &doc, uint8_t node, uint8_t zone, unsigned long now) {
+    Backfill &b = backfill[node][zone];
+    if (!b.active) return;
+
+    uint32_t      seq     = doc["seq"]  | 0UL;
+    uint32_t      last    = doc["last"] | 0UL;
+    unsigned long mcu_now = doc["now"]  | 0UL;
+
+    uint8_t       block[TS_BLOCK_BYTES];
+    size_t        len = ts_unbase64(doc["b"] | "", block, sizeof(block));
+    TsBlockReader reader(block, len);
+    TsSample      s;
+    while (reader.next(s)) {
+        lock.lock();
+        history.add(now - (mcu_now - s.t), node, zone, ts_value(s.v[0]), ts_value(s.v[1]), ts_value(s.v[2]));
+        lock.unlock();
+        b.samples++;
+        backfilled++;
+    }
+
+    if (seq < last) {
+        request_block(node, zone, seq + 1, now);
+        return;
+    }
+    b.active = false;
+    b.done   = true;
+    if (log) {
+        char text[64];
+        snprintf(text, sizeof(text), "Backfill: [%u.%u] %lu samples", node, zone, static_cast<unsigned long>(b.samples));
+        log->println(text);
+    }
+}
+
+// Every M:2011 is answered "loaded" or "rejected". The MCU drops what it took of an upload it
+// rejects part way, and the rest isn't sent.
+void BridgeCore::recipe_status(JsonDocument &doc, const char *line, uint8_t node) {
+    event("recipe", line);
+    if (!recipeAwaiting || node != recipeNode) return;
+
+    const char *what = doc["event"] | "";
+    if (strcmp(what, "loaded") == 0) {
+        recipeAwaiting = false;
+        if (recipeNext >= recipeUpload.size()) {
+            recipeUpload.clear();
+            recipeNext = 0;
+        }
+    }
+    else if (strcmp(what, "rejected") == 0) abandon_recipe(doc["why"] | "rejected", doc["step"] | -1);
+}
+
+// Ends an upload part way; the dashboards get an "error" on the recipe event
+void BridgeCore::abandon_recipe(const char *why, int step) {
+    JsonDocument err(&busAlloc);
+    err["N"]     = recipeNode;
+    err["error"] = "upload abandoned";
+    if (step >= 0) err["step"] = step;
+    err["why"]   = why;
+    char out[128];
+    serializeJson(err, out, sizeof(out));
+    event("recipe", out);
+    if (log) {
+        log->print("Recipe: ");
+        log->println(out);
+    }
+
+    recipeUpload.clear();
+    recipeNext     = 0;
+    recipeAwaiting = false;
+}
+
+void BridgeCore::profile_status(JsonDocument &doc, const char *line, uint8_t node, uint8_t zone) {
+    uint16_t id = doc["id"] | 0;
+
+    // Not cached on the MCU: send the whole profile once, with its id
+    if (!(doc["ok"] | false) && id != 0 && id == selectedProfile[node][zone].id) {
+        const CatalogProfile &p = selectedProfile[node][zone];
+        JsonDocument out(&busAlloc);
+        out["M"]      = MSG_SET_PROFILE;
+        out["N"]      = node;
+        if (zone) out["Z"] = zone;
+        out["id"]     = p.id;
+        out["crc"]    = profile_crc(p);
+        out["ec_min"] = p.ec_low;
+        out["ec_max"] = p.ec_high;
+        out["ec_avg"] = (p.ec_low + p.ec_high) / 2.0f;
+        out["ph_min"] = p.ph_low;
+        out["ph_max"] = p.ph_high;
+        out["ph_avg"] = (p.ph_low + p.ph_high) / 2.0f;
+        out["gro"]    = p.gro;
+        out["micro"]  = p.micro;
+        out["bloom"]  = p.bloom;
+
+        char profileLine[COMM_BUF_SIZE];
+        serializeJson(out, profileLine, sizeof(profileLine));
+        queue_to_mcu(profileLine);
+    } else {
+        event("profile", line);
+    }
+}
+
+//!##################################################
+//!######## Handlers ################################
+//! On the web server's task. A POST replies
+//! {"ok":true} once its command is in the slot for
+//! loop(), {"ok":false} with a 400 for a body that
+//! isn't JSON.
+//!##################################################
+
+// "N" and, past zone 0, "Z" of a command from the request's ?node= / ?zone=
+static void address(JsonDocument &out, const BridgeRequest &rq) {
+    out["N"] = rq.node();
+    uint8_t zone = rq.zone();
+    if (zone) out["Z"] = zone;
+}
+
+bool BridgeCore::parse_body(const BridgeRequest &rq, JsonDocument &in, Print &out) {
+    if (!deserializeJson(in, rq.body, rq.len)) return true;
+    out.print("{\"ok\":false}");
+    return false;
+}
+
+template <size_t N>
+void BridgeCore::stage(const JsonDocument &cmd, CommandSlot<N> &slot) {
+    lock.lock();
+    if (slot.pending) overwritten++;
+    serializeJson(cmd, slot.json, N);
+    slot.pending = true;
+    lock.unlock();
+}
+
+static int accepted(Print &out) {
+    out.print("{\"ok\":true}");
+    return 200;
+}
+
+void BridgeCore::select(const CatalogProfile &p, uint8_t node, uint8_t zone) {
+    lock.lock();
+    if (pendingSelect) overwritten++;
+    pendingSelectProfile = p;
+    pendingSelectNode    = node;
+    pendingSelectZone    = zone;
+    pendingSelect        = true;
+    lock.unlock();
+}
+
+// Snapshot, last known values: {"ph":6.12,"ec":1.3,"temp":21.40}
+int BridgeCore::get_data(const BridgeRequest &rq, Print &out) {
+    const NodeReading &v = readings[rq.node()][rq.zone()];
+    char json[64];
+    snprintf(json, sizeof(json), "{\"ph\":%.2f,\"ec\":%.1f,\"temp\":%.2f}", v.ph, v.ec, v.temp);
+    out.print(json);
+    return 200;
+}
+
+// Controllers the bus has heard from, with their last readings and link counters
+int BridgeCore::get_nodes(const BridgeRequest &, Print &out) {
+    unsigned long now = millis();
+    JsonDocument doc(&webAlloc);
+    JsonArray items = doc["nodes"].to<JsonArray>();
+    for (uint8_t a = 1; a <= NODE_MAX; ++a) {
+        const BusNode &n = bus.node(a);
+        if (n.replies == 0) continue;
+        JsonObject o = items.add<JsonObject>();
+        o["node"]     = a;
+        o["online"]   = n.online;
+        o["age_ms"]   = now - n.last_seen;
+        o["ph"]       = readings[a][0].ph;
+        o["ec"]       = readings[a][0].ec;
+        o["temp"]     = readings[a][0].temp;
+        // [[pH, EC, temp], ...] per zone, zone 0 first
+        o["zone_count"] = nodeZones[a];
+        JsonArray zones = o["zones"].to<JsonArray>();
+        for (uint8_t z = 0; z < nodeZones[a]; ++z) {
+            JsonArray r = zones.add<JsonArray>();
+            r.add(readings[a][z].ph);
+            r.add(readings[a][z].ec);
+            r.add(readings[a][z].temp);
+        }
+        o["polls"]    = n.polls;
+        o["timeouts"] = n.timeouts;
+        if (nodeDuty[a] >= 0) o["duty"] = nodeDuty[a];
+    }
+    doc["queued"]  = bus.queued();
+    doc["dropped"] = bus.dropped;
+    serializeJson(doc, out);
+    return 200;
+}
+
+// Memory watermarks (mem_watch.hpp): {"bridge":{...},"nodes":[{"node":1,"age_ms":4210,"mem":{...}}]},
+// each node's from its last M:2017, polled every MEM_POLL_MS
+int BridgeCore::get_mem(const BridgeRequest &, Print &out) {
+    unsigned long now = millis();
+    JsonDocument doc(&webAlloc);
+    mem.to_json(doc["bridge"].to<JsonObject>());
+    JsonArray items = doc["nodes"].to<JsonArray>();
+
+    char line[COMM_BUF_SIZE];
+    for (uint8_t a = 1; a <= NODE_MAX; ++a) {
+        lock.lock();
+        unsigned long at = nodeMemMs[a];
+        if (at) memcpy(line, nodeMem[a], sizeof(line));
+        lock.unlock();
+        if (!at) continue;
+
+        JsonDocument report(&webAlloc);
+        if (deserializeJson(report, line)) continue;
+        report.remove("M");
+        report.remove("N");
+        JsonObject o = items.add<JsonObject>();
+        o["node"]   = a;
+        o["age_ms"] = now - at;
+        o["mem"]    = report;
+    }
+    serializeJson(doc, out);
+    return 200;
+}
+
+// Bucketed history, oldest first, ?node=N&zone=Z:
+// {"bucket_ms":180000,"age_ms":4210,"rows":[[pH,EC,temp],null,...]}, null for a bucket with no readings.
+// A full ring is ~30 KB of JSON: streamed, a bucket at a time under the lock (a critical section on
+// the ESP32, not held across a write to the socket) while loop() adds to the ring. Buckets loop() pushes
+// out meanwhile go out as null, so the last row is still the one age_ms is measured from.
+int BridgeCore::get_history(const BridgeRequest &rq, Print &out) {
+    uint8_t node = rq.node(), zone = rq.zone();
+    lock.lock();
+    const HistoryRing *ring  = history.find(node, zone);
+    uint32_t           end   = ring ? ring->pushed() : 0;
+    uint32_t           first = ring ? end - ring->size() : 0;
+    unsigned long      age   = ring ? ring->age(millis()) : 0UL;
+    lock.unlock();
+
+    char text[48];
+    snprintf(text, sizeof(text), "{\"bucket_ms\":%lu,\"age_ms\":%lu,\"rows\":[", HISTORY_BUCKET_MS, age);
+    out.print(text);
+    for (uint32_t b = first; b < end; ++b) {
+        HistoryPoint p = { HISTORY_EMPTY, 0, 0.0f };
+        lock.lock();
+        if (history.find(node, zone) == ring) ring->bucket(b, p);
+        lock.unlock();
+
+        if (b != first) out.print(',');
+        if (p.ph == HISTORY_EMPTY) {
+            out.print("null");
+        } else {
+            snprintf(text, sizeof(text), "[%.2f,%.2f,%.2f]", p.ph / 100.0f, p.ec, p.temp / 100.0f);
+            out.print(text);
+        }
+    }
+    out.print("]}");
+    return 200;
+}
+
+static void add_profile_json(JsonArray items, const CatalogProfile &p) {
+    JsonObject o = items.add<JsonObject>();
+    o["id"]    = p.id;
+    o["crop"]  = p.crop;
+    o["stage"] = STAGE_NAMES[p.stage < NUM_STAGES ? p.stage : 0];
+    JsonArray ec = o["ec"].to<JsonArray>();
+    ec.add(p.ec_low);
+    ec.add(p.ec_high);
+    JsonArray ph = o["ph"].to<JsonArray>();
+    ph.add(p.ph_low);
+    ph.add(p.ph_high);
+    JsonArray parts = o["parts"].to<JsonArray>();
+    parts.add(p.gro);
+    parts.add(p.micro);
+    parts.add(p.bloom);
+}
+
+// Profile catalog, paginated: /profiles/crops?page=0&per=20 lists crops
+int BridgeCore::get_crops(const BridgeRequest &rq, Print &out) {
+    uint16_t per  = constrain(static_cast<uint16_t>(rq.number("per", PROFILES_PER_PAGE)), 1, PROFILES_MAX_PER_PAGE);
+    uint16_t page = static_cast<uint16_t>(rq.number("page", 0));
+
+    JsonDocument doc(&webAlloc);
+    doc["total"] = catalog.crops();
+    doc["page"]  = page;
+    doc["per"]   = per;
+    JsonArray items = doc["items"].to<JsonArray>();
+
+    for (uint32_t i = static_cast<uint32_t>(page) * per; i < catalog.crops() && items.size() < per; ++i) {
+        CatalogProfile first;
+        uint16_t       profiles;
+        if (!catalog.crop(i, first, profiles)) break;
+        JsonObject o = items.add<JsonObject>();
+        o["crop"]     = first.crop;
+        o["profiles"] = profiles;
+    }
+    serializeJson(doc, out);
+    return 200;
+}
+
+// /profiles?crop=Lettuce&stage=veg&page=0&per=20 lists profiles, both filters optional
+int BridgeCore::get_profiles(const BridgeRequest &rq, Print &out) {
+    uint16_t per  = constrain(static_cast<uint16_t>(rq.number("per", PROFILES_PER_PAGE)), 1, PROFILES_MAX_PER_PAGE);
+    uint16_t page = static_cast<uint16_t>(rq.number("page", 0));
+
+    uint16_t first = 0, end = catalog.count();
+    if (rq.has("crop") && !catalog.crop_range(rq.param("crop"), first, end)) {
+        first = end = 0;
+    }
+    ProfileStage stage = rq.has("stage") ? stage_from_name(rq.param("stage")) : NUM_STAGES;
+
+    JsonDocument doc(&webAlloc);
+    doc["page"] = page;
+    doc["per"]  = per;
+    JsonArray items = doc["items"].to<JsonArray>();
+
+    // Without a stage filter the page is a slice of the range; with one, of its matches
+    uint32_t skip  = static_cast<uint32_t>(page) * per;
+    uint16_t total = 0;
+    for (uint16_t pos = first; pos < end; ++pos) {
+        CatalogProfile p;
+        if (stage != NUM_STAGES) {
+            if (!catalog.at(pos, p) || p.stage != stage) continue;
+        } else if (total < skip || items.size() >= per) {
+            total++;
+            continue;
+        } else if (!catalog.at(pos, p)) {
+            continue;
+        }
+        if (total >= skip && items.size() < per) add_profile_json(items, p);
+        total++;
+    }
+    doc["total"] = total;
+    serializeJson(doc, out);
+    return 200;
+}
+
+// {"gro_ml":2.5,"micro_ml":2.5,"bloom_ml":5,"ph_up_ml":0,"ph_dn_ml":0} -> M:2001
+int BridgeCore::post_dose(const BridgeRequest &rq, Print &out) {
+    JsonDocument in(&webAlloc);
+    if (!parse_body(rq, in, out)) return 400;
+
+    JsonDocument cmd(&webAlloc);
+    cmd["M"]      = MSG_LOAD_DOSE;
+    address(cmd, rq);
+    cmd["gro"]    = in["gro_ml"]   | 0.0f;
+    cmd["micro"]  = in["micro_ml"] | 0.0f;
+    cmd["bloom"]  = in["bloom_ml"] | 0.0f;
+    cmd["ph_up"]  = in["ph_up_ml"] | 0.0f;
+    cmd["ph_dn"]  = in["ph_dn_ml"] | 0.0f;
+    stage(cmd, dose);
+    return accepted(out);
+}
+
+// {"run":true} -> M:2002
+int BridgeCore::post_state(const BridgeRequest &rq, Print &out) {
+    JsonDocument in(&webAlloc);
+    if (!parse_body(rq, in, out)) return 400;
+
+    JsonDocument cmd(&webAlloc);
+    cmd["M"]   = MSG_SYSTEM_STATE;
+    address(cmd, rq);
+    cmd["run"] = in["run"] | false;
+    stage(cmd, state);
+    return accepted(out);
+}
+
+// Band limits and, optionally, nutrient parts -> M:2003
+int BridgeCore::post_profile(const BridgeRequest &rq, Print &out) {
+    JsonDocument in(&webAlloc);
+    if (!parse_body(rq, in, out)) return 400;
+
+    JsonDocument cmd(&webAlloc);
+    cmd["M"]      = MSG_SET_PROFILE;
+    address(cmd, rq);
+    cmd["ec_min"] = in["ec_min"] | 0.0f;
+    cmd["ec_max"] = in["ec_max"] | 0.0f;
+    cmd["ec_avg"] = in["ec_avg"] | 0.0f;
+    cmd["ph_min"] = in["ph_min"] | 0.0f;
+    cmd["ph_max"] = in["ph_max"] | 0.0f;
+    cmd["ph_avg"] = in["ph_avg"] | 0.0f;
+    // Nutrient parts only when given; the MCU keeps its own otherwise
+    for (const char *part : { "gro", "micro", "bloom" }) {
+        if (in[part].is<int>()) cmd[part] = in[part].as<int>();
+    }
+    stage(cmd, profile);
+    return accepted(out);
+}
+
+// Pump calibration: {"pump":"gro"} starts a sweep (M:2004), {"ml":4.9} reports a measurement (M:2005)
+int BridgeCore::post_pump_cal(const BridgeRequest &rq, Print &out) {
+    JsonDocument in(&webAlloc);
+    if (!parse_body(rq, in, out)) return 400;
+
+    JsonDocument cmd(&webAlloc);
+    if (in["pump"].is<const char *>()) {
+        cmd["M"]    = MSG_PUMP_CAL_START;
+        cmd["pump"] = in["pump"];
+    } else {
+        cmd["M"]  = MSG_PUMP_CAL_MEASURE;
+        cmd["ml"] = in["ml"] | 0.0f;
+    }
+    address(cmd, rq);
+    stage(cmd, cal);
+    return accepted(out);
+}
+
+// Cancel a dose job: {"id":3}, or {} / {"id":0} for everything -> M:2008
+int BridgeCore::post_cancel(const BridgeRequest &rq, Print &out) {
+    JsonDocument in(&webAlloc);
+    if (!parse_body(rq, in, out)) return 400;
+
+    JsonDocument cmd(&webAlloc);
+    cmd["M"]  = MSG_CANCEL_JOB;
+    address(cmd, rq);
+    cmd["id"] = in["id"] | 0;
+    stage(cmd, cancel);
+    return accepted(out);
+}
+
+// Probe calibration: {"probe":"ph","point":0,"value":7.0}, {"probe":"ec","tcoef":0.019},
+// {"probe":"ph","reset":true}; optional "ch" limits it to one probe -> M:2009
+int BridgeCore::post_probe_cal(const BridgeRequest &rq, Print &out) {
+    JsonDocument in(&webAlloc);
+    if (!parse_body(rq, in, out)) return 400;
+
+    JsonDocument cmd(&webAlloc);
+    cmd["M"]     = MSG_PROBE_CAL;
+    address(cmd, rq);
+    cmd["probe"] = in["probe"] | "";
+    if (in["ch"].is<int>())      cmd["ch"]    = in["ch"];
+    if (in["reset"] | false)     cmd["reset"] = true;
+    else if (in["tcoef"].is<float>()) cmd["tcoef"] = in["tcoef"];
+    else {
+        cmd["point"] = in["point"] | 0;
+        cmd["value"] = in["value"] | 0.0f;
+    }
+    stage(cmd, probeCal);
+    return accepted(out);
+}
+
+// Recipe: {"steps":[["dose","gro",2.5],["mix",7],...]} uploads (see recipe.hpp),
+// {"run":true} / {"run":false} starts / aborts it, {} asks for its status
+int BridgeCore::post_recipe(const BridgeRequest &rq, Print &out) {
+    JsonDocument in(&webAlloc);
+    if (!parse_body(rq, in, out)) return 400;
+
+    address(in, rq);
+    stage(in, recipe);
+    return accepted(out);
+}
+
+// Switch profile: {"id":12}. The MCU applies its cached copy or asks for it (M:2015).
+int BridgeCore::post_select(const BridgeRequest &rq, Print &out) {
+    JsonDocument in(&webAlloc);
+    if (!parse_body(rq, in, out)) return 400;
+
+    CatalogProfile p;
+    if (!catalog.find(in["id"] | 0, p)) {
+        out.print("{\"ok\":false}");
+        return 404;
+    }
+    select(p, rq.node(), rq.zone());
+    return accepted(out);
+}
+
+uint8_t BridgeCore::ws_command(const WsCommand &cmd) {
+    if (cmd.node < 1 || cmd.node > NODE_MAX || cmd.zone >= ZONE_MAX) return WS_ACK_BAD;
+
+    JsonDocument out(&webAlloc);
+    switch (cmd.kind) {
+        case WS_CMD_STATE:
+            out["M"]   = MSG_SYSTEM_STATE;
+            out["N"]   = cmd.node;
+            if (cmd.zone) out["Z"] = cmd.zone;
+            out["run"] = cmd.run;
+            stage(out, state);
+            return WS_ACK_OK;
+
+        case WS_CMD_DOSE: {
+            for (float ml : cmd.ml) {
+                if (!isfinite(ml) || ml < 0.0f) return WS_ACK_BAD;
+            }
+            out["M"]     = MSG_LOAD_DOSE;
+            out["N"]     = cmd.node;
+            if (cmd.zone) out["Z"] = cmd.zone;
+            out["gro"]   = cmd.ml[0];
+            out["micro"] = cmd.ml[1];
+            out["bloom"] = cmd.ml[2];
+            out["ph_up"] = cmd.ml[3];
+            out["ph_dn"] = cmd.ml[4];
+            stage(out, dose);
+            return WS_ACK_OK;
+        }
+
+        case WS_CMD_CANCEL:
+            out["M"]  = MSG_CANCEL_JOB;
+            out["N"]  = cmd.node;
+            if (cmd.zone) out["Z"] = cmd.zone;
+            out["id"] = cmd.id;
+            stage(out, cancel);
+            return WS_ACK_OK;
+
+        case WS_CMD_SELECT: {
+            CatalogProfile p;
+            if (!catalog.find(cmd.id, p)) return WS_ACK_UNKNOWN;
+            select(p, cmd.node, cmd.zone);
+            return WS_ACK_OK;
+        }
+    }
+    return WS_ACK_BAD;
+}
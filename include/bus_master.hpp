@@ -0,0 +1,195 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "serial_comm.hpp"
+
+//!##################################################
+//!######## Bus master (bridge) #####################
+//! One bridge, up to NODE_MAX controllers on one
+//! half-duplex line. Only the bridge starts a
+//! transmission; a node talks in its turn, which an
+//! M:1001 poll grants and its M:1002 ends (queued
+//! reports first, see BusPort).
+//!
+//! Round robin over the addresses: at each visit a
+//! node gets one queued command or, when due, its
+//! poll. A command brings that node's next poll
+//! forward so its replies come back promptly.
+//!
+//! A node that misses BUS_OFFLINE_MISSES polls in a
+//! row goes offline and, like an empty address, is
+//! only probed every BUS_PROBE_MS; that is also how
+//! a new node is found. Probes are spread out so
+//! empty addresses don't eat into the live nodes'
+//! polls.
+//!##################################################
+
+static constexpr uint8_t       BUS_QUEUE_LINES     = 16;
+static constexpr unsigned long BUS_TURN_TIMEOUT_MS = 60;    // silence that ends an unanswered turn
+static constexpr unsigned long BUS_LINE_GAP_MS     = 10;    // every node parses every line
+static constexpr unsigned long BUS_PROBE_MS        = 30000;
+static constexpr uint8_t       BUS_OFFLINE_MISSES  = 3;
+
+struct BusNode {
+    bool          online;
+    bool          poll_soon;  // a command went out; poll without waiting for the period
+    uint8_t       missed;     // polls in a row without an M:1002
+    unsigned long last_poll;
+    unsigned long last_seen;
+    uint32_t      polls;
+    uint32_t      replies;
+    uint32_t      timeouts;
+    uint32_t      commands;
+};
+
+// Puts one line (without its newline) on the wire
+typedef void (*BusSendFn)(uint8_t node, const char *line);
+
+class BusMaster {
+    public:
+        unsigned long poll_ms = 2000;
+        BusSendFn     send    = nullptr;
+        uint32_t      dropped = 0; // commands refused for a full queue
+
+        // A command for one node, copied; false when the queue is full or the address is bad
+        bool queue(uint8_t node, const char *line);
+
+        // Every line heard on the bus, by the node it came from
+        void received(uint8_t node, uint16_t code, unsigned long now);
+
+        // From loop(): ends a timed-out turn, starts at most one transmission
+        void service(unsigned long now);
+
+        const BusNode &node(uint8_t addr) const { return nodes[addr <= NODE_MAX ? addr : 0]; }
+        uint8_t        turn() const { return turn_node; }
+        uint8_t        online() const;
+        uint8_t        queued() const;
+
+    private:
+        struct Line {
+            uint8_t  node; // 0 = free slot
+            uint32_t seq;
+            char     text[COMM_BUF_SIZE];
+        };
+
+        BusNode nodes[NODE_MAX + 1] = {}; // by address, [0] unused
+        Line    lines[BUS_QUEUE_LINES] = {};
+        uint32_t next_seq = 0;
+
+        uint8_t       rr         = 1;
+        uint8_t       turn_node  = 0;
+        unsigned long turn_at    = 0;
+        unsigned long last_tx    = 0;
+        unsigned long last_probe = 0;
+        bool          sent_any   = false;
+
+        int8_t next_line(uint8_t addr) const;
+        bool   poll_due(const BusNode &n, unsigned long now) const;
+        void   transmit(uint8_t addr, const char *line, unsigned long now);
+};
+
+bool BusMaster::queue(uint8_t node, const char *line) {
+    if (node == 0 || node > NODE_MAX || strlen(line) >= COMM_BUF_SIZE) return false;
+
+    for (Line &l : lines) {
+        if (l.node != 0) continue;
+        l.node = node;
+        l.seq  = next_seq++;
+        strcpy(l.text, line);
+        return true;
+    }
+    dropped++;
+    return false;
+}
+
+void BusMaster::received(uint8_t node, uint16_t code, unsigned long now) {
+    if (node == 0 || node > NODE_MAX) return;
+
+    BusNode &n = nodes[node];
+    n.last_seen = now;
+    n.online    = true;
+
+    if (node != turn_node) return;
+    turn_at = now; // still talking
+    if (code == MSG_SENSOR_RESPONSE) {
+        n.replies++;
+        n.missed  = 0;
+        turn_node = 0;
+    }
+}
+
+int8_t BusMaster::next_line(uint8_t addr) const {
+    int8_t best = -1;
+    for (uint8_t i = 0; i < BUS_QUEUE_LINES; ++i) {
+        if (lines[i].node == addr && (best < 0 || lines[i].seq < lines[best].seq)) best = i;
+    }
+    return best;
+}
+
+bool BusMaster::poll_due(const BusNode &n, unsigned long now) const {
+    if (n.polls == 0) return true; // first sweep at boot
+    if (n.online) return n.poll_soon || now - n.last_poll >= poll_ms;
+    return now - n.last_poll >= BUS_PROBE_MS && now - last_probe >= BUS_PROBE_MS / NODE_MAX;
+}
+
+void BusMaster::transmit(uint8_t addr, const char *line, unsigned long now) {
+    if (send) send(addr, line);
+    last_tx  = now;
+    sent_any = true;
+}
+
+void BusMaster::service(unsigned long now) {
+    if (turn_node) {
+        if (now - turn_at < BUS_TURN_TIMEOUT_MS) return;
+
+        BusNode &n = nodes[turn_node];
+        n.timeouts++;
+        if (++n.missed >= BUS_OFFLINE_MISSES) n.online = false;
+        turn_node = 0;
+    }
+
+    if (sent_any && now - last_tx < BUS_LINE_GAP_MS) return;
+
+    for (uint8_t k = 0; k < NODE_MAX; ++k) {
+        uint8_t addr = rr;
+        rr = (rr % NODE_MAX) + 1;
+        BusNode &n = nodes[addr];
+
+        int8_t i = next_line(addr);
+        if (i >= 0) {
+            transmit(addr, lines[i].text, now);
+            lines[i].node = 0;
+            n.commands++;
+            n.poll_soon = true;
+            return;
+        }
+
+        if (poll_due(n, now)) {
+            if (!n.online) last_probe = now;
+
+            char poll[24];
+            snprintf(poll, sizeof(poll), "{\"M\":%u,\"N\":%u}", MSG_SENSOR_REQUEST, addr);
+            transmit(addr, poll, now);
+            n.last_poll = now;
+            n.poll_soon = false;
+            n.polls++;
+            turn_node = addr;
+            turn_at   = now;
+            return;
+        }
+    }
+}
+
+uint8_t BusMaster::online() const {
+    uint8_t count = 0;
+    for (uint8_t a = 1; a <= NODE_MAX; ++a) count += nodes[a].online;
+    return count;
+}
+
+uint8_t BusMaster::queued() const {
+    uint8_t count = 0;
+    for (const Line &l : lines) count += l.node != 0;
+    return count;
+}
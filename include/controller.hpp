@@ -1,9 +1,12 @@
 #pragma once
 
 #include <Arduino.h>
+#include <array>
+
+// Gains are in (mS/cm or pH) per mL/L, identified online by gain_estimator.hpp
 
 // Adds nutrients if EC is below the minimum threshold
-float nutrient_calc(const float &TARGET_EC, const float &MIN_EC, const float &MAX_EC, const float &volume, const float &curr_ec) {
+float nutrient_calc(const float &TARGET_EC, const float &MIN_EC, const float &MAX_EC, const float &volume, const float &curr_ec, const float &EC_GAIN) {
 
   if (curr_ec >= MIN_EC) {
     return 0.0;
@@ -11,7 +14,6 @@ float nutrient_calc(const float &TARGET_EC, const float &MIN_EC, const float &MA
 
   static const float EC_INPUT_MAX = 200.0; // in mL //TODO NEED TO CHANGE
   static const float EC_INPUT_MIN = 0.0; // in mL
-  static const float EC_GAIN = 1.0; //TODO NEED TO CHANGE 
 
   // Input before clamping
   float pre_input = ((TARGET_EC - curr_ec) * volume) / EC_GAIN;
@@ -24,7 +26,7 @@ float nutrient_calc(const float &TARGET_EC, const float &MIN_EC, const float &MA
 
 
 // Adds pH UP if pH drops below the minimum threshold
-float ph_up_calc(const float &TARGET_PH, const float &MIN_PH, const float &MAX_PH, const float &volume, const float &curr_ph) {
+float ph_up_calc(const float &TARGET_PH, const float &MIN_PH, const float &MAX_PH, const float &volume, const float &curr_ph, const float &PH_GAIN) {
   // If pH is within range or higher than we want, we don't add pH UP
   if (curr_ph >= MIN_PH) {
     return 0.0;
@@ -32,7 +34,6 @@ float ph_up_calc(const float &TARGET_PH, const float &MIN_PH, const float &MAX_P
     
   static const float PH_UP_INPUT_MAX = 50.0; // in mL //TODO NEED TO CHANGE
   static const float PH_UP_INPUT_MIN = 0.0; // in mL
-  static const float PH_GAIN = 1.0; //TODO NEED TO CHANGE 
 
   // Input before clamping
   float pre_input = ((TARGET_PH - curr_ph) * volume) / PH_GAIN;
@@ -45,7 +46,7 @@ float ph_up_calc(const float &TARGET_PH, const float &MIN_PH, const float &MAX_P
 
 
 // Adds pH DOWN if pH rises above the maximum threshold
-float ph_down_calc(const float &TARGET_PH, const float &MIN_PH, const float &MAX_PH, const float &volume, const float &curr_ph) {
+float ph_down_calc(const float &TARGET_PH, const float &MIN_PH, const float &MAX_PH, const float &volume, const float &curr_ph, const float &PH_GAIN) {
   // If pH is within range or lower than we want, we don't add pH DOWN
   if (curr_ph <= MAX_PH) {
     return 0.0;
@@ -53,7 +54,6 @@ float ph_down_calc(const float &TARGET_PH, const float &MIN_PH, const float &MAX
 
   static const float PH_DOWN_INPUT_MAX = 50.0; // in mL
   static const float PH_DOWN_INPUT_MIN = 0.0; // in mL
-  static const float PH_GAIN = 1.0; //TODO NEED TO CHANGE
 
   // Input before clamping (Note: to avoid negative values since curr_ph > TARGET_PH, 
   // you might want to flip the subtraction depending on how your gain expects it)
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+#include <math.h>
+
+#include "plant_profile.hpp"
+
+//!##################################################
+//!######## Receding-horizon dose planner ###########
+//! Plans nutrients and pH together: FloraSeries
+//! nutrients acidify the reservoir, so the pH
+//! correction is sized for the pH *after* this
+//! cycle's nutrient dose, not the pH measured now.
+//!
+//! Each candidate (EC aim x pH aim) is rolled out
+//! over PLAN_HORIZON cycles with the actuator limits
+//! and the expected drift between cycles applied;
+//! the one needing the fewest dosing cycles wins,
+//! ties broken on total mL dosed. Only the first
+//! cycle of the winning plan is executed.
+//!##################################################
+
+// Linear reservoir model, all per mL of product per litre of reservoir
+struct PlantModel {
+    float ec_gain;      // mS/cm added by nutrients
+    float nutrient_ph;  // pH removed by nutrients (acidification, >= 0)
+    float ph_up_gain;   // pH added by pH Up
+    float ph_down_gain; // pH removed by pH Down
+
+    // Expected drift between two dosing cycles (uptake), in mS/cm and pH
+    float ec_drift;
+    float ph_drift;
+};
+
+// Most that can go in per cycle (mL), same caps as the controller.hpp calcs
+struct ActuatorLimits {
+    float nutrient_ml;
+    float ph_up_ml;
+    float ph_down_ml;
+};
+
+static constexpr ActuatorLimits DEFAULT_ACTUATOR_LIMITS = { 200.0f, 50.0f, 50.0f };
+
+struct DosePlan {
+    float   gro;
+    float   micro;
+    float   bloom;
+    float   ph_up;
+    float   ph_down;
+    uint8_t cycles;    // predicted dosing cycles over the horizon, +1 if still out of band after it
+    float   total_ml;  // predicted over the whole horizon
+
+    float nutrient() const { return gro + micro + bloom; }
+    bool  any() const { return nutrient() > 0.0f || ph_up > 0.0f || ph_down > 0.0f; }
+};
+
+static constexpr uint8_t PLAN_HORIZON = 3;
+
+// Aim points inside the band, as a fraction of the band from the low edge
+static constexpr uint8_t PLAN_NUM_AIMS = 3;
+static constexpr std::array<float, PLAN_NUM_AIMS> PLAN_AIMS = {{ 0.5f, 0.25f, 0.75f }};
+
+struct PlanStep {
+    float nutrient_ml;
+    float ph_up_ml;
+    float ph_down_ml;
+};
+
+// One cycle of the policy: dose EC up to ec_aim, then correct the post-nutrient pH to ph_aim
+PlanStep plan_step(const PlantModel &m, const ActuatorLimits &lim, const TargetPlant &plant,
+                   float volume_l, float ec, float ph, float ec_aim, float ph_aim) {
+    PlanStep step = { 0.0f, 0.0f, 0.0f };
+
+    if (ec < plant.ec_low && m.ec_gain > 0.0f) {
+        step.nutrient_ml = constrain((ec_aim - ec) * volume_l / m.ec_gain, 0.0f, lim.nutrient_ml);
+    }
+
+    float ph_after = ph - m.nutrient_ph * step.nutrient_ml / volume_l;
+
+    if (ph_after < plant.ph_low && m.ph_up_gain > 0.0f) {
+        step.ph_up_ml = constrain((ph_aim - ph_after) * volume_l / m.ph_up_gain, 0.0f, lim.ph_up_ml);
+    }
+    else if (ph_after > plant.ph_high && m.ph_down_gain > 0.0f) {
+        step.ph_down_ml = constrain((ph_after - ph_aim) * volume_l / m.ph_down_gain, 0.0f, lim.ph_down_ml);
+    }
+
+    return step;
+}
+
+void apply_step(const PlantModel &m, float volume_l, const PlanStep &step, float &ec, float &ph) {
+    ec += m.ec_gain * step.nutrient_ml / volume_l;
+    ph -= m.nutrient_ph * step.nutrient_ml / volume_l;
+    ph += m.ph_up_gain * step.ph_up_ml / volume_l;
+    ph -= m.ph_down_gain * step.ph_down_ml / volume_l;
+}
+
+bool plan_in_band(const TargetPlant &plant, float ec, float ph) {
+    // EC above the band is left to plant uptake; there is no actuator to lower it
+    return ec >= plant.ec_low && ph >= plant.ph_low && ph <= plant.ph_high;
+}
+
+DosePlan plan_doses(const PlantModel &m, const ActuatorLimits &lim, const TargetPlant &plant,
+                    float volume_l, float ec, float ph) {
+    DosePlan best = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0, 0.0f };
+    if (volume_l <= 0.0f || plan_in_band(plant, ec, ph)) return best;
+
+    best.cycles = PLAN_HORIZON + 2;
+    PlanStep first = { 0.0f, 0.0f, 0.0f };
+
+    float ec_span = plant.ec_high - plant.ec_low;
+    float ph_span = plant.ph_high - plant.ph_low;
+
+    for (float ec_frac : PLAN_AIMS) {
+        for (float ph_frac : PLAN_AIMS) {
+            float ec_aim = plant.ec_low + ec_frac * ec_span;
+            float ph_aim = plant.ph_low + ph_frac * ph_span;
+
+            float   sim_ec = ec;
+            float   sim_ph = ph;
+            float   total  = 0.0f;
+            uint8_t cycles = 0;
+            PlanStep step0 = { 0.0f, 0.0f, 0.0f };
+
+            for (uint8_t c = 0; c < PLAN_HORIZON; ++c) {
+                if (c > 0 && plan_in_band(plant, sim_ec, sim_ph)) {
+                    sim_ec += m.ec_drift;
+                    sim_ph += m.ph_drift;
+                    continue;
+                }
+
+                // Later cycles fall back to aiming mid-band
+                PlanStep step = (c == 0)
+                    ? plan_step(m, lim, plant, volume_l, sim_ec, sim_ph, ec_aim, ph_aim)
+                    : plan_step(m, lim, plant, volume_l, sim_ec, sim_ph,
+                                plant.ec_low + 0.5f * ec_span, plant.ph_low + 0.5f * ph_span);
+                if (c == 0) step0 = step;
+
+                apply_step(m, volume_l, step, sim_ec, sim_ph);
+                total += step.nutrient_ml + step.ph_up_ml + step.ph_down_ml;
+                cycles++;
+
+                sim_ec += m.ec_drift;
+                sim_ph += m.ph_drift;
+            }
+            if (!plan_in_band(plant, sim_ec, sim_ph)) cycles++;
+
+            if (cycles < best.cycles || (cycles == best.cycles && total < best.total_ml)) {
+                best.cycles   = cycles;
+                best.total_ml = total;
+                first         = step0;
+            }
+        }
+    }
+
+    // Split the nutrient volume by the profile's Gro/Micro/Bloom parts
+    float parts = static_cast<float>(plant.gro_amount + plant.micro_amount + plant.bloom_amount);
+    if (parts > 0.0f) {
+        best.gro   = first.nutrient_ml * plant.gro_amount   / parts;
+        best.micro = first.nutrient_ml * plant.micro_amount / parts;
+        best.bloom = first.nutrient_ml * plant.bloom_amount / parts;
+    }
+    best.ph_up   = first.ph_up_ml;
+    best.ph_down = first.ph_down_ml;
+
+    return best;
+}
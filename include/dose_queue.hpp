@@ -0,0 +1,418 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "motor.hpp"
+#include "pump_calibration.hpp"
+
+//!##################################################
+//!######## Dose job queue / pump arbiter ###########
+//! Pump runs and mixes are queued as jobs, each for
+//! one zone (reservoir, see zone.hpp). A zone runs
+//! one job at a time: lower priority first, FIFO
+//! within a priority.
+//!
+//! The pumps are shared. One pump job runs at a time
+//! across all zones, stepped from the step timer ISR
+//! (step_isr), so loop() keeps reading serial while
+//! a dose is in progress. Between zones the pumps go
+//! by priority, then FIFO; route() points the dosing
+//! manifold at the zone before its pump job starts.
+//! Each zone mixes with its own mixer, so one zone's
+//! mixing window overlaps the next zone's doses.
+//!
+//! A pH correction preempts a running nutrient dose,
+//! whichever zone either is for: the nutrient pump
+//! ramps down (Motor::stop) and what's left of the
+//! dose is requeued.
+//!
+//! halt_isr() is safe from any interrupt (E-stop pin)
+//! and stops the active pump and every mixer dead: it
+//! only touches the stepper's position and the mixer
+//! bridge pins. The next service() powers the mixers
+//! down and reports every job, as abort_all() does
+//! from loop().
+//!##################################################
+
+enum class JobKind : uint8_t { DOSE, STEPS, MIX };
+
+enum JobPriority : uint8_t {
+    PRIO_PH_SAFETY = 0,
+    PRIO_NUTRIENT  = 1,
+    PRIO_MIX       = 2,
+};
+
+enum class JobSource : uint8_t { AUTO, LOADING, CALIBRATION, RECIPE };
+
+struct DoseJob {
+    uint16_t      id;
+    JobKind       kind;
+    uint8_t       prio;
+    JobSource     source;
+    uint8_t       zone;
+    PumpId        pump;
+    float         ml;          // DOSE: total requested
+    float         done_ml;     // DOSE: dispensed before a preemption
+    long          steps;       // STEPS
+    SpeedProfile  profile;     // STEPS
+    unsigned long duration_ms; // MIX
+    uint32_t      seq;
+};
+
+// dispensed_ml is what actually went in (0 for MIX); aborted is true for cancelled/halted jobs
+typedef void (*JobDoneCallback)(const DoseJob &job, float dispensed_ml, bool aborted);
+
+static constexpr uint8_t DOSE_QUEUE_SIZE = 16;
+static constexpr uint8_t DOSE_MAX_ZONES  = 4;
+
+// Opens the manifold to one zone's reservoir
+typedef void (*ZoneRouteFn)(uint8_t zone);
+
+class DoseQueue {
+    public:
+        explicit DoseQueue(PumpSet<NUM_PUMPS> &pumps) : pumps(pumps) {}
+        DoseQueue(PumpSet<NUM_PUMPS> &pumps, Mixer &mixer) : pumps(pumps) { add_zone(mixer); }
+
+        JobDoneCallback on_done = nullptr;
+        ZoneRouteFn     route   = nullptr;
+
+        // Zones are numbered in the order they are added; false past DOSE_MAX_ZONES
+        bool    add_zone(Mixer &mixer);
+        uint8_t zones() const { return num_zones; }
+
+        // All return the job id, or 0 when the queue is full or there is no such zone
+        uint16_t push_dose(PumpId pump, float ml, JobSource source, uint8_t zone = 0);
+        uint16_t push_steps(PumpId pump, long steps, const SpeedProfile &profile, JobSource source, uint8_t zone = 0);
+        uint16_t push_mix(unsigned long duration_ms, JobSource source, uint8_t zone = 0);
+
+        // From loop(): completes, preempts and starts jobs
+        void service(unsigned long now);
+
+        // From the step timer ISR
+        void step_isr();
+
+        // From any context; the jobs are reported on the next service()
+        void halt_isr();
+
+        // Stops everything and reports all jobs as aborted
+        void abort_all();
+
+        // The same for one zone; the others carry on
+        void abort_zone(uint8_t zone);
+
+        // Returns false when no such job is queued or running
+        bool cancel(uint16_t id);
+
+        bool busy() const;
+        bool busy(JobSource source) const;
+        bool busy(JobSource source, uint8_t zone) const;
+        bool zone_busy(uint8_t zone) const;
+
+    private:
+        PumpSet<NUM_PUMPS> &pumps;
+        Mixer              *mixers[DOSE_MAX_ZONES] = {};
+        uint8_t             num_zones = 0;
+
+        DoseJob  jobs[DOSE_QUEUE_SIZE];
+        uint8_t  count    = 0;
+        uint16_t next_id  = 1;
+        uint32_t next_seq = 0;
+
+        // Each zone's running job; pump_zone's is the one on the pumps
+        DoseJob active[DOSE_MAX_ZONES];
+        bool    has_active[DOSE_MAX_ZONES] = {};
+        int8_t  pump_zone = -1;
+
+        Motor *volatile stepping  = nullptr; // owned by the ISR while set
+        volatile bool   step_done = false;
+        volatile bool   halted    = false;
+        bool            preempting = false;  // pump_zone's dose is ramping down for a pH job
+
+        uint16_t push(DoseJob job);
+        int8_t   next_index(uint8_t zone) const;
+        int8_t   next_pump_job(int8_t running_zone) const;
+        DoseJob  take(int8_t i);
+        void     start(unsigned long now);
+        float    stop_active(uint8_t zone);
+        void     finish(uint8_t zone, bool aborted, float dispensed_ml);
+        void     requeue(uint8_t zone, float dispensed_ml);
+        void     report(const DoseJob &job, float dispensed_ml, bool aborted);
+};
+
+static bool job_before(const DoseJob &a, const DoseJob &b) {
+    return a.prio < b.prio || (a.prio == b.prio && a.seq < b.seq);
+}
+
+bool DoseQueue::add_zone(Mixer &mixer) {
+    if (num_zones >= DOSE_MAX_ZONES) return false;
+    mixers[num_zones++] = &mixer;
+    return true;
+}
+
+uint16_t DoseQueue::push(DoseJob job) {
+    // A preempted dose has a slot kept for it while it ramps down
+    if (count + (preempting ? 1 : 0) >= DOSE_QUEUE_SIZE || job.zone >= num_zones) return 0;
+
+    job.id  = next_id++;
+    job.seq = next_seq++;
+    if (next_id == 0) next_id = 1;
+
+    jobs[count++] = job;
+    return job.id;
+}
+
+uint16_t DoseQueue::push_dose(PumpId pump, float ml, JobSource source, uint8_t zone) {
+    if (ml <= 0.0f) return 0;
+
+    DoseJob job = {};
+    job.kind   = JobKind::DOSE;
+    job.prio   = (pump == PUMP_PH_UP || pump == PUMP_PH_DOWN) ? PRIO_PH_SAFETY : PRIO_NUTRIENT;
+    job.source = source;
+    job.zone   = zone;
+    job.pump   = pump;
+    job.ml     = ml;
+    return push(job);
+}
+
+uint16_t DoseQueue::push_steps(PumpId pump, long steps, const SpeedProfile &profile, JobSource source, uint8_t zone) {
+    DoseJob job = {};
+    job.kind    = JobKind::STEPS;
+    job.prio    = PRIO_NUTRIENT;
+    job.source  = source;
+    job.zone    = zone;
+    job.pump    = pump;
+    job.steps   = steps;
+    job.profile = profile;
+    return push(job);
+}
+
+uint16_t DoseQueue::push_mix(unsigned long duration_ms, JobSource source, uint8_t zone) {
+    DoseJob job = {};
+    job.kind        = JobKind::MIX;
+    job.prio        = PRIO_MIX;
+    job.source      = source;
+    job.zone        = zone;
+    job.duration_ms = duration_ms;
+    return push(job);
+}
+
+bool DoseQueue::busy() const {
+    if (count > 0) return true;
+    for (uint8_t z = 0; z < num_zones; ++z) {
+        if (has_active[z]) return true;
+    }
+    return false;
+}
+
+bool DoseQueue::busy(JobSource source) const {
+    for (uint8_t z = 0; z < num_zones; ++z) {
+        if (busy(source, z)) return true;
+    }
+    return false;
+}
+
+bool DoseQueue::busy(JobSource source, uint8_t zone) const {
+    if (zone >= num_zones) return false;
+    if (has_active[zone] && active[zone].source == source) return true;
+    for (uint8_t i = 0; i < count; ++i) {
+        if (jobs[i].zone == zone && jobs[i].source == source) return true;
+    }
+    return false;
+}
+
+bool DoseQueue::zone_busy(uint8_t zone) const {
+    if (zone >= num_zones) return false;
+    return has_active[zone] || next_index(zone) >= 0;
+}
+
+int8_t DoseQueue::next_index(uint8_t zone) const {
+    int8_t best = -1;
+    for (uint8_t i = 0; i < count; ++i) {
+        if (jobs[i].zone == zone && (best < 0 || job_before(jobs[i], jobs[best]))) best = i;
+    }
+    return best;
+}
+
+// Best pump job among the zones that could take the pumps now: idle zones, plus
+// running_zone (the one holding them) when checking for a preemption
+int8_t DoseQueue::next_pump_job(int8_t running_zone) const {
+    int8_t best = -1;
+    for (uint8_t z = 0; z < num_zones; ++z) {
+        if (has_active[z] && z != running_zone) continue;
+        int8_t i = next_index(z);
+        if (i < 0 || jobs[i].kind == JobKind::MIX) continue;
+        if (best < 0 || job_before(jobs[i], jobs[best])) best = i;
+    }
+    return best;
+}
+
+DoseJob DoseQueue::take(int8_t i) {
+    DoseJob job = jobs[i];
+    jobs[i] = jobs[--count];
+    return job;
+}
+
+void DoseQueue::step_isr() {
+    Motor *m = stepping;
+    if (m && !m->run()) {
+        stepping  = nullptr;
+        step_done = true;
+    }
+}
+
+void DoseQueue::halt_isr() {
+    Motor *m = stepping;
+    stepping = nullptr;
+    if (m) m->halt();
+    for (uint8_t z = 0; z < num_zones; ++z) mixers[z]->cut();
+    halted = true;
+}
+
+// Takes the zone's running job off its actuator, stopped. Returns mL dispensed this run.
+float DoseQueue::stop_active(uint8_t zone) {
+    if (active[zone].kind == JobKind::MIX) {
+        mixers[zone]->stop();
+        return 0.0f;
+    }
+
+    noInterrupts();
+    stepping  = nullptr;
+    step_done = false;
+    float ml  = pumps[active[zone].pump].halt();
+    interrupts();
+    pump_zone  = -1;
+    preempting = false;
+    return ml;
+}
+
+void DoseQueue::start(unsigned long now) {
+    // Mixes don't need the pumps; each zone has its own mixer
+    for (uint8_t z = 0; z < num_zones; ++z) {
+        if (has_active[z]) continue;
+        int8_t i = next_index(z);
+        if (i < 0 || jobs[i].kind != JobKind::MIX) continue;
+
+        active[z]     = take(i);
+        has_active[z] = true;
+        mixers[z]->start(now, active[z].duration_ms);
+    }
+
+    if (pump_zone >= 0) return;
+
+    int8_t i = next_pump_job(-1);
+    if (i < 0) return;
+
+    uint8_t z     = jobs[i].zone;
+    active[z]     = take(i);
+    has_active[z] = true;
+    pump_zone     = z;
+    if (route) route(z);
+
+    const DoseJob &job = active[z];
+    if (job.kind == JobKind::DOSE) pumps[job.pump].start_dose(job.ml - job.done_ml);
+    else                           pumps[job.pump].start_steps(job.steps, job.profile);
+
+    noInterrupts();
+    step_done = false;
+    stepping  = &pumps[job.pump];
+    interrupts();
+}
+
+void DoseQueue::report(const DoseJob &job, float dispensed_ml, bool aborted) {
+    if (on_done) on_done(job, dispensed_ml, aborted);
+}
+
+void DoseQueue::finish(uint8_t zone, bool aborted, float dispensed_ml) {
+    has_active[zone] = false;
+    if (active[zone].kind == JobKind::DOSE) dispensed_ml += active[zone].done_ml;
+    report(active[zone], dispensed_ml, aborted);
+}
+
+// A preempted dose has ramped down; the rest of it goes back in the queue
+void DoseQueue::requeue(uint8_t zone, float dispensed_ml) {
+    DoseJob &job = active[zone];
+    preempting   = false;
+    job.done_ml += dispensed_ml;
+
+    // The ramp ran to the end of the dose
+    if (std::lround((job.ml - job.done_ml) * pumps[job.pump].calibration().steps_per_ml) <= 0) {
+        finish(zone, false, 0.0f);
+        return;
+    }
+    jobs[count++]    = job;
+    has_active[zone] = false;
+}
+
+void DoseQueue::service(unsigned long now) {
+    if (halted) {
+        abort_all();
+        return;
+    }
+
+    for (uint8_t z = 0; z < num_zones; ++z) {
+        if (has_active[z] && active[z].kind == JobKind::MIX && !mixers[z]->service(now)) finish(z, false, 0.0f);
+    }
+
+    if (pump_zone >= 0) {
+        uint8_t z = pump_zone;
+        if (step_done) {
+            step_done = false;
+            pump_zone = -1;
+            float ml  = pumps[active[z].pump].dispensed_ml();
+            if (preempting) requeue(z, ml);
+            else            finish(z, false, ml);
+        }
+        else if (!preempting && active[z].kind == JobKind::DOSE) {
+            // A queued pH correction preempts a running nutrient dose once it has ramped down
+            int8_t i = next_pump_job(z);
+            if (i >= 0 && jobs[i].prio < active[z].prio && count < DOSE_QUEUE_SIZE) {
+                noInterrupts();
+                pumps[active[z].pump].stop();
+                interrupts();
+                preempting = true;
+            }
+        }
+    }
+
+    start(now);
+}
+
+void DoseQueue::abort_zone(uint8_t zone) {
+    if (zone >= num_zones) return;
+
+    if (has_active[zone]) {
+        float ml = stop_active(zone);
+        mixers[zone]->stop();
+        finish(zone, true, ml);
+    }
+
+    // Anything queued behind it never started
+    int8_t i;
+    while ((i = next_index(zone)) >= 0) {
+        DoseJob job = take(i);
+        report(job, job.done_ml, true);
+    }
+}
+
+void DoseQueue::abort_all() {
+    halted = false;
+    for (uint8_t z = 0; z < num_zones; ++z) abort_zone(z);
+}
+
+bool DoseQueue::cancel(uint16_t id) {
+    for (uint8_t z = 0; z < num_zones; ++z) {
+        if (has_active[z] && active[z].id == id) {
+            finish(z, true, stop_active(z));
+            return true;
+        }
+    }
+
+    for (uint8_t i = 0; i < count; ++i) {
+        if (jobs[i].id == id) {
+            DoseJob job = take(i);
+            report(job, job.done_ml, true);
+            return true;
+        }
+    }
+    return false;
+}
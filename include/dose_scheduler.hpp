@@ -0,0 +1,214 @@
+#pragma once
+
+#include <Arduino.h>
+#include <math.h>
+
+#include "plant_profile.hpp"
+
+//!##################################################
+//!######## Adaptive dosing scheduler ###############
+//! Decides when the dosing calcs run, from the
+//! filtered EC/pH and how fast they are drifting:
+//!  - out of band            -> now
+//!  - predicted to leave the band within the
+//!    lookahead window       -> now, dosing against
+//!                              the forecast value
+//!  - nothing for max_interval_ms -> backstop check
+//! Never evaluates within min_settle_ms of a mix. A
+//! forecast that dosed nothing isn't acted on again
+//! for forecast_hold_ms; leaving the band still is.
+//!##################################################
+
+struct SchedulerConfig {
+    unsigned long min_settle_ms;    // after a dose + mix, readings need time to settle
+    unsigned long max_interval_ms;  // backstop evaluation even when nothing is drifting
+    unsigned long lookahead_ms;     // act early if the band will be left within this
+    unsigned long forecast_hold_ms; // after a forecast that dosed nothing, ignore forecasts this long
+    unsigned long slope_sample_ms;  // spacing of the drift-rate samples
+    float         slope_alpha;      // EWMA weight of each new drift-rate sample
+};
+
+static constexpr SchedulerConfig DEFAULT_SCHEDULER_CONFIG = {
+    3UL * 60UL * 1000UL,
+    60UL * 60UL * 1000UL,
+    10UL * 60UL * 1000UL,
+    5UL * 60UL * 1000UL,
+    10UL * 1000UL,
+    0.2f,
+};
+
+enum class DoseTrigger : uint8_t { NONE, OUT_OF_BAND, PREDICTED_EXIT, BACKSTOP };
+
+// EWMA of the rate of change of one filtered signal, in units per minute
+struct DriftTracker {
+    float         last_value = 0.0f;
+    unsigned long last_ms    = 0;
+    float         rate       = 0.0f;
+    bool          primed     = false;
+
+    void reset() {
+        primed = false;
+        rate   = 0.0f;
+    }
+
+    void update(float value, unsigned long now, const SchedulerConfig &cfg) {
+        if (!primed) {
+            last_value = value;
+            last_ms    = now;
+            primed     = true;
+            return;
+        }
+
+        unsigned long dt = now - last_ms;
+        if (dt < cfg.slope_sample_ms) return;
+
+        float sample = (value - last_value) * 60000.0f / static_cast<float>(dt);
+        rate += cfg.slope_alpha * (sample - rate);
+
+        last_value = value;
+        last_ms    = now;
+    }
+
+    // Minutes until value leaves [low, high] at the current rate, INFINITY if never
+    float minutes_to_exit(float value, float low, float high) const {
+        if (rate < 0.0f) return (low - value) / rate;
+        if (rate > 0.0f) return (high - value) / rate;
+        return INFINITY;
+    }
+};
+
+class DoseScheduler {
+    public:
+        explicit DoseScheduler(const SchedulerConfig &cfg = DEFAULT_SCHEDULER_CONFIG) : cfg(cfg) {}
+
+        void begin(unsigned long now);
+        // Picks up the cadence from before a reset
+        void resume(unsigned long now, unsigned long ms_since_eval);
+
+        // Feed every filtered sample
+        void update(float ec, float ph, unsigned long now);
+
+        // Whether the dosing calcs should run now; sets the values to dose against
+        DoseTrigger due(const TargetPlant &plant, unsigned long now);
+
+        // Call after each evaluation. A dose restarts the settle window and drift estimates.
+        void evaluated(unsigned long now, bool dosed);
+
+        float ec_for_dosing() const { return ec_target_input; }
+        float ph_for_dosing() const { return ph_target_input; }
+
+        float ec_rate() const { return ec_drift.rate; } // mS/cm per minute
+        float ph_rate() const { return ph_drift.rate; } // pH per minute
+
+        unsigned long ms_since_eval(unsigned long now) const { return now - last_eval_ms; }
+
+        SchedulerConfig cfg;
+
+    private:
+        DoseTrigger next_trigger(const TargetPlant &plant, unsigned long now);
+
+        DriftTracker ec_drift;
+        DriftTracker ph_drift;
+
+        float latest_ec = 0.0f;
+        float latest_ph = 0.0f;
+
+        float ec_target_input = 0.0f;
+        float ph_target_input = 0.0f;
+
+        unsigned long last_eval_ms = 0;
+        unsigned long settle_until = 0;
+        bool          settling     = false;
+
+        DoseTrigger   last_trigger  = DoseTrigger::NONE;
+        unsigned long hold_since    = 0;
+        bool          forecast_held = false;
+};
+
+void DoseScheduler::begin(unsigned long now) {
+    last_eval_ms  = now;
+    settling      = false;
+    forecast_held = false;
+    ec_drift.reset();
+    ph_drift.reset();
+}
+
+void DoseScheduler::resume(unsigned long now, unsigned long ms_since_eval) {
+    begin(now);
+    if (ms_since_eval > cfg.max_interval_ms) ms_since_eval = cfg.max_interval_ms;
+    last_eval_ms = now - ms_since_eval;
+}
+
+void DoseScheduler::update(float ec, float ph, unsigned long now) {
+    latest_ec = ec;
+    latest_ph = ph;
+
+    // Mixing transients would read as drift
+    if (settling) return;
+
+    ec_drift.update(ec, now, cfg);
+    ph_drift.update(ph, now, cfg);
+}
+
+DoseTrigger DoseScheduler::due(const TargetPlant &plant, unsigned long now) {
+    last_trigger = next_trigger(plant, now);
+    return last_trigger;
+}
+
+DoseTrigger DoseScheduler::next_trigger(const TargetPlant &plant, unsigned long now) {
+    ec_target_input = latest_ec;
+    ph_target_input = latest_ph;
+
+    if (settling) {
+        if (static_cast<long>(now - settle_until) < 0) return DoseTrigger::NONE;
+        settling = false;
+    }
+
+    // An evaluation that dosed nothing isn't repeated on every loop pass
+    if (now - last_eval_ms < cfg.slope_sample_ms) return DoseTrigger::NONE;
+
+    bool ec_out = latest_ec < plant.ec_low;
+    bool ph_out = latest_ph < plant.ph_low || latest_ph > plant.ph_high;
+    if (ec_out || ph_out) return DoseTrigger::OUT_OF_BAND;
+
+    if (forecast_held && now - hold_since >= cfg.forecast_hold_ms) forecast_held = false;
+
+    // Need a few rate samples before trusting a forecast
+    if (ec_drift.primed && ph_drift.primed && !forecast_held) {
+        float lookahead_min = static_cast<float>(cfg.lookahead_ms) / 60000.0f;
+
+        // EC only ever gets corrected upwards, so only a falling EC is actionable
+        bool ec_exit = ec_drift.rate < 0.0f &&
+                       ec_drift.minutes_to_exit(latest_ec, plant.ec_low, plant.ec_high) < lookahead_min;
+        bool ph_exit = ph_drift.minutes_to_exit(latest_ph, plant.ph_low, plant.ph_high) < lookahead_min;
+
+        if (ec_exit || ph_exit) {
+            if (ec_exit) ec_target_input = latest_ec + ec_drift.rate * lookahead_min;
+            if (ph_exit) ph_target_input = latest_ph + ph_drift.rate * lookahead_min;
+            return DoseTrigger::PREDICTED_EXIT;
+        }
+    }
+
+    if (now - last_eval_ms >= cfg.max_interval_ms) return DoseTrigger::BACKSTOP;
+
+    return DoseTrigger::NONE;
+}
+
+void DoseScheduler::evaluated(unsigned long now, bool dosed) {
+    last_eval_ms = now;
+    if (!dosed) {
+        // Planned against the forecast and found nothing to do: the same forecast would
+        // come up again on the next sample
+        if (last_trigger == DoseTrigger::PREDICTED_EXIT) {
+            forecast_held = true;
+            hold_since    = now;
+        }
+        return;
+    }
+
+    settling      = true;
+    settle_until  = now + cfg.min_settle_ms;
+    forecast_held = false;
+    ec_drift.reset();
+    ph_drift.reset();
+}
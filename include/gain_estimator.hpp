@@ -0,0 +1,160 @@
+#pragma once
+
+#include <math.h>
+
+#include "dose_planner.hpp"
+
+//!##################################################
+//!######## Online plant-gain identification ########
+//! Each actuator's gain is how far one mL per litre
+//! of reservoir moves the reading (mS/cm or pH).
+//! It is fitted from the filtered reading before a
+//! dose and after the mix has settled:
+//!     delta = gain * (dose_ml / volume_L)
+//! as a scalar Kalman/RLS estimate, so every dose
+//! tightens the confidence interval. Doses divide by
+//! the gain plus one sigma: while the gain is
+//! uncertain the controller undershoots instead of
+//! overshooting, and converges as the interval closes.
+//!##################################################
+
+struct GainConfig {
+    float prior;       // initial gain
+    float prior_sigma; // initial 1-sigma uncertainty
+    float min_gain;    // hard bounds on the estimate
+    float max_gain;
+    float drift_var;   // added variance per observation so the estimate can track bottle aging
+    float delta_var;   // variance of a settled before/after difference of the filtered reading
+};
+
+static constexpr GainConfig EC_GAIN_CONFIG      = { 1.0f, 1.0f, 0.05f, 5.0f,  0.0005f, 0.0008f };
+static constexpr GainConfig PH_UP_GAIN_CONFIG   = { 1.0f, 1.0f, 0.05f, 10.0f, 0.001f,  0.0008f };
+static constexpr GainConfig PH_DOWN_GAIN_CONFIG = { 1.0f, 1.0f, 0.05f, 10.0f, 0.001f,  0.0008f };
+// pH removed per mL/L of nutrients; may legitimately be ~0 for well-buffered water
+static constexpr GainConfig NUTRIENT_PH_CONFIG  = { 0.2f, 0.3f, 0.0f,  2.0f,  0.001f,  0.0008f };
+
+// Observations whose innovation is beyond this many sigma are dropped as outliers
+static constexpr float GAIN_OUTLIER_SIGMA = 4.0f;
+// Doses smaller than this (mL/L) say more about noise than about the gain
+static constexpr float GAIN_MIN_EXCITATION = 0.01f;
+
+class GainEstimator {
+    public:
+        explicit GainEstimator(const GainConfig &cfg) : cfg(cfg) { reset(); }
+
+        void reset() {
+            g = cfg.prior;
+            p = cfg.prior_sigma * cfg.prior_sigma;
+            n = 0;
+        }
+
+        // dose_per_l: mL per litre dosed. delta: settled change of the reading in the
+        // direction the actuator pushes. Returns false when the observation was rejected.
+        bool observe(float dose_per_l, float delta);
+
+        float gain() const { return g; }
+        float sigma() const { return sqrtf(p); }
+        float lower() const { return clamp(g - 2.0f * sigma()); }
+        float upper() const { return clamp(g + 2.0f * sigma()); }
+        unsigned observations() const { return n; }
+
+        // Gain to divide the correction by: 1-sigma high so an uncertain estimate undershoots
+        float dosing_gain() const { return clamp(g + sigma()); }
+
+        // Restores a previously persisted estimate
+        void restore(float gain, float var, unsigned count) {
+            g = clamp(gain);
+            p = var;
+            n = count;
+        }
+        float variance() const { return p; }
+
+        GainConfig cfg;
+
+    private:
+        float    g;
+        float    p;
+        unsigned n;
+
+        float clamp(float v) const {
+            if (v < cfg.min_gain) return cfg.min_gain;
+            if (v > cfg.max_gain) return cfg.max_gain;
+            return v;
+        }
+};
+
+bool GainEstimator::observe(float u, float delta) {
+    if (u < GAIN_MIN_EXCITATION || !isfinite(delta)) return false;
+
+    float r = cfg.delta_var;
+
+    p += cfg.drift_var;
+
+    float predicted  = g * u;
+    float innovation = delta - predicted;
+    float s          = u * u * p + r; // innovation variance
+
+    if (innovation * innovation > GAIN_OUTLIER_SIGMA * GAIN_OUTLIER_SIGMA * s) return false;
+
+    float k = p * u / s;
+    g = clamp(g + k * innovation);
+    p = (1.0f - k * u) * p;
+    n++;
+    return true;
+}
+
+//!##################################################
+//!######## Dose observation ########################
+//! Snapshot taken when a dose is made; completed with
+//! the settled readings once the mix has settled.
+//!##################################################
+
+struct DoseObservation {
+    bool  pending = false;
+    float ec_before;
+    float ph_before;
+    float nutrient_ml;
+    float ph_up_ml;
+    float ph_down_ml;
+    float volume_l;
+};
+
+struct PlantGains {
+    GainEstimator ec          { EC_GAIN_CONFIG };
+    GainEstimator ph_up       { PH_UP_GAIN_CONFIG };
+    GainEstimator ph_down     { PH_DOWN_GAIN_CONFIG };
+    GainEstimator nutrient_ph { NUTRIENT_PH_CONFIG };
+
+    // Feeds the settled change around one dose into the matching estimators.
+    // When nutrients and a pH product went in together, the nutrients' share of the
+    // pH move is taken out using the current acidification estimate.
+    void observe(const DoseObservation &obs, float ec_after, float ph_after) {
+        if (obs.volume_l <= 0.0f) return;
+
+        float u_nut   = obs.nutrient_ml / obs.volume_l;
+        float ph_rise = ph_after - obs.ph_before;
+
+        if (obs.nutrient_ml > 0.0f) {
+            ec.observe(u_nut, ec_after - obs.ec_before);
+
+            if (obs.ph_up_ml <= 0.0f && obs.ph_down_ml <= 0.0f) {
+                nutrient_ph.observe(u_nut, -ph_rise);
+                return;
+            }
+            ph_rise += nutrient_ph.gain() * u_nut;
+        }
+
+        if (obs.ph_up_ml > 0.0f && obs.ph_down_ml <= 0.0f) {
+            ph_up.observe(obs.ph_up_ml / obs.volume_l, ph_rise);
+        }
+        else if (obs.ph_down_ml > 0.0f && obs.ph_up_ml <= 0.0f) {
+            ph_down.observe(obs.ph_down_ml / obs.volume_l, -ph_rise);
+        }
+    }
+
+    // Model for the planner. Actuator gains are the conservative dosing gains.
+    PlantModel model(float ec_drift, float ph_drift) const {
+        return { ec.dosing_gain(), nutrient_ph.gain(), ph_up.dosing_gain(), ph_down.dosing_gain(),
+                 ec_drift, ph_drift };
+    }
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <Arduino.h>
+
+//!##################################################
+//!######## Idle sleep ##############################
+//! loop() works out when it next has anything to do
+//! (a zone sample, a checkpoint, a report) and sleeps
+//! the core until then, or until a byte arrives on
+//! the bus. While pumps or mixers run it doesn't.
+//!
+//! On the SAMD51 that is IDLE sleep (WFI): clocks
+//! and peripherals stay up, so the UART, the e-stop
+//! pin and the step timer all wake it from their
+//! interrupts. SysTick keeps millis() and wakes the
+//! core each ms, only for its handler; loop() runs
+//! again at the deadline.
+//!
+//! DutyCycle keeps the awake share for telemetry.
+//!##################################################
+
+static constexpr unsigned long IDLE_MAX_SLEEP_MS = 1000;
+
+// Earliest of the deadlines given, as ms from now (wrap-safe)
+class WakeSchedule {
+    public:
+        void begin(unsigned long now_ms, unsigned long max_ms = IDLE_MAX_SLEEP_MS) {
+            now  = now_ms;
+            left = max_ms;
+        }
+
+        void at(unsigned long due) {
+            long d = static_cast<long>(due - now);
+            if (d < 0) d = 0;
+            if (static_cast<unsigned long>(d) < left) left = d;
+        }
+
+        // Periodic work last done at `last`
+        void every(unsigned long last, unsigned long interval) { at(last + interval); }
+
+        unsigned long sleep_ms() const { return left; }
+
+    private:
+        unsigned long now  = 0;
+        unsigned long left = 0;
+};
+
+class DutyCycle {
+    public:
+        uint32_t sleeps = 0; // since boot
+
+        void awake(uint32_t us)  { awake_us += us; }
+        void asleep(uint32_t us) { asleep_us += us; sleeps++; }
+
+        // Per-mille of the time since the last call spent awake; 1000 when it never slept
+        uint16_t take_permille() {
+            uint64_t total = awake_us + asleep_us;
+            uint16_t pm    = total ? static_cast<uint16_t>((awake_us * 1000 + total / 2) / total) : 1000;
+            awake_us = asleep_us = 0;
+            return pm;
+        }
+
+    private:
+        uint64_t awake_us  = 0;
+        uint64_t asleep_us = 0;
+};
+
+#if defined(__SAMD51__)
+
+void idle_begin() {
+    PM->SLEEPCFG.reg = PM_SLEEPCFG_SLEEPMODE_IDLE;
+    while (PM->SLEEPCFG.bit.SLEEPMODE != PM_SLEEPCFG_SLEEPMODE_IDLE_Val);
+}
+
+// Sleeps up to `ms`, back early once wake() is true. wake() is checked with interrupts
+// off right before each WFI, so an interrupt landing in between still ends that sleep.
+// Returns the µs slept.
+uint32_t idle_sleep(unsigned long ms, bool (*wake)()) {
+    uint32_t      start = micros();
+    unsigned long t0    = millis();
+    while (millis() - t0 < ms) {
+        __disable_irq();
+        bool done = wake();
+        if (!done) {
+            __DSB();
+            __WFI();
+        }
+        __enable_irq();
+        if (done) break;
+    }
+    return micros() - start;
+}
+
+#else
+
+// Host builds: the harness moves the clock (tests/test_idle_schedule.cpp), or nothing sleeps
+static uint32_t (*idle_sleep_hook)(unsigned long ms, bool (*wake)()) = nullptr;
+
+void idle_begin() {}
+
+uint32_t idle_sleep(unsigned long ms, bool (*wake)()) { return idle_sleep_hook ? idle_sleep_hook(ms, wake) : 0; }
+
+#endif
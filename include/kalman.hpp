@@ -1,7 +1,8 @@
 #pragma once
 
 #include <array>
-#include <numeric>
+#include <stdint.h>
+#include <math.h>
 
 struct KalmanFilter
 {
@@ -9,78 +10,247 @@ struct KalmanFilter
     float p;
 };
 
+//!##################################################
+//!######## Probe health ############################
+//! Per channel, O(1) per sample:
+//!  - out of range / NaN           -> dropped
+//!  - stuck on one value while the
+//!    others move                  -> dropped
+//!  - far from the median of the
+//!    valid channels (3+ needed)   -> dropped
+//!  - mean/variance of the residual
+//!    to that median (exponentially
+//!    weighted Welford)            -> noise weight
+//! The survivors are fused by inverse variance and
+//! that variance is the filter's measurement noise,
+//! so a noisy probe counts for less and a dead one
+//! for nothing.
+//!##################################################
+
+struct FilterConfig {
+    float    min_valid;      // plausible reading range
+    float    max_valid;
+    float    process_noise;  // per sample
+    float    prior_var;      // channel noise assumed until it has history
+    float    min_var;        // floor, so one quiet channel can't take all the weight
+    float    gate_abs;       // always accept this close to the median
+    float    gate_sigma;     // ...or within this many of the channel's own sigma
+    uint16_t window;         // samples in the Welford statistics
+    uint16_t stuck_samples;  // identical readings before a channel can be called stuck
+    float    stuck_delta;    // how far the others must have moved meanwhile
+};
 
-float ec_filter(std::array<float, 4> curr_vals, KalmanFilter& state, float process_noise) {
-
-    static const float R = 1111.0f;
-
-    float pred_state = state.x;
-    float uncertainty_new = state.p + process_noise;
-
-    static const float sensor_noise = R / 4.0f;
-
-    float k_gain = uncertainty_new / (uncertainty_new + sensor_noise);
-
-    float z_avg = std::accumulate(curr_vals.begin(), curr_vals.end(), 0.0f) / curr_vals.size();
-    
-    pred_state = pred_state + k_gain * (z_avg - pred_state);
-
-    uncertainty_new = (1 - k_gain) * uncertainty_new;
-
-    state.x = pred_state;
-    state.p = uncertainty_new;
+// loop() samples the probes this often (main.cpp). Drift, windows and the stuck time are
+// given per second and in seconds below and converted at this rate, so changing it keeps
+// the response: with typical probe noise a step is 63% through in ~0.8 s for EC, ~1.4 s
+// for pH and ~2.5 s for temperature (test_probe_health checks them).
+static constexpr unsigned long FILTER_SAMPLE_MS = 100;
 
-    return pred_state;
+constexpr float    filter_drift(float var_per_s) { return var_per_s * FILTER_SAMPLE_MS / 1000.0f; }
+constexpr uint16_t filter_samples(float seconds) {
+    return static_cast<uint16_t>(seconds * 1000.0f / FILTER_SAMPLE_MS + 0.5f);
 }
 
+// Welford statistics over 30 s; a probe is stuck after 10 s on one value
+static constexpr FilterConfig EC_FILTER_CONFIG   = { -0.05f, 10.0f, filter_drift(1e-5f), 0.0025f, 1e-6f, 0.2f, 4.0f,
+                                                     filter_samples(30.0f), filter_samples(10.0f), 0.05f };
+static constexpr FilterConfig PH_FILTER_CONFIG   = {  0.5f,  13.5f, filter_drift(1e-5f), 0.0025f, 1e-5f, 0.3f, 4.0f,
+                                                     filter_samples(30.0f), filter_samples(10.0f), 0.05f };
+static constexpr FilterConfig TEMP_FILTER_CONFIG = {  0.0f,  50.0f, filter_drift(1e-4f), 0.25f,   1e-4f, 2.0f, 4.0f,
+                                                     filter_samples(30.0f), filter_samples(10.0f), 0.5f  };
+
+// A config for filters run every sample_ms instead (host simulations that step coarser than
+// loop()): same drift per second, same window and stuck time in seconds
+constexpr uint16_t filter_rescale(uint16_t samples, unsigned long sample_ms) {
+    return samples * FILTER_SAMPLE_MS / sample_ms > 1 ? samples * FILTER_SAMPLE_MS / sample_ms : 1;
+}
+constexpr FilterConfig filter_config_at(const FilterConfig &c, unsigned long sample_ms) {
+    return { c.min_valid, c.max_valid, c.process_noise * sample_ms / FILTER_SAMPLE_MS, c.prior_var, c.min_var,
+             c.gate_abs, c.gate_sigma, filter_rescale(c.window, sample_ms), filter_rescale(c.stuck_samples, sample_ms),
+             c.stuck_delta };
+}
 
-// pH Filter
-float ph_filter(std::array<float, 2> curr_vals, KalmanFilter& state, float process_noise) {
+// Weight of prior_var against the channel's own statistics: 1.6 s of samples
+static constexpr float FILTER_PRIOR_SAMPLES = filter_samples(1.6f);
 
+enum ProbeFault : uint8_t {
+    FAULT_NONE    = 0,
+    FAULT_RANGE   = 1 << 0,
+    FAULT_STUCK   = 1 << 1,
+    FAULT_OUTLIER = 1 << 2,
+};
 
-    static const float R = 0.0011f;
-    
-    float pred_state = state.x;
-    float uncertainty_new = state.p + process_noise;
+struct ChannelStats {
+    float    mean = 0.0f;   // residual to the median: the channel's bias
+    float    var  = 0.0f;   // residual variance: the channel's noise
+    uint16_t n    = 0;
+
+    float    last       = NAN;
+    uint16_t repeats    = 0;
+    float    frozen_ref = 0.0f; // consensus when the value stopped changing
+
+    uint8_t  fault = FAULT_NONE;
+
+    // Exponentially weighted Welford once the window is full
+    void add(float x, uint16_t window) {
+        if (n < window) n++;
+        float alpha = 1.0f / n;
+        float delta = x - mean;
+        mean += alpha * delta;
+        var   = (1.0f - alpha) * (var + alpha * delta * delta);
+    }
+
+    float noise(const FilterConfig &cfg) const {
+        float v = (var * n + cfg.prior_var * FILTER_PRIOR_SAMPLES) / (n + FILTER_PRIOR_SAMPLES);
+        return v < cfg.min_var ? cfg.min_var : v;
+    }
+};
 
-    static const float sensor_noise = R / 4.0f;
+template <size_t N>
+struct ProbeHealth {
+    explicit ProbeHealth(const FilterConfig &cfg) : cfg(cfg) {}
 
-    float k_gain = uncertainty_new / (uncertainty_new + sensor_noise);
+    FilterConfig                cfg;
+    std::array<ChannelStats, N> ch;
 
-    float z_avg = std::accumulate(curr_vals.begin(), curr_vals.end(), 0.0f) / curr_vals.size();
-    
-    pred_state = pred_state + k_gain * (z_avg - pred_state);
+    float   fused       = NAN; // last inverse-variance mean of the healthy channels
+    float   fused_var   = NAN; // and its variance (the Kalman R)
+    uint8_t healthy     = 0;   // bit per channel used in the last sample
 
-    uncertainty_new = (1 - k_gain) * uncertainty_new;
+    uint8_t fault_mask() const {
+        uint8_t m = 0;
+        for (size_t i = 0; i < N; ++i) if (ch[i].fault != FAULT_NONE) m |= 1 << i;
+        return m;
+    }
 
-    state.x = pred_state;
-    state.p = uncertainty_new;
+    // Screens one sample set and fuses the survivors. Returns false when none survived.
+    bool update(const std::array<float, N> &z);
+};
 
-    return pred_state;
+// Median of the first n entries (n small); reorders v
+inline float small_median(float *v, size_t n) {
+    for (size_t i = 1; i < n; ++i) {
+        float x = v[i];
+        size_t j = i;
+        while (j > 0 && v[j - 1] > x) { v[j] = v[j - 1]; --j; }
+        v[j] = x;
+    }
+    return (n & 1) ? v[n / 2] : 0.5f * (v[n / 2 - 1] + v[n / 2]);
+}
 
+template <size_t N>
+bool ProbeHealth<N>::update(const std::array<float, N> &z) {
+    // Range, then the median of what's left
+    float   valid[N];
+    size_t  n_valid = 0;
+    bool    in_range[N];
+
+    for (size_t i = 0; i < N; ++i) {
+        in_range[i] = isfinite(z[i]) && z[i] >= cfg.min_valid && z[i] <= cfg.max_valid;
+        if (in_range[i]) valid[n_valid++] = z[i];
+    }
+
+    healthy = 0;
+    if (n_valid == 0) {
+        for (size_t i = 0; i < N; ++i) ch[i].fault = FAULT_RANGE;
+        return false;
+    }
+
+    float median = small_median(valid, n_valid);
+
+    float sum_w  = 0.0f;
+    float sum_wz = 0.0f;
+
+    for (size_t i = 0; i < N; ++i) {
+        ChannelStats &c = ch[i];
+
+        if (!in_range[i]) {
+            c.fault   = FAULT_RANGE;
+            c.last    = NAN;
+            c.repeats = 0;
+            continue;
+        }
+
+        // Stuck: same reading sample after sample while the consensus has moved on
+        if (z[i] == c.last) {
+            if (c.repeats < 0xFFFF) c.repeats++;
+        } else {
+            c.last       = z[i];
+            c.repeats    = 0;
+            c.frozen_ref = median;
+        }
+        if (c.repeats >= cfg.stuck_samples && fabsf(median - c.frozen_ref) > cfg.stuck_delta) {
+            c.fault = FAULT_STUCK;
+            continue;
+        }
+
+        // Voting needs a majority to vote against
+        float residual = z[i] - median;
+        if (n_valid >= 3) {
+            float gate = cfg.gate_sigma * sqrtf(c.noise(cfg));
+            if (gate < cfg.gate_abs) gate = cfg.gate_abs;
+            if (fabsf(residual) > gate) {
+                c.fault = FAULT_OUTLIER;
+                continue;
+            }
+        }
+
+        c.fault = FAULT_NONE;
+        c.add(residual, cfg.window);
+
+        float w = 1.0f / c.noise(cfg);
+        sum_w  += w;
+        sum_wz += w * z[i];
+        healthy |= 1 << i;
+    }
+
+    if (sum_w <= 0.0f) return false;
+
+    fused     = sum_wz / sum_w;
+    fused_var = 1.0f / sum_w;
+    return true;
 }
 
-float temp_filter(std::array<float, 4> curr_vals, KalmanFilter& state, float process_noise) {
+// One Kalman step on the fused reading; with no healthy channel it only predicts,
+// so the state never goes NaN and picks up again once a probe recovers
+template <size_t N>
+float probe_filter(const std::array<float, N> &curr_vals, KalmanFilter& state, ProbeHealth<N> &health) {
 
+    float uncertainty_new = state.p + health.cfg.process_noise;
 
-    static const float R = 1111.0f;
-    
-    float pred_state = state.x;
-    float uncertainty_new = state.p + process_noise;
+    if (!health.update(curr_vals)) {
+        state.p = uncertainty_new;
+        return state.x;
+    }
 
-    static const float sensor_noise = R / 4.0f;
+    // Restored or initial state that isn't a number: start from the measurement
+    if (!isfinite(state.x) || !isfinite(state.p)) {
+        state.x = health.fused;
+        state.p = health.fused_var;
+        return state.x;
+    }
 
-    float k_gain = uncertainty_new / (uncertainty_new + sensor_noise);
+    float k_gain = uncertainty_new / (uncertainty_new + health.fused_var);
 
-    float z_avg = std::accumulate(curr_vals.begin(), curr_vals.end(), 0.0f) / curr_vals.size();
-    
-    pred_state = pred_state + k_gain * (z_avg - pred_state);
+    state.x = state.x + k_gain * (health.fused - state.x);
+    state.p = (1 - k_gain) * uncertainty_new;
+
+    return state.x;
+}
 
-    uncertainty_new = (1 - k_gain) * uncertainty_new;
 
-    state.x = pred_state;
-    state.p = uncertainty_new;
+template <size_t N>
+float ec_filter(const std::array<float, N> &curr_vals, KalmanFilter& state, ProbeHealth<N> &health) {
+    return probe_filter(curr_vals, state, health);
+}
 
-    return pred_state;
+// pH Filter
+template <size_t N>
+float ph_filter(const std::array<float, N> &curr_vals, KalmanFilter& state, ProbeHealth<N> &health) {
+    return probe_filter(curr_vals, state, health);
+}
 
+template <size_t N>
+float temp_filter(const std::array<float, N> &curr_vals, KalmanFilter& state, ProbeHealth<N> &health) {
+    return probe_filter(curr_vals, state, health);
 }
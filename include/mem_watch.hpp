@@ -0,0 +1,258 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <climits>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+//!##################################################
+//!######## Memory watch ############################
+//! Watermarks for what only shows after weeks up: a
+//! heap that slowly shrinks, or splits into blocks
+//! too small for the next JsonDocument. Free heap,
+//! the largest block malloc can still hand out, and
+//! each stack's headroom, kept as lows since boot.
+//!
+//! JsonDocuments on the per-message paths allocate
+//! through a CountingAllocator, one per subsystem:
+//! allocations climbing past frees, or live bytes
+//! that never return to 0 between messages, is the
+//! leak.
+//!
+//! The MCU reports in M:2017 when asked (M:2016);
+//! the bridge serves its own and its nodes' on /mem.
+//!##################################################
+
+static constexpr uint8_t MEM_STACKS_MAX = 3;
+static constexpr uint8_t MEM_ALLOCS_MAX = 3;
+
+// Counts what a subsystem's JsonDocuments take from the heap. Each block carries its size
+// in front, so frees and reallocations come off the live total.
+class CountingAllocator : public ArduinoJson::Allocator {
+    public:
+        const char *name;
+        uint32_t allocs = 0;
+        uint32_t frees  = 0;
+        uint32_t fails  = 0;
+        uint32_t live   = 0; // bytes held now
+        uint32_t peak   = 0;
+
+        explicit CountingAllocator(const char *name) : name(name) {}
+
+        void *allocate(size_t n) override {
+            uint8_t *p = static_cast<uint8_t *>(malloc(HEADER + n));
+            if (!p) {
+                fails++;
+                return nullptr;
+            }
+            memcpy(p, &n, sizeof(n));
+            allocs++;
+            grew(n, 0);
+            return p + HEADER;
+        }
+
+        void deallocate(void *ptr) override {
+            if (!ptr) return;
+            uint8_t *p = static_cast<uint8_t *>(ptr) - HEADER;
+            size_t   n;
+            memcpy(&n, p, sizeof(n));
+            live -= n;
+            frees++;
+            free(p);
+        }
+
+        void *reallocate(void *ptr, size_t n) override {
+            if (!ptr) return allocate(n);
+            uint8_t *p = static_cast<uint8_t *>(ptr) - HEADER;
+            size_t   old;
+            memcpy(&old, p, sizeof(old));
+            uint8_t *q = static_cast<uint8_t *>(realloc(p, HEADER + n));
+            if (!q) {
+                fails++;
+                return nullptr;
+            }
+            memcpy(q, &n, sizeof(n));
+            grew(n, old);
+            return q + HEADER;
+        }
+
+    private:
+        static constexpr size_t HEADER = alignof(std::max_align_t);
+
+        void grew(size_t n, size_t old) {
+            live += n - old;
+            if (live > peak) peak = live;
+        }
+};
+
+class MemWatch {
+    public:
+        uint32_t heap_free = 0;
+        uint32_t heap_min  = UINT32_MAX;
+        uint32_t block     = 0; // largest free block
+        uint32_t block_min = UINT32_MAX;
+        uint32_t samples   = 0;
+
+        // min: the platform's own low since boot when it keeps one, caught between samples
+        void heap(uint32_t free_bytes, uint32_t largest, uint32_t min = UINT32_MAX) {
+            heap_free = free_bytes;
+            block     = largest;
+            if (free_bytes < heap_min) heap_min = free_bytes;
+            if (min < heap_min)        heap_min = min;
+            if (largest < block_min)   block_min = largest;
+            samples++;
+        }
+
+        // Free heap not in the largest block, per-mille: near 0 is one clean block
+        uint16_t frag_permille() const {
+            return heap_free ? static_cast<uint16_t>(1000 - static_cast<uint64_t>(block) * 1000 / heap_free) : 0;
+        }
+
+        // Headroom left on a stack, bytes; the low is kept
+        void stack(const char *name, uint32_t headroom) {
+            for (uint8_t i = 0; i < nstacks; ++i) {
+                if (strcmp(stacks[i].name, name) == 0) {
+                    if (headroom < stacks[i].low) stacks[i].low = headroom;
+                    return;
+                }
+            }
+            if (nstacks < MEM_STACKS_MAX) stacks[nstacks++] = { name, headroom };
+        }
+
+        uint32_t stack_low(const char *name) const {
+            for (uint8_t i = 0; i < nstacks; ++i) {
+                if (strcmp(stacks[i].name, name) == 0) return stacks[i].low;
+            }
+            return UINT32_MAX;
+        }
+
+        void track(CountingAllocator &a) {
+            if (nallocs < MEM_ALLOCS_MAX) allocators[nallocs++] = &a;
+        }
+
+        // "heap", "heap_min", "block", "block_min", "frag", "stack": {name: low},
+        // "alloc": {name: [allocs, frees, fails, live, peak]}
+        void to_json(JsonObject out) const {
+            out["heap"]      = heap_free;
+            out["heap_min"]  = heap_min;
+            out["block"]     = block;
+            out["block_min"] = block_min;
+            out["frag"]      = frag_permille();
+            JsonObject s = out["stack"].to<JsonObject>();
+            for (uint8_t i = 0; i < nstacks; ++i) s[stacks[i].name] = stacks[i].low;
+            JsonObject a = out["alloc"].to<JsonObject>();
+            for (uint8_t i = 0; i < nallocs; ++i) {
+                const CountingAllocator &c = *allocators[i];
+                JsonArray r = a[c.name].to<JsonArray>();
+                r.add(c.allocs);
+                r.add(c.frees);
+                r.add(c.fails);
+                r.add(c.live);
+                r.add(c.peak);
+            }
+        }
+
+    private:
+        struct Stack {
+            const char *name;
+            uint32_t    low;
+        };
+        Stack              stacks[MEM_STACKS_MAX] = {};
+        uint8_t            nstacks                = 0;
+        CountingAllocator *allocators[MEM_ALLOCS_MAX] = {};
+        uint8_t            nallocs                = 0;
+};
+
+#if defined(ESP32)
+
+//!##################################################
+//!######## ESP32 ###################################
+//! FreeRTOS keeps each task's stack high-water mark
+//! (bytes on the ESP32) and the heap's low; the
+//! largest block is the 8-bit-capable heap's. The
+//! bridge has no interrupt handlers of its own: the
+//! UART and WiFi drivers' ISRs run on the IDF's
+//! interrupt stack, outside what it can change.
+//! mem_sample() is for loop(), whose task it reads.
+//!##################################################
+
+#include <esp_heap_caps.h>
+
+void mem_sample(MemWatch &w) {
+    w.heap(ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT), ESP.getMinFreeHeap());
+    w.stack("loop", uxTaskGetStackHighWaterMark(nullptr));
+
+    static TaskHandle_t async_tcp = nullptr;
+    if (!async_tcp) async_tcp = xTaskGetHandle("async_tcp");
+    if (async_tcp) w.stack("async_tcp", uxTaskGetStackHighWaterMark(async_tcp));
+}
+
+#elif defined(__SAMD51__)
+
+//!##################################################
+//!######## SAMD51 ##################################
+//! One stack (MSP) for loop() and every interrupt,
+//! growing down toward the heap. setup() paints the
+//! gap between them; the painted words still left
+//! above the heap are the headroom the deepest call
+//! chain has left ("main"). The step ISR marks its
+//! own stack pointer, interrupting whatever loop()
+//! was in ("isr"). Free heap is that gap plus what
+//! malloc holds freed; the gap is the largest block
+//! it can hand out without reusing one.
+//!##################################################
+
+#include <malloc.h>
+
+extern "C" char *sbrk(int incr);
+
+static constexpr uint32_t MEM_PAINT       = 0xA5A5A5A5;
+static constexpr uint32_t MEM_PAINT_GUARD = 256; // bytes left unpainted below the live stack
+
+static volatile uintptr_t mem_isr_sp = UINTPTR_MAX;
+
+static uintptr_t mem_heap_top() { return (reinterpret_cast<uintptr_t>(sbrk(0)) + 3) & ~uintptr_t(3); }
+
+// First thing in setup(), before the stack has been deep
+void mem_paint_stack() {
+    uint32_t *p   = reinterpret_cast<uint32_t *>(mem_heap_top());
+    uint32_t *end = reinterpret_cast<uint32_t *>(__get_MSP() - MEM_PAINT_GUARD);
+    while (p < end) *p++ = MEM_PAINT;
+}
+
+// From an interrupt handler: a few cycles
+inline void mem_isr_mark() {
+    uintptr_t sp = __get_MSP();
+    if (sp < mem_isr_sp) mem_isr_sp = sp;
+}
+
+void mem_sample(MemWatch &w) {
+    uintptr_t top = mem_heap_top();
+    uintptr_t sp  = __get_MSP();
+    uint32_t  gap = sp > top ? sp - top : 0;
+    w.heap(gap + mallinfo().fordblks, gap);
+}
+
+// Walks the painted words up from the heap; for reports, not every pass
+void mem_sample_stacks(MemWatch &w) {
+    uintptr_t       top = mem_heap_top();
+    const uint32_t *p   = reinterpret_cast<const uint32_t *>(top);
+    const uint32_t *sp  = reinterpret_cast<const uint32_t *>(__get_MSP());
+    while (p < sp && *p == MEM_PAINT) ++p;
+    w.stack("main", reinterpret_cast<uintptr_t>(p) - top);
+
+    uintptr_t isr = mem_isr_sp;
+    if (isr != UINTPTR_MAX) w.stack("isr", isr > top ? isr - top : 0);
+}
+
+#else
+
+// Host builds: the allocation counters work, there's no heap or stack to read
+void mem_paint_stack() {}
+inline void mem_isr_mark() {}
+void mem_sample(MemWatch &) {}
+void mem_sample_stacks(MemWatch &) {}
+
+#endif
@@ -3,6 +3,10 @@
 #include <Arduino.h>
 #include <TMCStepper.h>
 #include <AccelStepper.h>
+#include <array>
+#include <utility>
+
+#include "pump_calibration.hpp"
 
 #define R_SENSE 0.11
 #define DRIVER_ADDRESS 0b00
@@ -13,15 +17,32 @@ class Motor {
         
         void init();
         
+        // Ramps down at the profile's deceleration; run() carries on until it has stopped
         void stop();
         void test(int steps);
         void prime();
-        void dose(float volume);
+        void dose(float volume); // Blocking
+
+        // Non-blocking: start_*() sets up a move, run() advances it and must be
+        // called at least as often as the step rate (the step timer ISR does this)
+        void start_dose(float volume);
+        void start_steps(long steps, const SpeedProfile &profile);
+        bool run();
+
+        // Stops dead, without deceleration. Returns mL moved since the last start.
+        float halt();
+        float dispensed_ml();
+
+        void set_calibration(const PumpCalibration &cal);
+        const PumpCalibration &calibration() const { return cal; }
 
     private:
         uint8_t DIR_PIN;
         uint8_t STEP_PIN;
 
+        PumpCalibration cal = DEFAULT_PUMP_CALIBRATION;
+        long start_pos = 0;
+
         AccelStepper stepper;
         TMC2209Stepper driver;
 };
@@ -41,14 +62,53 @@ void Motor::init() {
     driver.I_scale_analog(false);
     driver.en_spreadCycle(false);
 
-    stepper.setMaxSpeed(6000);
-    stepper.setAcceleration(500);
+    stepper.setMaxSpeed(step_setpoint(cal.profile.max_speed));
+    stepper.setAcceleration(cal.profile.acceleration);
     stepper.setSpeed(4000);
 
 }
 
+void Motor::set_calibration(const PumpCalibration &new_cal) {
+    cal = new_cal;
+    cal.profile.max_speed = step_rate(cal.profile.max_speed); // what it will run at
+    stepper.setMaxSpeed(step_setpoint(cal.profile.max_speed));
+    stepper.setAcceleration(cal.profile.acceleration);
+}
+
+void Motor::start_dose(float volume) {
+    if (volume <= 0.0f) return;
+
+    // Multiply exact float volume by this pump's steps_per_ml, then round to the nearest whole step
+    start_steps(std::lround(volume * cal.steps_per_ml), cal.profile);
+}
+
+void Motor::start_steps(long steps, const SpeedProfile &profile) {
+    stepper.setMaxSpeed(step_setpoint(profile.max_speed));
+    stepper.setAcceleration(profile.acceleration);
+
+    start_pos = stepper.currentPosition();
+    stepper.move(steps);
+}
+
+bool Motor::run() {
+    return stepper.run();
+}
+
+float Motor::halt() {
+    // Dropping the target onto the current position also zeroes the speed
+    stepper.setCurrentPosition(stepper.currentPosition());
+    return dispensed_ml();
+}
+
+float Motor::dispensed_ml() {
+    long moved = stepper.currentPosition() - start_pos;
+    return static_cast<float>(moved < 0 ? -moved : moved) / cal.steps_per_ml;
+}
+
 void Motor::stop() {
-    stepper.stop();
+    // Not stepping yet: there's no speed to ramp down from, and stop() would leave the move on
+    if (stepper.speed() == 0.0f) stepper.setCurrentPosition(stepper.currentPosition());
+    else                         stepper.stop();
 }
 
 void Motor::test(int steps) {
@@ -66,57 +126,96 @@ void Motor::prime() {
 void Motor::dose(float volume) {
     if (volume <= 0.0) return; 
 
-    // Experimental value
-    static const int steps_per_ml = 488;
-
-    // Multiply exact float volume by steps_per_ml, then round to the nearest whole step
-    int steps_to_move = std::round(volume * static_cast<float>(steps_per_ml));
-    
-    stepper.move(steps_to_move);
+    start_dose(volume);
     stepper.runToPosition(); // Blocks until the motor reaches the target position
 }
 
+struct PumpPins {
+    uint8_t step;
+    uint8_t dir;
+};
 
-bool dose_nutrients(Motor &nutrient_1_motor, float nutrient_1_amount,
-                    Motor &nutrient_2_motor, float nutrient_2_amount,
-                    Motor &nutrient_3_motor, float nutrient_3_amount) {
- 
-    if (nutrient_1_amount > 0.0f || nutrient_2_amount > 0.0f || nutrient_3_amount > 0.0f) {
-        nutrient_1_motor.dose(nutrient_1_amount);
-        nutrient_2_motor.dose(nutrient_2_amount);
-        nutrient_3_motor.dose(nutrient_3_amount);
-        return true;
-    }
- 
-    return false;
-}
-
-bool dose_ph(Motor &ph_up_motor, float &ph_up_amount,
-             Motor &ph_down_motor, float &ph_down_amount) {
- 
-    if (ph_up_amount > 0.0f || ph_down_amount > 0.0f) {
-        ph_up_motor.dose(ph_up_amount);
-        ph_down_motor.dose(ph_down_amount);
-        return true;
-    }
- 
-    return false;
-}
-
-void mix_resevoir(uint8_t IN1, uint8_t IN2, uint8_t ENA) {
-    digitalWrite(IN1, HIGH);
-    digitalWrite(IN2, LOW);
-
-    analogWrite(ENA, 127); 
-    delay(7000); // Mix for 7 seconds
-    analogWrite(ENA, 0);
-}
-
+// N pumps on one TMC2209 UART, built from a board's step/dir pin table, indexed by PumpId
+template <size_t N>
+class PumpSet {
+    public:
+        template <typename Pins>
+        PumpSet(const Pins &pins, HardwareSerial &port)
+            : motors(make(pins, port, std::make_index_sequence<N>{})) {}
 
+        static constexpr size_t size = N;
 
+        void init() {
+            for (Motor &m : motors) m.init();
+        }
 
+        Motor &operator[](size_t i) { return motors[i]; }
+        const Motor &operator[](size_t i) const { return motors[i]; }
 
+        Motor *begin() { return motors.data(); }
+        Motor *end() { return motors.data() + N; }
 
+    private:
+        std::array<Motor, N> motors;
 
+        template <typename Pins, size_t... I>
+        static std::array<Motor, N> make(const Pins &pins, HardwareSerial &port, std::index_sequence<I...>) {
+            return {{ Motor(pins[I].dir, pins[I].step, port)... }};
+        }
+};
 
+// Non-blocking reservoir mixer on an H-bridge channel
+class Mixer {
+    public:
+        Mixer(uint8_t IN1, uint8_t IN2, uint8_t ENA) : IN1(IN1), IN2(IN2), ENA(ENA) {}
+
+        void init() {
+            pinMode(IN1, OUTPUT);
+            pinMode(IN2, OUTPUT);
+            pinMode(ENA, OUTPUT);
+        }
+
+        void start(unsigned long now, unsigned long duration_ms) {
+            digitalWrite(IN1, HIGH);
+            digitalWrite(IN2, LOW);
+            analogWrite(ENA, 127);
+
+            started_ms = now;
+            run_ms     = duration_ms;
+            running    = true;
+        }
+
+        // Returns true while still mixing
+        bool service(unsigned long now) {
+            if (running && now - started_ms >= run_ms) stop();
+            return running;
+        }
+
+        void stop() {
+            analogWrite(ENA, 0);
+            running = false;
+        }
+
+        // From an interrupt: both bridge inputs low brakes the motor. Only the port's clear
+        // register is written; analogWrite reconfigures the TCC/DAC and isn't ISR-safe, so the
+        // PWM is left for stop() from loop().
+        void cut() {
+#if defined(__SAMD51__)
+            const PinDescription &a = g_APinDescription[IN1];
+            const PinDescription &b = g_APinDescription[IN2];
+            PORT->Group[a.ulPort].OUTCLR.reg = 1ul << a.ulPin;
+            PORT->Group[b.ulPort].OUTCLR.reg = 1ul << b.ulPin;
+#else
+            digitalWrite(IN1, LOW);
+            digitalWrite(IN2, LOW);
+#endif
+        }
+
+        bool is_running() const { return running; }
 
+    private:
+        uint8_t IN1, IN2, ENA;
+        unsigned long started_ms = 0;
+        unsigned long run_ms     = 0;
+        bool running = false;
+};
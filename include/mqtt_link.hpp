@@ -0,0 +1,1021 @@
+#pragma once
+
+#include <Arduino.h>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include "ts_codec.hpp"
+
+//!##################################################
+//!######## MQTT telemetry ##########################
+//! Sensor samples, dose events and bridge metrics to
+//! a broker (the plant historian's), so nothing needs
+//! a browser open to be recorded.
+//!
+//! MQTT 3.1.1, publish only, QoS 1, one message in
+//! flight. Samples and doses are batched into one
+//! compact message per topic per MQTT_BATCH_MS (or
+//! sooner when the batch is full). Every closed
+//! batch is written to a bounded ring on flash
+//! (MqttSpool) and sent from there, oldest first; it
+//! leaves the ring on its PUBACK. A broker restart,
+//! a WiFi outage or a reset loses nothing the ring
+//! can hold, and the message in flight when the link
+//! dropped goes again with DUP set. Delivery is at
+//! least once: each payload carries the bridge's boot
+//! id and a sequence number to de-duplicate on.
+//!
+//! Everything runs from loop(); the socket
+//! (MqttTransport) only buffers.
+//!##################################################
+
+static constexpr size_t        MQTT_PAYLOAD_MAX     = 1000;   // one batch
+static constexpr size_t        MQTT_TOPIC_MAX       = 48;
+static constexpr uint16_t      MQTT_KEEPALIVE_S     = 60;
+static constexpr unsigned long MQTT_CONNECT_TIMEOUT_MS = 10000;
+static constexpr unsigned long MQTT_ACK_TIMEOUT_MS  = 15000;  // no PUBACK: reconnect and replay
+static constexpr unsigned long MQTT_BACKOFF_MIN_MS  = 1000;
+static constexpr unsigned long MQTT_BACKOFF_MAX_MS  = 60000;
+static constexpr unsigned long MQTT_BATCH_MS        = 60000;
+static constexpr unsigned long MQTT_PACKED_BATCH_MS = 600000; // sensor/ts; ~3 blocks of one zone polled every 2 s
+static constexpr uint8_t       MQTT_PACKED_SERIES   = 8;      // node/zones packed at once
+static constexpr uint8_t       MQTT_PACKED_BLOCKS   = 5;      // codec blocks in one sensor/ts message
+
+enum TelemetryTopic : uint8_t { TOPIC_SENSOR, TOPIC_DOSE, TOPIC_METRICS, TOPIC_SENSOR_TS, NUM_TOPICS };
+
+static const char *const TOPIC_NAMES[NUM_TOPICS] = { "sensor", "dose", "metrics", "sensor/ts" };
+
+//!##################################################
+//!######## Packets #################################
+//! Only what a QoS 1 publisher needs, plus SUBSCRIBE
+//! for the host tools that check what arrived.
+//!##################################################
+
+enum MqttPacketType : uint8_t {
+    MQTT_CONNECT = 1, MQTT_CONNACK = 2, MQTT_PUBLISH = 3, MQTT_PUBACK = 4,
+    MQTT_SUBSCRIBE = 8, MQTT_SUBACK = 9, MQTT_PINGREQ = 12, MQTT_PINGRESP = 13, MQTT_DISCONNECT = 14
+};
+
+// Remaining-length varint; returns its size
+size_t mqtt_put_length(uint8_t *out, size_t len) {
+    size_t n = 0;
+    do {
+        uint8_t b = len % 128;
+        len /= 128;
+        out[n++] = len ? (b | 0x80) : b;
+    } while (len);
+    return n;
+}
+
+size_t mqtt_put_string(uint8_t *out, const char *s, size_t len) {
+    out[0] = len >> 8;
+    out[1] = len & 0xFF;
+    memcpy(out + 2, s, len);
+    return len + 2;
+}
+
+// Fixed header + variable part into out, which must hold 5 + body bytes
+size_t mqtt_frame(uint8_t *out, uint8_t first, const uint8_t *body, size_t body_len) {
+    out[0] = first;
+    size_t n = 1 + mqtt_put_length(out + 1, body_len);
+    if (body_len) memcpy(out + n, body, body_len);
+    return n + body_len;
+}
+
+// CONNECT with a clean session: what isn't acked is replayed from our side, not the broker's
+size_t mqtt_connect_packet(uint8_t *out, const char *client_id, uint16_t keepalive_s,
+                           const char *user = nullptr, const char *pass = nullptr) {
+    uint8_t body[160];
+    size_t  n = mqtt_put_string(body, "MQTT", 4);
+    body[n++] = 4;                               // protocol level 3.1.1
+    body[n++] = 0x02 | (user ? 0x80 : 0) | (user && pass ? 0x40 : 0);
+    body[n++] = keepalive_s >> 8;
+    body[n++] = keepalive_s & 0xFF;
+    n += mqtt_put_string(body + n, client_id, strnlen(client_id, 40));
+    if (user)         n += mqtt_put_string(body + n, user, strnlen(user, 40));
+    if (user && pass) n += mqtt_put_string(body + n, pass, strnlen(pass, 40));
+    return mqtt_frame(out, MQTT_CONNECT << 4, body, n);
+}
+
+// PUBLISH QoS 1; out must hold MQTT_PAYLOAD_MAX + MQTT_TOPIC_MAX + 9 bytes
+size_t mqtt_publish_packet(uint8_t *out, const char *topic, uint16_t packet_id, bool dup,
+                           const uint8_t *payload, size_t len) {
+    size_t topic_len = strnlen(topic, MQTT_TOPIC_MAX);
+    size_t body_len  = 2 + topic_len + 2 + len;
+
+    out[0] = (MQTT_PUBLISH << 4) | (dup ? 0x08 : 0) | 0x02;
+    size_t n = 1 + mqtt_put_length(out + 1, body_len);
+    n += mqtt_put_string(out + n, topic, topic_len);
+    out[n++] = packet_id >> 8;
+    out[n++] = packet_id & 0xFF;
+    memcpy(out + n, payload, len);
+    return n + len;
+}
+
+size_t mqtt_subscribe_packet(uint8_t *out, uint16_t packet_id, const char *filter, uint8_t qos) {
+    uint8_t body[MQTT_TOPIC_MAX + 8];
+    size_t  n = 0;
+    body[n++] = packet_id >> 8;
+    body[n++] = packet_id & 0xFF;
+    n += mqtt_put_string(body + n, filter, strnlen(filter, MQTT_TOPIC_MAX));
+    body[n++] = qos;
+    return mqtt_frame(out, (MQTT_SUBSCRIBE << 4) | 0x02, body, n);
+}
+
+size_t mqtt_puback_packet(uint8_t *out, uint16_t packet_id) {
+    const uint8_t body[2] = { static_cast<uint8_t>(packet_id >> 8), static_cast<uint8_t>(packet_id & 0xFF) };
+    return mqtt_frame(out, MQTT_PUBACK << 4, body, 2);
+}
+
+size_t mqtt_ping_packet(uint8_t *out) {
+    return mqtt_frame(out, MQTT_PINGREQ << 4, nullptr, 0);
+}
+
+size_t mqtt_disconnect_packet(uint8_t *out) {
+    return mqtt_frame(out, MQTT_DISCONNECT << 4, nullptr, 0);
+}
+
+// One incoming packet; body points into the parser
+struct MqttPacket {
+    uint8_t        type;
+    uint8_t        flags;
+    const uint8_t *body;
+    size_t         len;
+
+    uint16_t id() const { return len >= 2 ? (body[0] << 8) | body[1] : 0; }
+};
+
+// Reassembles packets from whatever the socket hands over
+class MqttParser {
+    public:
+        static constexpr size_t MAX = MQTT_PAYLOAD_MAX + MQTT_TOPIC_MAX + 16;
+
+        // Consumes bytes until a packet is complete; true with it in pkt
+        bool feed(uint8_t b, MqttPacket &pkt);
+
+        void reset() { stage = 0; }
+
+        uint32_t oversized = 0; // packets too long to keep, skipped
+
+    private:
+        uint8_t buf[MAX];
+        uint8_t head;
+        uint8_t stage = 0;      // 0 header, 1 length, 2 body
+        uint8_t shift;
+        size_t  need, have;
+};
+
+bool MqttParser::feed(uint8_t b, MqttPacket &pkt) {
+    switch (stage) {
+        case 0:
+            head  = b;
+            need  = 0;
+            shift = 0;
+            stage = 1;
+            return false;
+
+        case 1:
+            need |= static_cast<size_t>(b & 0x7F) << shift;
+            shift += 7;
+            if (b & 0x80) {
+                if (shift > 21) stage = 0;  // malformed: resync on the next byte
+                return false;
+            }
+            have  = 0;
+            stage = 2;
+            if (need > 0) return false;
+            break;
+
+        default:
+            if (have < MAX) buf[have] = b;
+            if (++have < need) return false;
+            break;
+    }
+
+    stage = 0;
+    if (need > MAX) {
+        oversized++;
+        return false;
+    }
+    pkt = { static_cast<uint8_t>(head >> 4), static_cast<uint8_t>(head & 0x0F), buf, need };
+    return true;
+}
+
+//!##################################################
+//!######## Transport ###############################
+//! A TCP socket that never blocks loop(): open()
+//! only starts connecting, read() returns what has
+//! arrived, write() takes a whole packet or nothing.
+//!##################################################
+
+enum class MqttSocket : uint8_t { CLOSED, CONNECTING, OPEN };
+
+class MqttTransport {
+    public:
+        virtual bool       open(const char *host, uint16_t port) = 0;
+        virtual MqttSocket status() = 0;
+        virtual size_t     write(const uint8_t *data, size_t len) = 0;
+        virtual size_t     read(uint8_t *dst, size_t max) = 0;
+        virtual void       close() = 0;
+};
+
+//!##################################################
+//!######## Spool ###################################
+//! A ring of segment files, each holding up to
+//! MQTT_SPOOL_PER_SEGMENT batches in sequence order.
+//! A batch is only ever appended; a segment goes
+//! whole, once it's all acked or when the ring wraps
+//! back to it. Acks move a cursor kept in a file of
+//! its own, so nothing is rewritten in place (on
+//! LittleFS that copies the rest of the file).
+//! open() rebuilds the ring from the record headers
+//! and the cursor, so what was queued survives a
+//! reset. Full: the oldest segment goes, unless the
+//! batch in flight is in it; then the new one is
+//! refused. An append and a 4-byte cursor write per
+//! batch: a few a minute.
+//!##################################################
+
+static constexpr uint16_t MQTT_SPOOL_SEGMENTS    = 16;
+static constexpr uint16_t MQTT_SPOOL_PER_SEGMENT = 16;      // 256 batches, ~4 h of one tank's samples
+static constexpr uint16_t MQTT_SPOOL_MAGIC       = 0x4D51;  // "MQ"
+
+// Where the spool lives: LittleFS on the bridge, memory in the tests
+class SpoolFiles {
+    public:
+        virtual bool append(uint16_t segment, const void *src, size_t len) = 0;
+        virtual bool read(uint16_t segment, uint32_t offset, void *dst, size_t len) = 0;
+        virtual void remove(uint16_t segment) = 0;
+        // Everything below the cursor has been acked
+        virtual bool load_cursor(uint32_t &seq) = 0;
+        virtual bool save_cursor(uint32_t seq) = 0;
+};
+
+struct SpoolRecordHeader {
+    uint16_t magic;
+    uint16_t len;
+    uint32_t seq;
+    uint32_t hash;
+    uint8_t  topic;
+    uint8_t  reserved[3];
+};
+
+// FNV-1a over a payload
+uint32_t spool_hash(const uint8_t *data, size_t len) {
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < len; ++i) h = (h ^ data[i]) * 16777619UL;
+    return h;
+}
+
+class MqttSpool {
+    public:
+        explicit MqttSpool(uint16_t segments = MQTT_SPOOL_SEGMENTS, uint16_t per_segment = MQTT_SPOOL_PER_SEGMENT)
+            : segments(segments), per_segment(per_segment) {}
+
+        // Rebuilds the ring from the segments and the cursor
+        void open(SpoolFiles &f);
+
+        bool push(uint8_t topic, const uint8_t *payload, size_t len);
+        // Oldest queued batch, held for sending: push() won't evict it until pop() or release().
+        // false when empty. Skips (and drops) a record that fails its hash.
+        bool front(uint8_t &topic, uint8_t *payload, size_t &len);
+        // The held batch was acked: it leaves the ring
+        void pop();
+        // The held batch's connection went without an ack; it can be evicted again
+        void release() { held = false; }
+
+        uint32_t oldest() const { return first; }
+        uint32_t size() const   { return next - first; }
+        bool     empty() const  { return next == first; }
+
+        uint32_t dropped = 0;   // evicted while full, or corrupt
+        uint32_t errors  = 0;   // file writes that failed
+
+    private:
+        SpoolFiles *files = nullptr;
+        uint16_t    segments;
+        uint16_t    per_segment;
+        uint32_t    first   = 0;   // oldest pending sequence number
+        uint32_t    next    = 0;   // the next one to write
+        uint32_t    read_at = 0;   // first's offset in its segment
+        bool        held    = false;
+        uint32_t    held_seq;      // front()'s batch, out awaiting its PUBACK
+        uint16_t    held_len;
+
+        uint32_t capacity() const { return static_cast<uint32_t>(segments) * per_segment; }
+        uint16_t segment(uint32_t seq) const { return static_cast<uint16_t>((seq / per_segment) % segments); }
+        void     advance(uint16_t len);
+};
+
+void MqttSpool::open(SpoolFiles &f) {
+    files = &f;
+    held  = false;
+
+    uint32_t acked = 0;
+    f.load_cursor(acked);
+
+    // A segment is appended in sequence order, so its records chain by their lengths
+    bool     any = false, pending = false;
+    uint32_t newest = 0, oldest = 0, oldest_at = 0;
+    for (uint16_t s = 0; s < segments; ++s) {
+        SpoolRecordHeader h;
+        for (uint32_t at = 0; f.read(s, at, &h, sizeof(h)); at += sizeof(h) + h.len) {
+            if (h.magic != MQTT_SPOOL_MAGIC || segment(h.seq) != s || h.len > MQTT_PAYLOAD_MAX) break;
+
+            if (!any || h.seq > newest) newest = h.seq;
+            any = true;
+            if (h.seq >= acked && (!pending || h.seq < oldest)) {
+                oldest    = h.seq;
+                oldest_at = at;
+                pending   = true;
+            }
+        }
+    }
+    next    = (any && newest + 1 > acked) ? newest + 1 : acked;
+    first   = pending ? oldest : next;
+    read_at = pending ? oldest_at : 0;
+}
+
+bool MqttSpool::push(uint8_t topic, const uint8_t *payload, size_t len) {
+    if (!files || len > MQTT_PAYLOAD_MAX) return false;
+
+    if (next % per_segment == 0) {
+        // The new segment reuses the oldest one's file: what's pending there goes first
+        if (next - first > capacity() - per_segment) {
+            uint32_t keep = next - capacity() + per_segment;
+            if (held && held_seq < keep) return false;
+            dropped += keep - first;
+            first    = keep;
+            read_at  = 0;
+        }
+        files->remove(segment(next));
+    }
+
+    // Header and payload in one append; LittleFS commits it whole or not at all
+    uint8_t           record[sizeof(SpoolRecordHeader) + MQTT_PAYLOAD_MAX];
+    SpoolRecordHeader h = { MQTT_SPOOL_MAGIC, static_cast<uint16_t>(len), next, spool_hash(payload, len), topic,
+                            { 0, 0, 0 } };
+    memcpy(record, &h, sizeof(h));
+    memcpy(record + sizeof(h), payload, len);
+    if (!files->append(segment(next), record, sizeof(h) + len)) {
+        errors++;
+        return false;
+    }
+    next++;
+    return true;
+}
+
+bool MqttSpool::front(uint8_t &topic, uint8_t *payload, size_t &len) {
+    held = false;
+    while (files && first != next) {
+        SpoolRecordHeader h;
+        if (!files->read(segment(first), read_at, &h, sizeof(h)) || h.magic != MQTT_SPOOL_MAGIC || h.seq != first ||
+            h.len > MQTT_PAYLOAD_MAX) {
+            // Nothing past a bad header can be found: the rest of the segment goes
+            uint32_t left = per_segment - first % per_segment;
+            if (left > next - first) left = next - first;
+            dropped += left;
+            first   += left;
+            read_at  = 0;
+            continue;
+        }
+        if (files->read(segment(first), read_at + sizeof(h), payload, h.len) && spool_hash(payload, h.len) == h.hash) {
+            topic    = h.topic;
+            len      = h.len;
+            held     = true;
+            held_seq = first;
+            held_len = h.len;
+            return true;
+        }
+        dropped++;
+        advance(h.len);
+    }
+    return false;
+}
+
+void MqttSpool::pop() {
+    // Only the batch that went out: had it left the ring, the next one wasn't sent yet
+    bool acked = held && held_seq == first && first != next;
+    held = false;
+    if (!acked) return;
+
+    advance(held_len);
+    // An acked segment is done with; nothing newer shares its file while one of its batches is pending
+    if (first % per_segment == 0) files->remove(segment(first - 1));
+    if (!files->save_cursor(first)) errors++;
+}
+
+void MqttSpool::advance(uint16_t len) {
+    first++;
+    read_at = (first % per_segment == 0) ? 0 : read_at + sizeof(SpoolRecordHeader) + len;
+}
+
+//!##################################################
+//!######## Link ####################################
+//! Connect / CONNACK / publish / PUBACK, keepalive,
+//! and backoff 1 s, 2 s, 4 s ... to the maximum
+//! between failed attempts, as for WiFi. start()
+//! once there's an IP, stop() when it's gone.
+//!##################################################
+
+enum class MqttState : uint8_t { IDLE, CONNECTING, HANDSHAKE, UP, BACKOFF };
+
+static const char *const MQTT_STATE_NAMES[] = { "idle", "connecting", "handshake", "up", "backoff" };
+
+struct MqttConfig {
+    const char *host;
+    uint16_t    port;
+    const char *client_id;
+    const char *prefix;         // topics are <prefix>/sensor, <prefix>/dose, <prefix>/metrics, <prefix>/sensor/ts
+    const char *user;           // nullptr: anonymous
+    const char *pass;
+};
+
+class MqttLink {
+    public:
+        MqttLink(MqttTransport &net, MqttSpool &spool) : net(net), spool(spool) {}
+
+        MqttConfig cfg = {};
+
+        void start(unsigned long now) { attempt(now); }
+        void stop(unsigned long now);
+
+        // Into the spool; false when it can't be written (the batch is lost)
+        bool publish(uint8_t topic, const uint8_t *payload, size_t len);
+
+        void service(unsigned long now);
+
+        MqttState   status() const { return state; }
+        const char *name() const   { return MQTT_STATE_NAMES[static_cast<uint8_t>(state)]; }
+        uint32_t    queued() const { return spool.size(); }
+
+        uint32_t acked      = 0;
+        uint32_t replays    = 0;    // publishes sent again with DUP
+        uint32_t reconnects = 0;
+        uint32_t refused    = 0;    // CONNACK with an error code
+
+    private:
+        MqttTransport &net;
+        MqttSpool     &spool;
+
+        MqttState     state    = MqttState::IDLE;
+        unsigned long since    = 0;
+        unsigned long delay_ms = MQTT_BACKOFF_MIN_MS;
+        unsigned long last_tx  = 0;
+        unsigned long last_rx  = 0;
+
+        // The spool's oldest batch, awaiting its PUBACK on this connection; sends > 1 of the
+        // same sequence number went out with DUP
+        bool          has_inflight = false;
+        uint32_t      inflight_seq;
+        uint8_t       sends     = 0;
+        uint16_t      packet_id = 0;
+        unsigned long sent_at;
+        uint8_t       inflight_topic;
+        size_t        inflight_len;
+        uint8_t       inflight[MQTT_PAYLOAD_MAX];
+
+        uint8_t    tx[MQTT_PAYLOAD_MAX + MQTT_TOPIC_MAX + 16];
+        MqttParser parser;
+
+        void attempt(unsigned long now);
+        void back_off(unsigned long now);
+        void drop(unsigned long now);
+        void send_inflight(unsigned long now);
+        void release_inflight();
+        void handle(const MqttPacket &pkt, unsigned long now);
+        bool send(size_t len, unsigned long now);
+};
+
+void MqttLink::attempt(unsigned long now) {
+    state = MqttState::CONNECTING;
+    since = now;
+    parser.reset();
+    if (!net.open(cfg.host, cfg.port)) back_off(now);
+}
+
+void MqttLink::back_off(unsigned long now) {
+    net.close();
+    release_inflight();
+    state = MqttState::BACKOFF;
+    since = now;
+}
+
+void MqttLink::stop(unsigned long now) {
+    if (state == MqttState::UP) send(mqtt_disconnect_packet(tx), now);
+    net.close();
+    release_inflight();
+    state = MqttState::IDLE;
+}
+
+// No ack can come for it now; the spool may evict it while the link is down
+void MqttLink::release_inflight() {
+    if (!has_inflight) return;
+    has_inflight = false;
+    spool.release();
+}
+
+// The connection went: what was in flight goes again after the next CONNACK
+void MqttLink::drop(unsigned long now) {
+    reconnects++;
+    delay_ms = MQTT_BACKOFF_MIN_MS;
+    back_off(now);
+}
+
+bool MqttLink::send(size_t len, unsigned long now) {
+    if (net.write(tx, len) != len) return false;
+    last_tx = now;
+    return true;
+}
+
+bool MqttLink::publish(uint8_t topic, const uint8_t *payload, size_t len) {
+    return len <= MQTT_PAYLOAD_MAX && spool.push(topic, payload, len);
+}
+
+void MqttLink::send_inflight(unsigned long now) {
+    if (!has_inflight) {
+        if (!spool.front(inflight_topic, inflight, inflight_len)) return;
+        has_inflight = true;
+        // Still the batch that was out when the connection went: DUP, same packet id
+        if (sends == 0 || spool.oldest() != inflight_seq) {
+            inflight_seq = spool.oldest();
+            sends        = 0;
+            if (++packet_id == 0) packet_id = 1;
+        }
+    }
+
+    char topic[MQTT_TOPIC_MAX];
+    snprintf(topic, sizeof(topic), "%s/%s", cfg.prefix, TOPIC_NAMES[inflight_topic < NUM_TOPICS ? inflight_topic : 0]);
+
+    // Socket buffer full: tried again next pass
+    size_t n = mqtt_publish_packet(tx, topic, packet_id, sends > 0, inflight, inflight_len);
+    if (!send(n, now)) return;
+
+    if (sends > 0) replays++;
+    sends++;
+    sent_at = now;
+}
+
+void MqttLink::handle(const MqttPacket &pkt, unsigned long now) {
+    last_rx = now;
+
+    switch (pkt.type) {
+        case MQTT_CONNACK:
+            if (state != MqttState::HANDSHAKE) break;
+            if (pkt.len < 2 || pkt.body[1] != 0) {
+                refused++;
+                back_off(now);
+                break;
+            }
+            state    = MqttState::UP;
+            delay_ms = MQTT_BACKOFF_MIN_MS;
+            // A clean session: the broker has nothing of ours, the one in flight goes again
+            send_inflight(now);
+            break;
+
+        case MQTT_PUBACK:
+            if (!has_inflight || sends == 0 || pkt.id() != packet_id) break;
+            spool.pop();
+            has_inflight = false;
+            sends        = 0;
+            acked++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void MqttLink::service(unsigned long now) {
+    switch (state) {
+        case MqttState::IDLE:
+            break;
+
+        case MqttState::CONNECTING: {
+            MqttSocket s = net.status();
+            if (s == MqttSocket::OPEN) {
+                state = MqttState::HANDSHAKE;
+                since = last_rx = now;
+                if (!send(mqtt_connect_packet(tx, cfg.client_id, MQTT_KEEPALIVE_S, cfg.user, cfg.pass), now)) {
+                    back_off(now);
+                }
+            } else if (s == MqttSocket::CLOSED || now - since >= MQTT_CONNECT_TIMEOUT_MS) {
+                back_off(now);
+            }
+            break;
+        }
+
+        case MqttState::HANDSHAKE:
+        case MqttState::UP: {
+            uint8_t buf[64];
+            size_t  n;
+            while (state != MqttState::BACKOFF && (n = net.read(buf, sizeof(buf))) > 0) {
+                MqttPacket pkt;
+                for (size_t i = 0; i < n && state != MqttState::BACKOFF; ++i) {
+                    if (parser.feed(buf[i], pkt)) handle(pkt, now);
+                }
+            }
+            if (state == MqttState::BACKOFF) break;
+
+            if (net.status() != MqttSocket::OPEN) {
+                drop(now);
+            } else if (state == MqttState::HANDSHAKE) {
+                if (now - since >= MQTT_CONNECT_TIMEOUT_MS) back_off(now);
+            } else if (now - last_rx >= MQTT_KEEPALIVE_S * 1500UL ||
+                       (has_inflight && sends > 0 && now - sent_at >= MQTT_ACK_TIMEOUT_MS)) {
+                // Broker silent, or the ack isn't coming on this connection
+                drop(now);
+            } else if (!has_inflight || sends == 0) {
+                send_inflight(now);
+                if (now - last_tx >= MQTT_KEEPALIVE_S * 500UL) send(mqtt_ping_packet(tx), now);
+            }
+            break;
+        }
+
+        case MqttState::BACKOFF:
+            if (now - since >= delay_ms) {
+                delay_ms = (delay_ms * 2 < MQTT_BACKOFF_MAX_MS) ? delay_ms * 2 : MQTT_BACKOFF_MAX_MS;
+                attempt(now);
+            }
+            break;
+    }
+}
+
+//!##################################################
+//!######## Batches #################################
+//! Rows are JSON arrays with the ms since the batch
+//! opened in front:
+//!   {"boot":"1a2b3c4d","seq":7,"t0":123456,
+//!    "utc":1760000000,"rows":[[0,...],[2000,...]]}
+//! utc is left out until the clock has been set.
+//!##################################################
+
+class TelemetryBatch {
+    public:
+        explicit TelemetryBatch(uint8_t topic) : topic(topic) {}
+
+        const uint8_t topic;
+
+        // One row (fmt makes the fields after the time); false when it doesn't fit, close first
+        bool add(unsigned long now, uint32_t utc, const char *fmt, ...);
+
+        bool empty() const { return rows == 0; }
+        bool due(unsigned long now) const { return rows && now - t0 >= MQTT_BATCH_MS; }
+
+        // Whole payload into out (MQTT_PAYLOAD_MAX); empties the batch
+        size_t close(uint8_t *out, uint32_t boot, uint32_t seq);
+
+    private:
+        static constexpr size_t HEAD_MAX = 80;
+
+        char          body[MQTT_PAYLOAD_MAX - HEAD_MAX];
+        size_t        len  = 0;
+        uint16_t      rows = 0;
+        unsigned long t0   = 0;
+        uint32_t      utc0 = 0;
+};
+
+bool TelemetryBatch::add(unsigned long now, uint32_t utc, const char *fmt, ...) {
+    if (rows == 0) {
+        t0   = now;
+        utc0 = utc;
+        len  = 0;
+    }
+
+    char row[160];
+    int  n = snprintf(row, sizeof(row), "%s[%lu,", rows ? "," : "", now - t0);
+    va_list args;
+    va_start(args, fmt);
+    n += vsnprintf(row + n, sizeof(row) - n - 1, fmt, args);
+    va_end(args);
+    if (n >= static_cast<int>(sizeof(row)) - 1) return false;
+    row[n++] = ']';
+
+    if (len + n > sizeof(body)) return false;
+    memcpy(body + len, row, n);
+    len += n;
+    rows++;
+    return true;
+}
+
+size_t TelemetryBatch::close(uint8_t *out, uint32_t boot, uint32_t seq) {
+    char *o = reinterpret_cast<char *>(out);
+    int   n = snprintf(o, HEAD_MAX, "{\"boot\":\"%08lx\",\"seq\":%lu,\"t0\":%lu", static_cast<unsigned long>(boot),
+                       static_cast<unsigned long>(seq), t0);
+    if (utc0) n += snprintf(o + n, HEAD_MAX - n, ",\"utc\":%lu", static_cast<unsigned long>(utc0));
+    n += snprintf(o + n, HEAD_MAX - n, ",\"rows\":[");
+    memcpy(o + n, body, len);
+    n += len;
+    o[n++] = ']';
+    o[n++] = '}';
+
+    rows = 0;
+    len  = 0;
+    return n;
+}
+
+//!##################################################
+//!######## Packed samples ##########################
+//! With Telemetry::packed, samples go to sensor/ts
+//! instead: one message per node/zone, its readings
+//! as codec blocks (ts_codec.hpp), base64, times in
+//! ms since t0:
+//!   {"boot":"1a2b3c4d","seq":7,"t0":123456,
+//!    "utc":1760000000,"node":1,"zone":0,
+//!    "ts":["AQAAAAAA...","..."]}
+//! About a byte a sample instead of ~27, so a spool
+//! record (one flash append) holds minutes of a zone.
+//! Closed when MQTT_PACKED_BLOCKS are full or
+//! MQTT_PACKED_BATCH_MS old.
+//!##################################################
+
+class PackedSeries {
+    public:
+        static constexpr uint8_t topic = TOPIC_SENSOR_TS;
+
+        PackedSeries() { writer.begin(blocks[0]); }
+        PackedSeries(const PackedSeries &) = delete;
+
+        uint8_t       node = 0;
+        uint8_t       zone = 0;
+        unsigned long t0   = 0;
+
+        // false when the last block is full: close first
+        bool add(unsigned long now, uint32_t utc, uint8_t node, uint8_t zone, float ph, float ec, float temp);
+
+        bool empty() const { return full == 0 && writer.empty(); }
+        bool due(unsigned long now) const { return !empty() && now - t0 >= MQTT_PACKED_BATCH_MS; }
+
+        // Whole payload into out (MQTT_PAYLOAD_MAX); empties the series
+        size_t close(uint8_t *out, uint32_t boot, uint32_t seq);
+
+    private:
+        uint8_t       blocks[MQTT_PACKED_BLOCKS][TS_BLOCK_BYTES];
+        uint8_t       lens[MQTT_PACKED_BLOCKS] = {};
+        uint8_t       full = 0; // blocks before the one being written
+        TsBlockWriter writer;
+        uint32_t      utc0 = 0;
+};
+
+static_assert(MQTT_PACKED_BLOCKS * (TS_BLOCK_B64 + 3) + 120 < MQTT_PAYLOAD_MAX, "a packed series must fit one message");
+
+bool PackedSeries::add(unsigned long now, uint32_t utc, uint8_t n, uint8_t z, float ph, float ec, float temp) {
+    if (empty()) {
+        node = n;
+        zone = z;
+        t0   = now;
+        utc0 = utc;
+    }
+    TsSample s = ts_sample(now - t0, ph, ec, temp);
+    if (writer.append(s)) return true;
+    if (full + 1 >= MQTT_PACKED_BLOCKS) return false;
+
+    lens[full++] = writer.size();
+    writer.begin(blocks[full]);
+    return writer.append(s);
+}
+
+size_t PackedSeries::close(uint8_t *out, uint32_t boot, uint32_t seq) {
+    lens[full] = writer.size();
+
+    char *o = reinterpret_cast<char *>(out);
+    int   n = snprintf(o, MQTT_PAYLOAD_MAX, "{\"boot\":\"%08lx\",\"seq\":%lu,\"t0\":%lu",
+                       static_cast<unsigned long>(boot), static_cast<unsigned long>(seq), t0);
+    if (utc0) n += snprintf(o + n, MQTT_PAYLOAD_MAX - n, ",\"utc\":%lu", static_cast<unsigned long>(utc0));
+    n += snprintf(o + n, MQTT_PAYLOAD_MAX - n, ",\"node\":%u,\"zone\":%u,\"ts\":[", node, zone);
+    for (uint8_t b = 0; b <= full; ++b) {
+        if (b) o[n++] = ',';
+        o[n++] = '"';
+        n += ts_base64(blocks[b], lens[b], o + n, MQTT_PAYLOAD_MAX - n);
+        o[n++] = '"';
+    }
+    o[n++] = ']';
+    o[n++] = '}';
+
+    full = 0;
+    writer.begin(blocks[0]);
+    return n;
+}
+
+//!##################################################
+//!######## Telemetry ###############################
+//! What web_host feeds: a row per sample and per
+//! dose report, a metrics message now and then.
+//! service() closes batches once MQTT_BATCH_MS old.
+//!##################################################
+
+typedef uint32_t (*UtcClockFn)();  // seconds since 1970, 0 until the clock is set
+
+class Telemetry {
+    public:
+        explicit Telemetry(MqttLink &link, uint32_t boot = 0) : boot(boot), link(link) {}
+
+        uint32_t   boot;            // random per start, so a reset's seq 0 isn't a duplicate
+        UtcClockFn clock  = nullptr;
+        bool       packed = false;  // samples to sensor/ts as codec blocks, for a historian that decodes them
+
+        void sample(unsigned long now, uint8_t node, uint8_t zone, float ph, float ec, float temp) {
+            if (packed) pack(now, node, zone, ph, ec, temp);
+            else        row(sensors, now, "%u,%u,%.2f,%.1f,%.2f", node, zone, ph, ec, temp);
+        }
+
+        void dose(unsigned long now, uint8_t node, uint8_t zone, uint16_t id, const char *pump,
+                  float req_ml, float ml, bool aborted) {
+            row(doses, now, "%u,%u,%u,\"%.12s\",%.2f,%.2f,%u", node, zone, id, pump, req_ml, ml, aborted ? 1 : 0);
+        }
+
+        // One message on its own; fields are the inside of a JSON object
+        void metrics(unsigned long now, const char *fields) {
+            char out[MQTT_PAYLOAD_MAX];
+            uint32_t utc = utc_now();
+            int n = snprintf(out, sizeof(out), "{\"boot\":\"%08lx\",\"seq\":%lu,\"t\":%lu", static_cast<unsigned long>(boot),
+                             static_cast<unsigned long>(seq++), now);
+            if (utc) n += snprintf(out + n, sizeof(out) - n, ",\"utc\":%lu", static_cast<unsigned long>(utc));
+            n += snprintf(out + n, sizeof(out) - n, ",%s}", fields);
+            if (n >= static_cast<int>(sizeof(out))) {
+                lost++;
+                return;
+            }
+            if (!link.publish(TOPIC_METRICS, reinterpret_cast<uint8_t *>(out), n)) lost++;
+        }
+
+        void service(unsigned long now) {
+            if (sensors.due(now)) close(sensors);
+            if (doses.due(now))   close(doses);
+            for (PackedSeries &p : series) {
+                if (p.due(now)) close(p);
+            }
+        }
+
+        uint32_t messages() const { return seq; }
+
+        uint32_t lost = 0;  // batches the spool couldn't take
+
+    private:
+        MqttLink &link;
+        uint32_t  seq = 0;
+
+        TelemetryBatch sensors { TOPIC_SENSOR };
+        TelemetryBatch doses   { TOPIC_DOSE };
+        PackedSeries   series[MQTT_PACKED_SERIES];
+
+        uint32_t utc_now() const { return clock ? clock() : 0; }
+
+        template <typename... Args>
+        void row(TelemetryBatch &batch, unsigned long now, const char *fmt, Args... args) {
+            uint32_t utc = utc_now();
+            if (batch.add(now, utc, fmt, args...)) return;
+            close(batch);
+            batch.add(now, utc, fmt, args...);
+        }
+
+        // Into its node/zone's series, else a free one, else the one open longest goes out for it
+        void pack(unsigned long now, uint8_t node, uint8_t zone, float ph, float ec, float temp) {
+            PackedSeries *p = nullptr;
+            for (PackedSeries &s : series) {
+                if (!s.empty() && s.node == node && s.zone == zone) { p = &s; break; }
+                if (!p || (!p->empty() && (s.empty() || now - s.t0 > now - p->t0))) p = &s;
+            }
+            if (p->node != node || p->zone != zone) close(*p);
+
+            uint32_t utc = utc_now();
+            if (p->add(now, utc, node, zone, ph, ec, temp)) return;
+            close(*p);
+            p->add(now, utc, node, zone, ph, ec, temp);
+        }
+
+        template <typename Batch>
+        void close(Batch &batch) {
+            if (batch.empty()) return;
+            uint8_t out[MQTT_PAYLOAD_MAX];
+            size_t  n = batch.close(out, boot, seq++);
+            if (!link.publish(batch.topic, out, n)) lost++;
+        }
+};
+
+#if defined(ESP32)
+
+#include <AsyncTCP.h>
+#include <FS.h>
+
+static constexpr const char *MQTT_SPOOL_PATH   = "/mqtt";       // segments are /mqtt.0 ...
+static constexpr const char *MQTT_SPOOL_CURSOR = "/mqtt.ack";
+
+// AsyncTCP socket; its callbacks run in the async_tcp task and only fill the receive ring
+class AsyncMqttTransport : public MqttTransport {
+    public:
+        AsyncMqttTransport() {
+            client.onConnect([](void *self, AsyncClient *) {
+                static_cast<AsyncMqttTransport *>(self)->state = MqttSocket::OPEN;
+            }, this);
+            client.onDisconnect([](void *self, AsyncClient *) {
+                static_cast<AsyncMqttTransport *>(self)->state = MqttSocket::CLOSED;
+            }, this);
+            client.onError([](void *self, AsyncClient *, int8_t) {
+                static_cast<AsyncMqttTransport *>(self)->state = MqttSocket::CLOSED;
+            }, this);
+            client.onData([](void *self, AsyncClient *, void *data, size_t len) {
+                static_cast<AsyncMqttTransport *>(self)->received(static_cast<const uint8_t *>(data), len);
+            }, this);
+        }
+
+        bool open(const char *host, uint16_t port) override {
+            portENTER_CRITICAL(&mux);
+            rx_head = rx_len = 0;
+            portEXIT_CRITICAL(&mux);
+            state = MqttSocket::CONNECTING;
+            if (!client.connect(host, port)) state = MqttSocket::CLOSED;
+            return state != MqttSocket::CLOSED;
+        }
+
+        MqttSocket status() override { return state; }
+
+        size_t write(const uint8_t *data, size_t len) override {
+            if (state != MqttSocket::OPEN || client.space() < len) return 0;
+            size_t n = client.add(reinterpret_cast<const char *>(data), len);
+            client.send();
+            return n;
+        }
+
+        size_t read(uint8_t *dst, size_t max) override {
+            size_t n = 0;
+            portENTER_CRITICAL(&mux);
+            while (n < max && rx_len > 0) {
+                dst[n++] = rx[rx_head];
+                rx_head  = (rx_head + 1) % sizeof(rx);
+                rx_len--;
+            }
+            portEXIT_CRITICAL(&mux);
+            return n;
+        }
+
+        void close() override {
+            if (state != MqttSocket::CLOSED) client.close(true);
+            state = MqttSocket::CLOSED;
+        }
+
+    private:
+        AsyncClient         client;
+        volatile MqttSocket state = MqttSocket::CLOSED;
+        portMUX_TYPE        mux   = portMUX_INITIALIZER_UNLOCKED;
+
+        // The broker only sends acks and ping replies; a full ring drops the rest
+        uint8_t rx[512];
+        size_t  rx_head = 0;
+        size_t  rx_len  = 0;
+
+        void received(const uint8_t *data, size_t len) {
+            portENTER_CRITICAL(&mux);
+            for (size_t i = 0; i < len && rx_len < sizeof(rx); ++i) {
+                rx[(rx_head + rx_len) % sizeof(rx)] = data[i];
+                rx_len++;
+            }
+            portEXIT_CRITICAL(&mux);
+        }
+};
+
+// The spool on LittleFS: /mqtt.<n> per segment and /mqtt.ack; opened per access, from loop() only
+class FsSpoolFiles : public SpoolFiles {
+    public:
+        explicit FsSpoolFiles(fs::FS &fs) : fs(fs) {}
+
+        bool append(uint16_t segment, const void *src, size_t len) override {
+            File f = fs.open(path(segment), FILE_APPEND);
+            return f && f.write(static_cast<const uint8_t *>(src), len) == len;
+        }
+
+        bool read(uint16_t segment, uint32_t offset, void *dst, size_t len) override {
+            if (!fs.exists(path(segment))) return false;
+            File f = fs.open(path(segment), FILE_READ);
+            if (!f || offset + len > f.size() || !f.seek(offset)) return false;
+            return f.read(static_cast<uint8_t *>(dst), len) == len;
+        }
+
+        void remove(uint16_t segment) override {
+            if (fs.exists(path(segment))) fs.remove(path(segment));
+        }
+
+        bool load_cursor(uint32_t &seq) override {
+            if (!fs.exists(MQTT_SPOOL_CURSOR)) return false;
+            File f = fs.open(MQTT_SPOOL_CURSOR, FILE_READ);
+            return f && f.read(reinterpret_cast<uint8_t *>(&seq), sizeof(seq)) == sizeof(seq);
+        }
+
+        // Small enough for LittleFS to keep inline in its directory entry
+        bool save_cursor(uint32_t seq) override {
+            File f = fs.open(MQTT_SPOOL_CURSOR, FILE_WRITE);
+            return f && f.write(reinterpret_cast<const uint8_t *>(&seq), sizeof(seq)) == sizeof(seq);
+        }
+
+    private:
+        fs::FS &fs;
+        char    name[16];
+
+        const char *path(uint16_t segment) {
+            snprintf(name, sizeof(name), "%s.%u", MQTT_SPOOL_PATH, segment);
+            return name;
+        }
+};
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+// Active plant targets. EC in mS/cm; nutrient amounts are Gro/Micro/Bloom parts
+struct TargetPlant {
+    float ec_low;
+    float ec_high;
+    float ec_avg;
+
+    float ph_low;
+    float ph_high;
+    float ph_avg;
+
+    uint8_t gro_amount;
+    uint8_t micro_amount;
+    uint8_t bloom_amount;
+};
+
+//!##################################################
+//!######## Profile cache ###########################
+//! Catalog profiles the ESP32 has sent, by id. A
+//! switch to one of them is then just M:2014 with
+//! the id; the crc identifies the catalog's copy so
+//! an edited profile is never served stale. Least
+//! recently used goes first. RAM only.
+//!##################################################
+
+static constexpr uint8_t PROFILE_CACHE_SIZE = 8;
+
+class ProfileCache {
+    public:
+        void put(uint16_t id, uint16_t crc, const TargetPlant &plant) {
+            Entry *slot = &entries[0];
+            for (Entry &e : entries) {
+                if (e.id == id) { slot = &e; break; }
+                if (e.used < slot->used) slot = &e;
+            }
+            *slot = { id, crc, ++clock, plant };
+        }
+
+        // nullptr when the id isn't cached or the catalog's copy has changed
+        const TargetPlant *get(uint16_t id, uint16_t crc) {
+            for (Entry &e : entries) {
+                if (e.id != 0 && e.id == id && e.crc == crc) {
+                    e.used = ++clock;
+                    return &e.plant;
+                }
+            }
+            return nullptr;
+        }
+
+    private:
+        struct Entry {
+            uint16_t    id;   // 0 = empty; catalog ids start at 1
+            uint16_t    crc;
+            uint32_t    used;
+            TargetPlant plant;
+        };
+
+        Entry    entries[PROFILE_CACHE_SIZE] = {};
+        uint32_t clock = 0;
+};
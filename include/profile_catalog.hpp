@@ -0,0 +1,344 @@
+/*#################################################*/
+/* Plant profile catalog on the ESP32's LittleFS.  */
+/* Source: /profiles.csv, one profile per line:    */
+/*   id,crop,stage,ec_low,ec_high,ph_low,ph_high,  */
+/*   gro,micro,bloom                               */
+/* Compiled at boot into /profiles.bin, fixed-size */
+/* records sorted by crop then stage, and indexed  */
+/* in RAM by id and by crop. IDs are the stable    */
+/* handle: the MCU caches profiles by id (M:2014). */
+/*#################################################*/
+#pragma once
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+enum ProfileStage : uint8_t {
+    STAGE_SEEDLING = 0,
+    STAGE_VEG,
+    STAGE_TRANSITION,
+    STAGE_BLOOM,
+    NUM_STAGES
+};
+
+static const char *const STAGE_NAMES[NUM_STAGES] = { "seedling", "veg", "transition", "bloom" };
+
+// Returns NUM_STAGES when the name is unknown
+ProfileStage stage_from_name(const char *name) {
+    if (name == nullptr) return NUM_STAGES;
+    for (uint8_t i = 0; i < NUM_STAGES; ++i) {
+        if (strcmp(name, STAGE_NAMES[i]) == 0) return static_cast<ProfileStage>(i);
+    }
+    return NUM_STAGES;
+}
+
+static constexpr size_t PROFILE_CROP_LEN = 24; // including the NUL
+
+// One record of /profiles.bin, written as-is
+struct CatalogProfile {
+    uint16_t id;
+    uint8_t  stage;
+    uint8_t  reserved;
+    char     crop[PROFILE_CROP_LEN];
+    float    ec_low;
+    float    ec_high;
+    float    ph_low;
+    float    ph_high;
+    uint8_t  gro;
+    uint8_t  micro;
+    uint8_t  bloom;
+    uint8_t  reserved2;
+};
+
+static_assert(sizeof(CatalogProfile) == 48, "catalog records are stored as-is");
+
+static constexpr uint32_t CATALOG_MAGIC   = 0x43504148; // "HAPC"
+static constexpr uint16_t CATALOG_VERSION = 1;
+static constexpr uint16_t CATALOG_MAX     = 1024;
+
+struct CatalogHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t source_hash; // of the CSV it was built from; a changed CSV rebuilds
+    uint32_t reserved;
+};
+
+// FNV-1a, incremental: pass the previous result to continue
+uint32_t catalog_hash(const void *data, size_t len, uint32_t h = 2166136261UL) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+// Identifies a profile's contents: the MCU's cached copy is only used when this matches
+uint16_t profile_crc(const CatalogProfile &p) {
+    uint32_t h = catalog_hash(&p, sizeof(p));
+    return static_cast<uint16_t>(h ^ (h >> 16));
+}
+
+// One CSV line (no newline). False for blank lines, '#' comments and malformed rows.
+bool parse_profile_csv(const char *line, CatalogProfile &p) {
+    p = {};
+    while (*line == ' ') line++;
+    if (*line == '\0' || *line == '#') return false;
+
+    char buf[128];
+    strncpy(buf, line, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    char *field[10];
+    uint8_t n = 0;
+    char *s = buf;
+    while (n < 10) {
+        field[n++] = s;
+        char *comma = strchr(s, ',');
+        if (!comma) break;
+        *comma = '\0';
+        s = comma + 1;
+    }
+    if (n != 10) return false;
+
+    char *end;
+    long id = strtol(field[0], &end, 10);
+    if (end == field[0] || id <= 0 || id > 0xFFFF) return false;
+    p.id = static_cast<uint16_t>(id);
+
+    if (field[1][0] == '\0' || strlen(field[1]) >= PROFILE_CROP_LEN) return false;
+    strcpy(p.crop, field[1]);
+
+    p.stage = stage_from_name(field[2]);
+    if (p.stage == NUM_STAGES) return false;
+
+    float *bands[4] = { &p.ec_low, &p.ec_high, &p.ph_low, &p.ph_high };
+    for (uint8_t i = 0; i < 4; ++i) {
+        *bands[i] = strtof(field[3 + i], &end);
+        if (end == field[3 + i]) return false;
+    }
+    if (!(p.ec_low <= p.ec_high && p.ph_low <= p.ph_high && p.ec_low >= 0.0f)) return false;
+
+    uint8_t *parts[3] = { &p.gro, &p.micro, &p.bloom };
+    for (uint8_t i = 0; i < 3; ++i) {
+        long v = strtol(field[7 + i], &end, 10);
+        if (end == field[7 + i] || v < 0 || v > 255) return false;
+        *parts[i] = static_cast<uint8_t>(v);
+    }
+    return true;
+}
+
+// Catalog order: crop (case-insensitive), then stage, then id
+bool profile_before(const CatalogProfile &a, const CatalogProfile &b) {
+    int c = strcasecmp(a.crop, b.crop);
+    if (c != 0) return c < 0;
+    if (a.stage != b.stage) return a.stage < b.stage;
+    return a.id < b.id;
+}
+
+// Sorts, drops repeated ids (first row wins) and lays out the file. Returns the record count.
+uint16_t build_catalog(std::vector<CatalogProfile> &profiles, uint32_t source_hash, std::vector<uint8_t> &out) {
+    std::stable_sort(profiles.begin(), profiles.end(),
+                     [](const CatalogProfile &a, const CatalogProfile &b) { return a.id < b.id; });
+    profiles.erase(std::unique(profiles.begin(), profiles.end(),
+                               [](const CatalogProfile &a, const CatalogProfile &b) { return a.id == b.id; }),
+                   profiles.end());
+    if (profiles.size() > CATALOG_MAX) profiles.resize(CATALOG_MAX);
+    std::sort(profiles.begin(), profiles.end(), profile_before);
+
+    CatalogHeader hdr = { CATALOG_MAGIC, CATALOG_VERSION, static_cast<uint16_t>(profiles.size()), source_hash, 0 };
+    out.resize(sizeof(hdr) + profiles.size() * sizeof(CatalogProfile));
+    memcpy(out.data(), &hdr, sizeof(hdr));
+    if (!profiles.empty()) memcpy(out.data() + sizeof(hdr), profiles.data(), profiles.size() * sizeof(CatalogProfile));
+    return hdr.count;
+}
+
+// Read access to a built catalog, wherever it lives
+class CatalogFile {
+    public:
+        virtual bool read(uint32_t offset, void *dst, size_t len) = 0;
+};
+
+//!##################################################
+//!######## Catalog index ###########################
+//! open() reads the records once and keeps 4 bytes
+//! per profile (id -> position, sorted by id) and
+//! 2 per crop (first position). Lookups then read
+//! one record: by id, by page, by crop and stage.
+//!##################################################
+
+class ProfileCatalog {
+    public:
+        bool open(CatalogFile &file);
+
+        uint16_t count() const { return num; }
+        uint16_t crops() const { return static_cast<uint16_t>(crop_start.size()); }
+        uint32_t source_hash() const { return hash; }
+
+        // Record at a catalog position (crop/stage order)
+        bool at(uint16_t pos, CatalogProfile &p);
+        bool find(uint16_t id, CatalogProfile &p);
+
+        // First record of the i-th crop, and how many profiles it has
+        bool crop(uint16_t i, CatalogProfile &first, uint16_t &profiles);
+        // Positions [first, end) of a crop's profiles; false when there is no such crop
+        bool crop_range(const char *name, uint16_t &first, uint16_t &end);
+
+    private:
+        struct IdEntry {
+            uint16_t id;
+            uint16_t pos;
+        };
+
+        CatalogFile *file = nullptr;
+        uint16_t     num  = 0;
+        uint32_t     hash = 0;
+
+        std::vector<IdEntry>  by_id;
+        std::vector<uint16_t> crop_start;
+};
+
+bool ProfileCatalog::open(CatalogFile &f) {
+    file = nullptr;
+    num  = 0;
+    by_id.clear();
+    crop_start.clear();
+
+    CatalogHeader hdr;
+    if (!f.read(0, &hdr, sizeof(hdr)) || hdr.magic != CATALOG_MAGIC ||
+        hdr.version != CATALOG_VERSION || hdr.count > CATALOG_MAX) {
+        return false;
+    }
+
+    file = &f;
+    hash = hdr.source_hash;
+    by_id.reserve(hdr.count);
+
+    CatalogProfile p, prev = {};
+    for (uint16_t i = 0; i < hdr.count; ++i) {
+        if (!f.read(sizeof(hdr) + static_cast<uint32_t>(i) * sizeof(p), &p, sizeof(p))) return false;
+        p.crop[PROFILE_CROP_LEN - 1] = '\0';
+
+        by_id.push_back({ p.id, i });
+        if (i == 0 || strcasecmp(p.crop, prev.crop) != 0) crop_start.push_back(i);
+        prev = p;
+    }
+    std::sort(by_id.begin(), by_id.end(), [](const IdEntry &a, const IdEntry &b) { return a.id < b.id; });
+
+    num = hdr.count;
+    return true;
+}
+
+bool ProfileCatalog::at(uint16_t pos, CatalogProfile &p) {
+    if (!file || pos >= num) return false;
+    if (!file->read(sizeof(CatalogHeader) + static_cast<uint32_t>(pos) * sizeof(p), &p, sizeof(p))) return false;
+    p.crop[PROFILE_CROP_LEN - 1] = '\0';
+    return true;
+}
+
+bool ProfileCatalog::find(uint16_t id, CatalogProfile &p) {
+    auto it = std::lower_bound(by_id.begin(), by_id.end(), id,
+                               [](const IdEntry &e, uint16_t v) { return e.id < v; });
+    if (it == by_id.end() || it->id != id) return false;
+    return at(it->pos, p);
+}
+
+bool ProfileCatalog::crop(uint16_t i, CatalogProfile &first, uint16_t &profiles) {
+    if (i >= crop_start.size()) return false;
+    uint16_t end = (i + 1u < crop_start.size()) ? crop_start[i + 1] : num;
+    profiles = end - crop_start[i];
+    return at(crop_start[i], first);
+}
+
+bool ProfileCatalog::crop_range(const char *name, uint16_t &first, uint16_t &end) {
+    // Binary search over the crops' first records
+    size_t lo = 0, hi = crop_start.size();
+    CatalogProfile p;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (!at(crop_start[mid], p)) return false;
+        int c = strcasecmp(p.crop, name);
+        if (c == 0) {
+            first = crop_start[mid];
+            end   = (mid + 1 < crop_start.size()) ? crop_start[mid + 1] : num;
+            return true;
+        }
+        if (c < 0) lo = mid + 1;
+        else       hi = mid;
+    }
+    return false;
+}
+
+#if defined(ESP32)
+
+#include <FS.h>
+
+static constexpr const char *CATALOG_CSV_PATH = "/profiles.csv";
+static constexpr const char *CATALOG_BIN_PATH = "/profiles.bin";
+
+// The built catalog, kept open for the web handlers' reads
+class FsCatalogFile : public CatalogFile {
+    public:
+        bool open(fs::FS &fs, const char *path) {
+            f = fs.open(path, FILE_READ);
+            return static_cast<bool>(f);
+        }
+
+        void close() {
+            if (f) f.close();
+        }
+
+        bool read(uint32_t offset, void *dst, size_t len) override {
+            if (!f || !f.seek(offset)) return false;
+            return f.read(static_cast<uint8_t *>(dst), len) == len;
+        }
+
+    private:
+        File f;
+};
+
+// Hash of the CSV as it is on the filesystem now; 0 when there is none
+uint32_t catalog_source_hash(fs::FS &fs, const char *csv_path = CATALOG_CSV_PATH) {
+    File in = fs.open(csv_path, FILE_READ);
+    if (!in) return 0;
+
+    uint8_t  buf[256];
+    uint32_t h = catalog_hash(nullptr, 0);
+    size_t   n;
+    while ((n = in.read(buf, sizeof(buf))) > 0) h = catalog_hash(buf, n, h);
+    return h;
+}
+
+// Compiles the CSV into the binary catalog. Returns the number of profiles written, -1 on error.
+int build_catalog_file(fs::FS &fs, uint32_t source_hash, const char *csv_path = CATALOG_CSV_PATH,
+                       const char *bin_path = CATALOG_BIN_PATH) {
+    File in = fs.open(csv_path, FILE_READ);
+    if (!in) return -1;
+
+    std::vector<CatalogProfile> profiles;
+    char line[128];
+    while (in.available()) {
+        size_t n = in.readBytesUntil('\n', line, sizeof(line) - 1);
+        line[n] = '\0';
+        if (n > 0 && line[n - 1] == '\r') line[n - 1] = '\0';
+
+        CatalogProfile p;
+        if (parse_profile_csv(line, p)) profiles.push_back(p);
+    }
+    in.close();
+
+    std::vector<uint8_t> bin;
+    uint16_t count = build_catalog(profiles, source_hash, bin);
+
+    File out = fs.open(bin_path, FILE_WRITE);
+    if (!out) return -1;
+    size_t written = out.write(bin.data(), bin.size());
+    out.close();
+    return written == bin.size() ? count : -1;
+}
+
+#endif
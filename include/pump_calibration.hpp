@@ -0,0 +1,185 @@
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "step_timer.hpp"
+
+// Pump indices shared by the serial protocol and calibration storage
+enum PumpId : uint8_t {
+    PUMP_PH_UP = 0,
+    PUMP_PH_DOWN,
+    PUMP_GRO,
+    PUMP_MICRO,
+    PUMP_BLOOM,
+    NUM_PUMPS
+};
+
+// Same keys the M:2001 loading dose uses
+static const char *const PUMP_NAMES[NUM_PUMPS] = { "ph_up", "ph_dn", "gro", "micro", "bloom" };
+
+// Returns NUM_PUMPS when the name is unknown
+PumpId pump_id_from_name(const char *name) {
+    if (name == nullptr) return NUM_PUMPS;
+    for (uint8_t i = 0; i < NUM_PUMPS; ++i) {
+        if (strcmp(name, PUMP_NAMES[i]) == 0) return static_cast<PumpId>(i);
+    }
+    return NUM_PUMPS;
+}
+
+struct SpeedProfile {
+    float max_speed;    // steps/s
+    float acceleration; // steps/s^2
+};
+
+// Result of a calibration: how far to step per mL, and how fast that holds
+struct PumpCalibration {
+    float steps_per_ml;
+    SpeedProfile profile;
+};
+
+// Experimental value from the original bench test, used until a pump is calibrated; the bench
+// ran it at 6000 steps/s, which the step timer does as 5000
+static constexpr PumpCalibration DEFAULT_PUMP_CALIBRATION = { 488.0f, { STEP_TIMER_HZ / 4.0f, 500.0f } };
+
+//!##################################################
+//!######## Calibration sweep #######################
+//! Each profile dispenses every entry of CAL_STEPS.
+//! The operator weighs/measures each dispense and
+//! reports the mL back (M:2005). Profiles are listed
+//! slowest first; the slowest is the reference.
+//! Each is a rate the step timer runs exactly, so the
+//! fit is against the speed the pump really did.
+//!##################################################
+
+static constexpr uint8_t CAL_NUM_PROFILES = 5;
+static constexpr std::array<SpeedProfile, CAL_NUM_PROFILES> CAL_PROFILES = {{
+    { STEP_TIMER_HZ / 10.0f,  250.0f }, // 2000 steps/s
+    { STEP_TIMER_HZ / 5.0f,   500.0f }, // 4000
+    { STEP_TIMER_HZ / 4.0f,  1000.0f }, // 5000
+    { STEP_TIMER_HZ / 3.0f,  2000.0f }, // 6667
+    { STEP_TIMER_HZ / 2.0f,  4000.0f }, // 10000
+}};
+
+constexpr bool cal_profiles_on_ticks(uint8_t i = 0) {
+    return i == CAL_NUM_PROFILES ||
+           (step_rate(CAL_PROFILES[i].max_speed) == CAL_PROFILES[i].max_speed && cal_profiles_on_ticks(i + 1));
+}
+static_assert(cal_profiles_on_ticks(), "calibration profiles must be whole-tick step rates");
+
+static constexpr uint8_t CAL_NUM_VOLUMES = 2;
+static constexpr std::array<long, CAL_NUM_VOLUMES> CAL_STEPS = {{ 2440, 7320 }}; // ~5 mL and ~15 mL
+
+static constexpr uint8_t CAL_NUM_RUNS = CAL_NUM_PROFILES * CAL_NUM_VOLUMES;
+
+static constexpr float CAL_MAX_SPREAD = 0.02f; // steps/mL spread between the two volumes of one profile
+static constexpr float CAL_MAX_DRIFT  = 0.03f; // steps/mL deviation from the reference profile
+
+class PumpCalibrator {
+    public:
+        void start(PumpId pump);
+        void cancel();
+
+        bool active() const { return is_active; }
+        PumpId pump() const { return pump_id; }
+        uint8_t run() const { return run_idx; }
+
+        // Profile and step count for the dispense the operator is about to measure
+        const SpeedProfile &run_profile() const { return CAL_PROFILES[run_idx / CAL_NUM_VOLUMES]; }
+        long run_steps() const { return CAL_STEPS[run_idx % CAL_NUM_VOLUMES]; }
+
+        // Records the measured volume of the current run. Returns true when all runs are in.
+        bool record(float measured_ml);
+
+        // Fits steps/mL per profile and picks the fastest one that stays accurate
+        bool fit(PumpCalibration &out) const;
+
+    private:
+        bool    is_active = false;
+        PumpId  pump_id   = NUM_PUMPS;
+        uint8_t run_idx   = 0;
+        std::array<float, CAL_NUM_RUNS> measured_ml = {};
+
+        // Least squares through the origin: steps = k * ml
+        float profile_steps_per_ml(uint8_t profile, float &spread) const;
+};
+
+void PumpCalibrator::start(PumpId pump) {
+    is_active = true;
+    pump_id   = pump;
+    run_idx   = 0;
+    measured_ml.fill(0.0f);
+}
+
+void PumpCalibrator::cancel() {
+    is_active = false;
+    run_idx   = 0;
+}
+
+bool PumpCalibrator::record(float ml) {
+    if (!is_active) return false;
+
+    measured_ml[run_idx] = ml;
+    if (run_idx + 1 < CAL_NUM_RUNS) {
+        run_idx++;
+        return false;
+    }
+
+    is_active = false;
+    return true;
+}
+
+float PumpCalibrator::profile_steps_per_ml(uint8_t profile, float &spread) const {
+    float sum_sm = 0.0f;
+    float sum_mm = 0.0f;
+    for (uint8_t v = 0; v < CAL_NUM_VOLUMES; ++v) {
+        float ml = measured_ml[profile * CAL_NUM_VOLUMES + v];
+        sum_sm += static_cast<float>(CAL_STEPS[v]) * ml;
+        sum_mm += ml * ml;
+    }
+    if (sum_mm <= 0.0f) {
+        spread = INFINITY;
+        return 0.0f;
+    }
+
+    float k = sum_sm / sum_mm;
+
+    // Worst single-run disagreement with the fit, relative to the fit
+    spread = 0.0f;
+    for (uint8_t v = 0; v < CAL_NUM_VOLUMES; ++v) {
+        float ml = measured_ml[profile * CAL_NUM_VOLUMES + v];
+        if (ml <= 0.0f) {
+            spread = INFINITY;
+            return k;
+        }
+        float err = fabsf(static_cast<float>(CAL_STEPS[v]) / ml - k) / k;
+        if (err > spread) spread = err;
+    }
+    return k;
+}
+
+bool PumpCalibrator::fit(PumpCalibration &out) const {
+    float ref_spread;
+    float ref_k = profile_steps_per_ml(0, ref_spread);
+
+    // If the slowest profile isn't repeatable the measurements can't be trusted
+    if (ref_k <= 0.0f || ref_spread > CAL_MAX_SPREAD) return false;
+
+    out.steps_per_ml = ref_k;
+    out.profile      = CAL_PROFILES[0];
+
+    // Missed steps at high speed show up as more steps per mL than the reference
+    for (uint8_t p = 1; p < CAL_NUM_PROFILES; ++p) {
+        float spread;
+        float k = profile_steps_per_ml(p, spread);
+        if (spread > CAL_MAX_SPREAD) break;
+        if (fabsf(k - ref_k) / ref_k > CAL_MAX_DRIFT) break;
+
+        out.steps_per_ml = k;
+        out.profile      = CAL_PROFILES[p];
+    }
+
+    return true;
+}
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <Arduino.h>
+#include <math.h>
+#include <string.h>
+
+#include "pump_calibration.hpp"
+
+//!##################################################
+//!######## Recipes #################################
+//! A dosing program uploaded once (M:2011) and run
+//! on the MCU (M:2012), so a flush / staged feed /
+//! pH settle keeps going without the browser.
+//!
+//! A table of fixed-size steps, executed in order:
+//!  dose   pump, mL        queue it, wait till done
+//!  mix    s               queue it, wait till done
+//!  wait   s
+//!  stable sensor, tol, s  wait until the reading has
+//!                         held within tol for
+//!                         RECIPE_STABLE_MS (timeout
+//!                         s, 0 = none)
+//!  below  sensor, v, step jump if the reading is < v
+//!  above  sensor, v, step jump if the reading is > v
+//!  goto   step
+//!  end
+//! Jumps carry a limit (taken at most that many times
+//! per run, 0 = unlimited) so a re-check loop can't
+//! dose forever. Times are under RECIPE_MAX_S.
+//!##################################################
+
+enum RecipeOp : uint8_t {
+    RECIPE_END = 0,  // zeroed table = empty recipe
+    RECIPE_DOSE,
+    RECIPE_MIX,
+    RECIPE_WAIT,
+    RECIPE_STABLE,
+    RECIPE_BELOW,
+    RECIPE_ABOVE,
+    RECIPE_GOTO,
+    NUM_RECIPE_OPS
+};
+
+static const char *const RECIPE_OP_NAMES[NUM_RECIPE_OPS] = {
+    "end", "dose", "mix", "wait", "stable", "below", "above", "goto"
+};
+
+enum RecipeSensor : uint8_t {
+    RECIPE_EC = 0,
+    RECIPE_PH,
+    RECIPE_TEMP,
+    NUM_RECIPE_SENSORS
+};
+
+static const char *const RECIPE_SENSOR_NAMES[NUM_RECIPE_SENSORS] = { "ec", "ph", "temp" };
+
+struct RecipeStep {
+    uint8_t op;
+    uint8_t arg;     // dose: PumpId; stable/below/above: RecipeSensor
+    uint8_t target;  // below/above/goto: step to jump to
+    uint8_t limit;   // below/above/goto: jumps per run, 0 = unlimited
+    float   x;       // dose: mL; mix/wait: s; stable: tolerance; below/above: threshold
+    float   y;       // stable: timeout s
+};
+
+static constexpr uint8_t       RECIPE_MAX_STEPS   = 32;
+static constexpr uint8_t       RECIPE_CHUNK_STEPS = 8;  // one store record (96 B)
+static constexpr uint8_t       RECIPE_NUM_CHUNKS  = RECIPE_MAX_STEPS / RECIPE_CHUNK_STEPS;
+static constexpr unsigned long RECIPE_STABLE_MS   = 60000UL;
+static constexpr float         RECIPE_MAX_S       = 86400.0f; // a day: as ms, well inside unsigned long
+
+static_assert(sizeof(RecipeStep) == 12, "recipe steps are stored as-is");
+
+// Returns the op for a name, NUM_RECIPE_OPS when unknown
+RecipeOp recipe_op_from_name(const char *name) {
+    if (name == nullptr) return NUM_RECIPE_OPS;
+    for (uint8_t i = 0; i < NUM_RECIPE_OPS; ++i) {
+        if (strcmp(name, RECIPE_OP_NAMES[i]) == 0) return static_cast<RecipeOp>(i);
+    }
+    return NUM_RECIPE_OPS;
+}
+
+RecipeSensor recipe_sensor_from_name(const char *name) {
+    if (name == nullptr) return NUM_RECIPE_SENSORS;
+    for (uint8_t i = 0; i < NUM_RECIPE_SENSORS; ++i) {
+        if (strcmp(name, RECIPE_SENSOR_NAMES[i]) == 0) return static_cast<RecipeSensor>(i);
+    }
+    return NUM_RECIPE_SENSORS;
+}
+
+// Arguments in range for the op
+bool recipe_step_valid(const RecipeStep &s) {
+    switch (s.op) {
+        case RECIPE_END:    return true;
+        case RECIPE_DOSE:   return s.arg < NUM_PUMPS && s.x > 0.0f && isfinite(s.x);
+        case RECIPE_MIX:
+        case RECIPE_WAIT:   return s.x >= 0.0f && s.x < RECIPE_MAX_S;
+        case RECIPE_STABLE: return s.arg < NUM_RECIPE_SENSORS && s.x > 0.0f && isfinite(s.x) &&
+                                   s.y >= 0.0f && s.y < RECIPE_MAX_S;
+        case RECIPE_BELOW:
+        case RECIPE_ABOVE:  return s.arg < NUM_RECIPE_SENSORS && isfinite(s.x) && s.target < RECIPE_MAX_STEPS;
+        case RECIPE_GOTO:   return s.target < RECIPE_MAX_STEPS;
+        default:            return false;
+    }
+}
+
+enum class RecipeState : uint8_t { IDLE, RUNNING, DONE, ABORTED };
+
+static const char *const RECIPE_STATE_NAMES[] = { "idle", "running", "done", "aborted" };
+
+// STEP: a new step started; TIMEOUT: a stable step gave up waiting and moved on
+enum class RecipeEvent : uint8_t { STEP, TIMEOUT, DONE, ABORTED };
+
+class RecipeRunner;
+
+// Queue a job for the recipe; false when it couldn't be queued
+typedef bool (*RecipeDoseFn)(PumpId pump, float ml);
+typedef bool (*RecipeMixFn)(unsigned long duration_ms);
+typedef void (*RecipeEventCallback)(const RecipeRunner &recipe, RecipeEvent event);
+
+class RecipeRunner {
+    public:
+        RecipeStep steps[RECIPE_MAX_STEPS] = {};
+
+        RecipeDoseFn        do_dose  = nullptr;
+        RecipeMixFn         do_mix   = nullptr;
+        RecipeEventCallback on_event = nullptr;
+
+        // Table edits; refused while running or out of range
+        bool clear();
+        bool set_step(uint8_t index, const RecipeStep &step);
+
+        // Steps up to the last one that isn't END
+        uint8_t size() const;
+
+        bool start(unsigned long now);
+        void abort(const char *why);
+
+        // From loop() with the latest filtered readings (RecipeSensor order);
+        // jobs_busy: a dose or mix this recipe queued hasn't finished yet
+        void service(unsigned long now, const float (&readings)[NUM_RECIPE_SENSORS], bool jobs_busy);
+
+        bool        running() const { return state == RecipeState::RUNNING; }
+        RecipeState status() const  { return state; }
+        uint8_t     step() const    { return pc; }
+        const char *reason() const  { return why; }
+        unsigned long step_elapsed(unsigned long now) const { return now - step_started; }
+
+    private:
+        RecipeState state = RecipeState::IDLE;
+        uint8_t     pc    = 0;
+        bool        entered = false;
+        const char *why   = "";
+
+        unsigned long step_started = 0;
+        float         stable_ref   = NAN;
+        unsigned long stable_since = 0;
+
+        uint8_t taken[RECIPE_MAX_STEPS] = {};
+
+        // Returns true when the step is over (pc already moved on)
+        bool enter(unsigned long now, const float (&readings)[NUM_RECIPE_SENSORS]);
+        bool poll(unsigned long now, const float (&readings)[NUM_RECIPE_SENSORS], bool jobs_busy);
+        void jump(const RecipeStep &s, bool condition);
+        void finish(RecipeState end, const char *reason);
+        void emit(RecipeEvent event) { if (on_event) on_event(*this, event); }
+};
+
+bool RecipeRunner::clear() {
+    if (running()) return false;
+    memset(steps, 0, sizeof(steps));
+    state = RecipeState::IDLE;
+    return true;
+}
+
+bool RecipeRunner::set_step(uint8_t index, const RecipeStep &step) {
+    if (running() || index >= RECIPE_MAX_STEPS || !recipe_step_valid(step)) return false;
+    steps[index] = step;
+    return true;
+}
+
+uint8_t RecipeRunner::size() const {
+    uint8_t n = RECIPE_MAX_STEPS;
+    while (n > 0 && steps[n - 1].op == RECIPE_END) --n;
+    return n;
+}
+
+bool RecipeRunner::start(unsigned long now) {
+    if (running() || size() == 0) return false;
+
+    memset(taken, 0, sizeof(taken));
+    state        = RecipeState::RUNNING;
+    pc           = 0;
+    entered      = false;
+    why          = "";
+    step_started = now;
+    return true;
+}
+
+void RecipeRunner::abort(const char *reason) {
+    if (running()) finish(RecipeState::ABORTED, reason);
+}
+
+void RecipeRunner::finish(RecipeState end, const char *reason) {
+    state = end;
+    why   = reason;
+    emit(end == RecipeState::DONE ? RecipeEvent::DONE : RecipeEvent::ABORTED);
+}
+
+void RecipeRunner::jump(const RecipeStep &s, bool condition) {
+    uint8_t here = pc;
+    if (condition && (s.limit == 0 || taken[here] < s.limit)) {
+        taken[here]++;
+        pc = s.target;
+    } else {
+        pc++;
+    }
+}
+
+bool RecipeRunner::enter(unsigned long now, const float (&readings)[NUM_RECIPE_SENSORS]) {
+    const RecipeStep &s = steps[pc];
+    entered      = true;
+    step_started = now;
+    emit(RecipeEvent::STEP);
+
+    switch (s.op) {
+        case RECIPE_END:
+            finish(RecipeState::DONE, "");
+            return true;
+
+        case RECIPE_DOSE:
+            if (!do_dose || !do_dose(static_cast<PumpId>(s.arg), s.x)) {
+                finish(RecipeState::ABORTED, "dose queue full");
+                return true;
+            }
+            return false;
+
+        case RECIPE_MIX:
+            if (s.x <= 0.0f) break;
+            if (!do_mix || !do_mix(static_cast<unsigned long>(s.x * 1000.0f))) {
+                finish(RecipeState::ABORTED, "dose queue full");
+                return true;
+            }
+            return false;
+
+        case RECIPE_STABLE:
+            stable_ref   = readings[s.arg];
+            stable_since = now;
+            return false;
+
+        case RECIPE_BELOW:
+            jump(s, readings[s.arg] < s.x);
+            entered = false;
+            return true;
+
+        case RECIPE_ABOVE:
+            jump(s, readings[s.arg] > s.x);
+            entered = false;
+            return true;
+
+        case RECIPE_GOTO:
+            jump(s, true);
+            entered = false;
+            return true;
+
+        default:
+            return false;
+    }
+
+    pc++;
+    entered = false;
+    return true;
+}
+
+bool RecipeRunner::poll(unsigned long now, const float (&readings)[NUM_RECIPE_SENSORS], bool jobs_busy) {
+    const RecipeStep &s = steps[pc];
+
+    switch (s.op) {
+        case RECIPE_DOSE:
+        case RECIPE_MIX:
+            if (jobs_busy) return false;
+            break;
+
+        case RECIPE_WAIT:
+            if (now - step_started < static_cast<unsigned long>(s.x * 1000.0f)) return false;
+            break;
+
+        case RECIPE_STABLE: {
+            float v = readings[s.arg];
+            // Moved too far (or no reading): the window starts over from here
+            if (!isfinite(v) || !isfinite(stable_ref) || fabsf(v - stable_ref) > s.x) {
+                stable_ref   = v;
+                stable_since = now;
+            }
+            if (now - stable_since >= RECIPE_STABLE_MS) break;
+
+            if (s.y > 0.0f && now - step_started >= static_cast<unsigned long>(s.y * 1000.0f)) {
+                emit(RecipeEvent::TIMEOUT);
+                break;
+            }
+            return false;
+        }
+
+        default:
+            break;
+    }
+
+    pc++;
+    entered = false;
+    return true;
+}
+
+void RecipeRunner::service(unsigned long now, const float (&readings)[NUM_RECIPE_SENSORS], bool jobs_busy) {
+    // Bounded, so a loop of jumps with nothing to wait on can't stall loop()
+    for (uint8_t n = 0; n < RECIPE_MAX_STEPS && running(); ++n) {
+        if (pc >= RECIPE_MAX_STEPS) {
+            finish(RecipeState::DONE, "");
+            return;
+        }
+
+        if (!entered) {
+            bool over = enter(now, readings);
+            // A job was just queued; jobs_busy only reflects it from the next pass
+            if (!over) {
+                if (steps[pc].op == RECIPE_DOSE || steps[pc].op == RECIPE_MIX) return;
+                if (!poll(now, readings, jobs_busy)) return;
+            }
+            continue;
+        }
+
+        if (!poll(now, readings, jobs_busy)) return;
+    }
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <Arduino.h>
+
+//!##################################################
+//!######## Sensor history ##########################
+//! Days of readings on the bridge for the dashboard's
+//! charts, which otherwise only hold what arrived
+//! since the page opened.
+//!
+//! One ring per node/zone of fixed buckets (averages
+//! over HISTORY_BUCKET_MS), so a bucket's time is its
+//! position: 8 bytes a point, HISTORY_LEN points.
+//! Rings are handed out on the first reading from a
+//! node/zone. At ~11 KB a ring there aren't enough
+//! for every node/zone the bus can address: with all
+//! HISTORY_SLOTS taken a ring is only reused once its
+//! node/zone has been silent for HISTORY_STALE_MS,
+//! and until then a newcomer goes without history.
+//!##################################################
+
+static constexpr unsigned long HISTORY_BUCKET_MS = 180000UL;  // 3 min
+static constexpr uint16_t      HISTORY_LEN       = 1440;      // 3 days
+static constexpr uint8_t       HISTORY_SLOTS     = 4;
+static constexpr unsigned long HISTORY_STALE_MS  = 1800000UL; // 30 min
+
+// pH and temperature in hundredths; HISTORY_EMPTY in ph for a bucket nothing arrived in
+struct HistoryPoint {
+    int16_t ph;
+    int16_t temp;
+    float   ec;
+};
+
+static constexpr int16_t HISTORY_EMPTY = INT16_MIN;
+
+class HistoryRing {
+    public:
+        // A reading at `now`; closes the open bucket (and any skipped ones) once `now` is past it
+        void add(unsigned long now, float ph, float ec, float temp);
+
+        uint16_t size() const { return count; }
+
+        // i = 0 is the oldest closed bucket
+        const HistoryPoint &at(uint16_t i) const { return points[(head + HISTORY_LEN - count + i) % HISTORY_LEN]; }
+
+        // Buckets closed since the ring was cleared; bucket b of those is held while b >= pushed() - size()
+        uint32_t pushed() const { return total; }
+        bool bucket(uint32_t b, HistoryPoint &p) const {
+            if (b >= total || total - b > count) return false;
+            p = points[(head + HISTORY_LEN - (total - b)) % HISTORY_LEN];
+            return true;
+        }
+
+        // Time since the newest closed bucket ended
+        unsigned long age(unsigned long now) const { return now - bucket_start; }
+
+        void clear() { count = 0; head = 0; total = 0; n = 0; started = false; }
+
+    private:
+        HistoryPoint  points[HISTORY_LEN];
+        uint16_t      head  = 0; // next slot written
+        uint16_t      count = 0;
+        uint32_t      total = 0;
+
+        // Open bucket
+        bool          started      = false;
+        unsigned long bucket_start = 0;
+        float         sum_ph = 0.0f, sum_ec = 0.0f, sum_temp = 0.0f;
+        uint16_t      n = 0;
+
+        void close();
+        void push(const HistoryPoint &p);
+};
+
+void HistoryRing::add(unsigned long now, float ph, float ec, float temp) {
+    if (!started) {
+        started      = true;
+        bucket_start = now;
+    }
+    unsigned long passed = (now - bucket_start) / HISTORY_BUCKET_MS;
+    if (passed > 0) {
+        close();
+        // Skipped buckets go in empty, at most a ring's worth
+        for (unsigned long k = 1; k < passed && k <= HISTORY_LEN; ++k) push({ HISTORY_EMPTY, 0, 0.0f });
+        bucket_start += passed * HISTORY_BUCKET_MS;
+    }
+    sum_ph   += ph;
+    sum_ec   += ec;
+    sum_temp += temp;
+    n++;
+}
+
+void HistoryRing::close() {
+    if (n == 0) {
+        push({ HISTORY_EMPTY, 0, 0.0f });
+        return;
+    }
+    push({ static_cast<int16_t>(lroundf(sum_ph / n * 100.0f)), static_cast<int16_t>(lroundf(sum_temp / n * 100.0f)),
+           sum_ec / n });
+    sum_ph = sum_ec = sum_temp = 0.0f;
+    n = 0;
+}
+
+void HistoryRing::push(const HistoryPoint &p) {
+    points[head] = p;
+    head = (head + 1) % HISTORY_LEN;
+    total++;
+    if (count < HISTORY_LEN) count++;
+}
+
+class SensorHistory {
+    public:
+        // Dropped while every ring belongs to a node/zone still reporting
+        void add(unsigned long now, uint8_t node, uint8_t zone, float ph, float ec, float temp) {
+            HistoryRing *r = claim(now, node, zone);
+            if (r) r->add(now, ph, ec, temp);
+        }
+
+        // nullptr until the node/zone has reported
+        const HistoryRing *find(uint8_t node, uint8_t zone) const {
+            for (const Slot &s : slots) {
+                if (s.node == node && s.zone == zone) return &s.ring;
+            }
+            return nullptr;
+        }
+
+    private:
+        struct Slot {
+            uint8_t       node = 0; // 0: free
+            uint8_t       zone = 0;
+            unsigned long last = 0;
+            HistoryRing   ring;
+        };
+        Slot slots[HISTORY_SLOTS];
+
+        // Backfilled readings arrive older than the live ones: `last` only moves forward, and a
+        // slot heard from after `now` isn't stale
+        static long silent(const Slot &s, unsigned long now) { return static_cast<long>(now - s.last); }
+
+        HistoryRing *claim(unsigned long now, uint8_t node, uint8_t zone) {
+            Slot *pick = nullptr;
+            for (Slot &s : slots) {
+                if (s.node == node && s.zone == zone) { pick = &s; break; }
+                if (!pick || (pick->node != 0 && (s.node == 0 || silent(s, now) > silent(*pick, now)))) pick = &s;
+            }
+            if (pick->node != node || pick->zone != zone) {
+                if (pick->node != 0 && silent(*pick, now) < static_cast<long>(HISTORY_STALE_MS)) return nullptr;
+                pick->node = node;
+                pick->zone = zone;
+                pick->last = now;
+                pick->ring.clear();
+            }
+            if (silent(*pick, now) > 0) pick->last = now;
+            return &pick->ring;
+        }
+};
@@ -9,6 +9,19 @@ class ec_sensor {
   public:
     ec_sensor(uint8_t pin, float compensation_val);
     float read_val(float temp = 25.0);
+
+    // Per-channel calibration: mS/cm at 25 C = (SCALE * raw + OFFSET) / (1 + TCOEF * (T - 25))
+    static constexpr float ISO    = 0.0f;  // reading that doesn't move with temperature
+    static constexpr float TCOEF  = 0.02f; // typical nutrient solution, per C
+    static constexpr float counts_to_ms(float k) { return k * (3.3f / 4095.0f) / 1000.0f; }
+
+    // Conversion kernel shared with SensorArray:
+    //   prepare() once per sample set, compensation() and convert() per channel
+    static float prepare(float temp) { return temp - 25.0f; }
+    static float compensation(float tcoef, float ctx) { return 1.0f / (1.0f + tcoef * ctx); }
+    static float convert(uint16_t raw, float scale, float offset, float comp) {
+        return ISO + (scale * static_cast<float>(raw) + offset - ISO) * comp;
+    }
     
   private:
     float compensation_val;
@@ -23,16 +36,6 @@ ec_sensor::ec_sensor(uint8_t pin, float compensation_val) : compensation_val(com
 float ec_sensor::read_val(float temp) {
 
     uint16_t sensor_val = analogRead(this->analog_pin);
-    
-    float voltage = static_cast<float>(sensor_val) * (3.3f / 4095.0f); 
-
-    float temp_coefficient = 1.0 + 0.02 * (temp - 25.0);
-    float compensated_voltage = voltage / temp_coefficient;
-
-    float ec_microS = compensated_voltage * this->compensation_val;
-  
-    float ec_milliS = ec_microS / 1000.0f;
 
-    return ec_milliS;
-    // return ec_microS;
-}
\ No newline at end of file
+    return convert(sensor_val, counts_to_ms(this->compensation_val), 0.0f, compensation(TCOEF, prepare(temp)));
+}
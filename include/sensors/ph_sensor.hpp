@@ -11,6 +11,22 @@ class ph_sensor {
         
         float read_val(float current_temp_c = 25.0);
 
+        // Default probe line: pH = SLOPE * raw + OFFSET at 25 C
+        static constexpr float SLOPE  = -0.0225f;
+        static constexpr float OFFSET = 24.36f;
+
+        // Nernstian: the response around pH 7 scales with absolute temperature
+        static constexpr float ISO    = 7.0f;
+        static constexpr float TCOEF  = 1.0f / 298.15f;
+
+        // Conversion kernel shared with SensorArray:
+        //   prepare() once per sample set, compensation() and convert() per channel
+        static float prepare(float current_temp_c) { return current_temp_c - 25.0f; }
+        static float compensation(float tcoef, float ctx) { return 1.0f / (1.0f + tcoef * ctx); }
+        static float convert(uint16_t raw, float scale, float offset, float comp) {
+            return ISO + (scale * static_cast<float>(raw) + offset - ISO) * comp;
+        }
+
     private:
         // float OFFSET;
         // float SCALE;
@@ -22,14 +38,7 @@ ph_sensor::ph_sensor(uint8_t pin) : analog_pin(pin) {}
 
 // Read Sensor with Temperature Compensation
 float ph_sensor::read_val(float current_temp_c) {
-    float raw = analogRead(this->analog_pin);
-
-    float raw_ph = (-0.0225 * raw) + 24.36;
-
-    float current_temp_k = current_temp_c + 273.15;
-    float reference_temp_k = 298.15;
-
-    float compensated_ph = 7.0 + ((raw_ph - 7.0) * (reference_temp_k / current_temp_k));
+    uint16_t raw = analogRead(this->analog_pin);
 
-    return compensated_ph;
+    return convert(raw, SLOPE, OFFSET, compensation(TCOEF, prepare(current_temp_c)));
 }
@@ -0,0 +1,133 @@
+/*#################################################*/
+/* Two-point probe calibration: every channel of   */
+/* one SensorArray sits in a reference solution,   */
+/* raw counts are averaged, then the line through  */
+/* both points becomes that channel's scale/offset */
+/*#################################################*/
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+#include <math.h>
+
+#include "sensor_array.hpp"
+
+static constexpr uint8_t       PROBE_CAL_SAMPLES   = 64;
+static constexpr unsigned long PROBE_CAL_SAMPLE_MS = 20;  // ~1.3 s per point
+static constexpr float         PROBE_CAL_MIN_SPAN  = 50.0f; // raw counts between the two points
+
+// Channel mask meaning "every channel"
+static constexpr uint8_t PROBE_CAL_ALL = 0xFF;
+
+template <typename Sensor, size_t N>
+class ProbeCalibrator {
+    public:
+        explicit ProbeCalibrator(SensorArray<Sensor, N> &probes) : probes(probes) {}
+
+        // point is 0 or 1; value is the reference solution's reading at 25 C.
+        // ch selects one channel, or PROBE_CAL_ALL.
+        void begin_point(uint8_t point, float value, uint8_t ch = PROBE_CAL_ALL);
+
+        bool capturing() const { return active; }
+        void cancel() { active = false; have[0] = have[1] = false; }
+
+        // Call every loop(); temp is the solution temperature (NAN if unknown).
+        // Returns true when the current point has been captured.
+        bool service(unsigned long now, float temp);
+
+        // Averaged raw counts of the last captured point
+        const std::array<float, N> &raw(uint8_t point) const { return mean[point]; }
+        bool ready() const { return have[0] && have[1]; }
+
+        // Fits both points into probes.cal for the selected channels. Returns a bit per
+        // channel that was updated; a channel is left alone when the points are too close
+        // or the slope has the wrong sign.
+        uint8_t solve();
+
+    private:
+        SensorArray<Sensor, N> &probes;
+
+        bool    active  = false;
+        uint8_t point   = 0;
+        uint8_t mask    = PROBE_CAL_ALL;
+        uint8_t samples = 0;
+        unsigned long last_ms = 0;
+
+        std::array<float, N> sum;
+        float temp_sum = 0.0f;
+        uint8_t temp_n = 0;
+
+        bool                 have[2]  = { false, false };
+        float                value[2] = { 0.0f, 0.0f };
+        float                dt[2]    = { 0.0f, 0.0f }; // solution temperature - 25 C
+        std::array<float, N> mean[2];
+};
+
+template <typename Sensor, size_t N>
+void ProbeCalibrator<Sensor, N>::begin_point(uint8_t p, float v, uint8_t ch) {
+    // A new channel selection starts a fresh calibration
+    if (p == 0 || ch != mask) have[0] = have[1] = false;
+
+    point    = p & 1;
+    mask     = ch;
+    samples  = 0;
+    temp_sum = 0.0f;
+    temp_n   = 0;
+    sum.fill(0.0f);
+    value[point] = v;
+    have[point]  = false;
+    active   = true;
+}
+
+template <typename Sensor, size_t N>
+bool ProbeCalibrator<Sensor, N>::service(unsigned long now, float temp) {
+    if (!active || now - last_ms < PROBE_CAL_SAMPLE_MS) return false;
+    last_ms = now;
+
+    std::array<uint16_t, N> raw = probes.sample();
+    for (size_t i = 0; i < N; ++i) sum[i] += raw[i];
+    if (isfinite(temp)) {
+        temp_sum += temp;
+        temp_n++;
+    }
+
+    if (++samples < PROBE_CAL_SAMPLES) return false;
+
+    for (size_t i = 0; i < N; ++i) mean[point][i] = sum[i] / PROBE_CAL_SAMPLES;
+    dt[point]   = temp_n ? Sensor::prepare(temp_sum / temp_n) : 0.0f;
+    have[point] = true;
+    active      = false;
+    return true;
+}
+
+template <typename Sensor, size_t N>
+uint8_t ProbeCalibrator<Sensor, N>::solve() {
+    if (!ready()) return 0;
+
+    uint8_t updated = 0;
+    for (size_t i = 0; i < N; ++i) {
+        if (mask != PROBE_CAL_ALL && mask != i) continue;
+
+        float r0 = mean[0][i];
+        float r1 = mean[1][i];
+        if (fabsf(r1 - r0) < PROBE_CAL_MIN_SPAN) continue;
+
+        // What scale*raw + offset must have read at the solution's temperature
+        float tc = probes.cal.tcoef[i];
+        float t0 = Sensor::ISO + (value[0] - Sensor::ISO) / Sensor::compensation(tc, dt[0]);
+        float t1 = Sensor::ISO + (value[1] - Sensor::ISO) / Sensor::compensation(tc, dt[1]);
+
+        float scale  = (t1 - t0) / (r1 - r0);
+        float offset = t0 - scale * r0;
+
+        // Same direction as the nominal line, or a probe was swapped/unplugged
+        if (!isfinite(scale) || (scale > 0.0f) != (probes.cal.scale[i] > 0.0f)) continue;
+
+        probes.cal.scale[i]  = scale;
+        probes.cal.offset[i] = offset;
+        updated |= 1 << i;
+    }
+
+    have[0] = have[1] = false;
+    return updated;
+}
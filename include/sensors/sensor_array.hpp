@@ -0,0 +1,75 @@
+/*#################################################*/
+/* N probes of one sensor type, calibration stored */
+/* as structure-of-arrays so one sample set is     */
+/* converted in a single branch-free loop          */
+/*#################################################*/
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+
+template <size_t N>
+constexpr std::array<float, N> filled(float v) {
+    std::array<float, N> a = {};
+    for (size_t i = 0; i < N; ++i) a[i] = v;
+    return a;
+}
+
+template <size_t N>
+constexpr std::array<float, N> scaled(const std::array<float, N> &a, float k) {
+    std::array<float, N> out = {};
+    for (size_t i = 0; i < N; ++i) out[i] = a[i] * k;
+    return out;
+}
+
+// Per-channel calibration table, one array per coefficient
+template <size_t N>
+struct SensorCal {
+    std::array<float, N> scale;
+    std::array<float, N> offset;
+    std::array<float, N> tcoef;  // fractional change per C away from 25 C
+};
+
+// Uncalibrated table: the sensor's nominal line and temperature coefficient on every channel
+template <typename Sensor, size_t N>
+constexpr SensorCal<N> nominal_cal(const std::array<float, N> &scale, float offset) {
+    return { scale, filled<N>(offset), filled<N>(Sensor::TCOEF) };
+}
+
+// Sensor supplies the static kernel:
+//   float prepare(float temp)                                   once per sample set
+//   float compensation(float tcoef, float ctx)                  per channel
+//   float convert(uint16_t raw, float scale, float offset, float comp)
+template <typename Sensor, size_t N>
+class SensorArray {
+    public:
+        static constexpr size_t size = N;
+
+        constexpr SensorArray(const std::array<uint8_t, N> &pins, const SensorCal<N> &cal)
+            : pins(pins), cal(cal) {}
+
+        std::array<uint16_t, N> sample() const {
+            std::array<uint16_t, N> raw;
+            for (size_t i = 0; i < N; ++i) raw[i] = analogRead(pins[i]);
+            return raw;
+        }
+
+        // Samples every channel, then converts them together
+        std::array<float, N> read(float temp = 25.0f) const {
+            return convert(sample(), temp);
+        }
+
+        std::array<float, N> convert(const std::array<uint16_t, N> &raw, float temp = 25.0f) const {
+            const float ctx = Sensor::prepare(temp);
+
+            std::array<float, N> out;
+            for (size_t i = 0; i < N; ++i) out[i] = Sensor::compensation(cal.tcoef[i], ctx);
+            for (size_t i = 0; i < N; ++i) {
+                out[i] = Sensor::convert(raw[i], cal.scale[i], cal.offset[i], out[i]);
+            }
+            return out;
+        }
+
+        std::array<uint8_t, N> pins;
+        SensorCal<N>           cal;
+};
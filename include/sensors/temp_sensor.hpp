@@ -8,14 +8,22 @@ public:
     temp_sensor(uint8_t pin);
     float read_val();
 
+    // Conversion kernel shared with SensorArray. A thermistor needs no temperature
+    // compensation; scale/offset trim the result in C.
+    static constexpr float ISO   = 0.0f;
+    static constexpr float TCOEF = 0.0f;
+    static float prepare(float) { return 0.0f; }
+    static float compensation(float, float) { return 1.0f; }
+    static float convert(uint16_t raw, float scale, float offset, float comp);
+
 private:
     uint8_t read_pin;
 
-    const float fixed_resistance = 10000.0f;
-    const float v_ref = 3.3f;
-    const float nominal_resistance = 10000.0f;
-    const float nominal_temp = 25.0f;
-    const float b_coefficient = 3950.0f;
+    static constexpr float fixed_resistance = 10000.0f;
+    static constexpr float v_ref = 3.3f;
+    static constexpr float nominal_resistance = 10000.0f;
+    static constexpr float nominal_temp = 25.0f;
+    static constexpr float b_coefficient = 3950.0f;
 };
 
 temp_sensor::temp_sensor(uint8_t pin) : read_pin(pin){}
@@ -23,18 +31,20 @@ temp_sensor::temp_sensor(uint8_t pin) : read_pin(pin){}
 
 float temp_sensor::read_val() {
     int raw = analogRead(this->read_pin);
-    float voltage = raw * (this->v_ref / 4095.0f);
-    if (voltage <= 0.0f || voltage >= this->v_ref) return NAN;
+    return convert(raw, 1.0f, 0.0f, 1.0f);
+}
+
+float temp_sensor::convert(uint16_t raw, float scale, float offset, float) {
+    float voltage = raw * (v_ref / 4095.0f);
+    if (voltage <= 0.0f || voltage >= v_ref) return NAN;
 
-    float sensor_resistance = this->fixed_resistance * (voltage / (this->v_ref - voltage));
+    float sensor_resistance = fixed_resistance * (voltage / (v_ref - voltage));
 
-    float steinhart = sensor_resistance / this->nominal_resistance;
+    float steinhart = sensor_resistance / nominal_resistance;
     steinhart = logf(steinhart);
-    steinhart /= this->b_coefficient;
-    steinhart += 1.0f / (this->nominal_temp + 273.15f);
+    steinhart /= b_coefficient;
+    steinhart += 1.0f / (nominal_temp + 273.15f);
     steinhart = 1.0f / steinhart;
     steinhart -= 273.15f;
-    return steinhart;
+    return steinhart * scale + offset;
 }
-
-
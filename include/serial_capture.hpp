@@ -0,0 +1,130 @@
+/*#################################################*/
+/* UART traffic capture: every line between the    */
+/* ESP32 and the MCU, timestamped, one per record: */
+/*     <millis> <dir> <line>                       */
+/* dir is '>' for ESP32 -> MCU, '<' for MCU -> ESP32*/
+/* Replayed on the host by tools/serial_replay.cpp */
+/*#################################################*/
+#pragma once
+
+#include <Arduino.h>
+#include <cstdlib>
+#include <cstring>
+
+static constexpr char CAPTURE_TO_MCU   = '>';
+static constexpr char CAPTURE_FROM_MCU = '<';
+
+struct CaptureRecord {
+    unsigned long ms;
+    char          dir;
+    const char   *line;
+};
+
+// Splits one record (without its newline); line points into text. False when malformed.
+bool parse_capture_record(const char *text, CaptureRecord &rec) {
+    char *end;
+    rec.ms = strtoul(text, &end, 10);
+    if (end == text || end[0] != ' ') return false;
+
+    rec.dir = end[1];
+    if ((rec.dir != CAPTURE_TO_MCU && rec.dir != CAPTURE_FROM_MCU) || end[2] != ' ') return false;
+
+    rec.line = end + 3;
+    return true;
+}
+
+#if defined(ESP32)
+
+#include <FS.h>
+
+static constexpr const char   *CAPTURE_PATH      = "/capture.log";
+static constexpr size_t        CAPTURE_BUF_SIZE  = 2048;           // staged in RAM, one flash write per fill
+static constexpr unsigned long CAPTURE_FLUSH_MS  = 5000;           // ...or this often
+static constexpr uint32_t      CAPTURE_MAX_BYTES = 512UL * 1024UL; // stops itself here
+
+//!##################################################
+//!######## Capture writer ##########################
+//! Only called from loop(): the async web handlers
+//! never touch the file. A full file stops the
+//! capture rather than wrapping, so the start of an
+//! incident is never overwritten.
+//!##################################################
+
+class SerialCapture {
+    public:
+        explicit SerialCapture(fs::FS &fs, const char *path = CAPTURE_PATH) : fs(fs), path(path) {}
+
+        // Truncates the previous capture
+        bool start() {
+            File f = fs.open(path, FILE_WRITE);
+            if (!f) return false;
+            f.close();
+
+            len     = 0;
+            written = 0;
+            running = true;
+            return true;
+        }
+
+        void stop() {
+            flush();
+            running = false;
+        }
+
+        bool     active() const { return running; }
+        uint32_t bytes() const { return written + len; }
+
+        void record(char dir, const char *line, unsigned long now) {
+            if (!running) return;
+
+            char head[16];
+            int  n = snprintf(head, sizeof(head), "%lu %c ", now, dir);
+            size_t line_len = strlen(line);
+            size_t need     = n + line_len + 1;
+
+            if (written + len + need > CAPTURE_MAX_BYTES) {
+                stop();
+                return;
+            }
+            if (len + need > CAPTURE_BUF_SIZE) flush();
+            if (need > CAPTURE_BUF_SIZE) return; // longer than any line CommReader accepts
+
+            memcpy(buf + len, head, n);
+            len += n;
+            memcpy(buf + len, line, line_len);
+            len += line_len;
+            buf[len++] = '\n';
+        }
+
+        // Call every loop(); bounds what a reset can lose
+        void service(unsigned long now) {
+            if (running && len > 0 && now - last_flush_ms >= CAPTURE_FLUSH_MS) flush();
+            if (len == 0) last_flush_ms = now;
+        }
+
+    private:
+        fs::FS     &fs;
+        const char *path;
+
+        char     buf[CAPTURE_BUF_SIZE];
+        size_t   len     = 0;
+        uint32_t written = 0;
+        bool     running = false;
+
+        unsigned long last_flush_ms = 0;
+
+        void flush() {
+            if (len == 0) return;
+
+            // Filesystem gone or full: stop rather than keep a capture with holes in it
+            File f = fs.open(path, FILE_APPEND);
+            size_t n = f ? f.write(reinterpret_cast<const uint8_t *>(buf), len) : 0;
+            if (f) f.close();
+            if (n != len) running = false;
+
+            written += n;
+            len = 0;
+        }
+};
+
+#endif
@@ -4,20 +4,74 @@
 #include <cstdint>
 #include <array>
 #include <ArduinoJson.h>
+#include "mem_watch.hpp"
+#include "ts_codec.hpp"
 
 static constexpr uint16_t MSG_SENSOR_REQUEST  = 1001; // ESP32 → MCU: Request sensor data
 static constexpr uint16_t MSG_SENSOR_RESPONSE = 1002; // MCU → ESP32: sensor data response
 static constexpr uint16_t MSG_LOAD_DOSE       = 2001; // ESP32 → MCU: loading dose command
 static constexpr uint16_t MSG_SYSTEM_STATE    = 2002; // ESP32 → MCU: start/stop system
 static constexpr uint16_t MSG_SET_PROFILE     = 2003; // ESP32 → MCU: plant profile 
+static constexpr uint16_t MSG_PUMP_CAL_START  = 2004; // ESP32 → MCU: begin calibration sweep for one pump
+static constexpr uint16_t MSG_PUMP_CAL_MEASURE = 2005; // ESP32 → MCU: measured mL of the last calibration run
+static constexpr uint16_t MSG_PUMP_CAL_STATUS = 2006; // MCU → ESP32: next calibration run / fitted result
+static constexpr uint16_t MSG_DOSE_REPORT     = 2007; // MCU → ESP32: dose job finished or aborted
+static constexpr uint16_t MSG_CANCEL_JOB      = 2008; // ESP32 → MCU: cancel one dose job (id 0 = all)
+static constexpr uint16_t MSG_PROBE_CAL       = 2009; // ESP32 → MCU: capture a probe calibration point / set tempco
+static constexpr uint16_t MSG_PROBE_CAL_STATUS = 2010; // MCU → ESP32: captured point / fitted probe table
+static constexpr uint16_t MSG_RECIPE_LOAD     = 2011; // ESP32 → MCU: recipe steps from "at" (at 0 clears the table)
+static constexpr uint16_t MSG_RECIPE_CTRL     = 2012; // ESP32 → MCU: run / abort the recipe, or just ask for status
+static constexpr uint16_t MSG_RECIPE_STATUS   = 2013; // MCU → ESP32: recipe progress
+static constexpr uint16_t MSG_PROFILE_SELECT  = 2014; // ESP32 → MCU: switch to a cached catalog profile by id
+static constexpr uint16_t MSG_PROFILE_STATUS  = 2015; // MCU → ESP32: profile applied, or not cached (send M:2003)
+static constexpr uint16_t MSG_MEM_REQUEST     = 2016; // ESP32 → MCU: ask for the memory watermarks
+static constexpr uint16_t MSG_MEM_REPORT      = 2017; // MCU → ESP32: heap, stack and allocation watermarks
+static constexpr uint16_t MSG_HISTORY_REQUEST = 2018; // ESP32 → MCU: one block of a zone's sample log, "seq" or the oldest held
+static constexpr uint16_t MSG_HISTORY_BLOCK   = 2019; // MCU → ESP32: that block (ts_codec.hpp), the newest seq and the MCU's clock
 
-// Send data
-void send_sensor_data(Stream &port, float ph, float ec, float temp) {
+//!##################################################
+//!######## Zones ###################################
+//! One MCU can run several reservoirs (zone.hpp).
+//! Commands for one carry "Z", 0..ZONE_MAX-1, and so
+//! do the MCU's replies about it; no "Z" is zone 0,
+//! so a single-zone link is unchanged.
+//!##################################################
+
+static constexpr uint8_t ZONE_MAX = 4;
+
+struct ZoneReading {
+    float ph;
+    float ec;
+    float temp;
+};
+
+// Send data; "duty" (per-mille of time awake since the last one, idle_sleep.hpp) when not negative
+void send_sensor_data(Stream &port, float ph, float ec, float temp, int16_t duty = -1) {
     JsonDocument msg;
     msg["M"]    = MSG_SENSOR_RESPONSE;
     msg["pH"]   = ph;
     msg["ec"]   = ec;
     msg["temp"] = temp;
+    if (duty >= 0) msg["duty"] = duty;
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// Several zones in one M:1002: zone 0 at the top level as above, then every zone as [pH, ec, temp]
+void send_sensor_data(Stream &port, const ZoneReading *zones, uint8_t n, int16_t duty = -1) {
+    JsonDocument msg;
+    msg["M"]    = MSG_SENSOR_RESPONSE;
+    msg["pH"]   = zones[0].ph;
+    msg["ec"]   = zones[0].ec;
+    msg["temp"] = zones[0].temp;
+    if (duty >= 0) msg["duty"] = duty;
+    JsonArray all = msg["zones"].to<JsonArray>();
+    for (uint8_t z = 0; z < n; ++z) {
+        JsonArray r = all.add<JsonArray>();
+        r.add(zones[z].ph);
+        r.add(zones[z].ec);
+        r.add(zones[z].temp);
+    }
     serializeJson(msg, port);
     port.print('\n');
 }
@@ -26,11 +80,148 @@ void send_data(Stream &port, const float &ph, const float &ec, const float &temp
     send_sensor_data(port, ph, ec, temp);
 }
 
+// Tells the operator what was just dispensed and needs measuring
+void send_pump_cal_run(Stream &port, const char *pump, uint8_t run, uint8_t of, long steps, float max_speed, float accel) {
+    JsonDocument msg;
+    msg["M"]     = MSG_PUMP_CAL_STATUS;
+    msg["pump"]  = pump;
+    msg["run"]   = run;
+    msg["of"]    = of;
+    msg["steps"] = steps;
+    msg["speed"] = max_speed;
+    msg["accel"] = accel;
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// Final fit; ok=false means the measurements were rejected and the old calibration kept
+void send_pump_cal_result(Stream &port, const char *pump, bool ok, float steps_per_ml, float max_speed, float accel) {
+    JsonDocument msg;
+    msg["M"]     = MSG_PUMP_CAL_STATUS;
+    msg["pump"]  = pump;
+    msg["done"]  = true;
+    msg["ok"]    = ok;
+    msg["spml"]  = steps_per_ml;
+    msg["speed"] = max_speed;
+    msg["accel"] = accel;
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// One finished dose job; ml is what was actually dispensed, which is short of req when aborted
+void send_dose_report(Stream &port, uint16_t id, const char *pump, float requested_ml, float dispensed_ml, bool aborted,
+                      uint8_t zone = 0) {
+    JsonDocument msg;
+    msg["M"]       = MSG_DOSE_REPORT;
+    if (zone) msg["Z"] = zone;
+    msg["id"]      = id;
+    msg["pump"]    = pump;
+    msg["req"]     = requested_ml;
+    msg["ml"]      = dispensed_ml;
+    msg["aborted"] = aborted;
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// Averaged raw counts of one captured calibration point, per channel
+template <size_t N>
+void send_probe_cal_point(Stream &port, const char *probe, uint8_t point, const std::array<float, N> &raw,
+                          uint8_t zone = 0) {
+    JsonDocument msg;
+    msg["M"]     = MSG_PROBE_CAL_STATUS;
+    if (zone) msg["Z"] = zone;
+    msg["probe"] = probe;
+    msg["point"] = point;
+    JsonArray r  = msg["raw"].to<JsonArray>();
+    for (float v : raw) r.add(v);
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// Current table after a fit or tempco change; ok has a bit per channel that was updated
+template <size_t N>
+void send_probe_cal_table(Stream &port, const char *probe, uint8_t ok, const std::array<float, N> &scale,
+                          const std::array<float, N> &offset, const std::array<float, N> &tcoef, uint8_t zone = 0) {
+    JsonDocument msg;
+    msg["M"]     = MSG_PROBE_CAL_STATUS;
+    if (zone) msg["Z"] = zone;
+    msg["probe"] = probe;
+    msg["done"]  = true;
+    msg["ok"]    = ok;
+    JsonArray s = msg["slope"].to<JsonArray>();
+    JsonArray o = msg["offset"].to<JsonArray>();
+    JsonArray t = msg["tcoef"].to<JsonArray>();
+    for (size_t i = 0; i < N; ++i) {
+        s.add(scale[i]);
+        o.add(offset[i]);
+        t.add(tcoef[i]);
+    }
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// Reply to a catalog profile switch; ok=false asks for the full profile (M:2003 with its id)
+void send_profile_status(Stream &port, uint16_t id, bool ok, uint8_t zone = 0) {
+    JsonDocument msg;
+    msg["M"]  = MSG_PROFILE_STATUS;
+    if (zone) msg["Z"] = zone;
+    msg["id"] = id;
+    msg["ok"] = ok;
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// Recipe progress: sent on every step, timeout and end, and in reply to M:2012
+void send_recipe_status(Stream &port, const char *state, uint8_t step, const char *op, uint8_t steps,
+                        const char *event, const char *why, uint8_t zone = 0) {
+    JsonDocument msg;
+    msg["M"]     = MSG_RECIPE_STATUS;
+    if (zone) msg["Z"] = zone;
+    msg["state"] = state;
+    msg["step"]  = step;
+    msg["op"]    = op;
+    msg["n"]     = steps;
+    if (event[0]) msg["event"] = event;
+    if (why[0])   msg["why"]   = why;
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// Reply to M:2016 (mem_watch.hpp); the MCU's two stacks and one allocator fit the bridge's line buffer
+void send_mem_report(Stream &port, const MemWatch &mem) {
+    JsonDocument msg;
+    msg["M"] = MSG_MEM_REPORT;
+    mem.to_json(msg.as<JsonObject>());
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
+// One block of a zone's sample log, base64'd: "seq" is the block, "last" the one being written,
+// "now" the MCU's millis() to place the samples' times by. "b" is empty when seq isn't held.
+void send_history_block(Stream &port, uint8_t zone, uint32_t seq, uint32_t last, unsigned long now,
+                        const uint8_t *block, size_t len) {
+    char b64[TS_BLOCK_B64 + 1] = "";
+    ts_base64(block, len, b64, sizeof(b64));
+    JsonDocument msg;
+    msg["M"]    = MSG_HISTORY_BLOCK;
+    if (zone) msg["Z"] = zone;
+    msg["seq"]  = seq;
+    msg["last"] = last;
+    msg["now"]  = now;
+    msg["b"]    = b64;
+    serializeJson(msg, port);
+    port.print('\n');
+}
+
 static constexpr uint8_t COMM_BUF_SIZE = 255;
 
+// M:2019 at its longest, "N" stamped in: a full block and every number at ten digits
+static_assert(TS_BLOCK_B64 + 82 < COMM_BUF_SIZE, "a history block must fit the line buffer");
+
 struct CommReader {
-    char    buf[COMM_BUF_SIZE];
-    uint8_t idx = 0;
+    char     buf[COMM_BUF_SIZE];
+    uint8_t  idx       = 0;
+    uint16_t overflows = 0; // lines dropped for being longer than buf
 
     // Returns true when a full line has arrived
     bool poll(Stream &port) {
@@ -45,7 +236,10 @@ struct CommReader {
                 buf[idx++] = c;
             }
             // overflow
-            else { idx = 0; }
+            else {
+                idx = 0;
+                overflows++;
+            }
         }
         return false;
     }
@@ -55,4 +249,121 @@ struct CommReader {
 bool parse_message(const char *line, JsonDocument &doc) {
     DeserializationError err = deserializeJson(doc, line);
     return !err;
-}
\ No newline at end of file
+}
+
+//!##################################################
+//!######## Node addressing #########################
+//! Several MCUs can share one bridge on a multi-drop
+//! (RS-485) line. Every line then carries "N", the
+//! node it is for / from, 1..NODE_MAX. A line with
+//! no "N" is a point-to-point link: the bridge takes
+//! it as node 1.
+//!##################################################
+
+static constexpr uint8_t NODE_MAX = 16;
+
+// Node of a line, 0 when it has none (or isn't JSON)
+uint8_t line_node(const char *line) {
+    JsonDocument filter;
+    filter["N"] = true;
+    JsonDocument doc;
+    if (deserializeJson(doc, line, DeserializationOption::Filter(filter))) return 0;
+    return doc["N"] | 0;
+}
+
+static constexpr size_t BUS_OUTBOX_SIZE = 1024;
+
+//!##################################################
+//!######## Bus port (MCU) ##########################
+//! Address 0: a plain point-to-point port, node 1
+//! to the bridge.
+//! Address 1..NODE_MAX: the node only transmits in
+//! its turn. Everything written is held in an
+//! outbox with "N" stamped into each line, and
+//! end_turn() sends it, driver enabled, right after
+//! the M:1002 answering this node's M:1001 poll.
+//! A line that doesn't fit is dropped whole.
+//!##################################################
+
+class BusPort : public Stream {
+    public:
+        explicit BusPort(HardwareSerial &port) : port(port) {}
+
+        uint16_t dropped = 0; // lines that didn't fit the outbox
+
+        void begin(uint8_t address, int8_t driver_pin = -1) {
+            addr = address;
+            de   = driver_pin;
+            if (de >= 0) {
+                pinMode(de, OUTPUT);
+                digitalWrite(de, LOW);
+            }
+        }
+
+        uint8_t address() const { return addr; }
+
+        // Lines addressed to this node; point-to-point it answers as node 1 (or unaddressed)
+        bool accepts(const JsonDocument &doc) const {
+            uint8_t n = doc["N"] | 0;
+            return addr == 0 ? (n == 0 || n == 1) : n == addr;
+        }
+
+        // Sends the complete lines held so far
+        void end_turn() {
+            if (addr == 0 || line_start == 0) return;
+
+            if (de >= 0) digitalWrite(de, HIGH);
+            port.write(outbox, line_start);
+            port.flush(); // until the last stop bit is out, then release the line
+            if (de >= 0) digitalWrite(de, LOW);
+
+            memmove(outbox, outbox + line_start, len - line_start);
+            len       -= line_start;
+            line_start = 0;
+        }
+
+        size_t write(uint8_t c) override {
+            if (addr == 0) return port.write(c);
+
+            if (dropping) {
+                if (c == '\n') dropping = false;
+                return 1;
+            }
+
+            if (len == line_start && c == '{') {
+                char stamp[12];
+                int n = snprintf(stamp, sizeof(stamp), "{\"N\":%u,", addr);
+                append(reinterpret_cast<const uint8_t *>(stamp), n);
+            } else {
+                append(&c, 1);
+            }
+            if (!dropping && c == '\n') line_start = len;
+            return 1;
+        }
+        using Print::write;
+
+        int available() override { return port.available(); }
+        int read() override      { return port.read(); }
+        int peek() override      { return port.peek(); }
+
+    private:
+        HardwareSerial &port;
+        uint8_t addr = 0;
+        int8_t  de   = -1;
+
+        uint8_t outbox[BUS_OUTBOX_SIZE];
+        size_t  len        = 0;
+        size_t  line_start = 0;     // where the line being written began
+        bool    dropping   = false; // rest of an oversized line
+
+        void append(const uint8_t *data, size_t n) {
+            if (len + n > sizeof(outbox)) {
+                len      = line_start;
+                dropping = data[n - 1] != '\n';
+                dropped++;
+                return;
+            }
+            memcpy(outbox + len, data, n);
+            len += n;
+        }
+};
\ No newline at end of file
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <Arduino.h>
+#include <cstdint>
+#include <cstring>
+
+//!##################################################
+//!######## Persistent key/value store ##############
+//! Log-structured: every put() appends a record to
+//! the active flash block, the newest record for a
+//! key wins. When the block fills, the live records
+//! are compacted into the next block in the region,
+//! so erases rotate evenly over every block.
+//! A record with a bad CRC (torn by a brown-out) ends
+//! the log; the previous copy of that key survives.
+//!##################################################
+
+// Raw flash the store lives in. Offsets are relative to the start of the region.
+class FlashRegion {
+    public:
+        virtual uint32_t block_size() const = 0;
+        virtual uint8_t  num_blocks() const = 0;
+
+        virtual void read(uint32_t offset, void *dst, size_t len) = 0;
+        // offset and len are multiples of STORE_WRITE_UNIT, target is erased
+        virtual bool write(uint32_t offset, const void *src, size_t len) = 0;
+        virtual bool erase(uint8_t block) = 0;
+};
+
+static constexpr uint32_t STORE_WRITE_UNIT  = 16;   // SAMD51 quad-word
+static constexpr uint8_t  STORE_MAX_KEYS    = 32;
+static constexpr uint8_t  STORE_MAX_VALUE   = 112;  // record fits in 128 bytes
+static constexpr uint32_t STORE_BLOCK_MAGIC = 0x54534448; // "HDST"
+static constexpr uint8_t  STORE_KEY_ERASED  = 0xFF;
+
+struct StoreBlockHeader {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t reserved[2];
+};
+
+struct StoreRecordHeader {
+    uint8_t  key;
+    uint8_t  len;
+    uint16_t crc;
+    uint32_t seq;
+    uint32_t reserved[2];
+};
+
+static_assert(sizeof(StoreBlockHeader)  == STORE_WRITE_UNIT, "block header must be one write unit");
+static_assert(sizeof(StoreRecordHeader) == STORE_WRITE_UNIT, "record header must be one write unit");
+
+uint16_t store_crc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF) {
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (uint8_t b = 0; b < 8; ++b) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+class StateStore {
+    public:
+        explicit StateStore(FlashRegion &flash);
+
+        // Finds the newest valid block and rebuilds the key index. Formats an empty region.
+        bool begin();
+
+        bool get(uint8_t key, void *dst, size_t len);
+        // Skips the write when the stored value is already identical
+        bool put(uint8_t key, const void *src, size_t len);
+
+        template <typename T> bool get(uint8_t key, T &value) { return get(key, &value, sizeof(T)); }
+        template <typename T> bool put(uint8_t key, const T &value) { return put(key, &value, sizeof(T)); }
+
+        uint32_t generation() const { return gen; }
+        uint32_t bytes_free() const { return flash.block_size() - write_pos; }
+
+    private:
+        FlashRegion &flash;
+
+        uint8_t  active_block = 0;
+        uint32_t gen          = 0;
+        uint32_t seq          = 0;
+        uint32_t write_pos    = 0; // within the active block
+
+        // Offset within the active block of each key's newest record, 0 when absent
+        uint32_t index[STORE_MAX_KEYS] = {};
+
+        uint8_t record_buf[sizeof(StoreRecordHeader) + STORE_MAX_VALUE];
+
+        static uint32_t padded(size_t len) {
+            return (len + STORE_WRITE_UNIT - 1) / STORE_WRITE_UNIT * STORE_WRITE_UNIT;
+        }
+        uint32_t block_base(uint8_t block) const { return static_cast<uint32_t>(block) * flash.block_size(); }
+
+        bool format_block(uint8_t block, uint32_t generation);
+        void scan_active();
+        bool read_record(uint32_t pos, StoreRecordHeader &hdr, uint8_t *value);
+        bool append(uint8_t key, const void *src, size_t len);
+        bool compact();
+        bool abandon_compact(uint8_t old_block, const uint32_t *old_index, uint32_t old_pos);
+};
+
+StateStore::StateStore(FlashRegion &flash) : flash(flash) {}
+
+bool StateStore::begin() {
+    bool found = false;
+
+    for (uint8_t b = 0; b < flash.num_blocks(); ++b) {
+        StoreBlockHeader hdr;
+        flash.read(block_base(b), &hdr, sizeof(hdr));
+        if (hdr.magic != STORE_BLOCK_MAGIC) continue;
+
+        if (!found || hdr.generation > gen) {
+            found        = true;
+            active_block = b;
+            gen          = hdr.generation;
+        }
+    }
+
+    if (!found) {
+        active_block = 0;
+        return format_block(0, 1);
+    }
+
+    scan_active();
+    return true;
+}
+
+bool StateStore::format_block(uint8_t block, uint32_t generation) {
+    if (!flash.erase(block)) return false;
+
+    StoreBlockHeader hdr = { STORE_BLOCK_MAGIC, generation, { 0xFFFFFFFF, 0xFFFFFFFF } };
+    if (!flash.write(block_base(block), &hdr, sizeof(hdr))) return false;
+
+    active_block = block;
+    gen          = generation;
+    write_pos    = sizeof(StoreBlockHeader);
+    memset(index, 0, sizeof(index));
+    return true;
+}
+
+bool StateStore::read_record(uint32_t pos, StoreRecordHeader &hdr, uint8_t *value) {
+    flash.read(block_base(active_block) + pos, &hdr, sizeof(hdr));
+    if (hdr.key == STORE_KEY_ERASED || hdr.key >= STORE_MAX_KEYS) return false;
+    if (hdr.len > STORE_MAX_VALUE) return false;
+    if (pos + sizeof(hdr) + padded(hdr.len) > flash.block_size()) return false;
+
+    flash.read(block_base(active_block) + pos + sizeof(hdr), value, hdr.len);
+
+    uint16_t crc = store_crc16(&hdr.key, 2);
+    crc = store_crc16(reinterpret_cast<const uint8_t *>(&hdr.seq), sizeof(hdr.seq), crc);
+    crc = store_crc16(value, hdr.len, crc);
+    return crc == hdr.crc;
+}
+
+void StateStore::scan_active() {
+    memset(index, 0, sizeof(index));
+    write_pos = sizeof(StoreBlockHeader);
+    seq = 0;
+
+    uint8_t *value = record_buf + sizeof(StoreRecordHeader);
+    while (write_pos + sizeof(StoreRecordHeader) <= flash.block_size()) {
+        StoreRecordHeader hdr;
+        if (!read_record(write_pos, hdr, value)) {
+            // Torn or foreign data can't be overwritten in place; force a compaction on next put
+            if (hdr.key != STORE_KEY_ERASED) write_pos = flash.block_size();
+            return;
+        }
+        index[hdr.key] = write_pos;
+        if (hdr.seq >= seq) seq = hdr.seq + 1;
+        write_pos += sizeof(hdr) + padded(hdr.len);
+    }
+}
+
+bool StateStore::get(uint8_t key, void *dst, size_t len) {
+    if (key >= STORE_MAX_KEYS || index[key] == 0) return false;
+
+    StoreRecordHeader hdr;
+    uint8_t *value = record_buf + sizeof(StoreRecordHeader);
+    if (!read_record(index[key], hdr, value) || hdr.len != len) return false;
+
+    memcpy(dst, value, len);
+    return true;
+}
+
+bool StateStore::put(uint8_t key, const void *src, size_t len) {
+    if (key >= STORE_MAX_KEYS || len > STORE_MAX_VALUE) return false;
+
+    // Unchanged values cost no flash wear
+    if (index[key] != 0) {
+        StoreRecordHeader hdr;
+        uint8_t *value = record_buf + sizeof(StoreRecordHeader);
+        if (read_record(index[key], hdr, value) && hdr.len == len && memcmp(value, src, len) == 0) {
+            return true;
+        }
+    }
+
+    if (write_pos + sizeof(StoreRecordHeader) + padded(len) > flash.block_size()) {
+        if (!compact()) return false;
+    }
+    return append(key, src, len);
+}
+
+bool StateStore::append(uint8_t key, const void *src, size_t len) {
+    uint32_t total = sizeof(StoreRecordHeader) + padded(len);
+    if (write_pos + total > flash.block_size()) return false;
+
+    memset(record_buf, 0xFF, total);
+
+    StoreRecordHeader *hdr = reinterpret_cast<StoreRecordHeader *>(record_buf);
+    hdr->key = key;
+    hdr->len = static_cast<uint8_t>(len);
+    hdr->seq = seq++;
+    memcpy(record_buf + sizeof(StoreRecordHeader), src, len);
+
+    uint16_t crc = store_crc16(&hdr->key, 2);
+    crc = store_crc16(reinterpret_cast<const uint8_t *>(&hdr->seq), sizeof(hdr->seq), crc);
+    hdr->crc = store_crc16(record_buf + sizeof(StoreRecordHeader), len, crc);
+
+    if (!flash.write(block_base(active_block) + write_pos, record_buf, total)) return false;
+
+    index[key] = write_pos;
+    write_pos += total;
+    return true;
+}
+
+bool StateStore::compact() {
+    uint8_t old_block = active_block;
+    uint8_t new_block = (active_block + 1) % flash.num_blocks();
+
+    uint32_t old_index[STORE_MAX_KEYS];
+    uint32_t old_pos = write_pos;
+    memcpy(old_index, index, sizeof(index));
+
+    // The old block stays intact until the new one is complete, so a reset mid-compaction
+    // boots from the old block (the new one's generation header is written last)
+    if (!flash.erase(new_block)) return false;
+
+    active_block = new_block;
+    write_pos    = sizeof(StoreBlockHeader);
+    memset(index, 0, sizeof(index));
+
+    uint8_t value[STORE_MAX_VALUE];
+    for (uint8_t key = 0; key < STORE_MAX_KEYS; ++key) {
+        if (old_index[key] == 0) continue;
+
+        active_block = old_block;
+        StoreRecordHeader hdr;
+        bool ok = read_record(old_index[key], hdr, record_buf + sizeof(StoreRecordHeader));
+        if (ok) memcpy(value, record_buf + sizeof(StoreRecordHeader), hdr.len);
+        active_block = new_block;
+
+        if (ok && !append(key, value, hdr.len)) return abandon_compact(old_block, old_index, old_pos);
+    }
+
+    StoreBlockHeader bh = { STORE_BLOCK_MAGIC, gen + 1, { 0xFFFFFFFF, 0xFFFFFFFF } };
+    if (!flash.write(block_base(new_block), &bh, sizeof(bh))) return abandon_compact(old_block, old_index, old_pos);
+    gen++;
+    return true;
+}
+
+// The new block has no header, so the old one is still the newest on flash: carry on in it
+bool StateStore::abandon_compact(uint8_t old_block, const uint32_t *old_index, uint32_t old_pos) {
+    active_block = old_block;
+    write_pos    = old_pos;
+    memcpy(index, old_index, sizeof(index));
+    return false;
+}
+
+
+#if defined(__SAMD51__)
+
+// Top of internal flash, well clear of the sketch. Erase granularity on the SAMD51 is an 8 KB block.
+class Samd51Flash : public FlashRegion {
+    public:
+        static constexpr uint32_t BLOCK_SIZE = 8192;
+
+        explicit Samd51Flash(uint8_t blocks) : blocks(blocks), base(FLASH_SIZE - blocks * BLOCK_SIZE) {}
+
+        uint32_t block_size() const override { return BLOCK_SIZE; }
+        uint8_t  num_blocks() const override { return blocks; }
+
+        void read(uint32_t offset, void *dst, size_t len) override {
+            memcpy(dst, reinterpret_cast<const void *>(base + offset), len);
+        }
+
+        bool write(uint32_t offset, const void *src, size_t len) override {
+            volatile uint32_t *dst   = reinterpret_cast<volatile uint32_t *>(base + offset);
+            const uint32_t    *words = static_cast<const uint32_t *>(src);
+
+            NVMCTRL->CTRLA.bit.WMODE = NVMCTRL_CTRLA_WMODE_MAN;
+            command(NVMCTRL_CTRLB_CMD_PBC);
+
+            for (size_t w = 0; w < len / 4; w += 4) {
+                for (uint8_t i = 0; i < 4; ++i) dst[w + i] = words[w + i];
+                NVMCTRL->ADDR.reg = base + offset + w * 4;
+                command(NVMCTRL_CTRLB_CMD_WQW);
+            }
+
+            invalidate_cache();
+            return !NVMCTRL->INTFLAG.bit.PROGE;
+        }
+
+        bool erase(uint8_t block) override {
+            NVMCTRL->ADDR.reg = base + block * BLOCK_SIZE;
+            command(NVMCTRL_CTRLB_CMD_EB);
+            invalidate_cache();
+            return !NVMCTRL->INTFLAG.bit.LOCKE;
+        }
+
+    private:
+        uint8_t  blocks;
+        uint32_t base;
+
+        static void command(uint32_t cmd) {
+            while (!NVMCTRL->STATUS.bit.READY);
+            NVMCTRL->INTFLAG.reg = NVMCTRL_INTFLAG_MASK;
+            NVMCTRL->CTRLB.reg = NVMCTRL_CTRLB_CMDEX_KEY | cmd;
+            while (!NVMCTRL->STATUS.bit.READY);
+        }
+
+        static void invalidate_cache() {
+            CMCC->MAINT0.bit.INVALL = 1;
+        }
+};
+
+#else
+
+// Host builds (serial replay, test_state_store): same geometry in RAM, erased at start, gone at exit
+class HostFlash : public FlashRegion {
+    public:
+        static constexpr uint32_t BLOCK_SIZE = 8192;
+
+        explicit HostFlash(uint8_t blocks) : blocks(blocks), mem(new uint8_t[blocks * BLOCK_SIZE]) {
+            memset(mem, 0xFF, blocks * BLOCK_SIZE);
+        }
+        HostFlash(const HostFlash &) = delete;
+        ~HostFlash() { delete[] mem; }
+
+        uint32_t block_size() const override { return BLOCK_SIZE; }
+        uint8_t  num_blocks() const override { return blocks; }
+
+        void read(uint32_t offset, void *dst, size_t len) override { memcpy(dst, mem + offset, len); }
+
+        bool write(uint32_t offset, const void *src, size_t len) override {
+            // NOR flash only clears bits
+            const uint8_t *s = static_cast<const uint8_t *>(src);
+            for (size_t i = 0; i < len; ++i) mem[offset + i] &= s[i];
+            return true;
+        }
+
+        bool erase(uint8_t block) override {
+            memset(mem + block * BLOCK_SIZE, 0xFF, BLOCK_SIZE);
+            return true;
+        }
+
+    private:
+        uint8_t  blocks;
+        uint8_t *mem;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Arduino.h>
+
+//!##################################################
+//!######## Step timer ##############################
+//! TC3 interrupt at a fixed rate, used to pulse the
+//! steppers outside of loop() so a dose no longer
+//! blocks serial handling. Highest NVIC priority:
+//! a late tick shows up as step jitter.
+//! Stopped between jobs (step_timer_enable), or its
+//! ticks would wake the core out of idle sleep.
+//!
+//! AccelStepper steps on the first tick at or past
+//! its interval, so a pump only runs at whole-tick
+//! rates, STEP_TIMER_HZ / n: asked for 8000 steps/s
+//! it does 6667. Speed profiles are kept to those
+//! rates (step_rate) and AccelStepper is given half
+//! a tick in hand (step_setpoint), so a late or
+//! early tick doesn't slip a step to the next one.
+//!##################################################
+
+static constexpr uint32_t STEP_TIMER_HZ = 20000;
+
+// Ticks between steps at a step rate, rounded up; a rate computed as STEP_TIMER_HZ / n is n
+constexpr uint32_t step_ticks(float steps_per_s) {
+    return steps_per_s >= STEP_TIMER_HZ ? 1
+         : static_cast<uint32_t>(STEP_TIMER_HZ / steps_per_s - 0.001f) + 1;
+}
+
+// The rate a pump asked for steps_per_s actually runs at
+constexpr float step_rate(float steps_per_s) {
+    return static_cast<float>(STEP_TIMER_HZ) / step_ticks(steps_per_s);
+}
+
+// Max speed for AccelStepper to run at step_rate(steps_per_s): interval half a tick short
+constexpr float step_setpoint(float steps_per_s) {
+    return STEP_TIMER_HZ / (step_ticks(steps_per_s) - 0.5f);
+}
+
+static void (*volatile step_timer_callback)() = nullptr;
+static bool step_timer_on = false;
+
+#if defined(__SAMD51__)
+
+// TC3 clocked from GCLK1 (48 MHz), 16-bit match-frequency mode
+void step_timer_begin(uint32_t hz, void (*callback)()) {
+    step_timer_callback = callback;
+
+    GCLK->PCHCTRL[TC3_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK1 | GCLK_PCHCTRL_CHEN;
+    while (!(GCLK->PCHCTRL[TC3_GCLK_ID].reg & GCLK_PCHCTRL_CHEN));
+
+    TC3->COUNT16.CTRLA.bit.ENABLE = 0;
+    while (TC3->COUNT16.SYNCBUSY.bit.ENABLE);
+    TC3->COUNT16.CTRLA.reg = TC_CTRLA_SWRST;
+    while (TC3->COUNT16.SYNCBUSY.bit.SWRST);
+
+    TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_PRESCALER_DIV1;
+    TC3->COUNT16.WAVE.reg  = TC_WAVE_WAVEGEN_MFRQ;
+    TC3->COUNT16.CC[0].reg = static_cast<uint16_t>(48000000UL / hz - 1);
+    while (TC3->COUNT16.SYNCBUSY.bit.CC0);
+
+    TC3->COUNT16.INTENSET.reg = TC_INTENSET_MC0;
+    NVIC_SetPriority(TC3_IRQn, 0);
+    NVIC_EnableIRQ(TC3_IRQn);
+
+    TC3->COUNT16.CTRLA.bit.ENABLE = 1;
+    while (TC3->COUNT16.SYNCBUSY.bit.ENABLE);
+    step_timer_on = true;
+}
+
+void step_timer_enable(bool on) {
+    if (on == step_timer_on) return;
+    TC3->COUNT16.CTRLA.bit.ENABLE = on;
+    while (TC3->COUNT16.SYNCBUSY.bit.ENABLE);
+    step_timer_on = on;
+}
+
+void TC3_Handler() {
+    TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+    if (step_timer_callback) step_timer_callback();
+}
+
+#else
+
+// Host builds have no timer; the harness calls step_timer_callback itself
+void step_timer_begin(uint32_t, void (*callback)()) {
+    step_timer_callback = callback;
+    step_timer_on       = true;
+}
+
+void step_timer_enable(bool on) { step_timer_on = on; }
+
+#endif
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <Arduino.h>
+#include <math.h>
+#include <string.h>
+
+//!##################################################
+//!######## Time-series codec #######################
+//! pH, EC and temperature move slowly; as JSON every
+//! sample costs 25-50 bytes. Packed Gorilla-style,
+//! a steady one costs a few:
+//!
+//! Values in hundredths (pH, mS/cm, C). A block
+//! starts with its first sample whole, then each
+//! one as
+//!   time:   delta-of-delta ms
+//!             0                 0
+//!             10   + 7 bits     -64..63
+//!             110  + 10 bits    -512..511
+//!             1110 + 14 bits    -8192..8191
+//!             1111 + 32 bits    the delta itself
+//!   values: delta from the previous, each
+//!             0                 same
+//!             10   + 3 bits     -4..3
+//!             110  + 6 bits     -32..31
+//!             111  + 16 bits    the value itself
+//! bit-packed, most significant bit first.
+//!
+//! Header, little-endian:
+//!   [count u8][t0 u32][pH i16][EC i16][temp i16]
+//! Blocks are TS_BLOCK_BYTES at most and stand on
+//! their own: each decodes without the others, in at
+//! most TS_BLOCK_MAX_SAMPLES steps, and one rides in
+//! a JSON line base64'd (M:2019, the MQTT sensor/ts
+//! topic). Shared by the MCU's sample log, the
+//! bridge's history backfill and its telemetry.
+//!##################################################
+
+static constexpr uint8_t TS_VALUES            = 3;   // pH, EC, temperature
+static constexpr size_t  TS_BLOCK_BYTES       = 120; // base64'd, fits a bus line with room for its fields
+static constexpr size_t  TS_HEADER_BYTES      = 1 + 4 + 2 * TS_VALUES;
+static constexpr size_t  TS_BLOCK_B64         = 4 * ((TS_BLOCK_BYTES + 2) / 3);
+static constexpr uint8_t TS_BLOCK_MAX_SAMPLES = 1 + (TS_BLOCK_BYTES - TS_HEADER_BYTES) * 8 / (1 + TS_VALUES);
+
+static_assert((TS_BLOCK_BYTES - TS_HEADER_BYTES) * 8 / (1 + TS_VALUES) < 255, "count is one byte");
+
+// Time in ms (any origin, wrapping), values in hundredths
+struct TsSample {
+    uint32_t t;
+    int16_t  v[TS_VALUES];
+};
+
+static inline int16_t ts_quantize(float x) {
+    if (!(x == x)) return 0; // NaN
+    float q = roundf(x * 100.0f);
+    if (q > 32767.0f)  return 32767;
+    if (q < -32768.0f) return -32768;
+    return static_cast<int16_t>(q);
+}
+
+static inline float ts_value(int16_t q) { return q / 100.0f; }
+
+static inline TsSample ts_sample(uint32_t t, float ph, float ec, float temp) {
+    return { t, { ts_quantize(ph), ts_quantize(ec), ts_quantize(temp) } };
+}
+
+//!##################################################
+//!######## Writer ##################################
+//!##################################################
+
+class TsBlockWriter {
+    public:
+        // Starts an empty block in buf (TS_BLOCK_BYTES)
+        void begin(uint8_t *buf);
+
+        // false when it doesn't fit: the block is done, begin() another for it
+        bool append(const TsSample &s);
+
+        uint8_t count() const { return n; }
+        bool    empty() const { return n == 0; }
+        size_t  size() const  { return n ? (bit + 7) / 8 : 0; }
+
+    private:
+        uint8_t *buf   = nullptr;
+        size_t   bit   = 0;
+        uint8_t  n     = 0;
+        TsSample last  = {};
+        uint32_t delta = 0; // between the last two samples
+
+        bool put(uint32_t v, uint8_t bits);
+        bool put_time(uint32_t d);
+        bool put_value(int16_t v, int16_t prev);
+};
+
+void TsBlockWriter::begin(uint8_t *block) {
+    buf   = block;
+    bit   = TS_HEADER_BYTES * 8;
+    n     = 0;
+    delta = 0;
+    buf[0] = 0;
+}
+
+// Bits are set and cleared both, so what a refused sample left behind is written over
+bool TsBlockWriter::put(uint32_t v, uint8_t bits) {
+    if (bit + bits > TS_BLOCK_BYTES * 8) return false;
+    for (uint8_t i = bits; i-- > 0; ++bit) {
+        uint8_t mask = 0x80 >> (bit & 7);
+        if ((v >> i) & 1) buf[bit >> 3] |= mask;
+        else              buf[bit >> 3] &= ~mask;
+    }
+    return true;
+}
+
+bool TsBlockWriter::put_time(uint32_t d) {
+    int32_t dod = static_cast<int32_t>(d - delta);
+    if (dod == 0)                      return put(0, 1);
+    if (dod >= -64 && dod < 64)        return put(0b10, 2) && put(dod, 7);
+    if (dod >= -512 && dod < 512)      return put(0b110, 3) && put(dod, 10);
+    if (dod >= -8192 && dod < 8192)    return put(0b1110, 4) && put(dod, 14);
+    return put(0b1111, 4) && put(d, 32);
+}
+
+bool TsBlockWriter::put_value(int16_t v, int16_t prev) {
+    int32_t dv = static_cast<int32_t>(v) - prev;
+    if (dv == 0)                 return put(0, 1);
+    if (dv >= -4 && dv < 4)      return put(0b10, 2) && put(dv, 3);
+    if (dv >= -32 && dv < 32)    return put(0b110, 3) && put(dv, 6);
+    return put(0b111, 3) && put(static_cast<uint16_t>(v), 16);
+}
+
+bool TsBlockWriter::append(const TsSample &s) {
+    if (!buf) return false;
+
+    if (n == 0) {
+        uint8_t *p = buf + 1;
+        for (uint8_t i = 0; i < 4; ++i) *p++ = (s.t >> (8 * i)) & 0xFF;
+        for (uint8_t k = 0; k < TS_VALUES; ++k) {
+            *p++ = static_cast<uint16_t>(s.v[k]) & 0xFF;
+            *p++ = static_cast<uint16_t>(s.v[k]) >> 8;
+        }
+    } else {
+        if (n == TS_BLOCK_MAX_SAMPLES) return false;
+        size_t   mark = bit;
+        uint32_t d    = s.t - last.t;
+        bool     ok   = put_time(d);
+        for (uint8_t k = 0; ok && k < TS_VALUES; ++k) ok = put_value(s.v[k], last.v[k]);
+        if (!ok) {
+            bit = mark;
+            return false;
+        }
+        delta = d;
+    }
+    last   = s;
+    buf[0] = ++n;
+    return true;
+}
+
+//!##################################################
+//!######## Reader ##################################
+//!##################################################
+
+class TsBlockReader {
+    public:
+        // A block as written, len its bytes; a short or damaged one reads as far as it is whole
+        TsBlockReader(const uint8_t *block, size_t len);
+
+        uint8_t count() const { return total; }
+
+        // The next sample; false after the last
+        bool next(TsSample &s);
+
+    private:
+        const uint8_t *buf;
+        size_t         len;
+        size_t         bit   = TS_HEADER_BYTES * 8;
+        uint8_t        total = 0;
+        uint8_t        taken = 0;
+        TsSample       last  = {};
+        uint32_t       delta = 0;
+
+        bool get(uint8_t bits, uint32_t &v);
+        bool get_signed(uint8_t bits, int32_t &v);
+        bool ones(uint8_t max, uint8_t &k); // 1 bits before a 0, or max of them
+};
+
+TsBlockReader::TsBlockReader(const uint8_t *block, size_t n) : buf(block), len(n) {
+    if (len < TS_HEADER_BYTES || block[0] > TS_BLOCK_MAX_SAMPLES) return;
+    total = block[0];
+}
+
+bool TsBlockReader::get(uint8_t bits, uint32_t &v) {
+    if (bit + bits > len * 8) return false;
+    v = 0;
+    for (uint8_t i = 0; i < bits; ++i, ++bit) v = (v << 1) | ((buf[bit >> 3] >> (7 - (bit & 7))) & 1);
+    return true;
+}
+
+bool TsBlockReader::get_signed(uint8_t bits, int32_t &v) {
+    uint32_t u;
+    if (!get(bits, u)) return false;
+    v = (u & (1UL << (bits - 1))) ? static_cast<int32_t>(u | ~((1UL << bits) - 1)) : static_cast<int32_t>(u);
+    return true;
+}
+
+bool TsBlockReader::ones(uint8_t max, uint8_t &k) {
+    uint32_t b = 1;
+    for (k = 0; k < max; ++k) {
+        if (!get(1, b)) return false;
+        if (!b) break;
+    }
+    return true;
+}
+
+bool TsBlockReader::next(TsSample &s) {
+    if (taken >= total) return false;
+
+    if (taken == 0) {
+        const uint8_t *p = buf + 1;
+        last.t = 0;
+        for (uint8_t i = 0; i < 4; ++i) last.t |= static_cast<uint32_t>(*p++) << (8 * i);
+        for (uint8_t k = 0; k < TS_VALUES; ++k, p += 2) last.v[k] = static_cast<int16_t>(p[0] | (p[1] << 8));
+    } else {
+        static const uint8_t TIME_BITS[] = { 0, 7, 10, 14 };
+        static const uint8_t VALUE_BITS[] = { 0, 3, 6 };
+
+        uint8_t k;
+        int32_t dod = 0;
+        if (!ones(4, k)) return false;
+        if (k == 4) {
+            uint32_t d;
+            if (!get(32, d)) return false;
+            delta = d;
+        } else {
+            if (k && !get_signed(TIME_BITS[k], dod)) return false;
+            delta += dod;
+        }
+        last.t += delta;
+
+        for (uint8_t i = 0; i < TS_VALUES; ++i) {
+            if (!ones(3, k)) return false;
+            if (k == 3) {
+                uint32_t v;
+                if (!get(16, v)) return false;
+                last.v[i] = static_cast<int16_t>(v);
+            } else if (k) {
+                int32_t dv;
+                if (!get_signed(VALUE_BITS[k], dv)) return false;
+                last.v[i] = static_cast<int16_t>(last.v[i] + dv);
+            }
+        }
+    }
+    taken++;
+    s = last;
+    return true;
+}
+
+//!##################################################
+//!######## Sample log ##############################
+//! Ring of N blocks, the newest still being written.
+//! Blocks are numbered from 0 as they're started; a
+//! reader asks for one by number and gets nothing
+//! once it has been written over.
+//!##################################################
+
+template <uint8_t N>
+class TsLog {
+    public:
+        TsLog() { writer.begin(blocks[0]); }
+        TsLog(const TsLog &) = delete;
+
+        void add(const TsSample &s) {
+            if (!writer.append(s)) {
+                open++;
+                head = (head + 1) % N;
+                writer.begin(blocks[head]);
+                writer.append(s);
+            }
+            lens[head] = writer.size();
+        }
+
+        uint32_t newest() const { return open; } // the one being written
+        uint32_t oldest() const { return open >= N ? open - N + 1 : 0; }
+
+        // Block seq and its length; 0 when it isn't held (or has nothing in it yet)
+        size_t block(uint32_t seq, const uint8_t *&data) const {
+            if (seq < oldest() || seq > open) return 0;
+            uint8_t at = (head + N - (open - seq)) % N;
+            data = blocks[at];
+            return lens[at];
+        }
+
+    private:
+        uint8_t       blocks[N][TS_BLOCK_BYTES];
+        uint8_t       lens[N] = {};
+        uint8_t       head    = 0;
+        uint32_t      open    = 0;
+        TsBlockWriter writer;
+};
+
+//!##################################################
+//!######## Base64 ##################################
+//! How a block rides in a JSON line.
+//!##################################################
+
+static const char TS_B64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// out needs 4 * ((len + 2) / 3) + 1; returns the characters written, 0 if it won't fit
+size_t ts_base64(const uint8_t *in, size_t len, char *out, size_t cap) {
+    size_t need = 4 * ((len + 2) / 3);
+    if (need + 1 > cap) return 0;
+    char *o = out;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = static_cast<uint32_t>(in[i]) << 16;
+        if (i + 1 < len) v |= static_cast<uint32_t>(in[i + 1]) << 8;
+        if (i + 2 < len) v |= in[i + 2];
+        *o++ = TS_B64[(v >> 18) & 63];
+        *o++ = TS_B64[(v >> 12) & 63];
+        *o++ = i + 1 < len ? TS_B64[(v >> 6) & 63] : '=';
+        *o++ = i + 2 < len ? TS_B64[v & 63] : '=';
+    }
+    *o = '\0';
+    return need;
+}
+
+// Back to bytes; 0 on a character that isn't base64 or when it won't fit
+size_t ts_unbase64(const char *in, uint8_t *out, size_t cap) {
+    size_t   n    = 0;
+    uint32_t v    = 0;
+    uint8_t  bits = 0;
+    for (; *in && *in != '='; ++in) {
+        const char *at = strchr(TS_B64, *in);
+        if (!at) return 0;
+        v     = (v << 6) | static_cast<uint32_t>(at - TS_B64);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n == cap) return 0;
+            out[n++] = (v >> bits) & 0xFF;
+        }
+    }
+    return n;
+}
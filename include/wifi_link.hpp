@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Arduino.h>
+
+//!##################################################
+//!######## WiFi link ###############################
+//! Connect / back off / reconnect, driven from loop()
+//! so nothing waits on the access point: the UART
+//! bridge runs from boot, the web server starts on
+//! the first IP.
+//!
+//! The WiFi event handler (its own task) only sets
+//! flags; service() acts on them. A refused or
+//! timed-out attempt backs off 1 s, 2 s, 4 s ... up
+//! to WIFI_BACKOFF_MAX_MS; a drop after being up
+//! retries after the minimum.
+//!##################################################
+
+enum class WifiState : uint8_t { IDLE, CONNECTING, UP, BACKOFF };
+
+static const char *const WIFI_STATE_NAMES[] = { "idle", "connecting", "up", "backoff" };
+
+static constexpr unsigned long WIFI_CONNECT_TIMEOUT_MS = 15000;
+static constexpr unsigned long WIFI_BACKOFF_MIN_MS     = 1000;
+static constexpr unsigned long WIFI_BACKOFF_MAX_MS     = 60000;
+
+typedef void (*WifiActionFn)();
+
+class WifiLink {
+    public:
+        WifiActionFn connect = nullptr; // (re)starts an association attempt
+        WifiActionFn on_up   = nullptr; // got an IP
+        WifiActionFn on_down = nullptr; // lost it
+
+        void start(unsigned long now) { attempt(now); }
+
+        // From the WiFi event handler
+        void link_up()   { up = true; }
+        void link_down() { up = false; dropped = true; }
+
+        void service(unsigned long now);
+
+        WifiState     status() const   { return state; }
+        const char   *name() const     { return WIFI_STATE_NAMES[static_cast<uint8_t>(state)]; }
+        uint16_t      attempts() const { return tries; }
+        unsigned long backoff() const  { return delay_ms; }
+
+    private:
+        WifiState     state    = WifiState::IDLE;
+        volatile bool up       = false;
+        volatile bool dropped  = false; // a disconnect since the attempt began
+        unsigned long since    = 0;
+        unsigned long delay_ms = WIFI_BACKOFF_MIN_MS;
+        uint16_t      tries    = 0;
+
+        void attempt(unsigned long now);
+        void back_off(unsigned long now);
+};
+
+void WifiLink::attempt(unsigned long now) {
+    state = WifiState::CONNECTING;
+    since = now;
+    tries++;
+    dropped = false;
+    if (connect) connect();
+}
+
+void WifiLink::back_off(unsigned long now) {
+    state = WifiState::BACKOFF;
+    since = now;
+}
+
+void WifiLink::service(unsigned long now) {
+    switch (state) {
+        case WifiState::IDLE:
+            break;
+
+        case WifiState::CONNECTING:
+            if (up) {
+                state    = WifiState::UP;
+                delay_ms = WIFI_BACKOFF_MIN_MS;
+                tries    = 0;
+                if (on_up) on_up();
+            } else if (dropped || now - since >= WIFI_CONNECT_TIMEOUT_MS) {
+                back_off(now);
+            }
+            break;
+
+        case WifiState::UP:
+            if (!up) {
+                if (on_down) on_down();
+                back_off(now);
+            }
+            break;
+
+        case WifiState::BACKOFF:
+            if (now - since >= delay_ms) {
+                // Only a failed attempt grows the wait; a drop from UP left it at the minimum
+                if (tries > 0) delay_ms = (delay_ms * 2 < WIFI_BACKOFF_MAX_MS) ? delay_ms * 2 : WIFI_BACKOFF_MAX_MS;
+                attempt(now);
+            }
+            break;
+    }
+}
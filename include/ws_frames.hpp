@@ -0,0 +1,156 @@
+#pragma once
+
+#include <Arduino.h>
+#include <cstring>
+
+//!##################################################
+//!######## Dashboard WebSocket frames ##############
+//! Binary frames on /ws, little-endian, no padding.
+//!
+//! Down, bridge -> browser:
+//!   samples  [1][n][ms u32] then n x
+//!            [node][zone][pH f32][EC f32][temp f32]
+//!            one M:1002's zones, 6 + 14n bytes
+//!   ack      [2][seq u16][status]
+//! The MCU's other replies (2006, 2007, 2010, 2013,
+//! 2015) go down as text frames, the line as-is.
+//!
+//! Up, browser -> bridge:
+//!   command  [kind][seq u16][node][zone][args]
+//!     state   run u8
+//!     dose    gro, micro, bloom, ph_up, ph_dn f32 mL
+//!     cancel  job id u16 (0: all)
+//!     select  catalog profile id u16
+//! Every command is acked with its seq once the bridge
+//! has taken it for the MCU (what a REST POST's 200
+//! means), or refused. SSE and the REST endpoints
+//! stay for clients without a socket.
+//!##################################################
+
+static constexpr uint8_t WS_FRAME_SAMPLES = 1;
+static constexpr uint8_t WS_FRAME_ACK     = 2;
+
+static constexpr uint8_t WS_CMD_STATE  = 0x10;
+static constexpr uint8_t WS_CMD_DOSE   = 0x11;
+static constexpr uint8_t WS_CMD_CANCEL = 0x12;
+static constexpr uint8_t WS_CMD_SELECT = 0x13;
+
+static constexpr uint8_t WS_ACK_OK      = 0;
+static constexpr uint8_t WS_ACK_BAD     = 1; // malformed, unknown kind, or a node / zone out of range
+static constexpr uint8_t WS_ACK_UNKNOWN = 2; // no such profile in the catalog
+
+static constexpr size_t WS_SAMPLE_HEADER = 6;
+static constexpr size_t WS_SAMPLE_SIZE   = 14;
+static constexpr size_t WS_ACK_SIZE      = 4;
+static constexpr size_t WS_CMD_HEADER    = 5;
+
+static inline uint8_t *ws_put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static inline uint8_t *ws_put_u32(uint8_t *p, uint32_t v) {
+    for (uint8_t i = 0; i < 4; ++i) p[i] = (v >> (8 * i)) & 0xFF;
+    return p + 4;
+}
+
+static inline uint8_t *ws_put_f32(uint8_t *p, float f) {
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    return ws_put_u32(p, v);
+}
+
+static inline uint16_t ws_get_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static inline float ws_get_f32(const uint8_t *p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+// One samples frame, filled a zone at a time
+template <size_t MAX_SAMPLES>
+class WsSampleFrame {
+    public:
+        void begin(uint32_t ms) {
+            buf[0] = WS_FRAME_SAMPLES;
+            buf[1] = 0;
+            ws_put_u32(buf + 2, ms);
+        }
+
+        bool add(uint8_t node, uint8_t zone, float ph, float ec, float temp) {
+            if (buf[1] >= MAX_SAMPLES) return false;
+            uint8_t *p = buf + size();
+            *p++ = node;
+            *p++ = zone;
+            p = ws_put_f32(p, ph);
+            p = ws_put_f32(p, ec);
+            ws_put_f32(p, temp);
+            buf[1]++;
+            return true;
+        }
+
+        const uint8_t *data() const { return buf; }
+        size_t         size() const { return WS_SAMPLE_HEADER + buf[1] * WS_SAMPLE_SIZE; }
+        uint8_t        count() const { return buf[1]; }
+
+    private:
+        uint8_t buf[WS_SAMPLE_HEADER + MAX_SAMPLES * WS_SAMPLE_SIZE] = {};
+};
+
+static inline size_t ws_ack_frame(uint8_t *out, uint16_t seq, uint8_t status) {
+    out[0] = WS_FRAME_ACK;
+    ws_put_u16(out + 1, seq);
+    out[3] = status;
+    return WS_ACK_SIZE;
+}
+
+struct WsCommand {
+    uint8_t  kind;
+    uint16_t seq;
+    uint8_t  node;
+    uint8_t  zone;
+    bool     run;        // state
+    float    ml[5];      // dose: gro, micro, bloom, ph_up, ph_dn
+    uint16_t id;         // cancel, select
+};
+
+// Arguments each kind carries after the header; 0 for an unknown kind
+static inline size_t ws_command_args(uint8_t kind) {
+    switch (kind) {
+        case WS_CMD_STATE:  return 1;
+        case WS_CMD_DOSE:   return 5 * 4;
+        case WS_CMD_CANCEL: return 2;
+        case WS_CMD_SELECT: return 2;
+        default:            return 0;
+    }
+}
+
+// False for a frame too short for its kind, or an unknown kind; cmd.seq is still set when the header was there
+static inline bool ws_parse_command(const uint8_t *data, size_t len, WsCommand &cmd) {
+    cmd = {};
+    if (len < WS_CMD_HEADER) return false;
+    cmd.kind = data[0];
+    cmd.seq  = ws_get_u16(data + 1);
+    cmd.node = data[3];
+    cmd.zone = data[4];
+
+    size_t args = ws_command_args(cmd.kind);
+    if (args == 0 || len < WS_CMD_HEADER + args) return false;
+
+    const uint8_t *p = data + WS_CMD_HEADER;
+    switch (cmd.kind) {
+        case WS_CMD_STATE:
+            cmd.run = p[0] != 0;
+            break;
+        case WS_CMD_DOSE:
+            for (uint8_t i = 0; i < 5; ++i) cmd.ml[i] = ws_get_f32(p + 4 * i);
+            break;
+        default:
+            cmd.id = ws_get_u16(p);
+            break;
+    }
+    return true;
+}
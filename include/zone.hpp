@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+#include <utility>
+
+#include "sensors/ec_sensor.hpp"
+#include "sensors/ph_sensor.hpp"
+#include "sensors/temp_sensor.hpp"
+#include "sensors/sensor_array.hpp"
+#include "sensors/probe_calibration.hpp"
+
+#include "board_config.hpp"
+#include "kalman.hpp"
+#include "motor.hpp"
+#include "plant_profile.hpp"
+#include "dose_scheduler.hpp"
+#include "gain_estimator.hpp"
+#include "serial_comm.hpp"
+
+//!##################################################
+//!######## Zone ####################################
+//! One reservoir and everything that controls it:
+//! probes, filters, profile, volume, dosing schedule,
+//! fitted gains and mixer. main.cpp runs one per
+//! Board::ZONES entry; the dosing pumps are shared
+//! and the dose queue hands them out (dose_queue.hpp).
+//!##################################################
+
+// Nominal lines until a probe is calibrated (M:2009), then the persisted per-channel table
+constexpr SensorCal<Board::NUM_EC> ec_nominal_cal(const Board::ZonePins &pins) {
+    return nominal_cal<ec_sensor>(scaled(pins.ec_scale, ec_sensor::counts_to_ms(1.0f)), 0.0f);
+}
+static constexpr SensorCal<Board::NUM_PH> PH_NOMINAL_CAL =
+    nominal_cal<ph_sensor>(filled<Board::NUM_PH>(ph_sensor::SLOPE), ph_sensor::OFFSET);
+static constexpr SensorCal<Board::NUM_TEMP> TEMP_NOMINAL_CAL =
+    nominal_cal<temp_sensor>(filled<Board::NUM_TEMP>(1.0f), 0.0f);
+
+// Automated dose cycle in the queue: the readings it was planned from and what has gone in
+struct AutoCycle {
+    bool  active = false;
+    bool  aborted;
+    float ec_before;
+    float ph_before;
+    float volume_l;
+    float ml[NUM_PUMPS];
+};
+
+class Zone {
+    public:
+        Zone(uint8_t index, const Board::ZonePins &pins)
+            : index(index), valve(pins.valve), ec_nominal(ec_nominal_cal(pins)),
+              ecProbes(pins.ec, ec_nominal), phProbes(pins.ph, PH_NOMINAL_CAL), tempProbes(pins.temp, TEMP_NOMINAL_CAL),
+              mixer(pins.mix_in1, pins.mix_in2, pins.mix_ena), ecCalibrator(ecProbes), phCalibrator(phProbes) {}
+
+        const uint8_t index;
+        const int8_t  valve;
+
+        const SensorCal<Board::NUM_EC>          ec_nominal;
+        SensorArray<ec_sensor, Board::NUM_EC>     ecProbes;
+        SensorArray<ph_sensor, Board::NUM_PH>     phProbes;
+        SensorArray<temp_sensor, Board::NUM_TEMP> tempProbes;
+
+        Mixer mixer;
+
+        KalmanFilter ec_kalman   { 0.7f,  0.3f };
+        KalmanFilter pH_kalman   { 6.5f,  0.1f };
+        KalmanFilter temp_kalman { 22.0f, 0.4f };
+
+        ProbeHealth<Board::NUM_EC>   ecHealth   { EC_FILTER_CONFIG };
+        ProbeHealth<Board::NUM_PH>   phHealth   { PH_FILTER_CONFIG };
+        ProbeHealth<Board::NUM_TEMP> tempHealth { TEMP_FILTER_CONFIG };
+
+        // Last fault masks logged, so only changes are reported
+        uint8_t ec_faults = 0, ph_faults = 0, temp_faults = 0;
+
+        TargetPlant plant;
+        float       reservoir_volume_ml = 10000.0f;
+
+        // Populated every loop() pass while the zone runs (or a recipe runs on it)
+        float latest_ph   = 0.0f;
+        float latest_ec   = 0.0f;
+        float latest_temp = 0.0f;
+
+        // STANDBY / RUNNING, per zone
+        bool running = false;
+
+        DoseScheduler   scheduler;
+        PlantGains      gains;
+        DoseObservation doseObs;
+        unsigned long   doseObsMillis = 0;
+        AutoCycle       autoCycle;
+
+        // Only one point in progress per zone; only in STANDBY
+        ProbeCalibrator<ec_sensor, Board::NUM_EC> ecCalibrator;
+        ProbeCalibrator<ph_sensor, Board::NUM_PH> phCalibrator;
+
+        // Samples every probe and runs it through the screening and filters
+        void read_sensors() {
+            latest_temp = temp_filter(tempProbes.read(), temp_kalman, tempHealth);
+            auto ec_raw = ecProbes.read(latest_temp);
+            auto ph_raw = phProbes.read(latest_temp);
+            latest_ec = ec_filter(ec_raw, ec_kalman, ecHealth);
+            latest_ph = ph_filter(ph_raw, pH_kalman, phHealth);
+        }
+
+        // Temperature of a calibration solution; NAN when every thermistor is off-scale
+        float cal_temp() const {
+            std::array<float, Board::NUM_TEMP> t = tempProbes.read();
+            float sum = 0.0f;
+            uint8_t n = 0;
+            for (float v : t) {
+                if (isfinite(v)) { sum += v; n++; }
+            }
+            return n ? sum / n : NAN;
+        }
+
+        bool calibrating() const { return ecCalibrator.capturing() || phCalibrator.capturing(); }
+
+        ZoneReading reading() const { return { latest_ph, latest_ec, latest_temp }; }
+};
+
+// Board::ZONES as Zones, built in place (each Zone's calibrators point into it)
+template <size_t... I>
+std::array<Zone, sizeof...(I)> make_zones(std::index_sequence<I...>) {
+    return {{ Zone(I, Board::ZONES[I])... }};
+}
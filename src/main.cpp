@@ -2,150 +2,695 @@
 #include "sensors/ph_sensor.hpp"
 #include "sensors/temp_sensor.hpp"
 #include "sensors/water_level_sensor.hpp"
+#include "sensors/sensor_array.hpp"
+#include "sensors/probe_calibration.hpp"
 
+#include "board_config.hpp"
 #include "serial_comm.hpp"
 #include "controller.hpp"
 #include "kalman.hpp"
 #include "motor.hpp"
+#include "pump_calibration.hpp"
 #include "plant_profile.hpp"
+#include "state_store.hpp"
+#include "dose_scheduler.hpp"
+#include "gain_estimator.hpp"
+#include "dose_planner.hpp"
+#include "dose_queue.hpp"
+#include "recipe.hpp"
+#include "step_timer.hpp"
+#include "idle_sleep.hpp"
+#include "mem_watch.hpp"
+#include "zone.hpp"
+#include "ts_codec.hpp"
 
 #include "wiring_private.h"
 #include <numeric>
 #include <array>
 
 #define DEBUG_PORT Serial
-#define COMM_PORT  Serial1
-
-//!#############################
-//!######## Pin Defines ########
-//!#############################
-
-#define EC1_PIN  A5
-#define EC2_PIN  A9
-#define EC3_PIN  A13
-#define EC4_PIN  A1
-
-#define pH1_PIN  A3
-#define pH2_PIN  A15
-
-#define TEMP1_PIN A2
-#define TEMP2_PIN A6
-#define TEMP3_PIN A10
-#define TEMP4_PIN A14
-
-#define MIX_PIN_IN1 37
-#define MIX_PIN_IN2 39
-#define MIX_PIN_ENA 35
-
-#define pH_UP_STEP_PIN   50
-#define pH_UP_DIR_PIN    52
-#define pH_DOWN_STEP_PIN 48
-#define pH_DOWN_DIR_PIN  46
-#define GRO_STEP_PIN     36
-#define GRO_DIR_PIN      34
-#define MICRO_STEP_PIN   38
-#define MICRO_DIR_PIN    40
-#define BLOOM_STEP_PIN   42
-#define BLOOM_DIR_PIN    44
+#define COMM_UART  Serial1
+#define COMM_PORT  commBus
+
+// Bus address (serial_comm.hpp): 0 for a point-to-point link to the bridge,
+// 1..NODE_MAX when several controllers share one bridge; set per unit with -DNODE_ADDR=n
+#ifndef NODE_ADDR
+#define NODE_ADDR 0
+#endif
+
+// Optional normally-open E-stop to GND; halts the pumps from its pin interrupt
+// #define ESTOP_PIN 22
 
 //!#######################################
 //!######## Serial 2 (TMC2209) ###########
+//! SERCOM and pins come from the board
+//! descriptor (board_config.hpp)
 //!#######################################
 
-Uart TMC2209_Serial(&sercom1, 17, 16, SERCOM_RX_PAD_1, UART_TX_PAD_0);
-void SERCOM1_0_Handler() { TMC2209_Serial.IrqHandler(); }
-void SERCOM1_1_Handler() { TMC2209_Serial.IrqHandler(); }
-void SERCOM1_2_Handler() { TMC2209_Serial.IrqHandler(); }
-void SERCOM1_3_Handler() { TMC2209_Serial.IrqHandler(); }
+Uart TMC2209_Serial(&BOARD_TMC_SERCOM, Board::TMC_RX_PIN, Board::TMC_TX_PIN, Board::TMC_RX_PAD, Board::TMC_TX_PAD);
+void BOARD_TMC_SERCOM_HANDLER(0)() { TMC2209_Serial.IrqHandler(); }
+void BOARD_TMC_SERCOM_HANDLER(1)() { TMC2209_Serial.IrqHandler(); }
+void BOARD_TMC_SERCOM_HANDLER(2)() { TMC2209_Serial.IrqHandler(); }
+void BOARD_TMC_SERCOM_HANDLER(3)() { TMC2209_Serial.IrqHandler(); }
 #define TMC2209_PORT TMC2209_Serial
 
 //!################################################
 //!######## Sensor & Motor Objects ################
 //!################################################
 
-ec_sensor ec1(EC1_PIN, 660.37735849f);
-ec_sensor ec2(EC2_PIN, 2456.14035088f);
-ec_sensor ec3(EC3_PIN, 633.4841629f);
-ec_sensor ec4(EC4_PIN, 583.33333333f);
+// Indexed by PumpId; shared by every zone
+PumpSet<NUM_PUMPS> pumps(Board::PUMP_PINS, TMC2209_PORT);
+
+static const unsigned long MIX_DURATION_MS = 7000UL;
+
+//!##################################################
+//!######## Zones ###################################
+//! One per reservoir (zone.hpp): its own probes,
+//! filters, profile, volume, schedule and mixer.
+//! Commands pick one with "Z" (none: zone 0); logs
+//! count them from 1.
+//!##################################################
+
+static constexpr uint8_t NUM_ZONES = Board::NUM_ZONES;
+static_assert(NUM_ZONES >= 1 && NUM_ZONES <= ZONE_MAX && NUM_ZONES <= DOSE_MAX_ZONES, "too many zones");
+
+std::array<Zone, NUM_ZONES> zones = make_zones(std::make_index_sequence<NUM_ZONES>{});
 
-ph_sensor ph1(pH1_PIN);
-ph_sensor ph2(pH2_PIN);
+// "Zone n: " in front of a log line, when there is more than one
+void log_zone(const Zone &z) {
+    if (NUM_ZONES == 1) return;
+    DEBUG_PORT.print("Zone ");
+    DEBUG_PORT.print(z.index + 1);
+    DEBUG_PORT.print(": ");
+}
+
+bool any_zone_running() {
+    for (const Zone &z : zones) {
+        if (z.running) return true;
+    }
+    return false;
+}
 
-temp_sensor temp1(TEMP1_PIN);
-temp_sensor temp2(TEMP2_PIN);
-temp_sensor temp3(TEMP3_PIN);
-temp_sensor temp4(TEMP4_PIN);
+//!##################################################
+//!######## Dose queue ##############################
+//! Pumps step from the TC3 ISR, so serial is still
+//! read while dosing and M:2002 run:false / M:2008
+//! stop a pump within one loop() pass. The queue is
+//! also the pump arbiter: one zone on the pumps at a
+//! time, every zone mixing on its own.
+//!##################################################
 
-Motor ph_up(pH_UP_DIR_PIN,    pH_UP_STEP_PIN,   TMC2209_PORT);
-Motor ph_down(pH_DOWN_DIR_PIN, pH_DOWN_STEP_PIN, TMC2209_PORT);
-Motor gro(GRO_DIR_PIN,         GRO_STEP_PIN,     TMC2209_PORT);
-Motor micro(MICRO_DIR_PIN,     MICRO_STEP_PIN,   TMC2209_PORT);
-Motor bloom(BLOOM_DIR_PIN,     BLOOM_STEP_PIN,   TMC2209_PORT);
+DoseQueue doseQueue(pumps);
+
+// Opens the zone's valve on the dosing manifold and closes the others
+void route_zone(uint8_t zone) {
+    for (const Zone &z : zones) {
+        if (z.valve >= 0) digitalWrite(z.valve, z.index == zone ? HIGH : LOW);
+    }
+}
 
-KalmanFilter ec_kalman;
-KalmanFilter pH_kalman;
-KalmanFilter temp_kalman;
+void step_tick() {
+    mem_isr_mark();
+    doseQueue.step_isr();
+}
 
-TargetPlant plant;
+#ifdef ESTOP_PIN
+void estop_isr() { doseQueue.halt_isr(); }
+#endif
 
 //!##################################################
 //!######## Volume / Depletion Config ###############
+//! Per reservoir
 //!##################################################
 
 static const int   NUM_PLANTS                  = 21;
 static const float UPTAKE_ML_PER_PLANT_PER_DAY = 25.0f;
-static const float INTERVALS_PER_DAY           = 96.0f;
-static const float UPTAKE_PER_INTERVAL =
-    (NUM_PLANTS * UPTAKE_ML_PER_PLANT_PER_DAY) / INTERVALS_PER_DAY;
+static const float MS_PER_DAY                  = 86400000.0f;
+static const float UPTAKE_ML_PER_MS =
+    (NUM_PLANTS * UPTAKE_ML_PER_PLANT_PER_DAY) / MS_PER_DAY;
 
-static float reservoir_volume_ml   = 10000.0f;
 static const float RESERVOIR_MIN_ML = 2000.0f;
 
 //!##################################################
-//!######## Latest sensor cache #####################
-//! Populated every loop(), sent on M:1001 requests #
+//!######## Zone run state ##########################
+//! Zone::running false (STANDBY): no automated dosing
+//! there, and no sensor reads unless the recipe runs
+//! on it. Serial polling and loading-dose (M:2001)
+//! still run.
+//!
+//! Dosing scheduler per zone: evaluates on drift /
+//! band exit, 3 min settle after a mix, 60 min
+//! backstop (see dose_scheduler.hpp). Plant gains per
+//! zone, fitted after every automated dose once the
+//! mix has settled (see gain_estimator.hpp).
 //!##################################################
 
-static float latest_ph   = 0.0f;
-static float latest_ec   = 0.0f;
-static float latest_temp = 0.0f;
+static constexpr uint8_t NUM_GAINS = 4;
+
+GainEstimator &gain_estimator(Zone &z, uint8_t i) {
+    GainEstimator *const all[NUM_GAINS] = { &z.gains.ec, &z.gains.ph_up, &z.gains.ph_down, &z.gains.nutrient_ph };
+    return *all[i];
+}
 
 //!##################################################
-//!######## System run state ########################
-//! When false: no sensor reads, no automated dosing.
-//! Serial polling and loading-dose (M:2001) still run.
+//!######## Persistent state ########################
+//! Top 64 KB of flash (8 blocks). Run state, profile
+//! and calibrations are written when they change;
+//! filters and volume are checkpointed on a timer.
+//! A zone checkpoint is 4 records of 32 B: at one
+//! every 5 min a block (64 of them) fills in ~5 h,
+//! so each of the 8 is erased every ~43 h, sooner
+//! per running zone; ~200 erases a year against the
+//! SAMD51's rated 25k.
+//!
+//! Zone 0 keeps the single-reservoir keys; every
+//! further zone has its own copy of ZONE_KEYS after
+//! the recipe.
 //!##################################################
 
-static bool is_system_running = false;
+enum StoreKey : uint8_t {
+    KEY_RUN_STATE = 0,
+    KEY_PROFILE,
+    KEY_EC_FILTER,
+    KEY_PH_FILTER,
+    KEY_TEMP_FILTER,
+    KEY_CONTROL,
+    KEY_PUMP_CAL_0,                       // + PumpId
+    KEY_PUMP_CAL_END = KEY_PUMP_CAL_0 + NUM_PUMPS,
+    KEY_GAINS = KEY_PUMP_CAL_END,
+    KEY_EC_CAL,
+    KEY_PH_CAL,
+    KEY_RECIPE_0,                         // + chunk
+    KEY_RECIPE_END = KEY_RECIPE_0 + RECIPE_NUM_CHUNKS,
+    KEY_ZONE_1 = KEY_RECIPE_END,          // + (zone - 1) * NUM_ZONE_KEYS + ZONE_KEYS position
+};
+
+static constexpr StoreKey ZONE_KEYS[] = {
+    KEY_RUN_STATE, KEY_PROFILE, KEY_EC_FILTER, KEY_PH_FILTER, KEY_TEMP_FILTER, KEY_CONTROL,
+    KEY_GAINS, KEY_EC_CAL, KEY_PH_CAL
+};
+static constexpr uint8_t NUM_ZONE_KEYS = sizeof(ZONE_KEYS) / sizeof(ZONE_KEYS[0]);
+static_assert(KEY_ZONE_1 + (NUM_ZONES - 1) * NUM_ZONE_KEYS <= STORE_MAX_KEYS, "state store keys for the zones");
+
+// Store key of one of ZONE_KEYS for a zone
+uint8_t zone_key(const Zone &z, StoreKey key) {
+    if (z.index == 0) return key;
+    uint8_t i = 0;
+    while (i < NUM_ZONE_KEYS - 1 && ZONE_KEYS[i] != key) i++;
+    return KEY_ZONE_1 + (z.index - 1) * NUM_ZONE_KEYS + i;
+}
 
-//!##################################################
-//!######## Dosing timer ############################
-//!##################################################
+struct GainCheckpoint {
+    float    gain[4];
+    float    var[4];
+    uint32_t count[4];
+};
+
+struct ControlCheckpoint {
+    float    reservoir_volume_ml;
+    uint32_t ms_since_eval;
+};
 
-static unsigned long lastDoseMillis = 0;
-static const unsigned long doseInterval = 15UL * 60UL * 1000UL;
+#if defined(__SAMD51__)
+static Samd51Flash storeFlash(8);
+#else
+static HostFlash   storeFlash(8); // tools/serial_replay.cpp
+#endif
+static StateStore  store(storeFlash);
+static bool        store_ok = false;
+
+static unsigned long lastCheckpointMillis = 0;
+static const unsigned long checkpointInterval = 5UL * 60UL * 1000UL;
 
 static unsigned long lastDebugMillis = 0;
 static const unsigned long debugInterval = 2000UL;
 
+// Zones are sampled and serviced at this rate rather than on every loop() pass; the filter
+// constants are set for it (kalman.hpp)
+static unsigned long lastSampleMillis = 0;
+static const unsigned long sampleInterval = FILTER_SAMPLE_MS;
+
+// Running zones' readings, packed (ts_codec.hpp), for the bridge to read back after a restart
+// (M:2018): ~40 samples a block at this rate, so a couple of hours
+static constexpr uint8_t SAMPLE_LOG_BLOCKS = 24;
+static unsigned long lastSampleLogMillis = 0;
+static const unsigned long sampleLogInterval = 10000UL;
+static TsLog<SAMPLE_LOG_BLOCKS> sampleLog[NUM_ZONES];
+
+static DutyCycle dutyCycle;
+static uint32_t  awakeSinceMicros = 0;
+
 static CommReader commReader;
+static BusPort    commBus(COMM_UART);
+
+// Heap and stack lows (mem_watch.hpp); every parsed line's JsonDocument is counted as "comm"
+static CountingAllocator commAlloc("comm");
+static MemWatch          memWatch;
+
+void checkpoint_control(Zone &z, unsigned long now) {
+    if (!store_ok) return;
+
+    ControlCheckpoint ctrl = { z.reservoir_volume_ml, static_cast<uint32_t>(z.scheduler.ms_since_eval(now)) };
+    store.put(zone_key(z, KEY_EC_FILTER),   z.ec_kalman);
+    store.put(zone_key(z, KEY_PH_FILTER),   z.pH_kalman);
+    store.put(zone_key(z, KEY_TEMP_FILTER), z.temp_kalman);
+    store.put(zone_key(z, KEY_CONTROL),     ctrl);
+}
+
+void checkpoint_gains(Zone &z) {
+    if (!store_ok) return;
+
+    GainCheckpoint ckpt;
+    for (uint8_t i = 0; i < NUM_GAINS; ++i) {
+        ckpt.gain[i]  = gain_estimator(z, i).gain();
+        ckpt.var[i]   = gain_estimator(z, i).variance();
+        ckpt.count[i] = gain_estimator(z, i).observations();
+    }
+    store.put(zone_key(z, KEY_GAINS), ckpt);
+}
+
+// Logs a probe dropping out of (or back into) the fused reading
+template <size_t N>
+void report_probe_fault(const Zone &z, const char *name, const ProbeHealth<N> &health, uint8_t &last_mask) {
+    uint8_t mask = health.fault_mask();
+    if (mask == last_mask) return;
+
+    for (size_t i = 0; i < N; ++i) {
+        if (((mask ^ last_mask) & (1 << i)) == 0) continue;
+        log_zone(z);
+        DEBUG_PORT.print(name);
+        DEBUG_PORT.print(" probe ");
+        DEBUG_PORT.print(static_cast<int>(i + 1));
+        if (mask & (1 << i)) {
+            uint8_t f = health.ch[i].fault;
+            DEBUG_PORT.println(f == FAULT_RANGE ? " out of range, dropped" :
+                               f == FAULT_STUCK ? " stuck, dropped" : " disagrees with the others, dropped");
+        } else {
+            DEBUG_PORT.println(" back in use");
+        }
+    }
+    last_mask = mask;
+}
+
+void report_probe_faults(Zone &z) {
+    report_probe_fault(z, "EC",   z.ecHealth,   z.ec_faults);
+    report_probe_fault(z, "pH",   z.phHealth,   z.ph_faults);
+    report_probe_fault(z, "Temp", z.tempHealth, z.temp_faults);
+}
+
+// Completes the pending dose observation with the settled readings
+void finish_dose_observation(Zone &z, unsigned long now) {
+    if (!z.doseObs.pending || now - z.doseObsMillis < z.scheduler.cfg.min_settle_ms) return;
+
+    PlantGains &gains = z.gains;
+    gains.observe(z.doseObs, z.latest_ec, z.latest_ph);
+    z.doseObs.pending = false;
+    checkpoint_gains(z);
+
+    log_zone(z);
+    DEBUG_PORT.print("Gains -> EC ");
+    DEBUG_PORT.print(gains.ec.gain(), 3);
+    DEBUG_PORT.print(" +/-");
+    DEBUG_PORT.print(2.0f * gains.ec.sigma(), 3);
+    DEBUG_PORT.print(" | pH up ");
+    DEBUG_PORT.print(gains.ph_up.gain(), 3);
+    DEBUG_PORT.print(" +/-");
+    DEBUG_PORT.print(2.0f * gains.ph_up.sigma(), 3);
+    DEBUG_PORT.print(" | pH down ");
+    DEBUG_PORT.print(gains.ph_down.gain(), 3);
+    DEBUG_PORT.print(" +/-");
+    DEBUG_PORT.print(2.0f * gains.ph_down.sigma(), 3);
+    DEBUG_PORT.print(" | nutrient pH ");
+    DEBUG_PORT.print(gains.nutrient_ph.gain(), 3);
+    DEBUG_PORT.print(" +/-");
+    DEBUG_PORT.println(2.0f * gains.nutrient_ph.sigma(), 3);
+}
+
+// Called once every AUTO job of the zone has finished or been aborted
+void close_auto_cycle(Zone &z, unsigned long now) {
+    const AutoCycle &cycle = z.autoCycle;
+    float nutrient = cycle.ml[PUMP_GRO] + cycle.ml[PUMP_MICRO] + cycle.ml[PUMP_BLOOM];
+    float up       = cycle.ml[PUMP_PH_UP];
+    float down     = cycle.ml[PUMP_PH_DOWN];
+    bool  dosed    = nutrient > 0.0f || up > 0.0f || down > 0.0f;
+
+    // The settle window starts once mixing is done
+    z.scheduler.evaluated(now, dosed);
+
+    // A cut-short cycle wasn't mixed, so its settled readings say nothing about the gains
+    if (dosed && !cycle.aborted) {
+        z.doseObs = { true, cycle.ec_before, cycle.ph_before, nutrient, up, down, cycle.volume_l };
+        z.doseObsMillis = now;
+        log_zone(z);
+        DEBUG_PORT.println("Dosed and mixed.");
+    } else if (cycle.aborted) {
+        log_zone(z);
+        DEBUG_PORT.println("Automated dose aborted.");
+    }
+
+    z.autoCycle.active = false;
+    checkpoint_control(z, now);
+}
+
+//!##################################################
+//!######## Recipe ##################################
+//! One table per controller, run on one zone at a
+//! time (the "Z" of the M:2012 that starts it).
+//! Runs in either state; while it runs that zone's
+//! automated dosing holds off and its sensors are
+//! read even in STANDBY so its waits and branches
+//! see live values. The table survives a reset, a
+//! run in progress doesn't.
+//!##################################################
+
+static RecipeRunner recipe;
+static uint16_t     recipeJobId = 0;
+static bool         recipeDosed = false;
+static uint8_t      recipeZone  = 0;
+
+bool recipe_dose(PumpId pump, float ml) {
+    recipeJobId = doseQueue.push_dose(pump, ml, JobSource::RECIPE, recipeZone);
+    if (recipeJobId) recipeDosed = true;
+    return recipeJobId != 0;
+}
+
+bool recipe_mix(unsigned long duration_ms) {
+    recipeJobId = doseQueue.push_mix(duration_ms, JobSource::RECIPE, recipeZone);
+    return recipeJobId != 0;
+}
+
+bool recipe_running_on(const Zone &z) { return recipe.running() && recipeZone == z.index; }
+
+void report_recipe(const char *event) {
+    uint8_t pc = recipe.step() < RECIPE_MAX_STEPS ? recipe.step() : RECIPE_MAX_STEPS - 1;
+    send_recipe_status(COMM_PORT, RECIPE_STATE_NAMES[static_cast<uint8_t>(recipe.status())], recipe.step(),
+                       RECIPE_OP_NAMES[recipe.steps[pc].op], recipe.size(), event, recipe.reason(), recipeZone);
+}
+
+void on_recipe_event(const RecipeRunner &r, RecipeEvent event) {
+    switch (event) {
+        case RecipeEvent::STEP:    report_recipe("step");    return;
+        case RecipeEvent::TIMEOUT: report_recipe("timeout"); return;
+        case RecipeEvent::DONE:    report_recipe("done");    break;
+        case RecipeEvent::ABORTED: report_recipe("aborted"); break;
+    }
+
+    // Whatever it still had queued goes with it
+    if (recipeJobId) doseQueue.cancel(recipeJobId);
+    recipeJobId = 0;
+
+    // Its doses restart the settle window like an automated one
+    if (recipeDosed) zones[recipeZone].scheduler.evaluated(millis(), true);
+
+    DEBUG_PORT.print("Recipe ");
+    if (event == RecipeEvent::DONE) {
+        DEBUG_PORT.println("done.");
+    } else {
+        DEBUG_PORT.print("aborted at step ");
+        DEBUG_PORT.print(r.step());
+        DEBUG_PORT.print(": ");
+        DEBUG_PORT.println(r.reason());
+    }
+}
+
+// One step as uploaded: ["dose","gro",2.5], ["mix",7], ["wait",60], ["stable","ph",0.05,900],
+// ["below","ec",1.2,0,3], ["above","ph",6.5,4], ["goto",0], ["end"]
+bool parse_recipe_step(JsonArrayConst a, RecipeStep &step) {
+    step = {};
+    RecipeOp op = recipe_op_from_name(a[0] | "");
+    if (op == NUM_RECIPE_OPS) return false;
+    step.op = op;
+
+    switch (op) {
+        case RECIPE_DOSE:
+            step.arg = pump_id_from_name(a[1] | "");
+            step.x   = a[2] | 0.0f;
+            break;
+        case RECIPE_MIX:
+        case RECIPE_WAIT:
+            step.x = a[1] | -1.0f;
+            break;
+        case RECIPE_STABLE:
+            step.arg = recipe_sensor_from_name(a[1] | "");
+            step.x   = a[2] | 0.0f;
+            step.y   = a[3] | 0.0f;
+            break;
+        case RECIPE_BELOW:
+        case RECIPE_ABOVE:
+            step.arg    = recipe_sensor_from_name(a[1] | "");
+            step.x      = a[2] | NAN;
+            step.target = a[3] | 0xFF;
+            step.limit  = a[4] | 0;
+            break;
+        case RECIPE_GOTO:
+            step.target = a[1] | 0xFF;
+            step.limit  = a[2] | 0;
+            break;
+        default:
+            break;
+    }
+    return recipe_step_valid(step);
+}
+
+void save_recipe_chunks(uint8_t first, uint8_t last) {
+    if (!store_ok) return;
+    for (uint8_t c = first / RECIPE_CHUNK_STEPS; c <= last / RECIPE_CHUNK_STEPS; ++c) {
+        store.put(KEY_RECIPE_0 + c, &recipe.steps[c * RECIPE_CHUNK_STEPS], sizeof(RecipeStep) * RECIPE_CHUNK_STEPS);
+    }
+}
+
+// Overwrites a zone's defaults from setup() with whatever survived the last reset
+void restore_zone(Zone &z) {
+    store.get(zone_key(z, KEY_EC_FILTER),   z.ec_kalman);
+    store.get(zone_key(z, KEY_PH_FILTER),   z.pH_kalman);
+    store.get(zone_key(z, KEY_TEMP_FILTER), z.temp_kalman);
+    store.get(zone_key(z, KEY_PROFILE),     z.plant);
+    store.get(zone_key(z, KEY_RUN_STATE),   z.running);
+
+    // A table for another probe count (the board's zones were regrouped) stays nominal
+    store.get(zone_key(z, KEY_EC_CAL), z.ecProbes.cal);
+    store.get(zone_key(z, KEY_PH_CAL), z.phProbes.cal);
+
+    GainCheckpoint gckpt;
+    if (store.get(zone_key(z, KEY_GAINS), gckpt)) {
+        for (uint8_t i = 0; i < NUM_GAINS; ++i) {
+            gain_estimator(z, i).restore(gckpt.gain[i], gckpt.var[i], gckpt.count[i]);
+        }
+    }
+
+    ControlCheckpoint ctrl;
+    if (store.get(zone_key(z, KEY_CONTROL), ctrl)) {
+        z.reservoir_volume_ml = ctrl.reservoir_volume_ml;
+        // Keep the dosing cadence across the reset instead of restarting the interval
+        z.scheduler.resume(millis(), ctrl.ms_since_eval);
+    }
+}
+
+void restore_state() {
+    for (uint8_t i = 0; i < NUM_PUMPS; ++i) {
+        PumpCalibration cal;
+        if (store.get(KEY_PUMP_CAL_0 + i, cal)) pumps[i].set_calibration(cal);
+    }
+
+    for (uint8_t c = 0; c < RECIPE_NUM_CHUNKS; ++c) {
+        store.get(KEY_RECIPE_0 + c, &recipe.steps[c * RECIPE_CHUNK_STEPS], sizeof(RecipeStep) * RECIPE_CHUNK_STEPS);
+    }
+
+    for (Zone &z : zones) restore_zone(z);
+}
+
+//!##################################################
+//!######## Pump calibration ########################
+//! Only allowed with every zone in STANDBY, the pumps
+//! being shared. Dispenses through the outlet of the
+//! zone in the M:2004. Each M:2005 reply from the
+//! operator advances to the next dispense.
+//!##################################################
+
+static PumpCalibrator pumpCalibrator;
+static uint8_t        pumpCalZone = 0;
+
+// Queues the calibrator's current run; the operator is asked to measure it once it's done
+void run_pump_cal_step() {
+    if (!doseQueue.push_steps(pumpCalibrator.pump(), pumpCalibrator.run_steps(),
+                              pumpCalibrator.run_profile(), JobSource::CALIBRATION, pumpCalZone)) {
+        DEBUG_PORT.println("Pump cal: dose queue full");
+        pumpCalibrator.cancel();
+    }
+}
+
+//!##################################################
+//!######## Probe calibration #######################
+//! Per zone, only allowed in its STANDBY, probes in a
+//! reference solution. M:2009 point 0 then point 1
+//! captures ~1.3 s of raw counts each; the second
+//! fits and stores every selected channel.
+//!##################################################
+
+template <typename Sensor, size_t N>
+void finish_probe_cal_point(Zone &z, ProbeCalibrator<Sensor, N> &cal, SensorArray<Sensor, N> &probes,
+                            const char *name, uint8_t point, StoreKey key) {
+    send_probe_cal_point(COMM_PORT, name, point, cal.raw(point), z.index);
+    if (!cal.ready()) return;
+
+    uint8_t ok = cal.solve();
+    if (ok && store_ok) store.put(zone_key(z, key), probes.cal);
+    send_probe_cal_table(COMM_PORT, name, ok, probes.cal.scale, probes.cal.offset, probes.cal.tcoef, z.index);
+
+    log_zone(z);
+    DEBUG_PORT.print("Probe cal ");
+    DEBUG_PORT.print(name);
+    DEBUG_PORT.print(" -> channels 0x");
+    DEBUG_PORT.println(ok, HEX);
+}
+
+static uint8_t probeCalPoint[NUM_ZONES] = {};
+
+void service_probe_cal(unsigned long now) {
+    for (Zone &z : zones) {
+        if (!z.calibrating()) continue;
+
+        float temp = z.cal_temp();
+        uint8_t point = probeCalPoint[z.index];
+        if (z.ecCalibrator.service(now, temp)) finish_probe_cal_point(z, z.ecCalibrator, z.ecProbes, "ec", point, KEY_EC_CAL);
+        if (z.phCalibrator.service(now, temp)) finish_probe_cal_point(z, z.phCalibrator, z.phProbes, "ph", point, KEY_PH_CAL);
+    }
+}
+
+// Handles one M:2009 for either probe type
+template <typename Sensor, size_t N>
+void handle_probe_cal(JsonDocument &doc, Zone &z, ProbeCalibrator<Sensor, N> &cal, SensorArray<Sensor, N> &probes,
+                      const SensorCal<N> &nominal, const char *name, StoreKey key) {
+    uint8_t ch = doc["ch"] | PROBE_CAL_ALL;
+    if (ch != PROBE_CAL_ALL && ch >= N) {
+        DEBUG_PORT.println("Probe cal: no such channel");
+        return;
+    }
+
+    if (doc["reset"] | false) {
+        cal.cancel();
+        probes.cal = nominal;
+    }
+    else if (doc["tcoef"].is<float>()) {
+        float tc = doc["tcoef"];
+        for (size_t i = 0; i < N; ++i) {
+            if (ch == PROBE_CAL_ALL || ch == i) probes.cal.tcoef[i] = tc;
+        }
+    }
+    else {
+        probeCalPoint[z.index] = doc["point"] | 0;
+        cal.begin_point(probeCalPoint[z.index], doc["value"] | 0.0f, ch);
+        return;
+    }
+
+    if (store_ok) store.put(zone_key(z, key), probes.cal);
+    send_probe_cal_table(COMM_PORT, name, 0, probes.cal.scale, probes.cal.offset, probes.cal.tcoef, z.index);
+}
+
+// Catalog profiles, shared by the zones
+static ProfileCache profileCache;
+
+// After any change to a zone's plant: persist and log it
+void profile_changed(Zone &z) {
+    const TargetPlant &plant = z.plant;
+    if (store_ok) store.put(zone_key(z, KEY_PROFILE), plant);
+
+    log_zone(z);
+    DEBUG_PORT.print("Profile updated -> EC [");
+    DEBUG_PORT.print(plant.ec_low, 2);  DEBUG_PORT.print(", ");
+    DEBUG_PORT.print(plant.ec_high, 2); DEBUG_PORT.print("] avg ");
+    DEBUG_PORT.print(plant.ec_avg, 2);  DEBUG_PORT.print(" mS/cm | pH [");
+    DEBUG_PORT.print(plant.ph_low, 2);  DEBUG_PORT.print(", ");
+    DEBUG_PORT.print(plant.ph_high, 2); DEBUG_PORT.print("] avg ");
+    DEBUG_PORT.print(plant.ph_avg, 2);  DEBUG_PORT.print(" | parts ");
+    DEBUG_PORT.print(plant.gro_amount); DEBUG_PORT.print("/");
+    DEBUG_PORT.print(plant.micro_amount); DEBUG_PORT.print("/");
+    DEBUG_PORT.println(plant.bloom_amount);
+}
+
+void on_job_done(const DoseJob &job, float dispensed_ml, bool aborted) {
+    Zone &z = zones[job.zone];
+
+    if (job.kind == JobKind::DOSE) {
+        send_dose_report(COMM_PORT, job.id, PUMP_NAMES[job.pump], job.ml, dispensed_ml, aborted, z.index);
+    }
+
+    switch (job.source) {
+        case JobSource::AUTO:
+            if (job.kind == JobKind::DOSE) z.autoCycle.ml[job.pump] += dispensed_ml;
+            if (aborted) z.autoCycle.aborted = true;
+            break;
+
+        case JobSource::CALIBRATION:
+            if (aborted) {
+                pumpCalibrator.cancel();
+                DEBUG_PORT.println("Pump cal: dispense aborted, calibration cancelled.");
+            } else {
+                const SpeedProfile &profile = pumpCalibrator.run_profile();
+                send_pump_cal_run(COMM_PORT, PUMP_NAMES[job.pump], pumpCalibrator.run() + 1, CAL_NUM_RUNS,
+                                  job.steps, profile.max_speed, profile.acceleration);
+            }
+            break;
+
+        case JobSource::LOADING:
+            if (job.kind == JobKind::MIX && !aborted) DEBUG_PORT.println("Web loading dose complete. Mixed.");
+            break;
+
+        case JobSource::RECIPE:
+            if (job.id == recipeJobId) recipeJobId = 0;
+            if (aborted) recipe.abort("job aborted");
+            break;
+    }
+
+    if (aborted && job.kind == JobKind::DOSE) {
+        log_zone(z);
+        DEBUG_PORT.print("Aborted ");
+        DEBUG_PORT.print(PUMP_NAMES[job.pump]);
+        DEBUG_PORT.print(" after ");
+        DEBUG_PORT.print(dispensed_ml, 2);
+        DEBUG_PORT.print(" of ");
+        DEBUG_PORT.print(job.ml, 2);
+        DEBUG_PORT.println(" mL");
+    }
+}
 
 void handle_comm_message(const char *line) {
-    JsonDocument doc;
+    JsonDocument doc(&commAlloc);
     if (!parse_message(line, doc)) {
         DEBUG_PORT.print("COMM parse err: ");
         DEBUG_PORT.println(line);
         return;
     }
+    mem_sample(memWatch); // the document still held: the low a message brings
+
+    // On a shared bus, everything for the other nodes
+    if (!COMM_PORT.accepts(doc)) return;
 
     uint16_t msgType = doc["M"] | 0;
 
+    uint8_t zi = doc["Z"] | 0;
+    if (zi >= NUM_ZONES) {
+        DEBUG_PORT.print("No zone ");
+        DEBUG_PORT.println(zi);
+        return;
+    }
+    Zone &zone = zones[zi];
+
     switch (msgType) {
 
-        // ESP32 polling for sensor data
-        case MSG_SENSOR_REQUEST:   // 1001
-            send_sensor_data(COMM_PORT, latest_ph, latest_ec, latest_temp);
+        // ESP32 polling for sensor data; on a bus, also this node's turn to talk
+        case MSG_SENSOR_REQUEST: { // 1001
+            int16_t duty = dutyCycle.take_permille();
+            if (NUM_ZONES == 1) {
+                send_sensor_data(COMM_PORT, zone.latest_ph, zone.latest_ec, zone.latest_temp, duty);
+            } else {
+                ZoneReading r[NUM_ZONES];
+                for (const Zone &z : zones) r[z.index] = z.reading();
+                send_sensor_data(COMM_PORT, r, NUM_ZONES, duty);
+            }
+            COMM_PORT.end_turn();
             break;
+        }
 
         case MSG_LOAD_DOSE: {      // 2001
             float g  = doc["gro"]   | 0.0f;
@@ -154,29 +699,45 @@ void handle_comm_message(const char *line) {
             float pu = doc["ph_up"] | 0.0f;
             float pd = doc["ph_dn"] | 0.0f;
 
+            log_zone(zone);
             DEBUG_PORT.println("=== Web loading dose ===");
-            if (g  > 0.0f) gro.dose(g);
-            if (m  > 0.0f) micro.dose(m);
-            if (b  > 0.0f) bloom.dose(b);
-            if (pu > 0.0f) ph_up.dose(pu);
-            if (pd > 0.0f) ph_down.dose(pd);
-
-            if (g > 0.0f || m > 0.0f || b > 0.0f || pu > 0.0f || pd > 0.0f) {
-                mix_resevoir(MIX_PIN_IN1, MIX_PIN_IN2, MIX_PIN_ENA);
-                DEBUG_PORT.println("Web loading dose complete. Mixed.");
-            }
+            bool queued = false;
+            queued |= doseQueue.push_dose(PUMP_GRO,     g,  JobSource::LOADING, zi) != 0;
+            queued |= doseQueue.push_dose(PUMP_MICRO,   m,  JobSource::LOADING, zi) != 0;
+            queued |= doseQueue.push_dose(PUMP_BLOOM,   b,  JobSource::LOADING, zi) != 0;
+            queued |= doseQueue.push_dose(PUMP_PH_UP,   pu, JobSource::LOADING, zi) != 0;
+            queued |= doseQueue.push_dose(PUMP_PH_DOWN, pd, JobSource::LOADING, zi) != 0;
+
+            if (queued) doseQueue.push_mix(MIX_DURATION_MS, JobSource::LOADING, zi);
             break;
         }
 
-        // Start/stop 
+        // Start/stop the zone "Z" names; without one every zone, as the single-tank firmware did
         case MSG_SYSTEM_STATE: {   // 2002
             bool run = doc["run"] | false;
 
-            if (run && !is_system_running) {
-                lastDoseMillis = millis();
+            if (run && pumpCalibrator.active()) {
+                doseQueue.abort_all();
+                pumpCalibrator.cancel();
+                DEBUG_PORT.println("Pump calibration cancelled.");
             }
 
-            is_system_running = run;
+            // Stop means stop: whatever is pumping or mixing halts now, on every zone it covers
+            if (!run && doc["Z"].is<int>()) {
+                if (recipe_running_on(zone)) recipe.abort("stopped");
+                doseQueue.abort_zone(zi);
+            } else if (!run) {
+                recipe.abort("stopped");
+                doseQueue.abort_all();
+            }
+
+            for (Zone &z : zones) {
+                if (doc["Z"].is<int>() && &z != &zone) continue;
+                if (run && !z.running) z.scheduler.begin(millis());
+                z.running = run;
+                if (store_ok) store.put(zone_key(z, KEY_RUN_STATE), z.running);
+                log_zone(z);
+            }
             DEBUG_PORT.print("System state -> ");
             DEBUG_PORT.println(run ? "RUNNING" : "STANDBY");
             break;
@@ -184,20 +745,223 @@ void handle_comm_message(const char *line) {
 
         // Set plant profile
         case MSG_SET_PROFILE: {    // 2003
+            TargetPlant &plant = zone.plant;
             plant.ec_low  = doc["ec_min"] | plant.ec_low;
             plant.ec_high = doc["ec_max"] | plant.ec_high;
             plant.ec_avg  = doc["ec_avg"] | plant.ec_avg;
             plant.ph_low  = doc["ph_min"] | plant.ph_low;
             plant.ph_high = doc["ph_max"] | plant.ph_high;
             plant.ph_avg  = doc["ph_avg"] | plant.ph_avg;
+            plant.gro_amount   = doc["gro"]   | plant.gro_amount;
+            plant.micro_amount = doc["micro"] | plant.micro_amount;
+            plant.bloom_amount = doc["bloom"] | plant.bloom_amount;
+            profile_changed(zone);
+
+            // A catalog profile: kept for the next switch back to it
+            uint16_t id = doc["id"] | 0;
+            if (id) {
+                profileCache.put(id, doc["crc"] | 0, plant);
+                send_profile_status(COMM_PORT, id, true, zi);
+            }
+            break;
+        }
+
+        // Switch to a catalog profile sent earlier
+        case MSG_PROFILE_SELECT: { // 2014
+            uint16_t id = doc["id"] | 0;
+            const TargetPlant *cached = profileCache.get(id, doc["crc"] | 0);
+            if (cached) {
+                zone.plant = *cached;
+                profile_changed(zone);
+            }
+            send_profile_status(COMM_PORT, id, cached != nullptr, zi);
+            break;
+        }
+
+        // Begin pump calibration sweep, through the zone's outlet
+        case MSG_PUMP_CAL_START: { // 2004
+            PumpId id = pump_id_from_name(doc["pump"] | "");
+
+            if (id == NUM_PUMPS) {
+                DEBUG_PORT.println("Pump cal: unknown pump");
+                break;
+            }
+            if (any_zone_running()) {
+                DEBUG_PORT.println("Pump cal: every zone must be in STANDBY");
+                break;
+            }
+
+            DEBUG_PORT.print("=== Calibrating pump ");
+            DEBUG_PORT.print(PUMP_NAMES[id]);
+            DEBUG_PORT.println(" ===");
+
+            pumpCalZone = zi;
+            pumpCalibrator.start(id);
+            run_pump_cal_step();
+            break;
+        }
+
+        // Operator's measurement of the last calibration dispense
+        case MSG_PUMP_CAL_MEASURE: { // 2005
+            if (!pumpCalibrator.active()) {
+                DEBUG_PORT.println("Pump cal: no calibration in progress");
+                break;
+            }
+
+            if (doseQueue.busy(JobSource::CALIBRATION)) {
+                DEBUG_PORT.println("Pump cal: dispense still running");
+                break;
+            }
+
+            PumpId id = pumpCalibrator.pump();
+            float ml  = doc["ml"] | 0.0f;
+
+            if (!pumpCalibrator.record(ml)) {
+                run_pump_cal_step();
+                break;
+            }
+
+            PumpCalibration cal;
+            bool ok = pumpCalibrator.fit(cal);
+            if (ok) {
+                pumps[id].set_calibration(cal);
+                if (store_ok) store.put(KEY_PUMP_CAL_0 + id, cal);
+            } else {
+                cal = pumps[id].calibration();
+            }
+
+            send_pump_cal_result(COMM_PORT, PUMP_NAMES[id], ok, cal.steps_per_ml,
+                                 cal.profile.max_speed, cal.profile.acceleration);
+
+            DEBUG_PORT.print("Pump cal ");
+            DEBUG_PORT.print(PUMP_NAMES[id]);
+            DEBUG_PORT.print(ok ? " -> " : " rejected, keeping ");
+            DEBUG_PORT.print(cal.steps_per_ml, 1);
+            DEBUG_PORT.print(" steps/mL @ ");
+            DEBUG_PORT.print(cal.profile.max_speed, 0);
+            DEBUG_PORT.println(" steps/s");
+            break;
+        }
+
+        // Cancel one queued or running job, or everything (for one zone when it names one)
+        case MSG_CANCEL_JOB: {     // 2008
+            uint16_t id = doc["id"] | 0;
+
+            if (id == 0 && doc["Z"].is<int>()) {
+                if (recipe_running_on(zone)) recipe.abort("cancelled");
+                doseQueue.abort_zone(zi);
+                log_zone(zone);
+                DEBUG_PORT.println("Dose jobs cancelled.");
+            } else if (id == 0) {
+                recipe.abort("cancelled");
+                doseQueue.abort_all();
+                DEBUG_PORT.println("All dose jobs cancelled.");
+            } else if (!doseQueue.cancel(id)) {
+                DEBUG_PORT.print("Cancel: no job ");
+                DEBUG_PORT.println(id);
+            }
+            break;
+        }
+
+        // Probe calibration point / tempco / reset
+        case MSG_PROBE_CAL: {      // 2009
+            if (zone.running) {
+                DEBUG_PORT.println("Probe cal: zone must be in STANDBY");
+                break;
+            }
+
+            const char *probe = doc["probe"] | "";
+            if (strcmp(probe, "ec") == 0) {
+                handle_probe_cal(doc, zone, zone.ecCalibrator, zone.ecProbes, zone.ec_nominal, "ec", KEY_EC_CAL);
+            } else if (strcmp(probe, "ph") == 0) {
+                handle_probe_cal(doc, zone, zone.phCalibrator, zone.phProbes, PH_NOMINAL_CAL, "ph", KEY_PH_CAL);
+            } else {
+                DEBUG_PORT.println("Probe cal: unknown probe");
+            }
+            break;
+        }
+
+        // Recipe upload, from step "at"; at 0 starts a new table
+        case MSG_RECIPE_LOAD: {    // 2011
+            uint8_t        at = doc["at"] | 0;
+            JsonArrayConst in = doc["s"];
+
+            RecipeStep parsed[RECIPE_MAX_STEPS];
+            uint8_t    n  = 0;
+            const char *err = recipe.running() ? "recipe running" : "";
+
+            for (JsonArrayConst a : in) {
+                if (err[0]) break;
+                if (at + n >= RECIPE_MAX_STEPS) err = "too many steps";
+                else if (!parse_recipe_step(a, parsed[n])) err = "bad step";
+                else n++;
+            }
+            if (!err[0] && n == 0) err = "no steps";
+
+            if (err[0]) {
+                // The lines before this one are only part of a recipe; they mustn't run on their own
+                if (at > 0 && !recipe.running()) {
+                    recipe.clear();
+                    save_recipe_chunks(0, RECIPE_MAX_STEPS - 1);
+                }
+                send_recipe_status(COMM_PORT, RECIPE_STATE_NAMES[static_cast<uint8_t>(recipe.status())],
+                                   at + n, "", recipe.size(), "rejected", err);
+                DEBUG_PORT.print("Recipe: ");
+                DEBUG_PORT.println(err);
+                break;
+            }
 
-            DEBUG_PORT.print("Profile updated -> EC [");
-            DEBUG_PORT.print(plant.ec_low, 2);  DEBUG_PORT.print(", ");
-            DEBUG_PORT.print(plant.ec_high, 2); DEBUG_PORT.print("] avg ");
-            DEBUG_PORT.print(plant.ec_avg, 2);  DEBUG_PORT.print(" mS/cm | pH [");
-            DEBUG_PORT.print(plant.ph_low, 2);  DEBUG_PORT.print(", ");
-            DEBUG_PORT.print(plant.ph_high, 2); DEBUG_PORT.print("] avg ");
-            DEBUG_PORT.println(plant.ph_avg, 2);
+            if (at == 0) recipe.clear();
+            for (uint8_t i = 0; i < n; ++i) recipe.set_step(at + i, parsed[i]);
+            save_recipe_chunks(at, at == 0 ? RECIPE_MAX_STEPS - 1 : at + n - 1);
+
+            report_recipe("loaded");
+            break;
+        }
+
+        // Run on the zone / abort; without "run" only the status is sent
+        case MSG_RECIPE_CTRL: {    // 2012
+            if (doc["run"].is<bool>()) {
+                if (!doc["run"].as<bool>()) {
+                    recipe.abort("aborted by user");
+                    break;
+                }
+                if (pumpCalibrator.active() || zone.calibrating()) {
+                    DEBUG_PORT.println("Recipe: calibration in progress");
+                } else if (recipe.running()) {
+                    // Still bound to the zone it was started on
+                    DEBUG_PORT.println("Recipe: already running");
+                } else if (!recipe.start(millis())) {
+                    DEBUG_PORT.println("Recipe: no steps loaded");
+                } else {
+                    recipeZone  = zi;
+                    recipeDosed = false;
+                    log_zone(zone);
+                    DEBUG_PORT.print("=== Recipe started, ");
+                    DEBUG_PORT.print(recipe.size());
+                    DEBUG_PORT.println(" steps ===");
+                    break;
+                }
+            }
+            report_recipe("");
+            break;
+        }
+
+        // Heap, stack and allocation watermarks
+        case MSG_MEM_REQUEST: {    // 2016
+            mem_sample_stacks(memWatch);
+            send_mem_report(COMM_PORT, memWatch);
+            break;
+        }
+
+        // One block of the zone's sample log; asked for from 0, the oldest still held
+        case MSG_HISTORY_REQUEST: { // 2018
+            const TsLog<SAMPLE_LOG_BLOCKS> &log = sampleLog[zi];
+            uint32_t seq = doc["seq"] | 0UL;
+            if (seq < log.oldest()) seq = log.oldest();
+            const uint8_t *block = nullptr;
+            size_t len = log.block(seq, block);
+            send_history_block(COMM_PORT, zi, seq, log.newest(), millis(), block, len);
             break;
         }
 
@@ -210,103 +974,238 @@ void handle_comm_message(const char *line) {
 
 
 void setup() {
+    mem_paint_stack();
+    memWatch.track(commAlloc);
+
     DEBUG_PORT.begin(115200);
-    COMM_PORT.begin(115200);
+    COMM_UART.begin(115200);
+    COMM_PORT.begin(NODE_ADDR, Board::BUS_DE_PIN);
     TMC2209_PORT.begin(115200);
 
-    Wire.begin();
+    if (Board::HAS_I2C) Wire.begin();
 
-    pinMode(MIX_PIN_IN1, OUTPUT);
-    pinMode(MIX_PIN_IN2, OUTPUT);
-    pinMode(MIX_PIN_ENA, OUTPUT);
+    pinPeripheral(Board::TMC_TX_PIN, PIO_SERCOM);
+    pinPeripheral(Board::TMC_RX_PIN, PIO_SERCOM);
 
-    pinPeripheral(16, PIO_SERCOM);
-    pinPeripheral(17, PIO_SERCOM);
-
-    ph_up.init(); ph_down.init();
-    gro.init();   micro.init();  bloom.init();
+    pumps.init();
 
     analogReadResolution(12);
 
-    ec_kalman.x = 0.7f;    ec_kalman.p = 0.3f;
-    pH_kalman.x = 6.5f;    pH_kalman.p = 0.1f;
-    temp_kalman.x = 22.0f; temp_kalman.p = 0.4f;
+    for (Zone &z : zones) {
+        z.mixer.init();
+        if (z.valve >= 0) {
+            pinMode(z.valve, OUTPUT);
+            digitalWrite(z.valve, LOW);
+        }
+        doseQueue.add_zone(z.mixer);
 
-    plant.ec_high = 1.8f; plant.ec_low = 0.8f;
-    plant.ec_avg  = (plant.ec_high + plant.ec_low) / 2.0f;
-    plant.ph_high = 6.8f; plant.ph_low = 6.0f;
-    plant.ph_avg  = (plant.ph_high + plant.ph_low) / 2.0f;
-    plant.gro_amount = 1; plant.bloom_amount = 1; plant.micro_amount = 1;
+        TargetPlant &plant = z.plant;
+        plant.ec_high = 1.8f; plant.ec_low = 0.8f;
+        plant.ec_avg  = (plant.ec_high + plant.ec_low) / 2.0f;
+        plant.ph_high = 6.8f; plant.ph_low = 6.0f;
+        plant.ph_avg  = (plant.ph_high + plant.ph_low) / 2.0f;
+        plant.gro_amount = 1; plant.bloom_amount = 1; plant.micro_amount = 1;
 
-    is_system_running = false;
-    lastDoseMillis    = millis();
+        z.running = false;
+        z.scheduler.begin(millis());
+    }
 
-    DEBUG_PORT.println("Setup complete. System STANDBY — waiting for start command.");
+    store_ok = store.begin();
+    if (store_ok) {
+        restore_state();
+    } else {
+        DEBUG_PORT.println("WARNING: state store unavailable, using defaults.");
+    }
+    lastCheckpointMillis = millis();
+
+    doseQueue.on_done = on_job_done;
+    doseQueue.route   = route_zone;
+
+    recipe.do_dose  = recipe_dose;
+    recipe.do_mix   = recipe_mix;
+    recipe.on_event = on_recipe_event;
+    step_timer_begin(STEP_TIMER_HZ, step_tick);
+    idle_begin();
+    awakeSinceMicros = micros();
+
+#ifdef ESTOP_PIN
+    pinMode(ESTOP_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(ESTOP_PIN), estop_isr, FALLING);
+#endif
+
+    if (NUM_ZONES > 1) {
+        DEBUG_PORT.print(NUM_ZONES);
+        DEBUG_PORT.println(" zones.");
+    }
+    if (any_zone_running()) {
+        DEBUG_PORT.println("Setup complete. Restored RUNNING state.");
+    } else {
+        DEBUG_PORT.println("Setup complete. System STANDBY — waiting for start command.");
+    }
 }
 
 
-void loop() {
+bool comm_pending() { return COMM_PORT.available() > 0; }
 
-    unsigned long now = millis();
+// Sleeps the core until loop() next has work: a zone sample, checkpoint or report, or a
+// line arriving. Not while a job has the pumps or a mixer, or a probe calibration samples.
+void idle(unsigned long now) {
+    if (doseQueue.busy() || comm_pending()) return;
+    for (const Zone &z : zones) {
+        if (z.calibrating()) return;
+    }
 
-    if (commReader.poll(COMM_PORT)) {
-        handle_comm_message(commReader.buf);
+    WakeSchedule wake;
+    wake.begin(now);
+    for (const Zone &z : zones) {
+        if (z.running || recipe_running_on(z)) {
+            wake.every(lastSampleMillis, sampleInterval);
+            wake.every(lastSampleLogMillis, sampleLogInterval);
+            break;
+        }
+    }
+    if (any_zone_running()) {
+        wake.every(lastCheckpointMillis, checkpointInterval);
+        wake.every(lastDebugMillis, debugInterval);
     }
+    if (wake.sleep_ms() == 0) return;
 
-    if (!is_system_running) {
+    dutyCycle.awake(micros() - awakeSinceMicros);
+    dutyCycle.asleep(idle_sleep(wake.sleep_ms(), comm_pending));
+    awakeSinceMicros = micros();
+}
+
+// Sensors, recipe and automated dosing for one zone
+void service_zone(Zone &z, unsigned long now) {
+    bool recipe_here = recipe_running_on(z);
+    if (!z.running && !recipe_here) {
         return;
     }
 
-    // Read sensors
-    std::array<float, 4> temp_raw = {
-        temp1.read_val(), temp2.read_val(), temp3.read_val(), temp4.read_val()
-    };
-    latest_temp = temp_filter(temp_raw, temp_kalman, 0.1f);
+    z.read_sensors();
+    report_probe_faults(z);
 
-    std::array<float, 4> ec_raw = {
-        ec1.read_val(latest_temp), ec2.read_val(latest_temp), ec3.read_val(latest_temp), ec4.read_val(latest_temp)
-    };
-    std::array<float, 2> ph_raw = {
-        ph1.read_val(latest_temp), ph2.read_val(latest_temp)
-    };
+    if (recipe_here) {
+        const float readings[NUM_RECIPE_SENSORS] = { z.latest_ec, z.latest_ph, z.latest_temp };
+        recipe.service(now, readings, doseQueue.busy(JobSource::RECIPE, z.index));
+    }
 
-    latest_ec = ec_filter(ec_raw, ec_kalman, 0.1f);
-    latest_ph = ph_filter(ph_raw, pH_kalman, 0.1f);
+    if (!z.running) {
+        return;
+    }
 
-    // Check every 15 mins
-    if (now - lastDoseMillis >= doseInterval) {
+    finish_dose_observation(z, now);
 
-        reservoir_volume_ml -= UPTAKE_PER_INTERVAL;
-        if (reservoir_volume_ml < 0.0f) reservoir_volume_ml = 0.0f;
+    // Readings taken while pumping or mixing this tank would read as drift; a recipe has the pumps.
+    // Another zone's jobs don't count: this one's dose just queues behind them.
+    bool dosing = doseQueue.zone_busy(z.index) || recipe_here;
+    DoseScheduler &scheduler = z.scheduler;
+    if (!dosing) scheduler.update(z.latest_ec, z.latest_ph, now);
 
-        if (reservoir_volume_ml < RESERVOIR_MIN_ML)
-            DEBUG_PORT.println("WARNING: Reservoir low!");
+    DoseTrigger trigger = dosing ? DoseTrigger::NONE : scheduler.due(z.plant, now);
+    if (trigger == DoseTrigger::NONE) {
+        return;
+    }
 
-        float vol_L = reservoir_volume_ml / 1000.0f;
+    z.reservoir_volume_ml -= UPTAKE_ML_PER_MS * static_cast<float>(scheduler.ms_since_eval(now));
+    if (z.reservoir_volume_ml < 0.0f) z.reservoir_volume_ml = 0.0f;
 
-        float nutrient_dose = nutrient_calc(plant.ec_avg, plant.ec_low, plant.ec_high, vol_L, latest_ec);
-        float ph_up_dose    = ph_up_calc(plant.ph_avg, plant.ph_low, plant.ph_high, vol_L, latest_ph);
-        float ph_down_dose  = ph_down_calc(plant.ph_avg, plant.ph_low, plant.ph_high, vol_L, latest_ph);
+    if (z.reservoir_volume_ml < RESERVOIR_MIN_ML) {
+        log_zone(z);
+        DEBUG_PORT.println("WARNING: Reservoir low!");
+    }
 
-        std::array<float, 3> dose = proportion_nutrient(
-            nutrient_dose, plant.gro_amount, plant.micro_amount, plant.bloom_amount);
+    float vol_L = z.reservoir_volume_ml / 1000.0f;
 
-        bool nut_dosed = dose_nutrients(gro, dose[0], bloom, dose[1], micro, dose[2]);
-        bool ph_dosed  = dose_ph(ph_up, ph_up_dose, ph_down, ph_down_dose);
+    // Forecast values when dosing ahead of a predicted band exit, else the latest
+    float ec_in = scheduler.ec_for_dosing();
+    float ph_in = scheduler.ph_for_dosing();
 
-        if (nut_dosed || ph_dosed) {
-            mix_resevoir(MIX_PIN_IN1, MIX_PIN_IN2, MIX_PIN_ENA);
-            DEBUG_PORT.println("Dosed and mixed.");
-        } else {
+    // Drift expected by the next backstop check, for the planner's horizon
+    float cycle_min = static_cast<float>(scheduler.cfg.max_interval_ms) / 60000.0f;
+    PlantModel model = z.gains.model(scheduler.ec_rate() * cycle_min, scheduler.ph_rate() * cycle_min);
+
+    DosePlan plan = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, z.plant, vol_L, ec_in, ph_in);
+
+    // pH jobs jump ahead of the nutrients in the queue; the mix runs last
+    bool queued = false;
+    queued |= doseQueue.push_dose(PUMP_PH_UP,   plan.ph_up,   JobSource::AUTO, z.index) != 0;
+    queued |= doseQueue.push_dose(PUMP_PH_DOWN, plan.ph_down, JobSource::AUTO, z.index) != 0;
+    queued |= doseQueue.push_dose(PUMP_GRO,     plan.gro,     JobSource::AUTO, z.index) != 0;
+    queued |= doseQueue.push_dose(PUMP_MICRO,   plan.micro,   JobSource::AUTO, z.index) != 0;
+    queued |= doseQueue.push_dose(PUMP_BLOOM,   plan.bloom,   JobSource::AUTO, z.index) != 0;
+
+    if (queued) {
+        doseQueue.push_mix(MIX_DURATION_MS, JobSource::AUTO, z.index);
+
+        z.autoCycle = { true, false, z.latest_ec, z.latest_ph, vol_L, {} };
+        if (trigger == DoseTrigger::PREDICTED_EXIT) {
+            log_zone(z);
+            DEBUG_PORT.println("Dosing ahead of drift.");
+        }
+    } else {
+        if (trigger == DoseTrigger::BACKSTOP) {
+            log_zone(z);
             DEBUG_PORT.println("In range - nothing dosed.");
         }
+        scheduler.evaluated(now, false);
+        checkpoint_control(z, now);
+    }
+}
 
-        lastDoseMillis = now;
+
+void loop() {
+
+    unsigned long now = millis();
+
+    if (commReader.poll(COMM_PORT)) {
+        handle_comm_message(commReader.buf);
     }
 
-    // Send data over usb
-    if (now - lastDebugMillis >= debugInterval) {
-        send_data(DEBUG_PORT, latest_ph, latest_ec, latest_temp);
-        lastDebugMillis = now;
+    doseQueue.service(now);
+    step_timer_enable(doseQueue.busy());
+    service_probe_cal(now);
+    for (Zone &z : zones) {
+        if (z.autoCycle.active && !doseQueue.busy(JobSource::AUTO, z.index)) {
+            close_auto_cycle(z, now);
+        }
     }
-}
\ No newline at end of file
+
+    if (now - lastSampleMillis >= sampleInterval) {
+        for (Zone &z : zones) {
+            service_zone(z, now);
+        }
+        lastSampleMillis = now;
+    }
+
+    // Stamped with the tick rather than now, so a steady log's times cost a bit each
+    if (now - lastSampleLogMillis >= sampleLogInterval) {
+        bool behind = now - lastSampleLogMillis >= 2 * sampleLogInterval;
+        lastSampleLogMillis = behind ? now : lastSampleLogMillis + sampleLogInterval;
+        for (const Zone &z : zones) {
+            if (!z.running && !recipe_running_on(z)) continue;
+            sampleLog[z.index].add(ts_sample(lastSampleLogMillis, z.latest_ph, z.latest_ec, z.latest_temp));
+        }
+    }
+
+    if (any_zone_running()) {
+        if (now - lastCheckpointMillis >= checkpointInterval) {
+            for (Zone &z : zones) {
+                if (z.running) checkpoint_control(z, now);
+            }
+            lastCheckpointMillis = now;
+        }
+
+        // Send data over usb
+        if (now - lastDebugMillis >= debugInterval) {
+            for (const Zone &z : zones) {
+                if (!z.running) continue;
+                log_zone(z);
+                send_data(DEBUG_PORT, z.latest_ph, z.latest_ec, z.latest_temp);
+            }
+            lastDebugMillis = now;
+        }
+    }
+
+    idle(now);
+}
@@ -3,37 +3,246 @@
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <LittleFS.h>
+#include <StreamString.h>
 #include <ArduinoJson.h>
 #include "serial_comm.hpp"
-#include "pull_plant.hpp"
+#include "serial_capture.hpp"
+#include "profile_catalog.hpp"
+#include "wifi_link.hpp"
+#include "bus_master.hpp"
+#include "mqtt_link.hpp"
+#include "bridge_core.hpp"
 
 // WiFi stuff
 const char* ssid     = "fake-net"; // Replace with actual SSID
 const char* password = "password"; // Replace with actual password
 
-static float phValue   = 0.0f;
-static float ecValue   = 0.0f;
-static float tempValue = 0.0f;
+// Connect/reconnect runs from loop(); the bridge doesn't wait for it
+static WifiLink wifiLink;
+static bool     serverStarted = false;
 
-static const unsigned long POLL_INTERVAL_MS = 2000;
-static unsigned long lastPollMs = 0;
+// Telemetry to the historian's broker (see mqtt_link.hpp); spooled on LittleFS while it's away
+static const char *mqtt_host   = "192.168.1.10"; // Replace with the broker's address
+static const uint16_t mqtt_port = 1883;
+static const char *mqtt_prefix = "hydro/bridge1"; // one per bridge
+static const char *mqtt_client = "hydro-bridge1";
+static const bool  mqtt_packed = false; // samples as codec blocks on <prefix>/sensor/ts, if the historian decodes them
 
-static CommReader mcuReader;
+static AsyncMqttTransport mqttNet;
+static FsSpoolFiles       mqttFiles(LittleFS);
+static MqttSpool          mqttSpool;
+static MqttLink           mqtt(mqttNet, mqttSpool);
+static Telemetry          telemetry(mqtt);
+static unsigned long      lastMetricsMs = 0;
+
+// Route handlers, pending commands, readings and the bus (bridge_core.hpp); this file wires
+// them to the web server, Serial2 and LittleFS
+static BridgeCore bridge;
 
-static volatile bool   pendingDose    = false;
-static char            pendingDoseJson[256] = {};
+// RS-485 driver enable on Serial2's RTS, -1 for a plain point-to-point UART
+static const int8_t BUS_DE_PIN = -1;
+
+static CommReader mcuReader;
 
-static volatile bool   pendingState    = false;
-static char            pendingStateJson[128] = {};
+// Profile catalog file; the index is bridge.catalog
+static FsCatalogFile   catalogFile;
 
-static volatile bool   pendingProfile  = false;
-static char            pendingProfileJson[192] = {};
+// Capture on/off from /capture; the file itself is only touched from loop()
+static volatile bool   pendingCapture  = false;
+static bool            pendingCaptureOn = false;
 
-static portMUX_TYPE    doseMux = portMUX_INITIALIZER_UNLOCKED;
+static SerialCapture   capture(LittleFS);
 
 AsyncWebServer server(80);
 AsyncEventSource events("/events");
 
+// Binary samples down, typed commands up (ws_frames.hpp); /events and the POSTs stay as fallbacks
+AsyncWebSocket ws("/ws");
+static unsigned long lastWsCleanupMs = 0;
+
+// Every line to the MCUs goes out here (the bus decides when), so a capture sees all of them
+static void bus_send(uint8_t node, const char *line) {
+    Serial2.print(line);
+    Serial2.print('\n');
+    capture.record(CAPTURE_TO_MCU, line, millis());
+}
+
+static void send_event(const char *event, const char *data) { events.send(data, event, millis()); }
+static void send_ws_text(const char *line) { ws.textAll(line); }
+
+static void send_ws_binary(const uint8_t *frame, size_t len) {
+    if (ws.count()) ws.binaryAll(const_cast<uint8_t *>(frame), len);
+}
+
+// Query parameters and the collected body of one request, as the handlers see them
+class AsyncBridgeRequest : public BridgeRequest {
+    public:
+        explicit AsyncBridgeRequest(AsyncWebServerRequest *request) : request(request) {
+            if (request->_tempObject) {
+                body = static_cast<const char *>(request->_tempObject);
+                len  = strlen(body);
+            }
+        }
+
+        bool has(const char *name) const override { return request->hasParam(name); }
+
+        const char *param(const char *name) const override {
+            return request->hasParam(name) ? request->getParam(name)->value().c_str() : "";
+        }
+
+    private:
+        AsyncWebServerRequest *request;
+};
+
+// A POST body, chunk by chunk, into a buffer of the request's own (the server frees it with
+// the request), so two uploads interleaving on the socket can't mix. Past `max` it is cut.
+static void collect_body(AsyncWebServerRequest *request, size_t max, const uint8_t *data, size_t len, size_t index) {
+    if (index == 0 && !request->_tempObject) {
+        request->_tempObject = calloc(1, max + 1);
+        if (!request->_tempObject) return;
+    }
+    char *buf = static_cast<char *>(request->_tempObject);
+    if (!buf || index >= max) return;
+
+    size_t copy = (len < max - index) ? len : max - index;
+    memcpy(buf + index, data, copy);
+    buf[index + copy] = '\0';
+}
+
+// Runs the route's handler into the response
+static void reply(AsyncWebServerRequest *request, const BridgeRoute &route) {
+    AsyncBridgeRequest rq(request);
+
+    if (route.stream) {
+        AsyncResponseStream *r = request->beginResponseStream("application/json");
+        r->addHeader("Access-Control-Allow-Origin", "*");
+        r->setCode((bridge.*route.handler)(rq, *r));
+        request->send(r);
+        return;
+    }
+
+    StreamString json;
+    int status = (bridge.*route.handler)(rq, json);
+    AsyncWebServerResponse *r = request->beginResponse(status, "application/json", json);
+    r->addHeader("Access-Control-Allow-Origin", "*");
+    request->send(r);
+}
+
+// Rebuilds /profiles.bin when /profiles.csv has changed since it was built
+static void open_catalog() {
+    ProfileCatalog &catalog = bridge.catalog;
+    uint32_t source = catalog_source_hash(LittleFS);
+
+    if (catalogFile.open(LittleFS, CATALOG_BIN_PATH) && catalog.open(catalogFile) &&
+        (source == 0 || catalog.source_hash() == source)) {
+        Serial.printf("Profile catalog: %u profiles, %u crops\n", catalog.count(), catalog.crops());
+        return;
+    }
+    catalogFile.close();
+
+    if (source == 0) {
+        Serial.println("Profile catalog: no /profiles.csv");
+        return;
+    }
+
+    int built = build_catalog_file(LittleFS, source);
+    if (built < 0 || !catalogFile.open(LittleFS, CATALOG_BIN_PATH) || !catalog.open(catalogFile)) {
+        Serial.println("Profile catalog: build failed");
+        return;
+    }
+    Serial.printf("Profile catalog rebuilt: %u profiles, %u crops\n", catalog.count(), catalog.crops());
+}
+
+// Runs on the async_tcp task, like the POST handlers. Commands are a few bytes, so only
+// whole single-frame binary messages are taken.
+static void on_ws_event(AsyncWebSocket *socket, AsyncWebSocketClient *client, AwsEventType type,
+                        void *arg, uint8_t *data, size_t len) {
+    if (type == WS_EVT_CONNECT) {
+        Serial.printf("WS: client %u connected, %u open\n", client->id(), socket->count());
+        return;
+    }
+    if (type != WS_EVT_DATA) return;
+
+    AwsFrameInfo *info = static_cast<AwsFrameInfo *>(arg);
+    if (info->opcode != WS_BINARY || !info->final || info->index != 0 || info->len != len) return;
+
+    WsCommand cmd;
+    uint8_t   status = ws_parse_command(data, len, cmd) ? bridge.ws_command(cmd) : WS_ACK_BAD;
+    uint8_t   ack[WS_ACK_SIZE];
+    client->binary(ack, ws_ack_frame(ack, cmd.seq, status));
+}
+
+static void wifi_connect() {
+    WiFi.begin(ssid, password);
+    Serial.printf("WiFi: connecting to %s (attempt %u)\n", ssid, wifiLink.attempts());
+}
+
+static void wifi_up() {
+    Serial.print("WiFi: connected, IP ");
+    Serial.println(WiFi.localIP());
+
+    // Batches get a UTC stamp once this has answered
+    configTime(0, 0, "pool.ntp.org");
+    mqtt.start(millis());
+
+    // Routes were registered at boot; listening needs an interface with an address
+    if (!serverStarted) {
+        server.begin();
+        serverStarted = true;
+        Serial.println("Web server started.");
+    }
+}
+
+static void wifi_down() {
+    Serial.println("WiFi: link lost");
+    mqtt.stop(millis());
+}
+
+static uint32_t utc_seconds() {
+    time_t t = time(nullptr);
+    return t > 1600000000 ? static_cast<uint32_t>(t) : 0;
+}
+
+// Bridge and link health, once a batch period
+static void publish_metrics(unsigned long now) {
+    char fields[MQTT_PAYLOAD_MAX - 96];
+    int  n = snprintf(fields, sizeof(fields),
+                      "\"heap\":%u,\"heap_min\":%lu,\"block_min\":%lu,\"frag\":%u,\"rssi\":%d,\"wifi\":\"%s\","
+                      "\"bus_queued\":%u,\"bus_dropped\":%lu,\"mqtt\":[%lu,%lu,%lu,%lu,%lu],\"nodes\":[",
+                      static_cast<unsigned>(ESP.getFreeHeap()), static_cast<unsigned long>(bridge.mem.heap_min),
+                      static_cast<unsigned long>(bridge.mem.block_min), static_cast<unsigned>(bridge.mem.frag_permille()),
+                      WiFi.RSSI(), wifiLink.name(), static_cast<unsigned>(bridge.bus.queued()),
+                      static_cast<unsigned long>(bridge.bus.dropped), static_cast<unsigned long>(mqtt.queued()),
+                      static_cast<unsigned long>(mqtt.acked), static_cast<unsigned long>(mqtt.replays),
+                      static_cast<unsigned long>(mqtt.reconnects),
+                      static_cast<unsigned long>(telemetry.lost + mqttSpool.dropped));
+    // [address, online, polls, timeouts, awake per-mille] for each node heard from
+    bool first = true;
+    for (uint8_t a = 1; a <= NODE_MAX && n < static_cast<int>(sizeof(fields)) - 48; ++a) {
+        const BusNode &b = bridge.bus.node(a);
+        if (b.replies == 0) continue;
+        n += snprintf(fields + n, sizeof(fields) - n, "%s[%u,%u,%lu,%lu,%d]", first ? "" : ",", a, b.online ? 1 : 0,
+                      static_cast<unsigned long>(b.polls), static_cast<unsigned long>(b.timeouts), bridge.nodeDuty[a]);
+        first = false;
+    }
+    snprintf(fields + n, sizeof(fields) - n, "]");
+    telemetry.metrics(now, fields);
+}
+
+// Runs in the WiFi event task: flags only, wifiLink.service() does the rest
+static void on_wifi_event(WiFiEvent_t event) {
+    switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+            wifiLink.link_up();
+            break;
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+        case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+            wifiLink.link_down();
+            break;
+        default:
+            break;
+    }
+}
 
 void setup() {
     Serial.begin(115200);
@@ -45,158 +254,119 @@ void setup() {
         Serial.println("LittleFS mount failed!");
     }
 
-    WiFi.begin(ssid, password);
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(500);
-        Serial.print(".");
-    }
-    Serial.print("\nConnected! IP: ");
-    Serial.println(WiFi.localIP());
+    // Whatever the last run couldn't deliver goes first
+    mqttSpool.open(mqttFiles);
+    telemetry.boot  = esp_random();
+    telemetry.clock = utc_seconds;
+    telemetry.packed = mqtt_packed;
+    mqtt.cfg = { mqtt_host, mqtt_port, mqtt_client, mqtt_prefix, nullptr, nullptr };
+    Serial.printf("MQTT: %u batches spooled\n", mqttSpool.size());
+
+    bridge.begin();
+    bridge.telemetry = &telemetry;
+    bridge.log       = &Serial;
+    bridge.sse       = send_event;
+    bridge.ws_text   = send_ws_text;
+    bridge.ws_binary = send_ws_binary;
+    bridge.bus.send  = bus_send;
 
     server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
         request->send(LittleFS, "/website.html", "text/html");
     });
 
-    // ── Snapshot endpoint (last known values, no blocking Serial call) ─
-    server.on("/data", HTTP_GET, [](AsyncWebServerRequest *request) {
-        String json = "{\"ph\":"   + String(phValue,   2) +
-                      ",\"ec\":"   + String(ecValue,    1) +
-                      ",\"temp\":" + String(tempValue,  2) + "}";
-        AsyncWebServerResponse *r = request->beginResponse(200, "application/json", json);
-        r->addHeader("Access-Control-Allow-Origin", "*");
-        request->send(r);
-    });
+    // /data, /nodes, /history, the profile catalog and every command POST (bridge_core.hpp)
+    for (const BridgeRoute &route : BRIDGE_ROUTES) {
+        const BridgeRoute *r = &route;
+        if (!r->post) {
+            server.on(r->path, HTTP_GET, [r](AsyncWebServerRequest *request) { reply(request, *r); });
+            continue;
+        }
+        server.on(r->path, HTTP_POST,
+            [r](AsyncWebServerRequest *request) { reply(request, *r); },
+            nullptr,
+            [r](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+                collect_body(request, r->body_max, data, len, index);
+            });
+    }
 
-    server.on("/loading-dose", HTTP_POST,
+    // UART capture for replay on the host: {"on":true} starts a fresh one, {"on":false} stops it
+    server.on("/capture", HTTP_POST,
         [](AsyncWebServerRequest *request) {
-            String resp = "{\"ok\":true}";
-            AsyncWebServerResponse *r = request->beginResponse(200, "application/json", resp);
+            JsonDocument in(&bridge.webAlloc);
+            const char *body = static_cast<const char *>(request->_tempObject);
+            bool ok = body && !deserializeJson(in, body);
+            if (ok) {
+                bridge.lock.lock();
+                pendingCaptureOn = in["on"] | false;
+                pendingCapture   = true;
+                bridge.lock.unlock();
+            }
+            AsyncWebServerResponse *r = request->beginResponse(ok ? 200 : 400, "application/json",
+                                                               ok ? "{\"ok\":true}" : "{\"ok\":false}");
             r->addHeader("Access-Control-Allow-Origin", "*");
             request->send(r);
         },
         nullptr,
-        [](AsyncWebServerRequest *request,
-           uint8_t *data, size_t len, size_t index, size_t total) {
-
-            static char bodyBuf[256];
-            static size_t bodyLen = 0;
-
-            if (index == 0) bodyLen = 0;
-
-            size_t space = sizeof(bodyBuf) - bodyLen - 1;
-            size_t copy  = (len < space) ? len : space;
-            memcpy(bodyBuf + bodyLen, data, copy);
-            bodyLen += copy;
-            bodyBuf[bodyLen] = '\0';
-
-            if (index + len < total) return; // wait for more chunks
-
-            JsonDocument in;
-            if (deserializeJson(in, bodyBuf, bodyLen)) return;
-
-            // Build M:2001 forwarding message
-            JsonDocument out;
-            out["M"]      = MSG_LOAD_DOSE;
-            out["gro"]    = in["gro_ml"]   | 0.0f;
-            out["micro"]  = in["micro_ml"] | 0.0f;
-            out["bloom"]  = in["bloom_ml"] | 0.0f;
-            out["ph_up"]  = in["ph_up_ml"] | 0.0f;
-            out["ph_dn"]  = in["ph_dn_ml"] | 0.0f;
-
-            portENTER_CRITICAL(&doseMux);
-            serializeJson(out, pendingDoseJson, sizeof(pendingDoseJson));
-            pendingDose = true;
-            portEXIT_CRITICAL(&doseMux);
+        [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            collect_body(request, 32, data, len, index);
         }
     );
 
-    server.on("/set-state", HTTP_POST,
-        [](AsyncWebServerRequest *request) {
-            String resp = "{\"ok\":true}";
-            AsyncWebServerResponse *r = request->beginResponse(200, "application/json", resp);
-            r->addHeader("Access-Control-Allow-Origin", "*");
-            request->send(r);
-        },
-        nullptr,
-        [](AsyncWebServerRequest *request,
-           uint8_t *data, size_t len, size_t index, size_t total) {
-
-            static char bodyBuf[128];
-            static size_t bodyLen = 0;
-
-            if (index == 0) bodyLen = 0;
-
-            size_t space = sizeof(bodyBuf) - bodyLen - 1;
-            size_t copy  = (len < space) ? len : space;
-            memcpy(bodyBuf + bodyLen, data, copy);
-            bodyLen += copy;
-            bodyBuf[bodyLen] = '\0';
-
-            if (index + len < total) return; // wait for more chunks
-
-            JsonDocument in;
-            if (deserializeJson(in, bodyBuf, bodyLen)) return;
+    // Telemetry link: {"state":"up","queued":0,"acked":12,"replays":0,"reconnects":1,"lost":0}
+    server.on("/mqtt", HTTP_GET, [](AsyncWebServerRequest *request) {
+        JsonDocument doc(&bridge.webAlloc);
+        doc["state"]      = mqtt.name();
+        doc["queued"]     = mqtt.queued();
+        doc["acked"]      = mqtt.acked;
+        doc["replays"]    = mqtt.replays;
+        doc["reconnects"] = mqtt.reconnects;
+        doc["refused"]    = mqtt.refused;
+        doc["lost"]       = telemetry.lost + mqttSpool.dropped;
+        String json;
+        serializeJson(doc, json);
+        AsyncWebServerResponse *r = request->beginResponse(200, "application/json", json);
+        r->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(r);
+    });
 
-            // Build M:2002 forwarding message
-            JsonDocument out;
-            out["M"]   = MSG_SYSTEM_STATE;
-            out["run"] = in["run"] | false;
+    server.on("/capture", HTTP_GET, [](AsyncWebServerRequest *request) {
+        String json = String("{\"active\":") + (capture.active() ? "true" : "false") +
+                      ",\"bytes\":" + String(capture.bytes()) + "}";
+        AsyncWebServerResponse *r = request->beginResponse(200, "application/json", json);
+        r->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(r);
+    });
 
-            portENTER_CRITICAL(&doseMux);
-            serializeJson(out, pendingStateJson, sizeof(pendingStateJson));
-            pendingState = true;
-            portEXIT_CRITICAL(&doseMux);
+    // Download; stop the capture first or the last few seconds are still in RAM
+    server.on("/capture.log", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (!LittleFS.exists(CAPTURE_PATH)) {
+            request->send(404, "text/plain", "no capture");
+            return;
         }
-    );
+        request->send(LittleFS, CAPTURE_PATH, "text/plain", true);
+    });
 
-    server.on("/set-profile", HTTP_POST,
-        [](AsyncWebServerRequest *request) {
-            String resp = "{\"ok\":true}";
-            AsyncWebServerResponse *r = request->beginResponse(200, "application/json", resp);
-            r->addHeader("Access-Control-Allow-Origin", "*");
-            request->send(r);
-        },
-        nullptr,
-        [](AsyncWebServerRequest *request,
-           uint8_t *data, size_t len, size_t index, size_t total) {
-
-            static char bodyBuf[192];
-            static size_t bodyLen = 0;
-
-            if (index == 0) bodyLen = 0;
-
-            size_t space = sizeof(bodyBuf) - bodyLen - 1;
-            size_t copy  = (len < space) ? len : space;
-            memcpy(bodyBuf + bodyLen, data, copy);
-            bodyLen += copy;
-            bodyBuf[bodyLen] = '\0';
-
-            if (index + len < total) return; // wait for more chunks
-
-            JsonDocument in;
-            if (deserializeJson(in, bodyBuf, bodyLen)) return;
-
-            // Build M:2003 forwarding message
-            JsonDocument out;
-            out["M"]      = MSG_SET_PROFILE;
-            out["ec_min"] = in["ec_min"] | 0.0f;
-            out["ec_max"] = in["ec_max"] | 0.0f;
-            out["ec_avg"] = in["ec_avg"] | 0.0f;
-            out["ph_min"] = in["ph_min"] | 0.0f;
-            out["ph_max"] = in["ph_max"] | 0.0f;
-            out["ph_avg"] = in["ph_avg"] | 0.0f;
-
-            portENTER_CRITICAL(&doseMux);
-            serializeJson(out, pendingProfileJson, sizeof(pendingProfileJson));
-            pendingProfile = true;
-            portEXIT_CRITICAL(&doseMux);
-        }
-    );
+    open_catalog();
 
     server.addHandler(&events);
-    server.begin();
+    ws.onEvent(on_ws_event);
+    server.addHandler(&ws);
+
+    if (BUS_DE_PIN >= 0) {
+        Serial2.setPins(-1, -1, -1, BUS_DE_PIN);
+        Serial2.setMode(UART_MODE_RS485_HALF_DUPLEX);
+    }
+
+    // Reconnects are ours, with backoff, rather than the driver's fixed retry
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);
+    WiFi.onEvent(on_wifi_event);
+    wifiLink.connect = wifi_connect;
+    wifiLink.on_up   = wifi_up;
+    wifiLink.on_down = wifi_down;
+    wifiLink.start(millis());
 
-    Serial.println("Web server started.");
+    Serial.println("UART bridge started.");
 }
 
 
@@ -204,70 +374,43 @@ void loop() {
 
     unsigned long now = millis();
 
-    portENTER_CRITICAL(&doseMux);
-    bool hasDose = pendingDose;
-    if (hasDose) pendingDose = false;
-    portEXIT_CRITICAL(&doseMux);
-
-    if (hasDose) {
-        Serial2.print(pendingDoseJson);
-        Serial2.print('\n');
-        Serial.print("Forwarded loading dose -> ");
-        Serial.println(pendingDoseJson);
+    wifiLink.service(now);
+    mqtt.service(now);
+    telemetry.service(now);
+    if (now - lastMetricsMs >= MQTT_BATCH_MS) {
+        publish_metrics(now);
+        lastMetricsMs = now;
     }
 
-    portENTER_CRITICAL(&doseMux);
-    bool hasState = pendingState;
-    if (hasState) pendingState = false;
-    portEXIT_CRITICAL(&doseMux);
-
-    if (hasState) {
-        Serial2.print(pendingStateJson);
-        Serial2.print('\n');
-        Serial.print("Forwarded system state -> ");
-        Serial.println(pendingStateJson);
+    bridge.lock.lock();
+    bool hasCapture = pendingCapture;
+    bool captureOn  = pendingCaptureOn;
+    if (hasCapture) pendingCapture = false;
+    bridge.lock.unlock();
+
+    if (hasCapture) {
+        if (captureOn) {
+            Serial.println(capture.start() ? "Serial capture started." : "Serial capture: cannot open file");
+        } else if (capture.active()) {
+            capture.stop();
+            Serial.print("Serial capture stopped, ");
+            Serial.print(capture.bytes());
+            Serial.println(" bytes.");
+        }
     }
+    capture.service(now);
 
-    portENTER_CRITICAL(&doseMux);
-    bool hasProfile = pendingProfile;
-    if (hasProfile) pendingProfile = false;
-    portEXIT_CRITICAL(&doseMux);
-
-    if (hasProfile) {
-        Serial2.print(pendingProfileJson);
-        Serial2.print('\n');
-        Serial.print("Forwarded profile -> ");
-        Serial.println(pendingProfileJson);
+    // Sockets the browser dropped without a close
+    if (now - lastWsCleanupMs >= 1000) {
+        ws.cleanupClients();
+        lastWsCleanupMs = now;
     }
 
-    if (now - lastPollMs >= POLL_INTERVAL_MS) {
-        Serial2.print("{\"M\":1001}\n");
-        lastPollMs = now;
-    }
+    // Pending commands onto the bus, the recipe upload, watermarks, then the bus's next line
+    bridge.service(now);
 
     if (mcuReader.poll(Serial2)) {
-        const char *line = mcuReader.buf;
-
-        JsonDocument doc;
-        if (!deserializeJson(doc, line)) {
-
-            uint16_t msgType = doc["M"] | 0;
-
-            if (msgType == MSG_SENSOR_RESPONSE) {  // 1002
-
-                phValue   = doc["pH"]   | phValue;
-                ecValue   = doc["ec"]   | ecValue;
-                tempValue = doc["temp"] | tempValue;
-
-                Serial.printf("<- pH %.2f  EC %.1f  Temp %.2f\n",
-                              phValue, ecValue, tempValue);
-
-                String payload =
-                    "{\"ph\":"   + String(phValue,  2) +
-                    ",\"ec\":"   + String(ecValue,   1) +
-                    ",\"temp\":" + String(tempValue, 2) + "}";
-                events.send(payload.c_str(), "sensor", millis());
-            }
-        }
+        capture.record(CAPTURE_FROM_MCU, mcuReader.buf, now);
+        bridge.mcu_line(mcuReader.buf, now);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,349 @@
+// Benchmark: cost per call of the control-path primitives loop() runs every pass.
+// Host:   pio run -e native_control_bench && .pio/build/native_control_bench/program
+//             [--save FILE] [--baseline FILE]
+// Target: pio run -e grandcentral_control_bench -t upload && pio device monitor
+//
+// ns/op is wall time. cycles/op is DWT CYCCNT on the Grand Central and the TSC on
+// x86 hosts. With --baseline the run fails when any primitive is more than
+// BENCH_REGRESSION slower than the saved run. On the Grand Central the run also
+// fails when plan_doses takes longer than PLAN_BUDGET_US.
+
+#include <Arduino.h>
+#include <array>
+#include <stdio.h>
+#include <string.h>
+
+#include "sensors/ec_sensor.hpp"
+#include "sensors/ph_sensor.hpp"
+#include "sensors/temp_sensor.hpp"
+#include "sensors/sensor_array.hpp"
+#include "kalman.hpp"
+#include "controller.hpp"
+#include "dose_planner.hpp"
+#include "serial_comm.hpp"
+
+#if defined(__SAMD51__)
+static constexpr uint32_t BENCH_ITERS = 2000;
+#else
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+static constexpr uint32_t BENCH_ITERS = 200000;
+#endif
+
+static constexpr float BENCH_REGRESSION = 0.20f;
+
+// One dosing evaluation's plan on the M4; it runs inside a loop() pass
+static constexpr double PLAN_BUDGET_US = 1000.0;
+
+//!##################################################
+//!######## Timing ##################################
+//!##################################################
+
+#if defined(__SAMD51__)
+
+static void bench_clock_begin() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL  |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t bench_cycles() { return DWT->CYCCNT; }
+
+// The whole run fits in CYCCNT's 35 s wrap at 120 MHz
+struct BenchSpan {
+    uint32_t c0 = bench_cycles();
+    double cycles() const { return static_cast<uint32_t>(bench_cycles() - c0); }
+    double ns() const { return cycles() * 1e9 / F_CPU; }
+};
+
+#else
+
+static void bench_clock_begin() {}
+
+struct BenchSpan {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point t0 = Clock::now();
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t c0 = __rdtsc();
+    double cycles() const { return static_cast<double>(__rdtsc() - c0); }
+#else
+    double cycles() const { return NAN; }
+#endif
+    double ns() const { return std::chrono::duration<double, std::nano>(Clock::now() - t0).count(); }
+};
+
+#endif
+
+// Keeps a result alive without a store the compiler could see through
+template <typename T>
+static inline void keep(const T &v) { asm volatile("" : : "r,m"(v) : "memory"); }
+
+struct BenchResult {
+    const char *name;
+    double      ns;
+    double      cycles;
+};
+
+static constexpr size_t MAX_BENCHES = 16;
+static BenchResult results[MAX_BENCHES];
+static size_t      num_results = 0;
+
+template <typename F>
+static void bench(const char *name, F &&op) {
+    for (uint32_t i = 0; i < BENCH_ITERS / 10; ++i) op(i); // warm caches and branch predictors
+
+    BenchSpan span;
+    for (uint32_t i = 0; i < BENCH_ITERS; ++i) op(i);
+    double ns = span.ns(), cycles = span.cycles();
+
+    if (num_results < MAX_BENCHES) results[num_results++] = { name, ns / BENCH_ITERS, cycles / BENCH_ITERS };
+}
+
+//!##################################################
+//!######## Inputs ##################################
+//! 64 sample sets cycled through, so the filters see
+//! noise and the gates are exercised. Counts are what
+//! the Grand Central reads in a 1.3 mS/cm, pH 6.2,
+//! 22 C reservoir.
+//!##################################################
+
+static constexpr size_t NUM_SETS = 64;
+
+static std::array<std::array<uint16_t, 4>, NUM_SETS> ec_counts;
+static std::array<std::array<uint16_t, 2>, NUM_SETS> ph_counts;
+static std::array<std::array<uint16_t, 4>, NUM_SETS> temp_counts;
+
+static std::array<std::array<float, 4>, NUM_SETS> ec_values;
+static std::array<std::array<float, 2>, NUM_SETS> ph_values;
+static std::array<std::array<float, 4>, NUM_SETS> temp_values;
+
+// Out-of-band EC/pH pairs for the planner
+static std::array<std::array<float, 2>, NUM_SETS> plan_inputs;
+
+static const char *const COMM_LINES[] = {
+    "{\"M\":1001}",
+    "{\"M\":2002,\"run\":true}",
+    "{\"M\":2001,\"gro\":1.5,\"micro\":1.5,\"bloom\":1.5,\"ph_up\":0,\"ph_dn\":0.4}",
+    "{\"M\":2003,\"ec_min\":0.8,\"ec_max\":1.8,\"ec_avg\":1.3,\"ph_min\":6,\"ph_max\":6.8,\"ph_avg\":6.4}",
+};
+
+// Small LCG so host and target see the same inputs
+static uint32_t lcg = 12345;
+static int noise(int amplitude) {
+    lcg = lcg * 1664525u + 1013904223u;
+    return static_cast<int>((lcg >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static void make_inputs() {
+    for (size_t s = 0; s < NUM_SETS; ++s) {
+        for (size_t i = 0; i < 4; ++i) ec_counts[s][i]   = 1240 + noise(12);
+        for (size_t i = 0; i < 2; ++i) ph_counts[s][i]   = 807 + noise(4);
+        for (size_t i = 0; i < 4; ++i) temp_counts[s][i] = 2210 + noise(6);
+    }
+    for (size_t s = 0; s < NUM_SETS; ++s) plan_inputs[s] = {{ 0.6f + noise(15) / 100.0f, 6.4f + noise(120) / 100.0f }};
+
+    // One EC probe reads off in a few sets, so the outlier path is timed too
+    for (size_t s = 0; s < NUM_SETS; s += 16) ec_counts[s][2] = 300;
+
+    const float ec_k = ec_sensor::counts_to_ms(660.0f);
+    for (size_t s = 0; s < NUM_SETS; ++s) {
+        for (size_t i = 0; i < 4; ++i) ec_values[s][i]   = ec_k * ec_counts[s][i];
+        for (size_t i = 0; i < 2; ++i) ph_values[s][i]   = ph_sensor::SLOPE * ph_counts[s][i] + ph_sensor::OFFSET;
+        for (size_t i = 0; i < 4; ++i) temp_values[s][i] = temp_sensor::convert(temp_counts[s][i], 1.0f, 0.0f, 1.0f);
+    }
+}
+
+// Serializes into nothing; counts bytes so the work isn't dead
+class NullStream : public Stream {
+    public:
+        size_t bytes = 0;
+
+        size_t write(uint8_t) override { bytes++; return 1; }
+        size_t write(const uint8_t *, size_t n) override { bytes += n; return n; }
+        int available() override { return 0; }
+        int read() override { return -1; }
+        int peek() { return -1; }
+};
+
+//!##################################################
+//!######## Benchmarks ##############################
+//!##################################################
+
+static void run_benches() {
+    make_inputs();
+
+    KalmanFilter ec_k   { 1.3f, 0.3f };
+    KalmanFilter ph_k   { 6.2f, 0.1f };
+    KalmanFilter temp_k { 22.0f, 0.4f };
+    ProbeHealth<4> ec_h   { EC_FILTER_CONFIG };
+    ProbeHealth<2> ph_h   { PH_FILTER_CONFIG };
+    ProbeHealth<4> temp_h { TEMP_FILTER_CONFIG };
+
+    bench("ec_filter", [&](uint32_t i) { keep(ec_filter(ec_values[i % NUM_SETS], ec_k, ec_h)); });
+    bench("ph_filter", [&](uint32_t i) { keep(ph_filter(ph_values[i % NUM_SETS], ph_k, ph_h)); });
+    bench("temp_filter", [&](uint32_t i) { keep(temp_filter(temp_values[i % NUM_SETS], temp_k, temp_h)); });
+
+    // Single-probe conversions, ADC read included (the host ADC is a table lookup)
+#if !defined(ARDUINO)
+    native_adc[A1] = ec_counts[0][0];
+    native_adc[A3] = ph_counts[0][0];
+    native_adc[A2] = temp_counts[0][0];
+#endif
+    ec_sensor   ec(A1, 660.0f);
+    ph_sensor   ph(A3);
+    temp_sensor temp(A2);
+    bench("ec read_val", [&](uint32_t i) { keep(ec.read_val(21.0f + (i & 3))); });
+    bench("ph read_val", [&](uint32_t i) { keep(ph.read_val(21.0f + (i & 3))); });
+    bench("temp read_val", [&](uint32_t) { keep(temp.read_val()); });
+
+    // Whole-array conversion from counts already sampled, as loop() does after read()
+    SensorArray<ec_sensor, 4> ec_arr({{ A1, A5, A9, A13 }},
+        nominal_cal<ec_sensor>(filled<4>(ec_sensor::counts_to_ms(660.0f)), 0.0f));
+    SensorArray<ph_sensor, 2> ph_arr({{ A3, A15 }},
+        nominal_cal<ph_sensor>(filled<2>(ph_sensor::SLOPE), ph_sensor::OFFSET));
+    SensorArray<temp_sensor, 4> temp_arr({{ A2, A6, A10, A14 }},
+        nominal_cal<temp_sensor>(filled<4>(1.0f), 0.0f));
+    bench("ec convert x4", [&](uint32_t i) { keep(ec_arr.convert(ec_counts[i % NUM_SETS], 22.0f)); });
+    bench("ph convert x2", [&](uint32_t i) { keep(ph_arr.convert(ph_counts[i % NUM_SETS], 22.0f)); });
+    bench("temp convert x4", [&](uint32_t i) { keep(temp_arr.convert(temp_counts[i % NUM_SETS])); });
+
+    bench("proportion_nutrient", [&](uint32_t i) {
+        keep(proportion_nutrient(10.0f + (i & 7), 1 + (i & 1), 1, 2));
+    });
+
+    const TargetPlant  plant = { 0.8f, 1.8f, 1.3f, 6.0f, 6.8f, 6.4f, 1, 1, 1 };
+    const PlantModel   model = { 0.35f, 0.25f, 1.6f, 2.4f, -0.02f, 0.03f };
+    bench("plan_doses", [&](uint32_t i) {
+        const std::array<float, 2> &in = plan_inputs[i % NUM_SETS];
+        keep(plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, 10.0f, in[0], in[1]).total_ml);
+    });
+
+    NullStream sink;
+    bench("send_sensor_data", [&](uint32_t i) {
+        const std::array<float, 2> &p = ph_values[i % NUM_SETS];
+        send_sensor_data(sink, p[0], ec_values[i % NUM_SETS][0], temp_values[i % NUM_SETS][0]);
+    });
+    keep(sink.bytes);
+
+    bench("parse_message", [&](uint32_t i) {
+        JsonDocument doc;
+        keep(parse_message(COMM_LINES[i & 3], doc));
+    });
+}
+
+//!##################################################
+//!######## Reporting ###############################
+//!##################################################
+
+template <typename Out>
+static void report(Out &&print_line) {
+    char line[96];
+    snprintf(line, sizeof(line), "%-22s %12s %12s", "primitive", "ns/op", "cycles/op");
+    print_line(line);
+    for (size_t i = 0; i < num_results; ++i) {
+        snprintf(line, sizeof(line), "%-22s %12.1f %12.1f", results[i].name, results[i].ns, results[i].cycles);
+        print_line(line);
+    }
+}
+
+#if defined(ARDUINO)
+
+void setup() {
+    Serial.begin(115200);
+    while (!Serial && millis() < 5000);
+
+    bench_clock_begin();
+    run_benches();
+
+    Serial.print("Control-path bench, ");
+    Serial.print(BENCH_ITERS);
+    Serial.print(" iterations at ");
+    Serial.print(F_CPU / 1000000UL);
+    Serial.println(" MHz");
+    report([](const char *line) { Serial.println(line); });
+
+    for (size_t i = 0; i < num_results; ++i) {
+        if (strcmp(results[i].name, "plan_doses") != 0) continue;
+        Serial.print(results[i].ns / 1000.0 <= PLAN_BUDGET_US ? "PASSED" : "FAILED");
+        Serial.print(": plan_doses ");
+        Serial.print(results[i].ns / 1000.0);
+        Serial.print(" us, budget ");
+        Serial.println(PLAN_BUDGET_US);
+    }
+}
+
+void loop() {}
+
+#else
+
+// One "name<TAB>ns cycles" line per primitive, as --save writes it
+static bool load_baseline(const char *path, BenchResult *base, size_t &n) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+
+    static char names[MAX_BENCHES][32];
+    char line[128];
+    n = 0;
+    while (n < MAX_BENCHES && fgets(line, sizeof(line), f)) {
+        char  *tab = strchr(line, '\t');
+        if (!tab) continue;
+        *tab = '\0';
+        snprintf(names[n], sizeof(names[n]), "%.31s", line);
+        if (sscanf(tab + 1, "%lf %lf", &base[n].ns, &base[n].cycles) != 2) continue;
+        base[n].name = names[n];
+        n++;
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const char *save = nullptr, *baseline = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if      (!strcmp(argv[i], "--save"))     save     = argv[i + 1];
+        else if (!strcmp(argv[i], "--baseline")) baseline = argv[i + 1];
+    }
+
+    bench_clock_begin();
+    run_benches();
+
+    printf("Control-path bench, %u iterations\n", static_cast<unsigned>(BENCH_ITERS));
+    report([](const char *line) { printf("%s\n", line); });
+
+    if (save) {
+        FILE *f = fopen(save, "w");
+        if (!f) {
+            fprintf(stderr, "cannot write %s\n", save);
+            return 1;
+        }
+        for (size_t i = 0; i < num_results; ++i) fprintf(f, "%s\t%.2f %.2f\n", results[i].name, results[i].ns, results[i].cycles);
+        fclose(f);
+    }
+
+    int regressions = 0;
+    if (baseline) {
+        BenchResult base[MAX_BENCHES];
+        size_t      n = 0;
+        if (!load_baseline(baseline, base, n)) {
+            fprintf(stderr, "cannot read %s\n", baseline);
+            return 1;
+        }
+        for (size_t i = 0; i < num_results; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                if (strcmp(results[i].name, base[j].name) != 0) continue;
+                float ratio = static_cast<float>(results[i].ns / base[j].ns);
+                if (ratio > 1.0f + BENCH_REGRESSION) {
+                    printf("REGRESSION %s: %.1f ns/op vs %.1f (+%.0f%%)\n", results[i].name,
+                           results[i].ns, base[j].ns, (ratio - 1.0f) * 100.0f);
+                    regressions++;
+                }
+            }
+        }
+        printf("%s against %s (%d regressions)\n", regressions ? "FAILED" : "PASSED", baseline, regressions);
+    }
+    return regressions ? 1 : 0;
+}
+
+#endif
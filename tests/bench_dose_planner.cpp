@@ -0,0 +1,154 @@
+// Host benchmark: receding-horizon dose planner cost and cycles-to-band versus
+// the independent nutrient/pH calcs, and checks on the plans it makes.
+// pio run -e native_planner_bench && .pio/build/native_planner_bench/program
+// Time on the M4 is measured by bench_control_path (grandcentral_control_bench),
+// which fails when a plan takes longer than its budget.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "controller.hpp"
+#include "dose_planner.hpp"
+#include "reservoir_sim.hpp"
+#include "check.hpp"
+
+static const int    BENCH_PLANS     = 200000;
+
+static TargetPlant make_plant() {
+    TargetPlant p;
+    p.ec_low = 0.8f; p.ec_high = 1.8f; p.ec_avg = 1.3f;
+    p.ph_low = 6.0f; p.ph_high = 6.8f; p.ph_avg = 6.4f;
+    p.gro_amount = 1; p.micro_amount = 1; p.bloom_amount = 1;
+    return p;
+}
+
+static bool in_band(const TargetPlant &p, const ReservoirSim &sim) {
+    return sim.ec >= p.ec_low && sim.ph >= p.ph_low && sim.ph <= p.ph_high;
+}
+
+// Limits, and never pH Up and Down together
+static void check_plan(const DosePlan &plan, float ec, float ph) {
+    CHECK(plan.nutrient() <= DEFAULT_ACTUATOR_LIMITS.nutrient_ml + 1e-3f &&
+          plan.ph_up <= DEFAULT_ACTUATOR_LIMITS.ph_up_ml && plan.ph_down <= DEFAULT_ACTUATOR_LIMITS.ph_down_ml,
+          "plan over the limits at EC %.2f pH %.2f", ec, ph);
+    CHECK(plan.ph_up == 0.0f || plan.ph_down == 0.0f, "pH Up and Down together at EC %.2f pH %.2f", ec, ph);
+    CHECK(plan.gro >= 0.0f && plan.micro >= 0.0f && plan.bloom >= 0.0f, "negative dose at EC %.2f pH %.2f", ec, ph);
+}
+
+// Volumes for hand-worked states: 10 L, the sim's true gains
+static void check_volumes(const PlantModel &model, const TargetPlant &plant) {
+    // In band: nothing
+    DosePlan p = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, 10.0f, 1.3f, 6.4f);
+    CHECK(!p.any() && p.cycles == 0, "dosed an in-band tank");
+
+    // EC 0.5: every aim gets there in one cycle, so the smallest total wins: EC to 1.05 is
+    // (1.05 - 0.5) * 10 / 0.35 = 15.71 mL, which takes pH 6.4 down to 6.007, still in band
+    p = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, 10.0f, 0.5f, 6.4f);
+    CHECK(fabsf(p.nutrient() - 15.714f) < 0.01f, "nutrient %.3f mL, expected 15.714", p.nutrient());
+    CHECK(fabsf(p.gro - p.nutrient() / 3.0f) < 1e-3f && fabsf(p.bloom - p.gro) < 1e-3f, "1:1:1 split %.3f/%.3f/%.3f",
+          p.gro, p.micro, p.bloom);
+    CHECK(p.ph_up == 0.0f && p.ph_down == 0.0f, "pH dose %.3f/%.3f for the nutrients' acid", p.ph_up, p.ph_down);
+    CHECK(p.cycles == 1, "%u cycles", p.cycles);
+
+    // Same EC from pH 6.1: the acid takes it to 5.707, so pH Up to the lowest aim, 6.2:
+    // (6.2 - 5.707) * 10 / 1.6 = 3.08 mL
+    p = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, 10.0f, 0.5f, 6.1f);
+    CHECK(fabsf(p.nutrient() - 15.714f) < 0.01f, "nutrient %.3f mL", p.nutrient());
+    CHECK(fabsf(p.ph_up - 3.080f) < 0.01f, "pH Up %.3f mL, expected 3.080", p.ph_up);
+
+    // pH 7.5 alone: down to the highest aim, 6.6: 0.9 * 10 / 2.4 = 3.75 mL
+    p = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, 10.0f, 1.3f, 7.5f);
+    CHECK(p.nutrient() == 0.0f && fabsf(p.ph_down - 3.75f) < 0.01f, "pH Down %.3f mL, nutrient %.3f", p.ph_down,
+          p.nutrient());
+
+    // 100 L at EC 0.05: the cap's 200 mL only reach 0.75, a second cycle finishes
+    p = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, 100.0f, 0.05f, 6.4f);
+    CHECK(fabsf(p.nutrient() - DEFAULT_ACTUATOR_LIMITS.nutrient_ml) < 0.01f, "nutrient %.1f mL, expected the cap",
+          p.nutrient());
+    CHECK(p.cycles == 2, "%u cycles with the cap", p.cycles);
+
+    // No tank
+    p = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, 0.0f, 0.5f, 6.1f);
+    CHECK(!p.any(), "dosed an empty tank");
+}
+
+// Cycles until both EC and pH are in band, dosing from exact (noise-free) readings
+template <typename Policy>
+static int cycles_to_band(ReservoirSim sim, const TargetPlant &plant, Policy policy) {
+    for (int c = 0; c < 10; ++c) {
+        if (in_band(plant, sim)) return c;
+        float nut, up, down;
+        policy(sim, nut, up, down);
+        sim.dose(nut, up, down);
+    }
+    return 10;
+}
+
+int main() {
+    TargetPlant  plant = make_plant();
+    ReservoirSim truth;
+    PlantModel   model = { truth.ec_gain, truth.nutrient_acid, truth.ph_up_gain, truth.ph_down_gain, 0.0f, 0.0f };
+
+    auto independent = [&](const ReservoirSim &s, float &nut, float &up, float &down) {
+        nut  = nutrient_calc(plant.ec_avg, plant.ec_low, plant.ec_high, s.volume_l, s.ec, model.ec_gain);
+        up   = ph_up_calc(plant.ph_avg, plant.ph_low, plant.ph_high, s.volume_l, s.ph, model.ph_up_gain);
+        down = ph_down_calc(plant.ph_avg, plant.ph_low, plant.ph_high, s.volume_l, s.ph, model.ph_down_gain);
+    };
+    auto planned = [&](const ReservoirSim &s, float &nut, float &up, float &down) {
+        DosePlan plan = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, s.volume_l, s.ec, s.ph);
+        check_plan(plan, s.ec, s.ph);
+        nut  = plan.nutrient();
+        up   = plan.ph_up;
+        down = plan.ph_down;
+    };
+
+    check_volumes(model, plant);
+
+    // Cycles to band over a grid of starting states
+    int total_indep = 0, total_plan = 0, states = 0;
+    for (float ec = 0.3f; ec <= 1.6f; ec += 0.1f) {
+        for (float ph = 5.2f; ph <= 7.6f; ph += 0.2f) {
+            ReservoirSim sim = truth;
+            sim.ec = ec;
+            sim.ph = ph;
+            int indep = cycles_to_band(sim, plant, independent);
+            int plan  = cycles_to_band(sim, plant, planned);
+            // Exact model and readings: the first plan's forecast is what happens
+            int want  = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, sim.volume_l, ec, ph).cycles;
+            CHECK(plan == want, "EC %.1f pH %.1f: %d cycles, the plan said %d", ec, ph, plan, want);
+            CHECK(plan <= indep, "EC %.1f pH %.1f: planner %d cycles, independent %d", ec, ph, plan, indep);
+            total_indep += indep;
+            total_plan  += plan;
+            states++;
+        }
+    }
+
+    printf("cycles to band (mean over %d states): independent %.2f, planner %.2f\n",
+           states, double(total_indep) / states, double(total_plan) / states);
+
+    // Timing over random out-of-band states
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> ec_dist(0.2f, 1.0f);
+    std::uniform_real_distribution<float> ph_dist(5.0f, 7.8f);
+
+    std::vector<std::pair<float, float>> inputs(1024);
+    for (auto &in : inputs) in = { ec_dist(rng), ph_dist(rng) };
+
+    volatile float sink = 0.0f;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_PLANS; ++i) {
+        const auto &in = inputs[i & 1023];
+        DosePlan plan = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, 10.0f, in.first, in.second);
+        sink = sink + plan.total_ml;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    double ns_per_plan = std::chrono::duration<double, std::nano>(t1 - t0).count() / BENCH_PLANS;
+
+    printf("plan_doses: %.1f ns/plan on host, %d candidates x %d cycles\n",
+           ns_per_plan, PLAN_NUM_AIMS * PLAN_NUM_AIMS, PLAN_HORIZON);
+
+    return check_report();
+}
@@ -0,0 +1,271 @@
+// Host benchmark: time-series codec (ts_codec.hpp) against the JSON it replaces, on recorded
+// readings. Link bytes for a backfill (M:2019 blocks against one M:1002 per sample), spool
+// appends for the MQTT sensor topic (sensor/ts against JSON rows), bytes per sample,
+// encode / decode cost and the worst single-block decode.
+// pio run -e native_ts_codec_bench && .pio/build/native_ts_codec_bench/program [capture.log] [options]
+//
+//   capture.log  a UART capture from the bridge (/capture.log, serial_capture.hpp); its M:1002
+//                replies are the readings. Without one, a day of one tank is simulated through
+//                the firmware's probe filters.
+//   --hours N    simulated hours (default 24)
+//   --zones N    simulated zones, each its own tank (default 1)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "serial_comm.hpp"
+#include "serial_capture.hpp"
+#include "mqtt_link.hpp"
+#include "kalman.hpp"
+#include "reservoir_sim.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static const unsigned long POLL_MS = 2000;  // the bridge's M:1001
+static const unsigned long LOG_MS  = 10000; // the MCU's sample log (main.cpp)
+
+struct Reading {
+    unsigned long ms;
+    uint8_t       node;
+    uint8_t       zone;
+    ZoneReading   r;
+};
+
+// Every M:1002 zone the MCUs sent, in order
+static bool load_capture(const char *path, std::vector<Reading> &out) {
+    std::ifstream in(path);
+    if (!in) return false;
+    for (std::string line; std::getline(in, line);) {
+        CaptureRecord rec;
+        if (!parse_capture_record(line.c_str(), rec) || rec.dir != CAPTURE_FROM_MCU) continue;
+        JsonDocument doc;
+        if (deserializeJson(doc, rec.line) || (doc["M"] | 0) != MSG_SENSOR_RESPONSE) continue;
+        uint8_t   node  = doc["N"] | 1;
+        JsonArray zones = doc["zones"];
+        if (zones.isNull()) {
+            out.push_back({ rec.ms, node, 0, { doc["pH"] | 0.0f, doc["ec"] | 0.0f, doc["temp"] | 0.0f } });
+            continue;
+        }
+        for (size_t z = 0; z < zones.size() && z < ZONE_MAX; ++z) {
+            out.push_back({ rec.ms, node, static_cast<uint8_t>(z),
+                            { zones[z][0] | 0.0f, zones[z][1] | 0.0f, zones[z][2] | 0.0f } });
+        }
+    }
+    return !out.empty();
+}
+
+// Tanks sampled and filtered every 100 ms as the firmware does, polled every POLL_MS; a dose every
+// 4 h and a daily temperature swing
+static void simulate(float hours, uint8_t zones, std::vector<Reading> &out) {
+    struct Tank {
+        ReservoirSim                 sim;
+        KalmanFilter                 ec { 0.7f, 0.3f }, ph { 6.5f, 0.1f }, temp { 22.0f, 0.4f };
+        ProbeHealth<4>               ecHealth { EC_FILTER_CONFIG };
+        ProbeHealth<2>               phHealth { PH_FILTER_CONFIG };
+        ProbeHealth<4>               tempHealth { TEMP_FILTER_CONFIG };
+        ZoneReading                  latest = {};
+    };
+    std::vector<Tank> tanks(zones);
+    for (uint8_t z = 0; z < zones; ++z) tanks[z].sim.rng.seed(1234 + z);
+
+    unsigned long end = static_cast<unsigned long>(hours * 3600000.0f);
+    for (unsigned long ms = 0; ms < end; ms += 100) {
+        for (uint8_t z = 0; z < zones; ++z) {
+            Tank &t = tanks[z];
+            t.sim.advance(100.0f / 60000.0f);
+            t.sim.temp = 22.0f + 1.5f * sinf(2.0f * 3.14159265f * ms / 86400000.0f);
+            if (ms % (4 * 3600000UL) == 3600000UL) t.sim.dose(5.0f, 0.0f, 1.0f);
+            t.latest.ec   = ec_filter(t.sim.read_ec(), t.ec, t.ecHealth);
+            t.latest.ph   = ph_filter(t.sim.read_ph(), t.ph, t.phHealth);
+            t.latest.temp = temp_filter(t.sim.read_temp(), t.temp, t.tempHealth);
+            if (ms % POLL_MS == 0) out.push_back({ ms, 1, z, t.latest });
+        }
+    }
+}
+
+// Spool appends, as LittleFS would take them; nothing is kept
+class CountingSpoolFiles : public SpoolFiles {
+    public:
+        size_t writes = 0;
+        size_t bytes  = 0;
+
+        bool append(uint16_t, const void *, size_t len) override {
+            writes++;
+            bytes += len;
+            return true;
+        }
+        bool read(uint16_t, uint32_t, void *, size_t) override { return false; }
+        void remove(uint16_t) override {}
+        bool load_cursor(uint32_t &) override { return false; }
+        bool save_cursor(uint32_t) override { return true; }
+};
+
+class NoTransport : public MqttTransport {
+    public:
+        bool       open(const char *, uint16_t) override { return false; }
+        MqttSocket status() override { return MqttSocket::CLOSED; }
+        size_t     write(const uint8_t *, size_t) override { return 0; }
+        size_t     read(uint8_t *, size_t) override { return 0; }
+        void       close() override {}
+};
+
+struct SpoolRun {
+    size_t writes;
+    size_t messages;
+};
+
+// Every reading through Telemetry into a spool that keeps nothing
+static SpoolRun spool_run(const std::vector<Reading> &readings, bool packed) {
+    CountingSpoolFiles files;
+    NoTransport        net;
+    MqttSpool          spool(1, 1);
+    spool.open(files);
+    MqttLink  link(net, spool);
+    Telemetry telemetry(link, 0x1a2b3c4d);
+    telemetry.packed = packed;
+
+    unsigned long last = 0;
+    for (const Reading &r : readings) {
+        telemetry.sample(r.ms, r.node, r.zone, r.r.ph, r.r.ec, r.r.temp);
+        telemetry.service(r.ms);
+        last = r.ms;
+    }
+    telemetry.service(last + MQTT_PACKED_BATCH_MS); // what's left open goes out
+    return { files.writes, telemetry.messages() };
+}
+
+// Series key for the maps below
+static uint16_t key(const Reading &r) { return r.node * ZONE_MAX + r.zone; }
+
+int main(int argc, char **argv) {
+    const char *capture = nullptr;
+    float       hours   = 24.0f;
+    int         zones   = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--hours" && i + 1 < argc)      hours = atof(argv[++i]);
+        else if (a == "--zones" && i + 1 < argc) zones = std::max(1, std::min<int>(ZONE_MAX, atoi(argv[++i])));
+        else                                     capture = argv[i];
+    }
+
+    std::vector<Reading> readings;
+    if (capture) {
+        if (!load_capture(capture, readings)) {
+            fprintf(stderr, "%s: no M:1002 readings\n", capture);
+            return 1;
+        }
+        printf("%s: %zu readings\n", capture, readings.size());
+    } else {
+        simulate(hours, zones, readings);
+        printf("Simulated: %.0f h, %d zone(s), %zu readings every %lu ms\n", hours, zones, readings.size(), POLL_MS);
+    }
+
+    // Per node/zone, at the poll rate and at the MCU log's rate
+    std::map<uint16_t, std::vector<TsSample>> polled, logged;
+    std::map<uint16_t, unsigned long>         lastLogged;
+    for (const Reading &r : readings) {
+        TsSample s = ts_sample(r.ms, r.r.ph, r.r.ec, r.r.temp);
+        polled[key(r)].push_back(s);
+        auto at = lastLogged.find(key(r));
+        if (at == lastLogged.end() || r.ms - at->second >= LOG_MS) {
+            logged[key(r)].push_back(s);
+            lastLogged[key(r)] = r.ms;
+        }
+    }
+
+    // Codec: blocks, encode and decode cost, worst single block, quantization error
+    size_t   codecBytes = 0, blocks = 0, samples = 0;
+    double   encodeNs = 0.0, decodeNs = 0.0, worstBlockUs = 0.0;
+    float    maxErr[TS_VALUES] = {};
+    std::vector<std::vector<uint8_t>> packedBlocks;
+    for (auto &series : polled) {
+        uint8_t       buf[TS_BLOCK_BYTES];
+        TsBlockWriter w;
+        w.begin(buf);
+        auto e0 = Clock::now();
+        for (const TsSample &s : series.second) {
+            if (w.append(s)) continue;
+            packedBlocks.emplace_back(buf, buf + w.size());
+            w.begin(buf);
+            w.append(s);
+        }
+        if (!w.empty()) packedBlocks.emplace_back(buf, buf + w.size());
+        encodeNs += std::chrono::duration<double, std::nano>(Clock::now() - e0).count();
+        samples  += series.second.size();
+    }
+    size_t decoded = 0;
+    for (const std::vector<uint8_t> &b : packedBlocks) {
+        codecBytes += b.size();
+        blocks++;
+        auto d0 = Clock::now();
+        TsBlockReader r(b.data(), b.size());
+        TsSample s;
+        volatile uint32_t sink = 0;
+        while (r.next(s)) {
+            sink = sink + s.t;
+            decoded++;
+        }
+        double us = std::chrono::duration<double, std::micro>(Clock::now() - d0).count();
+        decodeNs += us * 1000.0;
+        worstBlockUs = std::max(worstBlockUs, us);
+    }
+    for (const Reading &r : readings) {
+        const float in[TS_VALUES] = { r.r.ph, r.r.ec, r.r.temp };
+        TsSample s = ts_sample(r.ms, r.r.ph, r.r.ec, r.r.temp);
+        for (uint8_t k = 0; k < TS_VALUES; ++k) maxErr[k] = std::max(maxErr[k], fabsf(ts_value(s.v[k]) - in[k]));
+    }
+
+    // Backfill over the link: one M:2019 per block of the MCU's log, against an M:1002 per sample
+    size_t jsonLink = 0, blockLink = 0, logSamples = 0;
+    for (auto &series : logged) {
+        for (const TsSample &s : series.second) {
+            Serial.tx.clear();
+            send_sensor_data(Serial, ts_value(s.v[0]), ts_value(s.v[1]), ts_value(s.v[2]));
+            jsonLink += Serial.tx.size();
+        }
+        logSamples += series.second.size();
+
+        // As the MCU's log fills them, each asked for once; on a bus "N" adds 7 bytes a line more
+        uint8_t       buf[TS_BLOCK_BYTES];
+        uint32_t      seq = 0;
+        TsBlockWriter w;
+        w.begin(buf);
+        for (size_t i = 0; i <= series.second.size(); ++i) {
+            if (i < series.second.size() && w.append(series.second[i])) continue;
+            Serial.tx.clear();
+            send_history_block(Serial, series.first % ZONE_MAX, seq, seq, 3600000UL, buf, w.size());
+            blockLink += Serial.tx.size();
+            seq++;
+            w.begin(buf);
+            if (i < series.second.size()) w.append(series.second[i]);
+        }
+    }
+
+    SpoolRun rows   = spool_run(readings, false);
+    SpoolRun packed = spool_run(readings, true);
+
+    printf("\nCodec, at the poll rate\n");
+    printf("  %zu samples in %zu blocks, %.2f bytes a sample (%.0f a block)\n", samples, blocks,
+           static_cast<double>(codecBytes) / samples, static_cast<double>(samples) / blocks);
+    printf("  encode %.1f ns / sample, decode %.1f ns / sample, worst block %.2f us\n", encodeNs / samples,
+           decodeNs / decoded, worstBlockUs);
+    printf("  quantization error  pH %.4f  EC %.4f  temp %.4f\n", maxErr[0], maxErr[1], maxErr[2]);
+    if (decoded != samples) printf("  DECODE MISMATCH: %zu of %zu\n", decoded, samples);
+
+    printf("\nBackfill over the link, the MCU's log every %lu ms (%zu samples)\n", LOG_MS, logSamples);
+    printf("  %-22s %10zu bytes  %6.1f a sample\n", "M:1002 per sample", jsonLink,
+           static_cast<double>(jsonLink) / logSamples);
+    printf("  %-22s %10zu bytes  %6.1f a sample  %5.1fx\n", "M:2019 blocks", blockLink,
+           static_cast<double>(blockLink) / logSamples, static_cast<double>(jsonLink) / blockLink);
+
+    printf("\nMQTT spool (one flash append a batch)\n");
+    printf("  %-22s %6zu appends  %6zu messages\n", "sensor rows (JSON)", rows.writes, rows.messages);
+    printf("  %-22s %6zu appends  %6zu messages  %5.1fx fewer writes\n", "sensor/ts (packed)", packed.writes,
+           packed.messages, static_cast<double>(rows.writes) / std::max<size_t>(1, packed.writes));
+    return decoded == samples ? 0 : 1;
+}
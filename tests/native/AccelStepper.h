@@ -0,0 +1,44 @@
+/*#################################################*/ 
+/* Host stand-in for AccelStepper: one step per    */
+/* run() call, no speed or acceleration modelling; */
+/* stop() runs on STOP_STEPS as its ramp down      */
+/*#################################################*/ 
+#pragma once
+
+#include "Arduino.h"
+
+class AccelStepper {
+    public:
+        enum { DRIVER = 1 };
+
+        AccelStepper(uint8_t, uint8_t, uint8_t) {}
+
+        void setMaxSpeed(float) {}
+        void setAcceleration(float) {}
+        void setSpeed(float) {}
+        float speed() const { return pos == target ? 0.0f : 1.0f; }
+
+        void move(long relative) { target = pos + relative; }
+        void moveTo(long absolute) { target = absolute; }
+        long distanceToGo() const { return target - pos; }
+        long currentPosition() const { return pos; }
+        void setCurrentPosition(long p) { pos = target = p; }
+
+        bool run() {
+            if (pos == target) return false;
+            pos += (target > pos) ? 1 : -1;
+            return true;
+        }
+        void runToPosition() { pos = target; }
+        void stop() {
+            long left = target - pos;
+            if (left > STOP_STEPS)       target = pos + STOP_STEPS;
+            else if (left < -STOP_STEPS) target = pos - STOP_STEPS;
+        }
+
+        static constexpr long STOP_STEPS = 50;
+
+    private:
+        long pos    = 0;
+        long target = 0;
+};
@@ -0,0 +1,142 @@
+/*#################################################*/ 
+/* Host stand-in for the Arduino core, just enough */
+/* for the header-only control code to build native*/
+/*#################################################*/ 
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <deque>
+#include <string>
+
+using std::min;
+using std::max;
+
+template <typename T, typename L, typename H>
+T constrain(T x, L low, H high) {
+    return x < low ? static_cast<T>(low) : (x > high ? static_cast<T>(high) : x);
+}
+
+// Digital I/O and interrupts are no-ops on the host
+#define HIGH         1
+#define LOW          0
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+#define FALLING      2
+
+#define DEC 10
+#define HEX 16
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int  digitalRead(uint8_t) { return LOW; }
+inline unsigned native_analog_writes = 0; // PWM reconfigurations, which an ISR mustn't do
+inline void analogWrite(uint8_t, int) { native_analog_writes++; }
+inline void analogReadResolution(int) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+inline int  digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+
+// Time only moves when the harness moves it. native_micros is µs into the current ms, for
+// harnesses that charge CPU time without reaching the next ms.
+inline unsigned long native_millis = 0;
+inline unsigned long native_micros = 0;
+inline unsigned long millis() { return native_millis; }
+inline unsigned long micros() { return native_millis * 1000UL + native_micros; }
+inline void delay(unsigned long ms) { native_millis += ms; }
+
+// Analog pins as the Grand Central numbers them
+enum : uint8_t { A0 = 0, A1, A2, A3, A4, A5, A6, A7, A8, A9, A10, A11, A12, A13, A14, A15 };
+
+class Print {
+    public:
+        virtual ~Print() = default;
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t *buf, size_t n) {
+            for (size_t i = 0; i < n; ++i) write(buf[i]);
+            return n;
+        }
+
+        size_t print(const char *s)          { return write(reinterpret_cast<const uint8_t *>(s), strlen(s)); }
+        size_t print(char c)                 { return write(static_cast<uint8_t>(c)); }
+        size_t print(double v, int digits = 2) { return printf_("%.*f", digits, v); }
+        size_t print(int v, int base = DEC)           { return printf_(base == HEX ? "%X" : "%d", v); }
+        size_t print(unsigned v, int base = DEC)      { return printf_(base == HEX ? "%X" : "%u", v); }
+        size_t print(long v, int base = DEC)          { return printf_(base == HEX ? "%lX" : "%ld", v); }
+        size_t print(unsigned long v, int base = DEC) { return printf_(base == HEX ? "%lX" : "%lu", v); }
+        size_t print(uint8_t v, int base = DEC)       { return print(static_cast<unsigned>(v), base); }
+        size_t print(uint16_t v, int base = DEC)      { return print(static_cast<unsigned>(v), base); }
+
+        template <typename T> size_t println(T v)          { return print(v) + print('\n'); }
+        template <typename T> size_t println(T v, int fmt) { return print(v, fmt) + print('\n'); }
+        size_t println() { return print('\n'); }
+
+        void flush() {}
+
+    private:
+        template <typename... Args>
+        size_t printf_(const char *fmt, Args... args) {
+            char buf[32];
+            int n = snprintf(buf, sizeof(buf), fmt, args...);
+            return write(reinterpret_cast<const uint8_t *>(buf), n < 0 ? 0 : static_cast<size_t>(n));
+        }
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() { return -1; }
+};
+
+// Loopback port: the harness feeds rx and inspects tx
+class HardwareSerial : public Stream {
+    public:
+        std::deque<char> rx;
+        std::string      tx;
+        bool             echo = false; // also copy tx to stdout
+
+        void begin(unsigned long) {}
+
+        size_t write(uint8_t c) override {
+            tx.push_back(static_cast<char>(c));
+            if (echo) fputc(c, stdout);
+            return 1;
+        }
+        using Print::write;
+
+        int available() override { return static_cast<int>(rx.size()); }
+        int read() override {
+            if (rx.empty()) return -1;
+            char c = rx.front();
+            rx.pop_front();
+            return static_cast<uint8_t>(c);
+        }
+        int peek() override { return rx.empty() ? -1 : static_cast<uint8_t>(rx.front()); }
+
+        void feed(const char *s) { while (*s) rx.push_back(*s++); }
+};
+
+inline HardwareSerial Serial, Serial1, Serial2;
+
+// SERCOM UARTs (variant.h on the real core)
+struct Sercom {};
+inline Sercom sercom1, sercom2;
+
+enum { SERCOM_RX_PAD_1 = 1, UART_TX_PAD_0 = 0, PIO_SERCOM = 2 };
+
+class Uart : public HardwareSerial {
+    public:
+        Uart(Sercom *, uint8_t, uint8_t, int, int) {}
+        void IrqHandler() {}
+};
+
+// What each analog pin reads; tests set it
+inline uint16_t native_adc[64] = {};
+inline uint16_t analogRead(uint8_t pin) { return native_adc[pin]; }
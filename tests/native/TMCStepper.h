@@ -0,0 +1,19 @@
+/*#################################################*/ 
+/* Host stand-in for the TMC2209 UART driver       */
+/*#################################################*/ 
+#pragma once
+
+#include "Arduino.h"
+
+class TMC2209Stepper {
+    public:
+        TMC2209Stepper(HardwareSerial *, float, uint8_t) {}
+
+        void begin() {}
+        void toff(uint8_t) {}
+        void rms_current(uint16_t) {}
+        void microsteps(uint16_t) {}
+        void pdn_disable(bool) {}
+        void I_scale_analog(bool) {}
+        void en_spreadCycle(bool) {}
+};
@@ -0,0 +1,16 @@
+/*#################################################*/ 
+/* Host stand-in for the I2C bus: nothing answers  */
+/*#################################################*/ 
+#pragma once
+
+#include "Arduino.h"
+
+class TwoWire {
+    public:
+        void    begin() {}
+        uint8_t requestFrom(uint8_t, uint8_t) { return 0; }
+        int     available() { return 0; }
+        int     read() { return -1; }
+};
+
+inline TwoWire Wire;
@@ -0,0 +1,23 @@
+#pragma once
+
+// Host test harness: CHECK(cond, fmt, ...) prints a failure with its file and line and carries
+// on; main() ends with return check_report();
+
+#include <cstdio>
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                  \
+    do {                                                  \
+        if (!(cond)) {                                    \
+            failures++;                                   \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);   \
+            printf(__VA_ARGS__);                          \
+            printf("\n");                                 \
+        }                                                 \
+    } while (0)
+
+static inline int check_report() {
+    printf("%s (%d failures)\n", failures ? "FAILED" : "PASSED", failures);
+    return failures ? 1 : 0;
+}
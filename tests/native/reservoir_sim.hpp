@@ -0,0 +1,56 @@
+/*#################################################*/ 
+/* Simulated reservoir for host-side tests         */
+/*#################################################*/ 
+#pragma once
+
+#include <array>
+#include <random>
+
+// Well-mixed reservoir with linear actuator gains (per mL/L), slow uptake drift
+// and independent Gaussian noise on every probe.
+struct ReservoirSim {
+    float volume_l = 10.0f;
+    float ec       = 1.2f;  // mS/cm
+    float ph       = 6.4f;
+    float temp     = 22.0f; // C
+
+    // Plant: true gains the estimators should find
+    float ec_gain       = 0.35f; // mS/cm per mL/L of nutrients
+    float ph_up_gain    = 1.6f;  // pH per mL/L of pH Up
+    float ph_down_gain  = 2.4f;  // pH per mL/L of pH Down
+    float nutrient_acid = 0.25f; // pH removed per mL/L of nutrients (FloraSeries is acidic)
+
+    // Uptake
+    float ec_drift_per_min = -0.0004f;
+    float ph_drift_per_min = 0.0006f;
+
+    float ec_noise   = 0.02f;
+    float ph_noise   = 0.02f;
+    float temp_noise = 0.1f;
+
+    std::mt19937 rng{ 1234 };
+
+    void dose(float nutrient_ml, float ph_up_ml, float ph_down_ml) {
+        ec += ec_gain * nutrient_ml / volume_l;
+        ph -= nutrient_acid * nutrient_ml / volume_l;
+        ph += ph_up_gain * ph_up_ml / volume_l;
+        ph -= ph_down_gain * ph_down_ml / volume_l;
+    }
+
+    void advance(float minutes) {
+        ec += ec_drift_per_min * minutes;
+        ph += ph_drift_per_min * minutes;
+    }
+
+    std::array<float, 4> read_ec() { return noisy<4>(ec, ec_noise); }
+    std::array<float, 2> read_ph() { return noisy<2>(ph, ph_noise); }
+    std::array<float, 4> read_temp() { return noisy<4>(temp, temp_noise); }
+
+    template <size_t N>
+    std::array<float, N> noisy(float value, float sigma) {
+        std::normal_distribution<float> dist(0.0f, sigma);
+        std::array<float, N> out;
+        for (float &v : out) v = value + dist(rng);
+        return out;
+    }
+};
@@ -0,0 +1,8 @@
+/*#################################################*/ 
+/* Host stand-in for the SAMD pin mux              */
+/*#################################################*/ 
+#pragma once
+
+#include "Arduino.h"
+
+inline int pinPeripheral(uint32_t, int) { return 0; }
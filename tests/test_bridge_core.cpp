@@ -0,0 +1,448 @@
+// Host test: the bridge's route handlers, pending slots and MCU replies (bridge_core.hpp), without
+// the web server: requests go straight to the handlers, lines straight to mcu_line().
+// pio run -e native_bridge_core_test && .pio/build/native_bridge_core_test/program
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bridge_core.hpp"
+#include "check.hpp"
+
+class TestRequest : public BridgeRequest {
+    public:
+        std::map<std::string, std::string> params;
+        std::string                        text;
+
+        explicit TestRequest(const char *b = "") : text(b) {
+            body = text.c_str();
+            len  = text.size();
+        }
+
+        bool        has(const char *name) const override { return params.count(name) != 0; }
+        const char *param(const char *name) const override {
+            auto it = params.find(name);
+            return it == params.end() ? "" : it->second.c_str();
+        }
+};
+
+class StringPrint : public Print {
+    public:
+        std::string s;
+        size_t write(uint8_t c) override {
+            s.push_back(static_cast<char>(c));
+            return 1;
+        }
+        using Print::write;
+};
+
+class MemCatalogFile : public CatalogFile {
+    public:
+        std::vector<uint8_t> data;
+
+        bool read(uint32_t offset, void *dst, size_t len) override {
+            if (offset + len > data.size()) return false;
+            memcpy(dst, data.data() + offset, len);
+            return true;
+        }
+};
+
+static std::vector<std::string> sent;
+static std::vector<std::string> events, eventData;
+static size_t                   frames = 0;
+
+static void record(uint8_t, const char *line) { sent.push_back(line); }
+static void on_sse(const char *event, const char *data) {
+    events.push_back(event);
+    eventData.push_back(data);
+}
+static void on_binary(const uint8_t *, size_t) { frames++; }
+
+// Lines the bus put out in `ms`, polls left out
+static std::vector<std::string> run(BridgeCore &core, unsigned long ms) {
+    sent.clear();
+    for (unsigned long end = native_millis + ms; native_millis < end; ++native_millis) core.service(native_millis);
+    std::vector<std::string> out;
+    for (const std::string &l : sent) {
+        if (l.find("\"M\":1001") == std::string::npos) out.push_back(l);
+    }
+    return out;
+}
+
+// The MCU's answer to an M:2018 from its own log, as the bus delivers it
+template <uint8_t N>
+static std::string answer_block(const TsLog<N> &log, const std::string &request, unsigned long mcu_now) {
+    JsonDocument doc;
+    deserializeJson(doc, request);
+    uint32_t seq = doc["seq"] | 0UL;
+    if (seq < log.oldest()) seq = log.oldest();
+    const uint8_t *block = nullptr;
+    size_t len = log.block(seq, block);
+
+    Serial.tx.clear();
+    send_history_block(Serial, doc["Z"] | 0, seq, log.newest(), mcu_now, block, len);
+    std::string line = Serial.tx.substr(0, Serial.tx.size() - 1);
+    return "{\"N\":" + std::to_string(doc["N"] | 1) + "," + line.substr(1);
+}
+
+static void fresh(BridgeCore &core) {
+    core.begin();
+    core.bus.send  = record;
+    core.sse       = on_sse;
+    core.ws_binary = on_binary;
+}
+
+void test_post_reaches_the_bus() {
+    BridgeCore  core;
+    fresh(core);
+    TestRequest rq("{\"gro_ml\":2.5,\"bloom_ml\":5}");
+    rq.params["node"] = "3";
+    rq.params["zone"] = "1";
+    StringPrint out;
+
+    CHECK(core.post_dose(rq, out) == 200 && out.s == "{\"ok\":true}", "reply %s", out.s.c_str());
+    std::vector<std::string> lines = run(core, 2000);
+    CHECK(lines.size() == 1, "%zu lines", lines.size());
+    CHECK(!lines.empty() && lines[0].find("{\"M\":2001,\"N\":3,\"Z\":1,\"gro\":2.5") == 0, "%s",
+          lines.empty() ? "" : lines[0].c_str());
+    CHECK(core.forwarded == 1 && core.overwritten == 0, "%u forwarded", core.forwarded);
+}
+
+void test_bad_body_is_refused() {
+    BridgeCore  core;
+    fresh(core);
+    TestRequest rq("{\"run\":tru");
+    StringPrint out;
+
+    CHECK(core.post_state(rq, out) == 400 && out.s == "{\"ok\":false}", "reply %s", out.s.c_str());
+    CHECK(run(core, 500).empty() && core.forwarded == 0, "a command went out");
+}
+
+void test_second_post_replaces_the_first() {
+    BridgeCore core;
+    fresh(core);
+    StringPrint out;
+    TestRequest on("{\"run\":true}"), off("{\"run\":false}");
+    core.post_state(on, out);
+    core.post_state(off, out);
+
+    std::vector<std::string> lines = run(core, 500);
+    CHECK(core.overwritten == 1, "%u overwritten", core.overwritten);
+    CHECK(lines.size() == 1 && lines[0].find("\"run\":false") != std::string::npos, "%zu lines", lines.size());
+}
+
+void test_sensor_reply_updates_routes() {
+    BridgeCore core;
+    fresh(core);
+    events.clear();
+    frames = 0;
+
+    core.mcu_line("{\"N\":2,\"M\":1002,\"zones\":[[6.1,1.4,21.5],[5.8,1.9,22]],\"duty\":12}", 1000);
+    CHECK(events.size() == 2 && events[0] == "sensor", "%zu events", events.size());
+    CHECK(frames == 1, "%zu ws frames", frames);
+
+    // Nothing logged on the MCU: the charts start from the next reading
+    TsLog<2> empty;
+    for (const std::string &l : run(core, 2000)) core.mcu_line(answer_block(empty, l, 3000).c_str(), native_millis);
+    native_millis = 1000;
+    core.mcu_line("{\"N\":2,\"M\":1002,\"zones\":[[6.1,1.4,21.5],[5.8,1.9,22]],\"duty\":12}", 1000);
+
+    TestRequest rq;
+    rq.params["node"] = "2";
+    rq.params["zone"] = "1";
+    StringPrint data;
+    core.get_data(rq, data);
+    CHECK(data.s == "{\"ph\":5.80,\"ec\":1.9,\"temp\":22.00}", "%s", data.s.c_str());
+
+    native_millis = 1500;
+    StringPrint nodes;
+    core.get_nodes(rq, nodes);
+    CHECK(nodes.s.find("\"node\":2") == std::string::npos, "listed before any poll answered: %s", nodes.s.c_str());
+
+    // A bucket shows once it has closed
+    native_millis = 1000 + HISTORY_BUCKET_MS;
+    core.mcu_line("{\"N\":2,\"M\":1002,\"zones\":[[6.1,1.4,21.5],[5.8,1.9,22]]}", native_millis);
+    StringPrint history;
+    core.get_history(rq, history);
+    CHECK(history.s.find("\"rows\":[[5.80,1.90,22.00]]") != std::string::npos, "%s", history.s.c_str());
+}
+
+void test_backfill_reads_the_mcu_log_back() {
+    BridgeCore core;
+    fresh(core);
+
+    // Six hours on the MCU, a sample every 10 s; its log holds the last few blocks
+    TsLog<4>      mcuLog;
+    unsigned long mcu_now = 6UL * 3600UL * 1000UL;
+    for (unsigned long t = 0; t < mcu_now; t += 10000) {
+        mcuLog.add(ts_sample(t, 6.0f + (t / 600000) * 0.01f, 1.5f, 21.0f));
+    }
+    size_t held = 0;
+    for (uint32_t seq = mcuLog.oldest(); seq <= mcuLog.newest(); ++seq) {
+        const uint8_t *block;
+        size_t len = mcuLog.block(seq, block);
+        held += TsBlockReader(block, len).count();
+    }
+
+    // The bridge just started
+    native_millis = 5000;
+    core.mcu_line("{\"N\":2,\"M\":1002,\"pH\":6.1,\"ec\":1.4,\"temp\":21.5}", native_millis);
+
+    size_t asked = 0;
+    for (int i = 0; i < 10; ++i) {
+        std::vector<std::string> lines = run(core, 2000);
+        if (lines.empty()) break;
+        CHECK(lines.size() == 1 && lines[0].find("\"M\":2018") != std::string::npos, "%zu lines", lines.size());
+        asked++;
+        core.mcu_line(answer_block(mcuLog, lines[0], mcu_now).c_str(), native_millis);
+    }
+    CHECK(asked == 4, "%zu blocks asked for", asked);
+    CHECK(core.backfilled == held, "%u of %zu samples", core.backfilled, held);
+
+    // Every closed 3 min bucket the log spans, then live readings carry on in the same ring
+    const HistoryRing *ring = core.history.find(2, 0);
+    size_t span = (held - 1) * 10000 / HISTORY_BUCKET_MS;
+    CHECK(ring && ring->size() >= span, "%u buckets of %zu", ring ? ring->size() : 0, span);
+    CHECK(ring && ring->size() && ring->at(ring->size() - 1).ph >= 630, "newest bucket pH %d",
+          ring && ring->size() ? ring->at(ring->size() - 1).ph : 0);
+
+    uint16_t before = ring ? ring->size() : 0;
+    native_millis += HISTORY_BUCKET_MS;
+    core.mcu_line("{\"N\":2,\"M\":1002,\"pH\":6.1,\"ec\":1.4,\"temp\":21.5}", native_millis);
+    CHECK(ring && ring->size() > before, "live reading didn't follow the backfill");
+    for (const std::string &l : run(core, 2000)) CHECK(l.find("\"M\":2018") == std::string::npos, "asked again");
+}
+
+void test_backfill_gives_up_on_a_silent_mcu() {
+    BridgeCore core;
+    fresh(core);
+    native_millis = 0;
+    core.mcu_line("{\"N\":4,\"M\":1002,\"pH\":6.1,\"ec\":1.4,\"temp\":21.5}", 0);
+    run(core, BACKFILL_TIMEOUT_MS + 100);
+    CHECK(!core.history.find(4, 0), "history before the timeout");
+
+    core.mcu_line("{\"N\":4,\"M\":1002,\"pH\":6.1,\"ec\":1.4,\"temp\":21.5}", native_millis);
+    CHECK(core.history.find(4, 0), "readings still held back");
+    CHECK(core.backfilled == 0, "%u backfilled", core.backfilled);
+}
+
+// loop() carrying on while /history streams: the lock isn't held across the writes, and the rows
+// pushed out of the ring meanwhile go out empty
+class ReadingMidStream : public StringPrint {
+    public:
+        BridgeCore   &core;
+        unsigned long at;
+        explicit ReadingMidStream(BridgeCore &c, unsigned long t) : core(c), at(t) {}
+
+        size_t write(uint8_t c) override {
+            if (s.size() == 40) core.mcu_line("{\"N\":4,\"M\":1002,\"pH\":6.4,\"ec\":1.4,\"temp\":21.5}", at);
+            return StringPrint::write(c);
+        }
+        using Print::write;
+};
+
+void test_history_streams_while_readings_arrive() {
+    BridgeCore core;
+    fresh(core);
+    native_millis = 0;
+    core.mcu_line("{\"N\":4,\"M\":1002,\"pH\":6.1,\"ec\":1.4,\"temp\":21.5}", 0);
+    run(core, BACKFILL_TIMEOUT_MS + 100);
+    for (int i = 0; i <= 5; ++i) {
+        core.mcu_line("{\"N\":4,\"M\":1002,\"pH\":6.1,\"ec\":1.4,\"temp\":21.5}", native_millis);
+        native_millis += HISTORY_BUCKET_MS;
+    }
+
+    TestRequest rq;
+    rq.params["node"] = "4";
+    ReadingMidStream out(core, native_millis + HISTORY_LEN * HISTORY_BUCKET_MS);
+    CHECK(core.get_history(rq, out) == 200, "status");
+    CHECK(out.s.find("\"rows\":[null,null,null,null,null]}") != std::string::npos, "%s", out.s.c_str());
+
+    native_millis = out.at;
+    StringPrint after;
+    core.get_history(rq, after);
+    CHECK(std::count(after.s.begin(), after.s.end(), ',') == HISTORY_LEN + 1, "%zu bytes, not a full ring after the gap",
+          after.s.size());
+}
+
+void test_select_resends_uncached_profile() {
+    MemCatalogFile file;
+    std::vector<CatalogProfile> profiles(1);
+    CHECK(parse_profile_csv("12,Basil,veg,1.0,1.6,5.5,6.5,2,3,4", profiles[0]), "csv");
+    build_catalog(profiles, 0, file.data);
+
+    BridgeCore core;
+    fresh(core);
+    CHECK(core.catalog.open(file), "catalog");
+
+    StringPrint out;
+    TestRequest missing("{\"id\":99}");
+    CHECK(core.post_select(missing, out) == 404, "unknown id accepted");
+
+    TestRequest rq("{\"id\":12}");
+    CHECK(core.post_select(rq, out) == 200, "select refused");
+    std::vector<std::string> lines = run(core, 500);
+    CHECK(lines.size() == 1 && lines[0].find("\"M\":2014") != std::string::npos, "%zu lines", lines.size());
+
+    // Not cached: the whole profile once, no event
+    events.clear();
+    core.mcu_line("{\"N\":1,\"M\":2015,\"id\":12,\"ok\":false}", native_millis);
+    lines = run(core, 500);
+    CHECK(lines.size() == 1 && lines[0].find("\"M\":2003") != std::string::npos, "%zu lines", lines.size());
+    CHECK(events.empty(), "event for a resend");
+
+    core.mcu_line("{\"N\":1,\"M\":2015,\"id\":12,\"ok\":true}", native_millis);
+    CHECK(events.size() == 1 && events[0] == "profile", "no profile event");
+}
+
+void test_ws_commands_share_the_slots() {
+    BridgeCore core;
+    fresh(core);
+
+    WsCommand cmd = {};
+    cmd.kind = WS_CMD_STATE;
+    cmd.node = 2;
+    cmd.run  = true;
+    CHECK(core.ws_command(cmd) == WS_ACK_OK, "state refused");
+
+    StringPrint out;
+    TestRequest off("{\"run\":false}");
+    core.post_state(off, out); // same slot: the POST wins
+    CHECK(core.overwritten == 1, "%u overwritten", core.overwritten);
+
+    cmd.kind = WS_CMD_DOSE;
+    cmd.ml[1] = -1.0f;
+    CHECK(core.ws_command(cmd) == WS_ACK_BAD, "negative dose accepted");
+    cmd.kind = WS_CMD_SELECT;
+    cmd.id   = 5;
+    CHECK(core.ws_command(cmd) == WS_ACK_UNKNOWN, "select without a catalog");
+    cmd.node = NODE_MAX + 1;
+    CHECK(core.ws_command(cmd) == WS_ACK_BAD, "bad node accepted");
+
+    std::vector<std::string> lines = run(core, 500);
+    CHECK(lines.size() == 1 && lines[0].find("\"run\":false") != std::string::npos, "%zu lines", lines.size());
+}
+
+void test_handlers_give_back_what_they_take() {
+    BridgeCore core;
+    fresh(core);
+    core.mcu_line("{\"N\":1,\"M\":1002,\"pH\":6.1,\"ec\":1.4,\"temp\":21.5}", 0);
+
+    StringPrint out;
+    TestRequest get;
+    TestRequest recipe("{\"steps\":[[\"dose\",\"gro\",2.5],[\"mix\",7]]}");
+    for (int i = 0; i < 50; ++i) {
+        for (const BridgeRoute &r : BRIDGE_ROUTES) {
+            if (r.post) continue;
+            (core.*r.handler)(get, out);
+        }
+        core.post_recipe(recipe, out);
+    }
+    CHECK(core.webAlloc.allocs == core.webAlloc.frees && core.webAlloc.live == 0, "%u allocs, %u live",
+          core.webAlloc.allocs, core.webAlloc.live);
+}
+
+// Runs the bridge until it puts out an M:2011, or up to ms; "" when none went out
+static std::string next_recipe_line(BridgeCore &core, unsigned long ms) {
+    for (unsigned long t = 0; t < ms; t += 10) {
+        for (const std::string &l : run(core, 10)) {
+            if (l.find("\"M\":2011") != std::string::npos) return l;
+        }
+    }
+    return "";
+}
+
+void test_rejected_recipe_upload_stops() {
+    BridgeCore core;
+    fresh(core);
+    StringPrint out;
+    std::string body = "{\"steps\":[";
+    for (int i = 0; i < 60; ++i) body += std::string(i ? "," : "") + "[\"wait\",1]";
+    TestRequest recipe((body + "]}").c_str());
+    core.post_recipe(recipe, out);
+
+    // Three lines' worth: the MCU takes the first, then refuses the second
+    std::string first = next_recipe_line(core, 5000);
+    CHECK(first.find("\"at\":0") != std::string::npos, "first line %s", first.c_str());
+    core.mcu_line("{\"M\":2013,\"state\":\"idle\",\"step\":0,\"op\":\"wait\",\"n\":22,\"event\":\"loaded\"}",
+                  native_millis);
+    std::string second = next_recipe_line(core, 5000);
+    CHECK(!second.empty() && second.find("\"at\":0") == std::string::npos, "second line %s", second.c_str());
+
+    eventData.clear();
+    core.mcu_line("{\"M\":2013,\"state\":\"idle\",\"step\":30,\"op\":\"\",\"n\":0,\"event\":\"rejected\","
+                  "\"why\":\"bad step\"}", native_millis);
+
+    std::string third = next_recipe_line(core, 5000);
+    CHECK(third.empty(), "upload carried on: %s", third.c_str());
+    CHECK(eventData.size() == 2 && eventData[1].find("\"error\":\"upload abandoned\"") != std::string::npos &&
+          eventData[1].find("\"why\":\"bad step\"") != std::string::npos,
+          "%s", eventData.empty() ? "no event" : eventData.back().c_str());
+}
+
+void test_silent_mcu_abandons_the_upload() {
+    // Two steps: one line, the last one, and the MCU never answers it
+    BridgeCore core;
+    fresh(core);
+    StringPrint out;
+    TestRequest recipe("{\"steps\":[[\"wait\",1],[\"mix\",5]]}");
+    core.post_recipe(recipe, out);
+
+    std::string line = next_recipe_line(core, 5000);
+    CHECK(line.find("\"at\":0") != std::string::npos, "line %s", line.c_str());
+
+    eventData.clear();
+    next_recipe_line(core, RECIPE_ANSWER_MS - 500);
+    CHECK(eventData.empty(), "gave up early: %s", eventData.empty() ? "" : eventData[0].c_str());
+    next_recipe_line(core, 1000);
+    CHECK(eventData.size() == 1 && eventData[0].find("\"error\":\"upload abandoned\"") != std::string::npos &&
+          eventData[0].find("\"why\":\"no answer\"") != std::string::npos,
+          "%s", eventData.empty() ? "no event" : eventData.back().c_str());
+
+    // A late answer is only passed on; the next upload starts clean
+    eventData.clear();
+    core.mcu_line("{\"M\":2013,\"state\":\"idle\",\"step\":0,\"op\":\"wait\",\"n\":2,\"event\":\"loaded\"}",
+                  native_millis);
+    CHECK(eventData.size() == 1, "%zu events for a late answer", eventData.size());
+    core.post_recipe(recipe, out);
+    line = next_recipe_line(core, 5000);
+    CHECK(line.find("\"at\":0") != std::string::npos, "next upload %s", line.c_str());
+    core.mcu_line("{\"M\":2013,\"state\":\"idle\",\"step\":0,\"op\":\"wait\",\"n\":2,\"event\":\"loaded\"}",
+                  native_millis);
+    eventData.clear();
+    next_recipe_line(core, RECIPE_ANSWER_MS + 1000);
+    CHECK(eventData.empty(), "answered upload abandoned: %s", eventData.empty() ? "" : eventData[0].c_str());
+}
+
+void test_routes_match_in_order() {
+    // A prefix would swallow a longer path listed after it
+    size_t n = sizeof(BRIDGE_ROUTES) / sizeof(BRIDGE_ROUTES[0]);
+    for (size_t i = 0; i < n; ++i) {
+        CHECK(BRIDGE_ROUTES[i].handler, "%s has no handler", BRIDGE_ROUTES[i].path);
+        CHECK(!BRIDGE_ROUTES[i].post || BRIDGE_ROUTES[i].body_max > 0, "%s takes no body", BRIDGE_ROUTES[i].path);
+        for (size_t j = i + 1; j < n; ++j) {
+            size_t len = strlen(BRIDGE_ROUTES[i].path);
+            CHECK(strncmp(BRIDGE_ROUTES[i].path, BRIDGE_ROUTES[j].path, len) != 0, "%s before %s",
+                  BRIDGE_ROUTES[i].path, BRIDGE_ROUTES[j].path);
+        }
+    }
+}
+
+int main() {
+    test_post_reaches_the_bus();
+    test_bad_body_is_refused();
+    test_second_post_replaces_the_first();
+    test_sensor_reply_updates_routes();
+    test_backfill_reads_the_mcu_log_back();
+    test_backfill_gives_up_on_a_silent_mcu();
+    test_history_streams_while_readings_arrive();
+    test_select_resends_uncached_profile();
+    test_ws_commands_share_the_slots();
+    test_handlers_give_back_what_they_take();
+    test_rejected_recipe_upload_stops();
+    test_silent_mcu_abandons_the_upload();
+    test_routes_match_in_order();
+
+    return check_report();
+}
@@ -0,0 +1,159 @@
+// Host test: bus addressing, the MCU's turn-based BusPort and the bridge's BusMaster scheduling.
+// pio run -e native_bus_master_test && .pio/build/native_bus_master_test/program
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bus_master.hpp"
+#include "check.hpp"
+
+struct Sent {
+    uint8_t     node;
+    std::string line;
+};
+
+static std::vector<Sent> sent;
+
+static void record(uint8_t node, const char *line) { sent.push_back({ node, line }); }
+
+static bool is_poll(const Sent &s) { return s.line.find("\"M\":1001") != std::string::npos; }
+
+// Nodes 1..live answer every poll straight away
+static void run(BusMaster &bus, unsigned long &now, unsigned long ms, uint8_t live) {
+    for (unsigned long end = now + ms; now < end; now += 5) {
+        size_t before = sent.size();
+        bus.service(now);
+        if (sent.size() > before && is_poll(sent.back()) && sent.back().node <= live) {
+            bus.received(sent.back().node, MSG_SENSOR_RESPONSE, now + 2);
+        }
+    }
+}
+
+void test_busport_holds_lines_for_the_turn() {
+    HardwareSerial uart;
+    BusPort port(uart);
+    port.begin(3);
+
+    port.print("{\"M\":2007,\"id\":1}\n");
+    CHECK(uart.tx.empty(), "sent outside its turn");
+
+    port.print("{\"M\":1002,\"pH\":6.1}\n");
+    port.print("{\"M\":20"); // half a line when the turn ends
+    port.end_turn();
+    CHECK(uart.tx == "{\"N\":3,\"M\":2007,\"id\":1}\n{\"N\":3,\"M\":1002,\"pH\":6.1}\n", "turn: %s", uart.tx.c_str());
+
+    uart.tx.clear();
+    port.print("07}\n");
+    port.end_turn();
+    CHECK(uart.tx == "{\"N\":3,\"M\":2007}\n", "rest of the line: %s", uart.tx.c_str());
+
+    // A line that doesn't fit is dropped whole; the rest still goes
+    uart.tx.clear();
+    std::string big(BUS_OUTBOX_SIZE, 'x');
+    port.print(("{\"M\":2013,\"s\":\"" + big + "\"}\n").c_str());
+    port.print("{\"M\":1002}\n");
+    port.end_turn();
+    CHECK(port.dropped == 1, "%u dropped", port.dropped);
+    CHECK(uart.tx == "{\"N\":3,\"M\":1002}\n", "after a drop: %s", uart.tx.c_str());
+
+    JsonDocument doc;
+    deserializeJson(doc, "{\"M\":1001,\"N\":3}");
+    CHECK(port.accepts(doc), "own address refused");
+    deserializeJson(doc, "{\"M\":1001,\"N\":4}");
+    CHECK(!port.accepts(doc), "other address accepted");
+    deserializeJson(doc, "{\"M\":1001}");
+    CHECK(!port.accepts(doc), "unaddressed line accepted on a bus");
+
+    // Point-to-point: straight through, node 1 or unaddressed
+    HardwareSerial uart2;
+    BusPort p2p(uart2);
+    p2p.begin(0);
+    p2p.print("{\"M\":1002}\n");
+    CHECK(uart2.tx == "{\"M\":1002}\n", "point-to-point held or stamped");
+    CHECK(p2p.accepts(doc), "unaddressed refused point-to-point");
+    deserializeJson(doc, "{\"M\":1001,\"N\":2}");
+    CHECK(!p2p.accepts(doc), "point-to-point took node 2's line");
+
+    CHECK(line_node("{\"M\":2002,\"N\":7,\"run\":true}") == 7, "line_node");
+    CHECK(line_node("{\"M\":2002}") == 0, "line_node unaddressed");
+}
+
+void test_round_robin_is_fair() {
+    sent.clear();
+    BusMaster bus;
+    bus.send = record;
+    unsigned long now = 0;
+
+    // 12 live nodes; after the boot sweep every one is polled every period
+    run(bus, now, 30000, 12);
+    CHECK(bus.online() == 12, "%u online", bus.online());
+
+    uint32_t lo = UINT32_MAX, hi = 0;
+    for (uint8_t a = 1; a <= 12; ++a) {
+        lo = std::min(lo, bus.node(a).replies);
+        hi = std::max(hi, bus.node(a).replies);
+    }
+    CHECK(hi - lo <= 1 && lo >= 14, "replies %u..%u", lo, hi);
+
+    // Empty addresses: swept at boot, then at most one probe per BUS_PROBE_MS / NODE_MAX
+    CHECK(bus.node(13).polls >= 1 && bus.node(13).polls <= 2, "%u probes of an empty address", bus.node(13).polls);
+    CHECK(!bus.node(13).online, "empty address online");
+}
+
+void test_commands_go_first_and_bring_the_poll_forward() {
+    sent.clear();
+    BusMaster bus;
+    bus.send = record;
+    unsigned long now = 0;
+    run(bus, now, 3000, 4);
+
+    sent.clear();
+    CHECK(bus.queue(2, "{\"M\":2002,\"N\":2,\"run\":true}"), "queue");
+    CHECK(bus.queue(2, "{\"M\":2003,\"N\":2}"), "queue");
+    CHECK(bus.queue(3, "{\"M\":2002,\"N\":3,\"run\":true}"), "queue");
+    run(bus, now, 200, 4);
+
+    CHECK(sent.size() >= 5, "%zu lines", sent.size());
+    // In order per node, interleaved between nodes, each followed by an early poll
+    std::vector<std::string> to2;
+    for (const Sent &s : sent) if (s.node == 2) to2.push_back(s.line);
+    CHECK(to2.size() >= 3 && to2[0].find("2002") != std::string::npos && to2[1].find("2003") != std::string::npos,
+          "node 2 order");
+    CHECK(is_poll({ 2, to2.back() }), "no early poll after the commands");
+    CHECK(bus.queued() == 0, "%u still queued", bus.queued());
+
+    CHECK(!bus.queue(0, "{}") && !bus.queue(NODE_MAX + 1, "{}"), "bad address queued");
+    for (uint8_t i = 0; i < BUS_QUEUE_LINES; ++i) bus.queue(1, "{\"M\":2008}");
+    CHECK(!bus.queue(1, "{\"M\":2008}") && bus.dropped == 1, "full queue");
+}
+
+void test_silent_node_goes_offline_and_comes_back() {
+    sent.clear();
+    BusMaster bus;
+    bus.send = record;
+    unsigned long now = 0;
+    run(bus, now, 5000, 3);
+    CHECK(bus.node(3).online, "node 3 not found");
+
+    // Node 3 unplugged: three missed polls and it is only probed
+    run(bus, now, 10000, 2);
+    CHECK(!bus.node(3).online && bus.node(3).timeouts == BUS_OFFLINE_MISSES, "%u timeouts", bus.node(3).timeouts);
+    uint32_t polls = bus.node(3).polls;
+    run(bus, now, 10000, 2);
+    CHECK(bus.node(3).polls == polls, "offline node polled at the full rate");
+
+    // Plugged back in: found on the next probe
+    run(bus, now, BUS_PROBE_MS, 3);
+    CHECK(bus.node(3).online, "node 3 not rediscovered");
+}
+
+int main() {
+    test_busport_holds_lines_for_the_turn();
+    test_round_robin_is_fair();
+    test_commands_go_first_and_bring_the_poll_forward();
+    test_silent_node_goes_offline_and_comes_back();
+
+    return check_report();
+}
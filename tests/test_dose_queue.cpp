@@ -0,0 +1,258 @@
+// Host test: dose job ordering, preemption, cancellation, stop latency and sharing the pumps between zones.
+// pio run -e native_dose_queue_test && .pio/build/native_dose_queue_test/program
+
+#include <cstdio>
+#include <vector>
+
+#include "dose_queue.hpp"
+#include "check.hpp"
+
+struct Report {
+    uint16_t id;
+    uint8_t  zone;
+    PumpId   pump;
+    JobKind  kind;
+    float    ml;
+    bool     aborted;
+};
+
+static std::vector<Report>  reports;
+static std::vector<uint8_t> routes;
+
+static void record(const DoseJob &job, float ml, bool aborted) {
+    reports.push_back({ job.id, job.zone, job.pump, job.kind, ml, aborted });
+}
+
+static void record_route(uint8_t zone) { routes.push_back(zone); }
+
+struct Rig {
+    HardwareSerial     port;
+    PumpSet<NUM_PUMPS> pumps { std::array<PumpPins, NUM_PUMPS>{}, port };
+
+    Mixer     mixer { 0, 0, 0 };
+    DoseQueue queue { pumps, mixer };
+
+    unsigned long now = 0;
+
+    Rig() {
+        reports.clear();
+        routes.clear();
+        queue.on_done = record;
+        queue.route   = record_route;
+    }
+
+    // Timer ticks between two loop() passes
+    void tick(int steps) {
+        for (int i = 0; i < steps; ++i) queue.step_isr();
+        queue.service(++now);
+    }
+
+    void run_until_idle() {
+        for (int i = 0; i < 100000 && queue.busy(); ++i) tick(100);
+    }
+};
+
+void test_ph_runs_before_nutrients() {
+    Rig rig;
+    rig.queue.push_dose(PUMP_GRO, 1.0f, JobSource::AUTO);
+    rig.queue.push_dose(PUMP_PH_DOWN, 1.0f, JobSource::AUTO);
+    rig.queue.push_mix(10, JobSource::AUTO);
+    rig.run_until_idle();
+
+    CHECK(reports.size() == 3, "%zu reports", reports.size());
+    if (reports.size() != 3) return;
+    CHECK(reports[0].pump == PUMP_PH_DOWN, "pH down did not run first");
+    CHECK(reports[1].pump == PUMP_GRO, "gro did not run second");
+    CHECK(reports[2].kind == JobKind::MIX, "mix did not run last");
+    CHECK(fabsf(reports[1].ml - 1.0f) < 0.01f, "gro dispensed %.3f mL", reports[1].ml);
+}
+
+void test_ph_preempts_nutrient() {
+    Rig rig;
+    rig.queue.push_dose(PUMP_GRO, 10.0f, JobSource::LOADING);
+    rig.tick(0);
+    rig.tick(1000); // part way into the gro dose
+
+    rig.queue.push_dose(PUMP_PH_UP, 1.0f, JobSource::AUTO);
+    rig.run_until_idle();
+
+    CHECK(reports.size() == 2, "%zu reports", reports.size());
+    if (reports.size() != 2) return;
+    CHECK(reports[0].pump == PUMP_PH_UP, "pH up did not preempt");
+    CHECK(reports[1].pump == PUMP_GRO && !reports[1].aborted, "gro did not resume");
+    CHECK(fabsf(reports[1].ml - 10.0f) < 0.01f, "gro dispensed %.3f of 10 mL", reports[1].ml);
+}
+
+void test_preemption_ramps_down() {
+    Rig rig;
+    rig.queue.push_dose(PUMP_GRO, 10.0f, JobSource::LOADING);
+    rig.tick(0);
+    rig.tick(1000);
+
+    rig.queue.push_dose(PUMP_PH_UP, 1.0f, JobSource::AUTO);
+    rig.queue.service(++rig.now);
+    float at = rig.pumps[PUMP_GRO].dispensed_ml();
+
+    // The gro pump decelerates; the pH pump waits for it
+    rig.tick(AccelStepper::STOP_STEPS / 2);
+    CHECK(rig.pumps[PUMP_GRO].dispensed_ml() > at, "gro stopped dead on preemption");
+    CHECK(rig.pumps[PUMP_PH_UP].dispensed_ml() == 0.0f && reports.empty(), "pH started before gro stopped");
+
+    rig.tick(AccelStepper::STOP_STEPS);
+    float ramp = (rig.pumps[PUMP_GRO].dispensed_ml() - at) * DEFAULT_PUMP_CALIBRATION.steps_per_ml;
+    CHECK(std::lround(ramp) == AccelStepper::STOP_STEPS, "ramped down over %.0f steps", ramp);
+
+    rig.run_until_idle();
+    CHECK(reports.size() == 2 && reports[0].pump == PUMP_PH_UP, "pH did not run next");
+    if (reports.size() != 2) return;
+    CHECK(fabsf(reports[1].ml - 10.0f) < 0.01f, "gro dispensed %.3f of 10 mL", reports[1].ml);
+}
+
+void test_profiles_run_at_whole_ticks() {
+    Rig rig;
+    for (const SpeedProfile &p : CAL_PROFILES) {
+        CHECK(step_ticks(p.max_speed) * p.max_speed == STEP_TIMER_HZ, "%.0f steps/s between ticks", p.max_speed);
+    }
+
+    // Asked for 8000 steps/s, the pump steps every 3rd tick; the calibration says so
+    rig.pumps[PUMP_GRO].set_calibration({ 500.0f, { 8000.0f, 1000.0f } });
+    float speed = rig.pumps[PUMP_GRO].calibration().profile.max_speed;
+    CHECK(fabsf(speed - STEP_TIMER_HZ / 3.0f) < 0.1f, "recorded %.1f steps/s", speed);
+    CHECK(step_ticks(step_setpoint(speed)) == 3 && 1e6f / step_setpoint(speed) < 3e6f / STEP_TIMER_HZ,
+          "setpoint %.1f steps/s", step_setpoint(speed));
+}
+
+void test_abort_reports_partial() {
+    Rig rig;
+    rig.queue.push_dose(PUMP_MICRO, 10.0f, JobSource::LOADING);
+    rig.queue.push_dose(PUMP_BLOOM, 10.0f, JobSource::LOADING);
+    rig.tick(0);
+    rig.tick(DEFAULT_PUMP_CALIBRATION.steps_per_ml * 2);
+
+    rig.queue.abort_all();
+
+    CHECK(!rig.queue.busy(), "queue still busy after abort");
+    CHECK(reports.size() == 2, "%zu reports", reports.size());
+    if (reports.size() != 2) return;
+    CHECK(reports[0].aborted && reports[1].aborted, "jobs not marked aborted");
+    CHECK(fabsf(reports[0].ml - 2.0f) < 0.01f, "micro reported %.3f mL, 2 went in", reports[0].ml);
+    CHECK(reports[1].ml == 0.0f, "bloom never started but reported %.3f mL", reports[1].ml);
+}
+
+void test_halt_from_isr_stops_next_tick() {
+    Rig rig;
+    Mixer mixer2 { 0, 0, 0 };
+    rig.queue.add_zone(mixer2);
+    rig.queue.push_dose(PUMP_GRO, 10.0f, JobSource::AUTO);
+    rig.queue.push_mix(60000, JobSource::AUTO, 1);
+    rig.tick(0);
+    rig.tick(500);
+    CHECK(mixer2.is_running(), "zone 1 not mixing");
+
+    long before = rig.pumps[PUMP_GRO].dispensed_ml() * DEFAULT_PUMP_CALIBRATION.steps_per_ml;
+    unsigned pwm = native_analog_writes;
+    rig.queue.halt_isr();
+    CHECK(native_analog_writes == pwm, "halt_isr reconfigured the PWM");
+    for (int i = 0; i < 100; ++i) rig.queue.step_isr();
+    long after = rig.pumps[PUMP_GRO].dispensed_ml() * DEFAULT_PUMP_CALIBRATION.steps_per_ml;
+
+    CHECK(before == after, "pump kept stepping after halt (%ld -> %ld)", before, after);
+
+    // loop() powers the mixer down and reports both jobs
+    rig.queue.service(++rig.now);
+    CHECK(!mixer2.is_running(), "mixer left on after the halt");
+    CHECK(reports.size() == 2 && reports[0].aborted && reports[1].aborted, "halt not reported as abort");
+}
+
+void test_cancel_one() {
+    Rig rig;
+    uint16_t a = rig.queue.push_dose(PUMP_GRO,   1.0f, JobSource::LOADING);
+    uint16_t b = rig.queue.push_dose(PUMP_MICRO, 1.0f, JobSource::LOADING);
+
+    CHECK(rig.queue.cancel(b), "queued job not cancelled");
+    CHECK(!rig.queue.cancel(b), "job cancelled twice");
+    rig.run_until_idle();
+
+    CHECK(reports.size() == 2, "%zu reports", reports.size());
+    if (reports.size() != 2) return;
+    CHECK(reports[0].id == b && reports[0].aborted, "cancelled job not reported");
+    CHECK(reports[1].id == a && !reports[1].aborted, "other job affected");
+}
+
+// Two reservoirs on the same pumps, each with its own mixer
+struct ZoneRig : Rig {
+    Mixer mixer2 { 0, 0, 0 };
+
+    ZoneRig() { queue.add_zone(mixer2); }
+};
+
+void test_zones_share_pumps_and_overlap_mixes() {
+    ZoneRig rig;
+    CHECK(rig.queue.zones() == 2, "%u zones", rig.queue.zones());
+    CHECK(rig.queue.push_dose(PUMP_GRO, 1.0f, JobSource::AUTO, 2) == 0, "job for a zone that doesn't exist");
+
+    rig.queue.push_dose(PUMP_GRO, 1.0f, JobSource::AUTO, 0);
+    rig.queue.push_mix(5000, JobSource::AUTO, 0);
+    rig.queue.push_dose(PUMP_MICRO, 1.0f, JobSource::AUTO, 1);
+    rig.queue.push_mix(5000, JobSource::AUTO, 1);
+    rig.run_until_idle();
+
+    CHECK(reports.size() == 4, "%zu reports", reports.size());
+    if (reports.size() != 4) return;
+    // Zone 1 doses while zone 0 mixes; each zone still doses before it mixes
+    CHECK(reports[0].zone == 0 && reports[0].pump == PUMP_GRO, "zone 0 did not dose first");
+    CHECK(reports[1].zone == 1 && reports[1].pump == PUMP_MICRO, "zone 1 waited for zone 0's mix");
+    CHECK(reports[2].zone == 0 && reports[2].kind == JobKind::MIX, "zone 0 mix");
+    CHECK(reports[3].zone == 1 && reports[3].kind == JobKind::MIX, "zone 1 mix");
+    CHECK(rig.now < 2 * 5000, "mixes ran back to back (%lu ms)", rig.now);
+    CHECK(routes.size() == 2 && routes[0] == 0 && routes[1] == 1, "manifold not routed per zone");
+}
+
+void test_ph_preempts_across_zones() {
+    ZoneRig rig;
+    rig.queue.push_dose(PUMP_GRO, 10.0f, JobSource::LOADING, 0);
+    rig.tick(0);
+    rig.tick(1000);
+
+    rig.queue.push_dose(PUMP_PH_UP, 1.0f, JobSource::AUTO, 1);
+    rig.run_until_idle();
+
+    CHECK(reports.size() == 2, "%zu reports", reports.size());
+    if (reports.size() != 2) return;
+    CHECK(reports[0].zone == 1 && reports[0].pump == PUMP_PH_UP, "zone 1's pH did not preempt");
+    CHECK(reports[1].zone == 0 && fabsf(reports[1].ml - 10.0f) < 0.01f, "zone 0's gro: %.3f of 10 mL", reports[1].ml);
+    CHECK(routes.size() == 3 && routes[1] == 1 && routes[2] == 0, "manifold not switched back");
+}
+
+void test_abort_zone_leaves_the_others() {
+    ZoneRig rig;
+    rig.queue.push_dose(PUMP_GRO, 2.0f, JobSource::LOADING, 0);
+    rig.queue.push_dose(PUMP_MICRO, 2.0f, JobSource::LOADING, 1);
+    rig.queue.push_mix(10, JobSource::LOADING, 1);
+    rig.tick(0);
+
+    rig.queue.abort_zone(1);
+    CHECK(!rig.queue.zone_busy(1) && rig.queue.zone_busy(0), "abort_zone hit the wrong zone");
+    rig.run_until_idle();
+
+    CHECK(reports.size() == 3, "%zu reports", reports.size());
+    if (reports.size() != 3) return;
+    CHECK(reports[0].zone == 1 && reports[0].aborted && reports[1].zone == 1 && reports[1].aborted,
+          "zone 1 jobs not aborted");
+    CHECK(reports[2].zone == 0 && !reports[2].aborted && fabsf(reports[2].ml - 2.0f) < 0.01f, "zone 0 dose cut short");
+}
+
+int main() {
+    test_ph_runs_before_nutrients();
+    test_ph_preempts_nutrient();
+    test_preemption_ramps_down();
+    test_profiles_run_at_whole_ticks();
+    test_abort_reports_partial();
+    test_halt_from_isr_stops_next_tick();
+    test_cancel_one();
+    test_zones_share_pumps_and_overlap_mixes();
+    test_ph_preempts_across_zones();
+    test_abort_zone_leaves_the_others();
+
+    return check_report();
+}
@@ -0,0 +1,168 @@
+// Host test: when the adaptive scheduler runs the dosing calcs — band exits, forecasts,
+// the backstop, the settle window after a dose and a resume after a reset.
+// pio run -e native_dose_scheduler_test && .pio/build/native_dose_scheduler_test/program
+
+#include <cstdio>
+
+#include "dose_scheduler.hpp"
+#include "check.hpp"
+
+static const TargetPlant PLANT = { 1.0f, 1.6f, 1.3f, 5.8f, 6.4f, 6.1f, 1, 1, 1 };
+static const unsigned long SAMPLE_MS = 10000; // dosing is looked at on every 10 s sample
+
+// Feeds samples from `now` for `ms`, EC and pH moving at the given rates per minute;
+// returns the first trigger (now left at that sample), or NONE after the whole stretch
+struct Tank {
+    DoseScheduler sched;
+    unsigned long now = 0;
+    float         ec  = 1.3f;
+    float         ph  = 6.1f;
+
+    DoseTrigger run(unsigned long ms, float ec_per_min = 0.0f, float ph_per_min = 0.0f) {
+        for (unsigned long end = now + ms; now < end; now += SAMPLE_MS) {
+            ec += ec_per_min * SAMPLE_MS / 60000.0f;
+            ph += ph_per_min * SAMPLE_MS / 60000.0f;
+            sched.update(ec, ph, now);
+            DoseTrigger t = sched.due(PLANT, now);
+            if (t != DoseTrigger::NONE) return t;
+        }
+        return DoseTrigger::NONE;
+    }
+};
+
+void test_backstop_when_nothing_drifts() {
+    Tank t;
+    t.sched.begin(0);
+    CHECK(t.run(DEFAULT_SCHEDULER_CONFIG.max_interval_ms - SAMPLE_MS) == DoseTrigger::NONE, "evaluated a still tank");
+    CHECK(t.run(2 * SAMPLE_MS) == DoseTrigger::BACKSTOP, "no backstop");
+    CHECK(t.now == DEFAULT_SCHEDULER_CONFIG.max_interval_ms, "backstop at %lu ms", t.now);
+
+    t.sched.evaluated(t.now, false);
+    CHECK(t.run(DEFAULT_SCHEDULER_CONFIG.max_interval_ms - SAMPLE_MS) == DoseTrigger::NONE, "backstop repeated early");
+}
+
+void test_out_of_band_now_and_not_every_pass() {
+    Tank t;
+    t.sched.begin(0);
+    t.run(60000);
+    t.ec = 0.9f;
+    CHECK(t.run(SAMPLE_MS) == DoseTrigger::OUT_OF_BAND, "low EC not acted on");
+    CHECK(t.sched.ec_for_dosing() == 0.9f, "dosing against %.2f", t.sched.ec_for_dosing());
+
+    // Nothing dosed (say the pumps are at their limit): once per drift sample, not per loop pass
+    t.sched.evaluated(t.now, false);
+    CHECK(t.sched.due(PLANT, t.now + 1) == DoseTrigger::NONE, "re-evaluated on the next pass");
+    CHECK(t.sched.due(PLANT, t.now + SAMPLE_MS) == DoseTrigger::OUT_OF_BAND, "still out of band, not re-evaluated");
+
+    // EC above the band is diluted by the operator, not dosed
+    Tank high;
+    high.sched.begin(0);
+    high.ec = 1.9f;
+    CHECK(high.run(60000) == DoseTrigger::NONE, "high EC triggered dosing");
+}
+
+void test_forecast_doses_ahead() {
+    // Falling 0.02 mS/cm a minute from 1.15: out of band in ~7.5 min, inside the 10 min lookahead
+    Tank t;
+    t.sched.begin(0);
+    t.ec = 1.25f;
+    DoseTrigger trig = t.run(600000, -0.02f);
+    CHECK(trig == DoseTrigger::PREDICTED_EXIT, "trigger %d", static_cast<int>(trig));
+    CHECK(t.ec > PLANT.ec_low, "only caught it at %.3f, out of band", t.ec);
+    CHECK(t.sched.ec_rate() < -0.01f && t.sched.ec_rate() > -0.03f, "rate %.4f/min", t.sched.ec_rate());
+    CHECK(t.sched.ec_for_dosing() < PLANT.ec_low, "dosing against %.3f, not the forecast", t.sched.ec_for_dosing());
+    CHECK(t.sched.ph_for_dosing() == t.ph, "pH forecast without pH drift");
+
+    // Rising EC is never a reason to dose
+    Tank up;
+    up.sched.begin(0);
+    up.ec = 1.5f;
+    CHECK(up.run(600000, 0.02f) == DoseTrigger::NONE, "rising EC triggered dosing");
+
+    // pH leaves either side
+    Tank acid;
+    acid.sched.begin(0);
+    acid.ph = 6.3f;
+    CHECK(acid.run(600000, 0.0f, 0.02f) == DoseTrigger::PREDICTED_EXIT, "rising pH not forecast");
+    CHECK(acid.sched.ph_for_dosing() > PLANT.ph_high, "pH forecast %.3f", acid.sched.ph_for_dosing());
+}
+
+void test_empty_forecast_is_held_off() {
+    Tank t;
+    t.sched.begin(0);
+    t.ec = 1.25f;
+    CHECK(t.run(600000, -0.005f) == DoseTrigger::NONE, "slow drift forecast early");
+    CHECK(t.run(1200000, -0.01f) == DoseTrigger::PREDICTED_EXIT, "no forecast");
+
+    // The plan came out empty: the same forecast isn't re-planned every sample
+    t.sched.evaluated(t.now, false);
+    unsigned long held_at = t.now;
+    t.now += SAMPLE_MS;
+    DoseTrigger trig = t.run(DEFAULT_SCHEDULER_CONFIG.forecast_hold_ms - SAMPLE_MS, -0.01f);
+    CHECK(trig == DoseTrigger::NONE, "trigger %d %lu ms into the hold", static_cast<int>(trig), t.now - held_at);
+    CHECK(t.ec > PLANT.ec_low, "left the band during the hold");
+    CHECK(t.run(2 * SAMPLE_MS, -0.01f) == DoseTrigger::PREDICTED_EXIT, "forecast not back after the hold");
+
+    // Leaving the band isn't held off
+    t.sched.evaluated(t.now, false);
+    t.now += SAMPLE_MS;
+    t.ec = 0.95f;
+    CHECK(t.run(SAMPLE_MS) == DoseTrigger::OUT_OF_BAND, "band exit held off with the forecast");
+
+    // A dose ends the hold
+    t.sched.evaluated(t.now, true);
+    t.ec = 1.25f;
+    t.run(DEFAULT_SCHEDULER_CONFIG.min_settle_ms + SAMPLE_MS);
+    CHECK(t.run(600000, -0.02f) == DoseTrigger::PREDICTED_EXIT, "forecast still held after a dose");
+}
+
+void test_settles_after_a_dose() {
+    Tank t;
+    t.sched.begin(0);
+    t.run(60000);
+    t.ec = 0.9f;
+    CHECK(t.run(SAMPLE_MS) == DoseTrigger::OUT_OF_BAND, "low EC not acted on");
+    t.sched.evaluated(t.now, true);
+    unsigned long dosed_at = t.now;
+    t.now += SAMPLE_MS;
+
+    // Still low while it mixes in: not looked at again until the settle time is up, and the mixing
+    // transient isn't taken for drift
+    t.ec = 1.2f;
+    DoseTrigger trig = t.run(DEFAULT_SCHEDULER_CONFIG.min_settle_ms - SAMPLE_MS, 0.05f);
+    CHECK(trig == DoseTrigger::NONE, "trigger %d %lu ms after the dose", static_cast<int>(trig), t.now - dosed_at);
+    CHECK(t.sched.ec_rate() == 0.0f, "drift %.4f picked up while settling", t.sched.ec_rate());
+
+    t.ec = 0.95f;
+    CHECK(t.run(2 * SAMPLE_MS) == DoseTrigger::OUT_OF_BAND, "not re-evaluated after settling");
+    CHECK(t.now - dosed_at >= DEFAULT_SCHEDULER_CONFIG.min_settle_ms, "re-evaluated %lu ms after the dose",
+          t.now - dosed_at);
+}
+
+void test_resume_keeps_the_cadence() {
+    // Reset 50 min after the last evaluation: the backstop is 10 min away, not an hour
+    Tank t;
+    t.now = 5000000;
+    t.sched.resume(t.now, 50UL * 60UL * 1000UL);
+    unsigned long start = t.now;
+    CHECK(t.run(DEFAULT_SCHEDULER_CONFIG.max_interval_ms) == DoseTrigger::BACKSTOP, "no backstop");
+    CHECK(t.now - start <= 10UL * 60UL * 1000UL, "backstop %lu ms after the resume", t.now - start);
+
+    // A day down evaluates straight away
+    Tank late;
+    late.now = 5000000;
+    late.sched.resume(late.now, 86400000UL);
+    late.now += SAMPLE_MS;
+    CHECK(late.run(SAMPLE_MS) == DoseTrigger::BACKSTOP, "overdue backstop not run");
+}
+
+int main() {
+    test_backstop_when_nothing_drifts();
+    test_out_of_band_now_and_not_every_pass();
+    test_forecast_doses_ahead();
+    test_empty_forecast_is_held_off();
+    test_settles_after_a_dose();
+    test_resume_keeps_the_cadence();
+
+    return check_report();
+}
@@ -0,0 +1,134 @@
+// Host test: online gain identification against a simulated reservoir.
+// pio run -e native_gain_test && .pio/build/native_gain_test/program
+
+#include <cstdio>
+#include <array>
+
+#include "controller.hpp"
+#include "kalman.hpp"
+#include "gain_estimator.hpp"
+#include "reservoir_sim.hpp"
+#include "check.hpp"
+
+static const float SAMPLE_HZ    = 5.0f;
+static const unsigned long SAMPLE_MS = 200;
+static const float SETTLE_MIN   = 3.0f;
+
+struct Loop {
+    ReservoirSim sim;
+    KalmanFilter ec_k   { 1.2f, 0.3f };
+    KalmanFilter ph_k   { 6.4f, 0.1f };
+    ProbeHealth<4> ec_h { filter_config_at(EC_FILTER_CONFIG, SAMPLE_MS) };
+    ProbeHealth<2> ph_h { filter_config_at(PH_FILTER_CONFIG, SAMPLE_MS) };
+    PlantGains   gains;
+
+    float ec = 0.0f;
+    float ph = 0.0f;
+
+    // Runs the filters for a while, like loop() does between evaluations
+    void settle(float minutes) {
+        int samples = static_cast<int>(minutes * 60.0f * SAMPLE_HZ);
+        for (int i = 0; i < samples; ++i) {
+            sim.advance(1.0f / (60.0f * SAMPLE_HZ));
+            ec = ec_filter(sim.read_ec(), ec_k, ec_h);
+            ph = ph_filter(sim.read_ph(), ph_k, ph_h);
+        }
+    }
+
+    // One evaluation + dose + settle + gain update, as main.cpp does it
+    void cycle() {
+        const float ec_lo = 0.8f, ec_hi = 1.8f, ph_lo = 6.0f, ph_hi = 6.8f;
+        float vol = sim.volume_l;
+
+        float nut  = nutrient_calc((ec_lo + ec_hi) / 2, ec_lo, ec_hi, vol, ec, gains.ec.dosing_gain());
+        float up   = ph_up_calc((ph_lo + ph_hi) / 2, ph_lo, ph_hi, vol, ph, gains.ph_up.dosing_gain());
+        float down = ph_down_calc((ph_lo + ph_hi) / 2, ph_lo, ph_hi, vol, ph, gains.ph_down.dosing_gain());
+
+        DoseObservation obs = { true, ec, ph, nut, up, down, vol };
+        sim.dose(nut, up, down);
+        settle(SETTLE_MIN);
+        gains.observe(obs, ec, ph);
+    }
+};
+
+static bool in_band(float v, float lo, float hi) { return v >= lo && v <= hi; }
+
+void test_estimator_converges() {
+    GainEstimator est(EC_GAIN_CONFIG);
+    std::mt19937 rng(7);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+
+    for (int i = 0; i < 20; ++i) {
+        float u = 1.0f + 0.2f * (i % 5);
+        est.observe(u, 0.42f * u + noise(rng));
+    }
+
+    CHECK(est.lower() <= 0.42f && est.upper() >= 0.42f,
+          "true gain 0.42 outside [%.3f, %.3f]", est.lower(), est.upper());
+    CHECK(est.sigma() < 0.02f, "sigma %.4f did not shrink", est.sigma());
+}
+
+void test_estimator_rejects_outliers() {
+    GainEstimator est(EC_GAIN_CONFIG);
+    for (int i = 0; i < 10; ++i) est.observe(1.0f, 0.5f);
+
+    float before = est.gain();
+    CHECK(!est.observe(1.0f, 5.0f), "outlier accepted");
+    CHECK(est.gain() == before, "outlier moved the gain");
+    CHECK(!est.observe(0.0f, 0.3f), "zero dose accepted");
+}
+
+void test_estimator_bounded() {
+    GainConfig cfg = PH_UP_GAIN_CONFIG;
+    cfg.delta_var = 1e6f; // so the wild observations pass the outlier gate
+    GainEstimator est(cfg);
+    for (int i = 0; i < 50; ++i) est.observe(1.0f, 100.0f);
+    CHECK(est.gain() <= PH_UP_GAIN_CONFIG.max_gain, "gain %.3f above bound", est.gain());
+    CHECK(est.upper() <= PH_UP_GAIN_CONFIG.max_gain, "upper %.3f above bound", est.upper());
+}
+
+void test_closed_loop_one_cycle() {
+    Loop loop;
+    loop.settle(5.0f);
+
+    // Identification: a few excursions in each direction
+    for (int round = 0; round < 4; ++round) {
+        loop.sim.ec = 0.5f;                     loop.settle(5.0f); loop.cycle();
+        loop.sim.ph = 5.4f; loop.sim.ec = 1.3f; loop.settle(5.0f); loop.cycle();
+        loop.sim.ph = 7.4f;                     loop.settle(5.0f); loop.cycle();
+    }
+
+    printf("  EC gain      %.3f [%.3f, %.3f] (true %.3f)\n", loop.gains.ec.gain(),
+           loop.gains.ec.lower(), loop.gains.ec.upper(), loop.sim.ec_gain);
+    printf("  pH up gain   %.3f [%.3f, %.3f] (true %.3f)\n", loop.gains.ph_up.gain(),
+           loop.gains.ph_up.lower(), loop.gains.ph_up.upper(), loop.sim.ph_up_gain);
+    printf("  pH down gain %.3f [%.3f, %.3f] (true %.3f)\n", loop.gains.ph_down.gain(),
+           loop.gains.ph_down.lower(), loop.gains.ph_down.upper(), loop.sim.ph_down_gain);
+
+    printf("  nutrient pH  %.3f [%.3f, %.3f] (true %.3f)\n", loop.gains.nutrient_ph.gain(),
+           loop.gains.nutrient_ph.lower(), loop.gains.nutrient_ph.upper(), loop.sim.nutrient_acid);
+
+    CHECK(fabsf(loop.gains.ec.gain() - loop.sim.ec_gain) < 0.1f * loop.sim.ec_gain, "EC gain off");
+    CHECK(fabsf(loop.gains.nutrient_ph.gain() - loop.sim.nutrient_acid) < 0.2f * loop.sim.nutrient_acid, "nutrient pH off");
+    CHECK(fabsf(loop.gains.ph_up.gain() - loop.sim.ph_up_gain) < 0.1f * loop.sim.ph_up_gain, "pH up gain off");
+    CHECK(fabsf(loop.gains.ph_down.gain() - loop.sim.ph_down_gain) < 0.1f * loop.sim.ph_down_gain, "pH down gain off");
+
+    // Once identified, a single correction lands in band
+    loop.sim.ec = 0.55f; loop.settle(5.0f); loop.cycle();
+    CHECK(in_band(loop.sim.ec, 0.8f, 1.8f), "EC %.3f not in band after one cycle", loop.sim.ec);
+
+    loop.sim.ph = 5.3f; loop.settle(5.0f); loop.cycle();
+    CHECK(in_band(loop.sim.ph, 6.0f, 6.8f), "pH %.3f not in band after one pH up cycle", loop.sim.ph);
+
+    loop.sim.ph = 7.5f; loop.settle(5.0f); loop.cycle();
+    CHECK(in_band(loop.sim.ph, 6.0f, 6.8f), "pH %.3f not in band after one pH down cycle", loop.sim.ph);
+}
+
+int main() {
+    test_estimator_converges();
+    test_estimator_rejects_outliers();
+    test_estimator_bounded();
+    test_closed_loop_one_cycle();
+
+    return check_report();
+}
@@ -0,0 +1,225 @@
+// Host simulation: the controller's wake schedule (idle_sleep.hpp), run on the real firmware.
+// The clock jumps from one wake to the next; the bridge's polls and commands arrive as bytes
+// that end a sleep early, as the UART interrupt does on the board.
+// pio run -e native_idle_schedule_test && .pio/build/native_idle_schedule_test/program
+
+#include <climits>
+#include <cstdio>
+#include <deque>
+#include <string>
+
+#include "../src/main.cpp"
+#include "check.hpp"
+
+struct Arrival {
+    unsigned long ms;
+    std::string   line;
+};
+
+// Lines from the bridge, in time order
+static std::deque<Arrival> arrivals;
+
+struct SimStats {
+    unsigned long passes     = 0;
+    unsigned long sleeps     = 0;
+    unsigned long slept_ms   = 0;
+    unsigned long spins      = 0; // passes that didn't sleep, a ms each
+    unsigned long awake_us   = 0; // those, and PASS_US per pass that did
+    unsigned long max_gap    = 0; // between zone samples
+    unsigned long max_reply  = 0; // M:1001 in to M:1002 out
+    unsigned long polls      = 0;
+    unsigned long replies    = 0;
+    long          last_duty  = -1;
+    long          max_duty   = -1;
+};
+
+// What a loop() pass that goes back to sleep costs on the board: the sample and filters, a
+// poll's reply. The clock doesn't stand still while awake, so the reported duty means something.
+static const unsigned long PASS_US = 500;
+
+static SimStats stats;
+static unsigned long pollSentMs = 0;
+
+static void deliver_due() {
+    while (!arrivals.empty() && arrivals.front().ms <= native_millis) {
+        if (arrivals.front().line.find("\"M\":1001") != std::string::npos) {
+            pollSentMs = arrivals.front().ms;
+            stats.polls++;
+        }
+        COMM_UART.feed(arrivals.front().line.c_str());
+        COMM_UART.feed("\n");
+        arrivals.pop_front();
+    }
+}
+
+static void check_replies() {
+    size_t at;
+    while ((at = COMM_UART.tx.find('\n')) != std::string::npos) {
+        std::string line = COMM_UART.tx.substr(0, at);
+        COMM_UART.tx.erase(0, at + 1);
+        if (line.find("\"M\":1002") == std::string::npos) continue;
+
+        stats.replies++;
+        stats.max_reply = std::max(stats.max_reply, native_millis - pollSentMs);
+        size_t d = line.find("\"duty\":");
+        stats.last_duty = d == std::string::npos ? -1 : atol(line.c_str() + d + 7);
+        stats.max_duty  = std::max(stats.max_duty, stats.last_duty);
+    }
+    DEBUG_PORT.tx.clear();
+}
+
+// Stands in for WFI: time passes to the deadline, or to the next byte in. The pass's
+// PASS_US came out of the first ms of it.
+static uint32_t sim_sleep(unsigned long ms, bool (*wake)()) {
+    check_replies(); // written this pass, before time moves on
+    if (wake()) return 0;
+    unsigned long until = native_millis + ms;
+    if (!arrivals.empty() && static_cast<long>(arrivals.front().ms - until) < 0) until = arrivals.front().ms;
+
+    uint32_t slept_us = (until - native_millis) * 1000 - native_micros;
+    stats.sleeps++;
+    stats.slept_ms += until - native_millis;
+    native_millis = until;
+    native_micros = 0;
+    deliver_due();
+    return slept_us;
+}
+
+static void run_for(unsigned long ms) {
+    const uint32_t ticks_per_ms = STEP_TIMER_HZ / 1000;
+    unsigned long  end          = native_millis + ms;
+    unsigned long  prev_sample  = lastSampleMillis;
+
+    bool          first        = true; // the gap since before the run doesn't count
+
+    while (static_cast<long>(end - native_millis) > 0) {
+        unsigned long sleeps = stats.sleeps;
+        native_micros = PASS_US;
+        loop();
+        stats.passes++;
+        check_replies();
+
+        if (lastSampleMillis != prev_sample) {
+            if (!first) stats.max_gap = std::max(stats.max_gap, lastSampleMillis - prev_sample);
+            prev_sample = lastSampleMillis;
+            first       = false;
+        }
+
+        // Didn't sleep: a ms awake, the pumps stepping if the timer runs
+        if (stats.sleeps == sleeps) {
+            native_millis++;
+            native_micros = 0;
+            stats.spins++;
+            stats.awake_us += 1000;
+            for (uint32_t i = 0; step_timer_on && i < ticks_per_ms && step_timer_callback; ++i) step_timer_callback();
+            deliver_due();
+        } else {
+            stats.awake_us += PASS_US;
+        }
+    }
+}
+
+// The bridge's M:1001 every 2 s for the next `ms`
+static void schedule_polls(unsigned long ms) {
+    for (unsigned long t = 2000; t < ms; t += 2000) arrivals.push_back({ native_millis + t, "{\"M\":1001}" });
+}
+
+static void send_now(const char *line) {
+    arrivals.push_front({ native_millis, line });
+    deliver_due();
+}
+
+static void report(const char *name, unsigned long ms) {
+    printf("  %-8s %6.1f passes/s  %5.1f sleeps/s  awake %5.2f%%  sample gap max %lu ms  reply max %lu ms\n", name,
+           stats.passes * 1000.0 / ms, stats.sleeps * 1000.0 / ms, stats.awake_us / (10.0 * ms), stats.max_gap,
+           stats.max_reply);
+}
+
+void test_standby_sleeps_between_polls() {
+    const unsigned long ms = 10UL * 60UL * 1000UL;
+    stats = {};
+    schedule_polls(ms);
+    run_for(ms);
+    report("standby", ms);
+
+    CHECK(stats.replies == stats.polls && stats.polls == ms / 2000 - 1, "%lu polls, %lu answered", stats.polls, stats.replies);
+    CHECK(stats.max_reply == 0, "poll answered %lu ms late", stats.max_reply);
+    CHECK(stats.spins == 0, "%lu passes without sleeping", stats.spins);
+    // A wake per poll and one per IDLE_MAX_SLEEP_MS at most
+    CHECK(stats.passes <= ms / 2000 + ms / IDLE_MAX_SLEEP_MS + 2, "%lu loop() passes", stats.passes);
+    // A PASS_US pass a second: half a per-mille, reported rounded up
+    CHECK(stats.last_duty == 1, "duty %ld", stats.last_duty);
+    CHECK(!step_timer_on, "step timer left on");
+}
+
+void test_running_keeps_sample_rate() {
+    const unsigned long ms = 10UL * 60UL * 1000UL;
+    send_now("{\"M\":2002,\"run\":true}");
+    stats = {};
+    schedule_polls(ms);
+    run_for(ms);
+    report("running", ms);
+
+    CHECK(zones[0].running, "not running");
+    CHECK(stats.max_gap == sampleInterval, "sample gap %lu ms", stats.max_gap);
+    CHECK(stats.max_reply == 0, "poll answered %lu ms late", stats.max_reply);
+    CHECK(stats.replies == stats.polls, "%lu polls, %lu answered", stats.polls, stats.replies);
+    // Samples, reports and polls; a spinning loop() would be thousands a second
+    CHECK(stats.passes < ms / sampleInterval + ms / debugInterval + ms / 2000 + 10, "%lu loop() passes", stats.passes);
+    // Ten PASS_US passes a second
+    CHECK(stats.last_duty >= 5 && stats.last_duty <= 6, "duty %ld", stats.last_duty);
+
+    send_now("{\"M\":2002,\"run\":false}");
+    run_for(100);
+}
+
+void test_dosing_stays_awake() {
+    send_now("{\"M\":2001,\"gro\":1.0}");
+    stats = {};
+    schedule_polls(60000);
+    run_for(60000);
+    report("dose", 60000);
+
+    CHECK(!doseQueue.busy(), "dose still running");
+    CHECK(stats.spins > 0, "slept through the dose");
+    CHECK(!step_timer_on, "step timer left on after the dose");
+    // Awake throughout while the pump runs, back to a pass a second after it
+    CHECK(stats.max_duty >= 900, "duty %ld at most during the dose", stats.max_duty);
+    CHECK(stats.last_duty >= 1 && stats.last_duty <= 2, "duty %ld after the dose", stats.last_duty);
+}
+
+void test_wake_schedule_wraps() {
+    // millis() about to wrap; the sample is due after it
+    WakeSchedule w;
+    w.begin(ULONG_MAX - 0xFF);
+    w.every(ULONG_MAX - 0x5F, 200);
+    CHECK(w.sleep_ms() == 0xA0 + 200, "%lu ms", w.sleep_ms());
+    w.at(ULONG_MAX - 0x1FF);     // already past
+    CHECK(w.sleep_ms() == 0, "overdue deadline %lu ms", w.sleep_ms());
+
+    DutyCycle d;
+    d.awake(1000);
+    d.asleep(99000);
+    CHECK(d.take_permille() == 10, "per-mille");
+    CHECK(d.take_permille() == 1000, "not reset");
+}
+
+int main() {
+    // Every probe mid-band for the default profile, so nothing doses while running
+    for (const Board::ZonePins &zp : Board::ZONES) {
+        for (size_t i = 0; i < Board::NUM_EC; ++i) {
+            native_adc[zp.ec[i]] = lroundf(1.3f / (zp.ec_scale[i] * ec_sensor::counts_to_ms(1.0f)));
+        }
+        for (uint8_t pin : zp.ph)   native_adc[pin] = 807;
+        for (uint8_t pin : zp.temp) native_adc[pin] = 2210;
+    }
+    idle_sleep_hook = sim_sleep;
+    setup();
+
+    test_standby_sleeps_between_polls();
+    test_running_keeps_sample_rate();
+    test_dosing_stays_awake();
+    test_wake_schedule_wraps();
+
+    return check_report();
+}
@@ -0,0 +1,94 @@
+// Host test: memory watermarks and the counting JSON allocator (mem_watch.hpp), and the M:2017 line.
+// pio run -e native_mem_watch_test && .pio/build/native_mem_watch_test/program
+
+#include <cstdio>
+#include <string>
+
+#include "serial_comm.hpp"
+#include "check.hpp"
+
+void test_allocator_counts_live_bytes() {
+    CountingAllocator a("comm");
+    void *p = a.allocate(100);
+    void *q = a.allocate(50);
+    CHECK(p && q && a.allocs == 2 && a.live == 150, "%u allocs, %u live", a.allocs, a.live);
+
+    p = a.reallocate(p, 300);
+    CHECK(p && a.live == 350 && a.peak == 350, "grown: %u live, %u peak", a.live, a.peak);
+    memset(p, 0x5A, 300); // all of it usable
+
+    p = a.reallocate(p, 20);
+    CHECK(a.live == 70 && a.peak == 350, "shrunk: %u live, %u peak", a.live, a.peak);
+
+    a.deallocate(p);
+    a.deallocate(q);
+    a.deallocate(nullptr);
+    CHECK(a.frees == 2 && a.live == 0, "%u frees, %u live", a.frees, a.live);
+
+    volatile size_t huge = SIZE_MAX / 2;
+    CHECK(!a.allocate(huge) && a.fails == 1 && a.allocs == 2, "failed allocation counted as %u", a.fails);
+}
+
+void test_documents_give_back_what_they_take() {
+    CountingAllocator a("comm");
+    for (int i = 0; i < 100; ++i) {
+        JsonDocument doc(&a);
+        deserializeJson(doc, "{\"M\":2001,\"gro\":1.5,\"micro\":2.5,\"name\":\"a string long enough to be copied\"}");
+    }
+    CHECK(a.allocs == a.frees && a.live == 0, "%u allocs, %u frees, %u live", a.allocs, a.frees, a.live);
+}
+
+void test_watch_keeps_lows() {
+    MemWatch w;
+    w.heap(100000, 90000);
+    w.heap(80000, 20000);
+    w.heap(95000, 95000, 60000); // the platform saw lower between samples
+    CHECK(w.heap_free == 95000 && w.heap_min == 60000, "heap %u min %u", w.heap_free, w.heap_min);
+    CHECK(w.block == 95000 && w.block_min == 20000, "block %u min %u", w.block, w.block_min);
+    CHECK(w.frag_permille() == 0, "one block, frag %u", w.frag_permille());
+
+    w.heap(100000, 25000);
+    CHECK(w.frag_permille() == 750, "frag %u", w.frag_permille());
+
+    w.stack("main", 4000);
+    w.stack("isr", 3800);
+    w.stack("main", 4400);
+    std::string name = "main"; // same name, other pointer
+    w.stack(name.c_str(), 3500);
+    CHECK(w.stack_low("main") == 3500 && w.stack_low("isr") == 3800, "main %u isr %u", w.stack_low("main"),
+          w.stack_low("isr"));
+    CHECK(w.stack_low("loop") == UINT32_MAX, "unknown stack");
+}
+
+void test_report_fits_a_line() {
+    // The MCU's, every number at its widest: 256 KB of RAM, counters at their limit
+    CountingAllocator comm("comm");
+    MemWatch w;
+    w.track(comm);
+    comm.allocs = comm.frees = comm.fails = UINT32_MAX;
+    comm.live = comm.peak = 262144;
+    w.heap(262144, 262144);
+    w.heap(262144, 144);
+    w.stack("main", 262144);
+    w.stack("isr", 262144);
+
+    // Node-stamped as a bus node sends it
+    BusPort port(Serial1);
+    port.begin(16);
+    send_mem_report(port, w);
+    port.end_turn();
+    std::string line = Serial1.tx;
+    CHECK(!line.empty() && line.back() == '\n', "no line");
+    CHECK(line.size() <= COMM_BUF_SIZE, "%zu bytes", line.size());
+    CHECK(line.find("\"M\":2017") != std::string::npos && line.find("\"alloc\":{\"comm\":[") != std::string::npos,
+          "%s", line.c_str());
+}
+
+int main() {
+    test_allocator_counts_live_bytes();
+    test_documents_give_back_what_they_take();
+    test_watch_keeps_lows();
+    test_report_fits_a_line();
+
+    return check_report();
+}
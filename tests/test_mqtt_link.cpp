@@ -0,0 +1,449 @@
+// Host test: MQTT packets, the flash spool, QoS 1 replay across broker restarts, and batching.
+// pio run -e native_mqtt_link_test && .pio/build/native_mqtt_link_test/program
+
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mqtt_link.hpp"
+#include "check.hpp"
+
+// The spool's files held in memory instead of on LittleFS
+class MemSpoolFiles : public SpoolFiles {
+    public:
+        std::map<uint16_t, std::vector<uint8_t>> segs;
+        bool     has_cursor = false;
+        uint32_t cursor     = 0;
+        size_t   appends    = 0;
+        size_t   removes    = 0;
+
+        bool append(uint16_t segment, const void *src, size_t len) override {
+            const uint8_t *p = static_cast<const uint8_t *>(src);
+            segs[segment].insert(segs[segment].end(), p, p + len);
+            appends++;
+            return true;
+        }
+
+        bool read(uint16_t segment, uint32_t offset, void *dst, size_t len) override {
+            auto it = segs.find(segment);
+            if (it == segs.end() || offset + len > it->second.size()) return false;
+            memcpy(dst, it->second.data() + offset, len);
+            return true;
+        }
+
+        void remove(uint16_t segment) override { removes += segs.erase(segment); }
+
+        bool load_cursor(uint32_t &seq) override {
+            seq = cursor;
+            return has_cursor;
+        }
+
+        bool save_cursor(uint32_t seq) override {
+            cursor     = seq;
+            has_cursor = true;
+            return true;
+        }
+
+        size_t bytes() const {
+            size_t n = 0;
+            for (const auto &s : segs) n += s.second.size();
+            return n;
+        }
+};
+
+struct Received {
+    std::string topic;
+    std::string payload;
+    uint16_t    id;
+    bool        dup;
+};
+
+// A broker on the other end of the socket: answers CONNECT, PUBLISH and PINGREQ
+class FakeBroker : public MqttTransport {
+    public:
+        bool       running    = true;   // accepting connections
+        bool       acking     = true;   // sends PUBACKs
+        uint8_t    connack_rc = 0;
+        MqttSocket state      = MqttSocket::CLOSED;
+        int        opens      = 0;
+        int        pings      = 0;
+
+        std::vector<Received> got;
+        std::deque<uint8_t>   out;
+
+        bool open(const char *, uint16_t) override {
+            opens++;
+            parser.reset();
+            out.clear();
+            state = running ? MqttSocket::OPEN : MqttSocket::CLOSED;
+            return true;
+        }
+
+        MqttSocket status() override { return state; }
+
+        size_t write(const uint8_t *data, size_t len) override {
+            if (state != MqttSocket::OPEN) return 0;
+            MqttPacket pkt;
+            for (size_t i = 0; i < len; ++i) {
+                if (parser.feed(data[i], pkt)) handle(pkt);
+            }
+            return len;
+        }
+
+        size_t read(uint8_t *dst, size_t max) override {
+            size_t n = 0;
+            while (n < max && !out.empty()) {
+                dst[n++] = out.front();
+                out.pop_front();
+            }
+            return n;
+        }
+
+        void close() override { state = MqttSocket::CLOSED; }
+
+        // Broker goes away: the connection drops and nothing is accepted until it's back
+        void crash() {
+            running = false;
+            state   = MqttSocket::CLOSED;
+            out.clear();
+        }
+
+    private:
+        MqttParser parser;
+
+        void reply(const uint8_t *pkt, size_t len) { out.insert(out.end(), pkt, pkt + len); }
+
+        void handle(const MqttPacket &pkt) {
+            uint8_t buf[8];
+            switch (pkt.type) {
+                case MQTT_CONNECT: {
+                    const uint8_t connack[4] = { MQTT_CONNACK << 4, 2, 0, connack_rc };
+                    reply(connack, sizeof(connack));
+                    break;
+                }
+                case MQTT_PUBLISH: {
+                    size_t   tlen = (pkt.body[0] << 8) | pkt.body[1];
+                    Received r;
+                    r.topic.assign(reinterpret_cast<const char *>(pkt.body + 2), tlen);
+                    r.id  = (pkt.body[2 + tlen] << 8) | pkt.body[3 + tlen];
+                    r.dup = pkt.flags & 0x08;
+                    r.payload.assign(reinterpret_cast<const char *>(pkt.body + 4 + tlen), pkt.len - 4 - tlen);
+                    got.push_back(r);
+                    if (acking) reply(buf, mqtt_puback_packet(buf, r.id));
+                    break;
+                }
+                case MQTT_PINGREQ: {
+                    pings++;
+                    const uint8_t resp[2] = { MQTT_PINGRESP << 4, 0 };
+                    reply(resp, sizeof(resp));
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+};
+
+struct Rig {
+    FakeBroker    broker;
+    MemSpoolFiles files;
+    MqttSpool     spool;
+    MqttLink      link { broker, spool };
+    unsigned long now = 0;
+
+    explicit Rig(uint16_t segments = MQTT_SPOOL_SEGMENTS, uint16_t per_segment = MQTT_SPOOL_PER_SEGMENT)
+        : spool(segments, per_segment) {
+        spool.open(files);
+        link.cfg = { "broker", 1883, "bridge-test", "hydro/test", nullptr, nullptr };
+    }
+
+    // loop() every 10 ms
+    void run_for(unsigned long ms) {
+        for (unsigned long end = now + ms; now < end; now += 10) link.service(now);
+    }
+
+    void publish(const char *text) {
+        link.publish(TOPIC_SENSOR, reinterpret_cast<const uint8_t *>(text), strlen(text));
+    }
+};
+
+static void test_packets() {
+    uint8_t buf[MqttParser::MAX + 8];
+
+    // CONNECT: "MQTT", level 4, clean session, keepalive, client id
+    size_t n = mqtt_connect_packet(buf, "ab", 60);
+    const uint8_t expect[] = { 0x10, 14, 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60, 0, 2, 'a', 'b' };
+    CHECK(n == sizeof(expect) && memcmp(buf, expect, n) == 0, "connect packet, %zu bytes", n);
+
+    // A publish long enough for a two-byte remaining length parses back whole
+    std::string payload(600, 'x');
+    n = mqtt_publish_packet(buf, "a/b", 0x1234, true, reinterpret_cast<const uint8_t *>(payload.data()), payload.size());
+    CHECK(buf[0] == 0x3A, "publish QoS 1 with DUP, got 0x%02X", buf[0]);
+    CHECK((buf[1] & 0x80) && n == 3 + 2 + 3 + 2 + 600, "remaining length as two bytes, %zu", n);
+
+    MqttParser parser;
+    MqttPacket pkt;
+    int        complete = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (parser.feed(buf[i], pkt)) complete++;
+    }
+    CHECK(complete == 1 && pkt.type == MQTT_PUBLISH && pkt.len == n - 3, "parsed, len %zu", pkt.len);
+
+    // Zero-length packets complete on their length byte
+    n = mqtt_ping_packet(buf);
+    CHECK(!parser.feed(buf[0], pkt) && parser.feed(buf[1], pkt) && pkt.type == MQTT_PINGREQ && pkt.len == 0,
+          "ping parses");
+}
+
+static void test_spool_survives_reset() {
+    MemSpoolFiles files;
+    MqttSpool     spool(4, 2);
+    spool.open(files);
+
+    for (int i = 0; i < 3; ++i) {
+        char text[8];
+        snprintf(text, sizeof(text), "b%d", i);
+        CHECK(spool.push(TOPIC_SENSOR, reinterpret_cast<uint8_t *>(text), strlen(text)), "push %d", i);
+    }
+    uint8_t topic, payload[MQTT_PAYLOAD_MAX];
+    size_t  len;
+    CHECK(spool.front(topic, payload, len) && len == 2 && memcmp(payload, "b0", 2) == 0, "oldest first");
+    spool.pop();
+    CHECK(files.appends == 3 && files.has_cursor && files.cursor == 1, "%zu appends, cursor %u", files.appends,
+          files.cursor);
+
+    // A reset: the ring is rebuilt from the segments and the cursor
+    MqttSpool after(4, 2);
+    after.open(files);
+    CHECK(after.size() == 2, "2 pending after reopen, got %u", after.size());
+    CHECK(after.front(topic, payload, len) && memcmp(payload, "b1", 2) == 0, "b1 is next");
+
+    // New batches carry on after the old ones; an acked segment is removed
+    after.push(TOPIC_DOSE, reinterpret_cast<const uint8_t *>("b3"), 2);
+    after.pop();
+    CHECK(files.segs.count(0) == 0 && files.removes == 1, "segment 0 kept after its last ack");
+    after.front(topic, payload, len);
+    after.pop();
+    CHECK(after.front(topic, payload, len) && topic == TOPIC_DOSE && memcmp(payload, "b3", 2) == 0, "b3 last");
+}
+
+static void test_spool_bounded() {
+    MemSpoolFiles files;
+    MqttSpool     spool(2, 2);
+    spool.open(files);
+
+    for (int i = 0; i < 10; ++i) {
+        char text[8];
+        snprintf(text, sizeof(text), "b%d", i);
+        spool.push(TOPIC_SENSOR, reinterpret_cast<uint8_t *>(text), strlen(text));
+    }
+    CHECK(spool.size() == 4 && spool.dropped == 6, "size %u dropped %u", spool.size(), spool.dropped);
+    CHECK(files.segs.size() == 2 && files.bytes() == 4 * (sizeof(SpoolRecordHeader) + 2),
+          "files stay at the ring's size, %zu in %zu", files.bytes(), files.segs.size());
+
+    uint8_t topic, payload[MQTT_PAYLOAD_MAX];
+    size_t  len;
+    CHECK(spool.front(topic, payload, len) && memcmp(payload, "b6", 2) == 0, "the newest 4 kept");
+
+    // Reopened after wrapping: still the same 4, same order
+    MqttSpool after(2, 2);
+    after.open(files);
+    CHECK(after.size() == 4 && after.front(topic, payload, len) && memcmp(payload, "b6", 2) == 0,
+          "wrapped ring reopens, size %u", after.size());
+
+    // A corrupted record is skipped, not sent
+    files.segs[1][sizeof(SpoolRecordHeader)] ^= 0xFF;
+    CHECK(after.front(topic, payload, len) && memcmp(payload, "b7", 2) == 0 && after.dropped == 1,
+          "corrupt record dropped");
+}
+
+static void test_publish_and_ack() {
+    Rig rig;
+    rig.link.start(rig.now);
+    rig.run_for(100);
+    CHECK(rig.link.status() == MqttState::UP, "up, got %s", rig.link.name());
+
+    rig.publish("{\"a\":1}");
+    rig.publish("{\"a\":2}");
+    rig.run_for(100);
+
+    CHECK(rig.broker.got.size() == 2, "2 delivered, got %zu", rig.broker.got.size());
+    CHECK(rig.broker.got.size() == 2 && rig.broker.got[0].topic == "hydro/test/sensor" &&
+          rig.broker.got[0].payload == "{\"a\":1}" && rig.broker.got[1].payload == "{\"a\":2}", "topic and order");
+    CHECK(rig.link.acked == 2 && rig.spool.empty(), "acked %u, spool %u", rig.link.acked, rig.spool.size());
+
+    // Idle: keepalive pings at half the interval
+    rig.run_for(MQTT_KEEPALIVE_S * 1000UL);
+    CHECK(rig.broker.pings >= 1 && rig.link.status() == MqttState::UP, "pinged %d", rig.broker.pings);
+}
+
+static void test_replay_after_broker_restart() {
+    Rig rig;
+    rig.link.start(rig.now);
+    rig.run_for(100);
+
+    // Published, then the broker dies before acking it
+    rig.broker.acking = false;
+    rig.publish("one");
+    rig.run_for(100);
+    CHECK(rig.broker.got.size() == 1 && !rig.broker.got[0].dup, "first send");
+    rig.broker.crash();
+    rig.broker.acking = true;
+
+    // Batches keep closing while it's away; reconnects back off
+    rig.publish("two");
+    rig.run_for(5000);
+    rig.publish("three");
+    CHECK(rig.link.status() != MqttState::UP, "not up while the broker is down");
+    CHECK(rig.spool.size() == 3, "3 spooled, got %u", rig.spool.size());
+
+    rig.broker.running = true;
+    rig.run_for(20000);
+
+    const std::vector<Received> &got = rig.broker.got;
+    CHECK(got.size() == 4, "one replay + three, got %zu", got.size());
+    if (got.size() == 4) {
+        CHECK(got[1].payload == "one" && got[1].dup && got[1].id == got[0].id, "replayed with DUP and the same id");
+        CHECK(got[2].payload == "two" && got[3].payload == "three" && !got[2].dup, "then in order");
+    }
+    CHECK(rig.spool.empty() && rig.link.replays == 1 && rig.link.reconnects == 1,
+          "spool %u replays %u reconnects %u", rig.spool.size(), rig.link.replays, rig.link.reconnects);
+}
+
+static void test_full_spool_keeps_the_batch_in_flight() {
+    Rig rig(2, 2);
+    rig.link.start(rig.now);
+    rig.run_for(100);
+
+    // Out and awaiting its ack while the ring fills: the new batch is refused, not the held one
+    rig.broker.acking = false;
+    rig.publish("b0");
+    rig.run_for(100);
+    for (int i = 1; i <= 3; ++i) {
+        char text[8];
+        snprintf(text, sizeof(text), "b%d", i);
+        rig.publish(text);
+    }
+    CHECK(!rig.link.publish(TOPIC_SENSOR, reinterpret_cast<const uint8_t *>("b4"), 2), "evicted the batch in flight");
+    CHECK(rig.spool.size() == 4 && rig.spool.dropped == 0, "size %u dropped %u", rig.spool.size(), rig.spool.dropped);
+
+    // Its PUBACK acks it, and nothing after it is skipped
+    uint8_t ack[4];
+    size_t  n = mqtt_puback_packet(ack, rig.broker.got[0].id);
+    rig.broker.out.insert(rig.broker.out.end(), ack, ack + n);
+    rig.broker.acking = true;
+    rig.run_for(100);
+
+    const std::vector<Received> &got = rig.broker.got;
+    CHECK(got.size() == 4, "4 delivered, got %zu", got.size());
+    for (size_t i = 0; i < got.size(); ++i) {
+        CHECK(got[i].payload == "b" + std::to_string(i), "got %s at %zu", got[i].payload.c_str(), i);
+    }
+    CHECK(rig.spool.empty() && rig.link.acked == 4, "spool %u acked %u", rig.spool.size(), rig.link.acked);
+
+    // Down, nothing is in flight: the oldest segment goes, and the next batch isn't sent as a DUP
+    rig.broker.acking = false;
+    rig.publish("c0");
+    rig.run_for(100);
+    rig.broker.crash();
+    rig.broker.acking = true;
+    rig.run_for(100);
+    for (int i = 1; i <= 4; ++i) {
+        char text[8];
+        snprintf(text, sizeof(text), "c%d", i);
+        rig.publish(text);
+    }
+    CHECK(rig.spool.dropped == 2, "dropped %u", rig.spool.dropped);
+    rig.broker.running = true;
+    rig.run_for(5000);
+    CHECK(got.size() == 8 && got[5].payload == "c2" && !got[5].dup && got[5].id != got[4].id,
+          "c2 after the outage, %zu sent", got.size());
+    CHECK(rig.spool.empty(), "spool %u", rig.spool.size());
+}
+
+static void test_missing_ack_reconnects() {
+    Rig rig;
+    rig.link.start(rig.now);
+    rig.run_for(100);
+
+    rig.broker.acking = false;
+    rig.publish("lost ack");
+    rig.run_for(MQTT_ACK_TIMEOUT_MS + 100);
+    rig.broker.acking = true;
+    rig.run_for(3000);
+
+    CHECK(rig.broker.opens == 2 && rig.broker.got.size() == 2 && rig.broker.got[1].dup, "reconnected and replayed");
+    CHECK(rig.spool.empty(), "acked the second time");
+}
+
+static void test_refused_backs_off() {
+    Rig rig;
+    rig.broker.connack_rc = 5;  // not authorised
+    rig.link.start(rig.now);
+
+    rig.run_for(500);
+    CHECK(rig.link.refused == 1 && rig.link.status() == MqttState::BACKOFF, "refused, backing off");
+    rig.run_for(1000);
+    CHECK(rig.broker.opens == 2, "retry after 1 s, opens %d", rig.broker.opens);
+    rig.run_for(1500);
+    CHECK(rig.broker.opens == 2, "then waits 2 s, opens %d", rig.broker.opens);
+    rig.run_for(1000);
+    CHECK(rig.broker.opens == 3, "third attempt, opens %d", rig.broker.opens);
+}
+
+static void test_batches() {
+    Rig       rig;
+    Telemetry telemetry(rig.link, 0xBEEF);
+    rig.link.start(rig.now);
+    rig.run_for(100);
+
+    // A minute of 2 s samples from two zones: one message
+    for (int i = 0; i < 30; ++i) {
+        telemetry.sample(rig.now, 1, i % 2, 6.2f, 1234.5f, 21.0f);
+        rig.run_for(2000);
+        telemetry.service(rig.now);
+    }
+    rig.run_for(100);
+    CHECK(rig.broker.got.size() == 1, "one batch a minute, got %zu", rig.broker.got.size());
+    if (!rig.broker.got.empty()) {
+        const std::string &p = rig.broker.got[0].payload;
+        CHECK(p.rfind("{\"boot\":\"0000beef\",\"seq\":0,\"t0\":100,\"rows\":[[0,1,0,6.20,1234.5,21.00],[2000,1,1,", 0) == 0,
+              "payload %s", p.substr(0, 90).c_str());
+        CHECK(p.size() <= MQTT_PAYLOAD_MAX && p.back() == '}', "closed, %zu bytes", p.size());
+    }
+
+    // A full batch closes early and the next one carries on
+    rig.broker.got.clear();
+    for (int i = 0; i < 200; ++i) telemetry.sample(rig.now, 3, 0, 6.2f, 1234.5f, 21.0f);
+    rig.run_for(500);
+    CHECK(rig.broker.got.size() == 5, "35 rows a batch, got %zu batches", rig.broker.got.size());
+    for (const Received &r : rig.broker.got) CHECK(r.payload.size() <= MQTT_PAYLOAD_MAX, "%zu bytes", r.payload.size());
+
+    // Doses and metrics on their own topics
+    rig.broker.got.clear();
+    telemetry.dose(rig.now, 1, 1, 7, "gro", 2.5f, 2.49f, false);
+    rig.run_for(MQTT_BATCH_MS);
+    telemetry.service(rig.now);
+    telemetry.metrics(rig.now, "\"heap\":123");
+    rig.run_for(100);
+    CHECK(rig.broker.got.size() >= 2 && rig.broker.got[rig.broker.got.size() - 2].topic == "hydro/test/dose",
+          "dose topic");
+    CHECK(!rig.broker.got.empty() && rig.broker.got.back().topic == "hydro/test/metrics" &&
+          rig.broker.got.back().payload.find("\"heap\":123}") != std::string::npos, "metrics");
+}
+
+int main() {
+    test_packets();
+    test_spool_survives_reset();
+    test_spool_bounded();
+    test_publish_and_ack();
+    test_replay_after_broker_restart();
+    test_full_spool_keeps_the_batch_in_flight();
+    test_missing_ack_reconnects();
+    test_refused_backs_off();
+    test_batches();
+
+    return check_report();
+}
@@ -0,0 +1,126 @@
+// Host test: two-point probe calibration and the batched conversion kernel.
+// pio run -e native_probe_cal_test && .pio/build/native_probe_cal_test/program
+
+#include <cstdio>
+
+#include "sensors/ec_sensor.hpp"
+#include "sensors/ph_sensor.hpp"
+#include "sensors/probe_calibration.hpp"
+#include "check.hpp"
+
+// A probe whose true line differs from the nominal one
+struct TrueProbe {
+    uint8_t pin;
+    float   scale;
+    float   offset;
+    float   tcoef;
+};
+
+// Raw counts the probe produces for a solution reading value at 25 C, at temp C
+template <typename Sensor>
+static void present(const TrueProbe &p, float value, float temp) {
+    float comp = Sensor::compensation(p.tcoef, Sensor::prepare(temp));
+    float line = Sensor::ISO + (value - Sensor::ISO) / comp;
+    native_adc[p.pin] = static_cast<uint16_t>(lroundf((line - p.offset) / p.scale));
+}
+
+template <typename Sensor, size_t N>
+static void capture(ProbeCalibrator<Sensor, N> &cal, const std::array<TrueProbe, N> &probes,
+                    uint8_t point, float value, float temp) {
+    for (const TrueProbe &p : probes) present<Sensor>(p, value, temp);
+    cal.begin_point(point, value);
+    unsigned long now = 0;
+    while (!cal.service(now, temp)) now += PROBE_CAL_SAMPLE_MS;
+}
+
+void test_ph_two_point() {
+    const std::array<TrueProbe, 2> truth = {{
+        { 3, -0.0210f, 23.10f, ph_sensor::TCOEF },
+        { 4, -0.0240f, 25.80f, ph_sensor::TCOEF },
+    }};
+
+    SensorArray<ph_sensor, 2> probes({{ 3, 4 }}, nominal_cal<ph_sensor>(filled<2>(ph_sensor::SLOPE), ph_sensor::OFFSET));
+    ProbeCalibrator<ph_sensor, 2> cal(probes);
+
+    // Buffers at 20 C; labelled values are at 25 C
+    capture(cal, truth, 0, 7.0f, 20.0f);
+    capture(cal, truth, 1, 4.0f, 20.0f);
+    uint8_t ok = cal.solve();
+    CHECK(ok == 0x3, "channels updated 0x%x", ok);
+
+    // Read a pH 5.5 solution at 30 C
+    for (const TrueProbe &p : truth) present<ph_sensor>(p, 5.5f, 30.0f);
+    std::array<float, 2> ph = probes.read(30.0f);
+    for (size_t i = 0; i < 2; ++i) {
+        CHECK(fabsf(ph[i] - 5.5f) < 0.03f, "probe %zu reads %.3f, expected 5.5", i, ph[i]);
+    }
+}
+
+void test_ec_single_channel_and_tempco() {
+    const std::array<TrueProbe, 4> truth = {{
+        { 10, ec_sensor::counts_to_ms(700.0f), 0.02f, 0.019f },
+        { 11, ec_sensor::counts_to_ms(600.0f), -0.01f, 0.021f },
+        { 12, ec_sensor::counts_to_ms(650.0f), 0.00f, 0.020f },
+        { 13, ec_sensor::counts_to_ms(640.0f), 0.03f, 0.020f },
+    }};
+
+    SensorArray<ec_sensor, 4> probes({{ 10, 11, 12, 13 }},
+                                     nominal_cal<ec_sensor>(filled<4>(ec_sensor::counts_to_ms(650.0f)), 0.0f));
+    SensorCal<4> before = probes.cal;
+    ProbeCalibrator<ec_sensor, 4> cal(probes);
+
+    probes.cal.tcoef[1] = 0.021f;
+    for (const TrueProbe &p : truth) present<ec_sensor>(p, 0.5f, 22.0f);
+    cal.begin_point(0, 0.5f, 1);
+    unsigned long now = 0;
+    while (!cal.service(now, 22.0f)) now += PROBE_CAL_SAMPLE_MS;
+
+    for (const TrueProbe &p : truth) present<ec_sensor>(p, 1.413f, 22.0f);
+    cal.begin_point(1, 1.413f, 1);
+    while (!cal.service(now, 22.0f)) now += PROBE_CAL_SAMPLE_MS;
+
+    uint8_t ok = cal.solve();
+    CHECK(ok == 0x2, "channels updated 0x%x, expected only channel 1", ok);
+    CHECK(probes.cal.scale[0] == before.scale[0] && probes.cal.scale[2] == before.scale[2],
+          "unselected channels changed");
+
+    for (const TrueProbe &p : truth) present<ec_sensor>(p, 1.0f, 26.0f);
+    float ec = probes.read(26.0f)[1];
+    CHECK(fabsf(ec - 1.0f) < 0.01f, "channel 1 reads %.4f, expected 1.0", ec);
+}
+
+void test_rejects_flat_points() {
+    const std::array<TrueProbe, 2> truth = {{
+        { 3, -0.0210f, 23.10f, ph_sensor::TCOEF },
+        { 4, -0.0240f, 25.80f, ph_sensor::TCOEF },
+    }};
+    SensorArray<ph_sensor, 2> probes({{ 3, 4 }}, nominal_cal<ph_sensor>(filled<2>(ph_sensor::SLOPE), ph_sensor::OFFSET));
+    ProbeCalibrator<ph_sensor, 2> cal(probes);
+
+    capture(cal, truth, 0, 7.0f, 25.0f);
+    capture(cal, truth, 1, 7.05f, 25.0f); // same buffer twice
+    CHECK(cal.solve() == 0, "calibrated from two near-identical points");
+    CHECK(probes.cal.scale[0] == ph_sensor::SLOPE, "nominal line overwritten");
+}
+
+void test_matches_single_probe_path() {
+    // The batched kernel with nominal tables reads the same as the per-probe classes
+    ec_sensor single(20, 660.37735849f);
+    SensorArray<ec_sensor, 1> batch({{ 20 }}, nominal_cal<ec_sensor>(filled<1>(ec_sensor::counts_to_ms(660.37735849f)), 0.0f));
+    native_adc[20] = 1234;
+    CHECK(fabsf(single.read_val(18.0f) - batch.read(18.0f)[0]) < 1e-5f, "EC paths disagree");
+
+    ph_sensor single_ph(21);
+    SensorArray<ph_sensor, 1> batch_ph({{ 21 }}, nominal_cal<ph_sensor>(filled<1>(ph_sensor::SLOPE), ph_sensor::OFFSET));
+    native_adc[21] = 800;
+    CHECK(fabsf(single_ph.read_val(31.0f) - batch_ph.read(31.0f)[0]) < 1e-4f, "pH paths disagree");
+}
+
+int main() {
+    test_ph_two_point();
+    test_ec_single_channel_and_tempco();
+    test_rejects_flat_points();
+    test_matches_single_probe_path();
+
+    return check_report();
+}
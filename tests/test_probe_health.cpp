@@ -0,0 +1,161 @@
+// Host test: per-channel probe statistics, fault rejection and noise-weighted fusion.
+// pio run -e native_probe_health_test && .pio/build/native_probe_health_test/program
+
+#include <cstdio>
+#include <random>
+
+#include "kalman.hpp"
+#include "check.hpp"
+
+static std::mt19937 rng(99);
+
+static float gauss(float sigma) {
+    std::normal_distribution<float> d(0.0f, sigma);
+    return d(rng);
+}
+
+void test_nan_thermistor_does_not_poison() {
+    KalmanFilter   state = { 22.0f, 0.4f };
+    ProbeHealth<4> health(TEMP_FILTER_CONFIG);
+
+    float t = 0.0f;
+    for (int i = 0; i < 500; ++i) {
+        std::array<float, 4> z = { 22.0f + gauss(0.1f), NAN, 22.0f + gauss(0.1f), 22.0f + gauss(0.1f) };
+        t = temp_filter(z, state, health);
+    }
+    CHECK(isfinite(t) && fabsf(t - 22.0f) < 0.1f, "temp %.3f", t);
+    CHECK(health.ch[1].fault == FAULT_RANGE, "NaN probe not flagged");
+
+    // Every probe gone: hold the last estimate instead of going NaN
+    std::array<float, 4> dead = { NAN, NAN, NAN, NAN };
+    for (int i = 0; i < 10; ++i) t = temp_filter(dead, state, health);
+    CHECK(isfinite(t) && fabsf(t - 22.0f) < 0.1f, "temp %.3f with every probe dead", t);
+}
+
+void test_stuck_probe_dropped() {
+    KalmanFilter   state = { 1.0f, 0.3f };
+    ProbeHealth<4> health(EC_FILTER_CONFIG);
+
+    // Probe 3 freezes while the solution rises
+    float ec = 1.0f;
+    for (int i = 0; i < 1000; ++i) {
+        ec += 0.0005f;
+        std::array<float, 4> z = { ec + gauss(0.01f), ec + gauss(0.01f), 1.0f, ec + gauss(0.01f) };
+        ec_filter(z, state, health);
+    }
+    CHECK(health.ch[2].fault != FAULT_NONE, "stuck probe still in use");
+    CHECK(fabsf(state.x - ec) < 0.02f, "EC %.3f, true %.3f", state.x, ec);
+}
+
+void test_outlier_voted_out() {
+    KalmanFilter   state = { 6.0f, 0.1f };
+    ProbeHealth<3> health(PH_FILTER_CONFIG);
+
+    for (int i = 0; i < 300; ++i) {
+        std::array<float, 3> z = { 6.0f + gauss(0.02f), 6.0f + gauss(0.02f), 9.5f + gauss(0.02f) };
+        ph_filter(z, state, health);
+    }
+    CHECK(health.ch[2].fault == FAULT_OUTLIER, "drifted probe not voted out");
+    CHECK(fabsf(state.x - 6.0f) < 0.02f, "pH %.3f", state.x);
+}
+
+void test_noisy_probe_down_weighted() {
+    ProbeHealth<4> health(EC_FILTER_CONFIG);
+    KalmanFilter   state = { 1.2f, 0.3f };
+
+    for (int i = 0; i < 2000; ++i) {
+        std::array<float, 4> z = { 1.2f + gauss(0.005f), 1.2f + gauss(0.005f), 1.2f + gauss(0.005f), 1.2f + gauss(0.08f) };
+        ec_filter(z, state, health);
+    }
+    float quiet = health.ch[0].noise(health.cfg);
+    float noisy = health.ch[3].noise(health.cfg);
+    CHECK(noisy > 20.0f * quiet, "noisy probe variance %.2e vs quiet %.2e", noisy, quiet);
+}
+
+// Equal-weight average with the old fixed R, for comparison
+static float fixed_filter(const std::array<float, 4> &z, KalmanFilter &state) {
+    const float sensor_noise = 1111.0f / 4.0f;
+    float p = state.p + 0.1f;
+    float k = p / (p + sensor_noise);
+    float avg = (z[0] + z[1] + z[2] + z[3]) / 4.0f;
+    state.x += k * (avg - state.x);
+    state.p = (1 - k) * p;
+    return state.x;
+}
+
+void test_converges_faster() {
+    KalmanFilter   adaptive = { 0.7f, 0.3f };
+    KalmanFilter   fixed    = { 0.7f, 0.3f };
+    ProbeHealth<4> health(EC_FILTER_CONFIG);
+
+    int adaptive_at = -1, fixed_at = -1;
+    for (int i = 0; i < 5000 && (adaptive_at < 0 || fixed_at < 0); ++i) {
+        std::array<float, 4> z;
+        for (float &v : z) v = 1.5f + gauss(0.02f);
+        if (fabsf(ec_filter(z, adaptive, health) - 1.5f) < 0.01f && adaptive_at < 0) adaptive_at = i;
+        if (fabsf(fixed_filter(z, fixed) - 1.5f) < 0.01f && fixed_at < 0) fixed_at = i;
+    }
+    printf("  samples to within 0.01 mS/cm: adaptive %d, fixed R %d\n", adaptive_at, fixed_at);
+    CHECK(adaptive_at >= 0 && (fixed_at < 0 || adaptive_at < fixed_at), "adaptive filter not faster");
+}
+
+// Seconds until a settled filter is 63% through a step, sampled every FILTER_SAMPLE_MS
+template <size_t N>
+static float step_response_s(const FilterConfig &cfg, float from, float to, float sigma) {
+    KalmanFilter   state = { from, 0.01f };
+    ProbeHealth<N> health(cfg);
+    std::array<float, N> z;
+
+    for (int i = 0; i < 3000; ++i) {
+        for (float &v : z) v = from + gauss(sigma);
+        probe_filter(z, state, health);
+    }
+    for (int i = 1; i < 100000; ++i) {
+        for (float &v : z) v = to + gauss(sigma);
+        if (fabsf(probe_filter(z, state, health) - from) >= 0.632f * fabsf(to - from)) {
+            return i * FILTER_SAMPLE_MS / 1000.0f;
+        }
+    }
+    return INFINITY;
+}
+
+// The constants are in seconds at loop()'s sample rate, not in samples
+void test_response_times() {
+    float ec   = step_response_s<4>(EC_FILTER_CONFIG, 1.0f, 1.1f, 0.01f);
+    float ph   = step_response_s<2>(PH_FILTER_CONFIG, 6.0f, 6.1f, 0.02f);
+    float temp = step_response_s<4>(TEMP_FILTER_CONFIG, 21.0f, 22.0f, 0.1f);
+    printf("  63%% of a step at %lu ms: EC %.1f s, pH %.1f s, temp %.1f s\n", FILTER_SAMPLE_MS, ec, ph, temp);
+    CHECK(ec > 0.2f && ec < 1.5f, "EC step took %.1f s", ec);
+    CHECK(ph > 0.2f && ph < 2.5f, "pH step took %.1f s", ph);
+    CHECK(temp > 0.5f && temp < 5.0f, "temp step took %.1f s", temp);
+
+    CHECK(EC_FILTER_CONFIG.window * FILTER_SAMPLE_MS == 30000, "window of %u samples", EC_FILTER_CONFIG.window);
+
+    // A probe frozen while the others move is dropped after ~10 s, not before
+    KalmanFilter   state = { 1.0f, 0.3f };
+    ProbeHealth<4> health(EC_FILTER_CONFIG);
+    float ec_true = 1.0f, stuck_s = INFINITY;
+    for (int i = 1; i < 1000 && !isfinite(stuck_s); ++i) {
+        ec_true += 0.001f;
+        std::array<float, 4> z = { ec_true + gauss(0.01f), ec_true + gauss(0.01f), 1.0f, ec_true + gauss(0.01f) };
+        ec_filter(z, state, health);
+        if (health.ch[2].fault == FAULT_STUCK) stuck_s = i * FILTER_SAMPLE_MS / 1000.0f;
+    }
+    CHECK(stuck_s >= 9.9f && stuck_s < 12.0f, "stuck probe dropped after %.1f s", stuck_s);
+
+    // A coarser simulation keeps the same times
+    FilterConfig coarse = filter_config_at(EC_FILTER_CONFIG, 2000);
+    CHECK(coarse.window == 15 && coarse.stuck_samples == 5, "rescaled to %u / %u samples", coarse.window,
+          coarse.stuck_samples);
+}
+
+int main() {
+    test_nan_thermistor_does_not_poison();
+    test_stuck_probe_dropped();
+    test_outlier_voted_out();
+    test_noisy_probe_down_weighted();
+    test_converges_faster();
+    test_response_times();
+
+    return check_report();
+}
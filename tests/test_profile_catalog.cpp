@@ -0,0 +1,163 @@
+// Host test: profile CSV parsing, catalog build and lookups, and the MCU's profile cache.
+// pio run -e native_profile_catalog_test && .pio/build/native_profile_catalog_test/program
+
+#include <cstdio>
+#include <vector>
+
+#include "plant_profile.hpp"
+#include "profile_catalog.hpp"
+#include "check.hpp"
+
+// A built catalog held in memory instead of on LittleFS
+class MemCatalogFile : public CatalogFile {
+    public:
+        std::vector<uint8_t> data;
+
+        bool read(uint32_t offset, void *dst, size_t len) override {
+            if (offset + len > data.size()) return false;
+            memcpy(dst, data.data() + offset, len);
+            return true;
+        }
+};
+
+static std::vector<CatalogProfile> parse_all(const char *const *lines, size_t n) {
+    std::vector<CatalogProfile> out;
+    for (size_t i = 0; i < n; ++i) {
+        CatalogProfile p;
+        if (parse_profile_csv(lines[i], p)) out.push_back(p);
+    }
+    return out;
+}
+
+static const char *const CSV[] = {
+    "# id,crop,stage,ec_low,ec_high,ph_low,ph_high,gro,micro,bloom",
+    "4,Lettuce,veg,0.8,1.2,6.0,7.0,3,2,1",
+    "1,Arugula,seedling,0.5,0.8,6.0,7.0,1,1,0",
+    "6,spinach,veg,1.8,2.3,6.0,7.0,3,2,1",
+    "3,Lettuce,seedling,0.5,0.8,6.0,7.0,1,1,0",
+    "2,Arugula,veg,0.8,1.2,6.0,7.0,3,2,1",
+    "",
+    "4,Lettuce,bloom,9,9,9,9,9,9,9",          // repeated id: first row wins
+    "7,Lettuce,bloom,1.0,1.4,5.8,6.5,1,2,3",
+};
+
+static void build(MemCatalogFile &file, ProfileCatalog &catalog, uint32_t hash = 0x1234) {
+    std::vector<CatalogProfile> profiles = parse_all(CSV, sizeof(CSV) / sizeof(CSV[0]));
+    build_catalog(profiles, hash, file.data);
+    CHECK(catalog.open(file), "open");
+}
+
+void test_csv_rows() {
+    CatalogProfile p;
+    CHECK(parse_profile_csv("12,Basil,transition,1.0,1.6,5.5,6.5,2,3,4", p), "valid row");
+    CHECK(p.id == 12 && strcmp(p.crop, "Basil") == 0 && p.stage == STAGE_TRANSITION, "fields");
+    CHECK(p.ec_low == 1.0f && p.ec_high == 1.6f && p.ph_low == 5.5f && p.ph_high == 6.5f, "bands");
+    CHECK(p.gro == 2 && p.micro == 3 && p.bloom == 4, "parts");
+
+    CHECK(!parse_profile_csv("# comment", p), "comment");
+    CHECK(!parse_profile_csv("   ", p), "blank");
+    CHECK(!parse_profile_csv("0,Basil,veg,1,2,5,6,1,1,1", p), "id 0 accepted");
+    CHECK(!parse_profile_csv("1,Basil,fruiting,1,2,5,6,1,1,1", p), "unknown stage accepted");
+    CHECK(!parse_profile_csv("1,Basil,veg,2,1,5,6,1,1,1", p), "inverted EC band accepted");
+    CHECK(!parse_profile_csv("1,Basil,veg,1,2,5,6,1,1", p), "short row accepted");
+    CHECK(!parse_profile_csv("1,Basil,veg,1,2,5,6,1,1,300", p), "part out of range accepted");
+    CHECK(!parse_profile_csv("1,A crop name much too long to store,veg,1,2,5,6,1,1,1", p), "long crop accepted");
+}
+
+void test_build_sorts_and_dedups() {
+    MemCatalogFile file;
+    ProfileCatalog catalog;
+    build(file, catalog);
+
+    CHECK(catalog.count() == 6, "%u profiles", catalog.count());
+    CHECK(catalog.crops() == 3, "%u crops", catalog.crops());
+    CHECK(catalog.source_hash() == 0x1234, "hash");
+
+    // Crop (any case), then stage
+    const uint16_t order[] = { 1, 2, 3, 4, 7, 6 };
+    for (uint16_t i = 0; i < 6; ++i) {
+        CatalogProfile p;
+        CHECK(catalog.at(i, p) && p.id == order[i], "position %u holds id %u", i, p.id);
+    }
+
+    CatalogProfile p;
+    CHECK(catalog.find(4, p) && p.stage == STAGE_VEG && p.ec_high == 1.2f, "first row of id 4 kept");
+    CHECK(catalog.find(7, p) && p.bloom == 3, "find 7");
+    CHECK(!catalog.find(5, p), "found a missing id");
+    CHECK(!catalog.at(6, p), "read past the end");
+}
+
+void test_crop_lookups() {
+    MemCatalogFile file;
+    ProfileCatalog catalog;
+    build(file, catalog);
+
+    uint16_t first, end;
+    CHECK(catalog.crop_range("lettuce", first, end) && first == 2 && end == 5, "lettuce [%u,%u)", first, end);
+    CHECK(catalog.crop_range("SPINACH", first, end) && first == 5 && end == 6, "spinach [%u,%u)", first, end);
+    CHECK(catalog.crop_range("Arugula", first, end) && first == 0 && end == 2, "arugula [%u,%u)", first, end);
+    CHECK(!catalog.crop_range("Basil", first, end), "found a missing crop");
+
+    CatalogProfile p;
+    uint16_t n = 0;
+    CHECK(catalog.crop(1, p, n) && strcmp(p.crop, "Lettuce") == 0 && n == 3, "crop 1: %s x%u", p.crop, n);
+    CHECK(catalog.crop(2, p, n) && n == 1, "last crop");
+    CHECK(!catalog.crop(3, p, n), "crop past the end");
+}
+
+void test_bad_files_rejected() {
+    MemCatalogFile file;
+    ProfileCatalog catalog;
+    build(file, catalog);
+
+    MemCatalogFile truncated;
+    truncated.data.assign(file.data.begin(), file.data.end() - 10);
+    CHECK(!catalog.open(truncated), "opened a truncated catalog");
+
+    MemCatalogFile bad = file;
+    bad.data[0] ^= 0xFF;
+    CHECK(!catalog.open(bad), "opened a bad magic");
+    CatalogProfile p;
+    CHECK(catalog.count() == 0 && !catalog.find(1, p), "failed open left records behind");
+
+    MemCatalogFile empty;
+    std::vector<CatalogProfile> none;
+    CHECK(build_catalog(none, 0, empty.data) == 0, "empty build");
+    CHECK(catalog.open(empty) && catalog.count() == 0 && catalog.crops() == 0, "empty catalog");
+}
+
+void test_profile_cache() {
+    ProfileCache cache;
+    TargetPlant plant = { 0.8f, 1.2f, 1.0f, 6.0f, 7.0f, 6.5f, 3, 2, 1 };
+
+    CHECK(cache.get(1, 0xAAAA) == nullptr, "hit on an empty cache");
+    cache.put(1, 0xAAAA, plant);
+    const TargetPlant *hit = cache.get(1, 0xAAAA);
+    CHECK(hit && hit->gro_amount == 3, "hit");
+    CHECK(cache.get(1, 0xBBBB) == nullptr, "served a changed profile");
+
+    // Fill it; id 1 was used most recently of the old ones, so 2 goes
+    for (uint16_t id = 2; id <= PROFILE_CACHE_SIZE; ++id) cache.put(id, id, plant);
+    cache.get(1, 0xAAAA);
+    cache.put(100, 100, plant);
+    CHECK(cache.get(2, 2) == nullptr, "least recently used kept");
+    CHECK(cache.get(1, 0xAAAA) != nullptr, "recently used evicted");
+    CHECK(cache.get(100, 100) != nullptr, "newest missing");
+
+    // Re-sending an id replaces it in place
+    plant.gro_amount = 9;
+    cache.put(1, 0xCCCC, plant);
+    hit = cache.get(1, 0xCCCC);
+    CHECK(hit && hit->gro_amount == 9, "update");
+    CHECK(cache.get(3, 3) != nullptr, "update evicted another entry");
+}
+
+int main() {
+    test_csv_rows();
+    test_build_sorts_and_dedups();
+    test_crop_lookups();
+    test_bad_files_rejected();
+    test_profile_cache();
+
+    return check_report();
+}
@@ -0,0 +1,101 @@
+// Host test: the pump calibration sweep and its steps/mL fit.
+// pio run -e native_pump_cal_test && .pio/build/native_pump_cal_test/program
+
+#include <cstdio>
+
+#include "pump_calibration.hpp"
+#include "check.hpp"
+
+static std::array<float, CAL_NUM_PROFILES> every_profile(float steps_per_ml) {
+    std::array<float, CAL_NUM_PROFILES> a;
+    a.fill(steps_per_ml);
+    return a;
+}
+
+// Runs the whole sweep on a pump that needs steps_per_ml[p] at profile p
+static bool sweep(PumpCalibrator &cal, const std::array<float, CAL_NUM_PROFILES> &steps_per_ml,
+                  float second_volume_error = 0.0f) {
+    cal.start(PUMP_GRO);
+    bool done = false;
+    for (uint8_t r = 0; r < CAL_NUM_RUNS; ++r) {
+        CHECK(!done, "sweep finished after %u runs", r);
+        CHECK(cal.run() == r && cal.run_steps() == CAL_STEPS[r % CAL_NUM_VOLUMES], "run %u", r);
+        float ml = cal.run_steps() / steps_per_ml[r / CAL_NUM_VOLUMES];
+        if (r % CAL_NUM_VOLUMES == 1) ml *= 1.0f + second_volume_error;
+        done = cal.record(ml);
+    }
+    return done;
+}
+
+void test_fits_a_pump_that_keeps_up() {
+    PumpCalibrator cal;
+    CHECK(sweep(cal, every_profile(500.0f)), "sweep not done");
+    CHECK(!cal.active(), "still active after the last run");
+
+    PumpCalibration out = {};
+    CHECK(cal.fit(out), "fit refused");
+    CHECK(fabsf(out.steps_per_ml - 500.0f) < 0.5f, "%.2f steps/mL", out.steps_per_ml);
+    CHECK(out.profile.max_speed == CAL_PROFILES[CAL_NUM_PROFILES - 1].max_speed, "%.0f steps/s, expected the fastest",
+          out.profile.max_speed);
+}
+
+void test_stops_at_missed_steps() {
+    // From profile 3 on the pump skips 5% of its steps: more steps per mL than the reference
+    PumpCalibrator cal;
+    sweep(cal, {{ 500.0f, 501.0f, 505.0f, 525.0f, 560.0f }});
+
+    PumpCalibration out = {};
+    CHECK(cal.fit(out), "fit refused");
+    CHECK(out.profile.max_speed == CAL_PROFILES[2].max_speed, "picked %.0f steps/s", out.profile.max_speed);
+    CHECK(fabsf(out.steps_per_ml - 505.0f) < 0.5f, "%.2f steps/mL, expected profile 2's", out.steps_per_ml);
+}
+
+void test_rejects_degenerate_fits() {
+    PumpCalibration before = { 123.0f, { 1.0f, 1.0f } };
+
+    // Nothing dispensed
+    PumpCalibrator cal;
+    cal.start(PUMP_GRO);
+    while (!cal.record(0.0f)) {}
+    PumpCalibration out = before;
+    CHECK(!cal.fit(out), "fitted a pump that dispensed nothing");
+    CHECK(out.steps_per_ml == before.steps_per_ml, "result written on a refused fit");
+
+    // The two reference volumes disagree by 10%: the measurements can't be trusted
+    sweep(cal, every_profile(500.0f), 0.1f);
+    CHECK(!cal.fit(out), "fitted an unrepeatable reference");
+
+    // One reference run lost
+    cal.start(PUMP_GRO);
+    cal.record(CAL_STEPS[0] / 500.0f);
+    while (!cal.record(0.0f)) {}
+    CHECK(!cal.fit(out), "fitted with a missing reference run");
+
+    // A bad fast profile only ends the search
+    cal.start(PUMP_GRO);
+    for (uint8_t r = 0; r < CAL_NUM_RUNS; ++r) {
+        float ml = cal.run_steps() / 500.0f;
+        if (r / CAL_NUM_VOLUMES == 1 && r % CAL_NUM_VOLUMES == 1) ml *= 1.1f;
+        cal.record(ml);
+    }
+    CHECK(cal.fit(out) && out.profile.max_speed == CAL_PROFILES[0].max_speed, "picked %.0f steps/s",
+          out.profile.max_speed);
+}
+
+void test_cancel() {
+    PumpCalibrator cal;
+    cal.start(PUMP_PH_UP);
+    cal.record(5.0f);
+    cal.cancel();
+    CHECK(!cal.active() && cal.run() == 0, "cancel left run %u", cal.run());
+    CHECK(!cal.record(5.0f), "recorded while idle");
+}
+
+int main() {
+    test_fits_a_pump_that_keeps_up();
+    test_stops_at_missed_steps();
+    test_rejects_degenerate_fits();
+    test_cancel();
+
+    return check_report();
+}
@@ -0,0 +1,229 @@
+// Host test: recipe step sequencing, waits, branches with jump limits and aborts.
+// pio run -e native_recipe_test && .pio/build/native_recipe_test/program
+
+#include <cstdio>
+#include <vector>
+
+#include "recipe.hpp"
+#include "check.hpp"
+
+// Stand-in for the dose queue: a job takes job_ms to finish
+struct FakeJob {
+    bool          dose;
+    PumpId        pump;
+    float         ml;
+    unsigned long ms;
+};
+
+static std::vector<FakeJob>     jobs;
+static std::vector<RecipeEvent> events;
+static bool                     queue_full = false;
+
+static bool fake_dose(PumpId pump, float ml) {
+    if (queue_full) return false;
+    jobs.push_back({ true, pump, ml, 0 });
+    return true;
+}
+
+static bool fake_mix(unsigned long ms) {
+    if (queue_full) return false;
+    jobs.push_back({ false, NUM_PUMPS, 0.0f, ms });
+    return true;
+}
+
+static void record(const RecipeRunner &, RecipeEvent e) { events.push_back(e); }
+
+static size_t count(RecipeEvent e) {
+    size_t n = 0;
+    for (RecipeEvent x : events) if (x == e) n++;
+    return n;
+}
+
+struct Rig {
+    RecipeRunner  recipe;
+    unsigned long now = 0;
+    float         readings[NUM_RECIPE_SENSORS] = { 1.0f, 6.0f, 21.0f };
+
+    unsigned long job_done_at = 0; // the last queued job is busy until then
+    size_t        jobs_seen   = 0;
+
+    Rig() {
+        jobs.clear();
+        events.clear();
+        queue_full = false;
+        recipe.do_dose  = fake_dose;
+        recipe.do_mix   = fake_mix;
+        recipe.on_event = record;
+    }
+
+    void add(uint8_t i, RecipeStep s) {
+        CHECK(recipe.set_step(i, s), "step %u rejected", i);
+    }
+
+    // One loop() pass every 100 ms; doses take 1 s, mixes their duration
+    void run_for(unsigned long ms) {
+        for (unsigned long end = now + ms; now < end && recipe.running(); now += 100) {
+            if (jobs.size() > jobs_seen) {
+                job_done_at = now + (jobs.back().dose ? 1000UL : jobs.back().ms);
+                jobs_seen   = jobs.size();
+            }
+            recipe.service(now, readings, now < job_done_at);
+        }
+    }
+};
+
+void test_steps_run_in_order() {
+    Rig r;
+    r.add(0, { RECIPE_DOSE, PUMP_GRO,   0, 0, 2.5f, 0.0f });
+    r.add(1, { RECIPE_DOSE, PUMP_MICRO, 0, 0, 1.5f, 0.0f });
+    r.add(2, { RECIPE_MIX,  0,          0, 0, 7.0f, 0.0f });
+    r.add(3, { RECIPE_WAIT, 0,          0, 0, 30.0f, 0.0f });
+
+    CHECK(r.recipe.size() == 4, "size %u", r.recipe.size());
+    CHECK(r.recipe.start(r.now), "start");
+
+    r.run_for(5000);
+    CHECK(jobs.size() == 3, "%zu jobs queued", jobs.size());
+    CHECK(jobs[0].pump == PUMP_GRO && jobs[0].ml == 2.5f, "first dose");
+    CHECK(jobs[1].pump == PUMP_MICRO, "second dose");
+    CHECK(!jobs[2].dose && jobs[2].ms == 7000, "mix of %lu ms", jobs[2].ms);
+
+    // Each job is waited for: the mix ends ~9 s in, then 30 s of waiting
+    r.run_for(30000);
+    CHECK(r.recipe.running() && r.recipe.step() == 3, "still waiting at step %u", r.recipe.step());
+    r.run_for(10000);
+    CHECK(r.recipe.status() == RecipeState::DONE, "done");
+    CHECK(count(RecipeEvent::STEP) == 5, "%zu step events", count(RecipeEvent::STEP)); // 4 + end
+    CHECK(count(RecipeEvent::DONE) == 1, "one done event");
+}
+
+void test_stable_waits_for_a_quiet_window() {
+    Rig r;
+    r.add(0, { RECIPE_STABLE, RECIPE_PH, 0, 0, 0.05f, 0.0f });
+
+    r.recipe.start(r.now);
+    // Drifting 0.1 per 10 s: never within 0.05 for a minute
+    for (int i = 0; i < 30; ++i) {
+        r.readings[RECIPE_PH] = 6.0f + 0.1f * i;
+        r.run_for(10000);
+    }
+    CHECK(r.recipe.running(), "settled while drifting");
+
+    // One more step, then it holds still: done one window later, not before
+    r.readings[RECIPE_PH] = 9.0f;
+    r.run_for(RECIPE_STABLE_MS - 1000);
+    CHECK(r.recipe.running(), "settled early");
+    r.run_for(2000);
+    CHECK(r.recipe.status() == RecipeState::DONE, "never settled");
+}
+
+void test_stable_timeout_moves_on() {
+    Rig r;
+    r.add(0, { RECIPE_STABLE, RECIPE_EC, 0, 0, 0.01f, 120.0f });
+    r.add(1, { RECIPE_DOSE,   PUMP_GRO,  0, 0, 1.0f,  0.0f });
+
+    r.recipe.start(r.now);
+    for (int i = 0; i < 20 && r.recipe.step() == 0; ++i) {
+        r.readings[RECIPE_EC] += 0.1f;
+        r.run_for(10000);
+    }
+    CHECK(count(RecipeEvent::TIMEOUT) == 1, "%zu timeouts", count(RecipeEvent::TIMEOUT));
+    CHECK(r.now >= 120000 && r.now <= 130000, "timed out at %lu ms", r.now);
+    r.run_for(5000);
+    CHECK(jobs.size() == 1, "step after the timeout didn't run");
+}
+
+void test_branch_limit_bounds_a_recheck_loop() {
+    Rig r;
+    // Dose, re-check, up to 3 more times while EC stays low
+    r.add(0, { RECIPE_DOSE,  PUMP_GRO,  0, 0, 1.0f, 0.0f });
+    r.add(1, { RECIPE_WAIT,  0,         0, 0, 10.0f, 0.0f });
+    r.add(2, { RECIPE_BELOW, RECIPE_EC, 0, 3, 1.2f, 0.0f });
+
+    r.recipe.start(r.now);
+    r.run_for(600000);
+    CHECK(r.recipe.status() == RecipeState::DONE, "loop didn't end");
+    CHECK(jobs.size() == 4, "%zu doses, expected 4", jobs.size());
+
+    // Reaching the threshold ends it sooner
+    Rig r2;
+    r2.add(0, { RECIPE_DOSE,  PUMP_GRO,  0, 0, 1.0f, 0.0f });
+    r2.add(1, { RECIPE_WAIT,  0,         0, 0, 10.0f, 0.0f });
+    r2.add(2, { RECIPE_BELOW, RECIPE_EC, 0, 0, 1.2f, 0.0f });
+    r2.recipe.start(r2.now);
+    r2.run_for(25000);
+    r2.readings[RECIPE_EC] = 1.3f;
+    r2.run_for(60000);
+    CHECK(r2.recipe.status() == RecipeState::DONE, "unlimited loop didn't exit on threshold");
+    CHECK(jobs.size() == 3, "%zu doses, expected 3", jobs.size());
+}
+
+void test_jump_loop_does_not_stall() {
+    Rig r;
+    r.add(0, { RECIPE_ABOVE, RECIPE_TEMP, 2, 0, 30.0f, 0.0f });
+    r.add(1, { RECIPE_GOTO,  0,           0, 0, 0.0f,  0.0f });
+
+    r.recipe.start(r.now);
+    r.recipe.service(r.now, r.readings, false);
+    CHECK(r.recipe.running(), "should still be spinning");
+
+    // Warm enough: jumps past the table, which ends it
+    r.readings[RECIPE_TEMP] = 31.0f;
+    r.recipe.service(r.now, r.readings, false);
+    CHECK(r.recipe.status() == RecipeState::DONE, "didn't leave the loop");
+}
+
+void test_table_edits_and_aborts() {
+    Rig r;
+    CHECK(!r.recipe.start(r.now), "started an empty recipe");
+    CHECK(!r.recipe.set_step(0, { RECIPE_DOSE, NUM_PUMPS, 0, 0, 1.0f, 0.0f }), "unknown pump accepted");
+    CHECK(!r.recipe.set_step(0, { RECIPE_DOSE, PUMP_GRO, 0, 0, -1.0f, 0.0f }), "negative dose accepted");
+    CHECK(!r.recipe.set_step(0, { RECIPE_GOTO, 0, RECIPE_MAX_STEPS, 0, 0.0f, 0.0f }), "jump out of the table accepted");
+    CHECK(!r.recipe.set_step(RECIPE_MAX_STEPS, { RECIPE_WAIT, 0, 0, 0, 1.0f, 0.0f }), "step past the table accepted");
+    CHECK(!r.recipe.set_step(0, { NUM_RECIPE_OPS, 0, 0, 0, 0.0f, 0.0f }), "unknown op accepted");
+
+    // Times become unsigned long ms: nothing past a day, nothing infinite
+    CHECK(!r.recipe.set_step(0, { RECIPE_WAIT, 0, 0, 0, 1e9f, 0.0f }), "wait of 30 years accepted");
+    CHECK(!r.recipe.set_step(0, { RECIPE_MIX, 0, 0, 0, INFINITY, 0.0f }), "endless mix accepted");
+    CHECK(!r.recipe.set_step(0, { RECIPE_STABLE, RECIPE_PH, 0, 0, 0.1f, INFINITY }), "endless timeout accepted");
+    CHECK(!r.recipe.set_step(0, { RECIPE_STABLE, RECIPE_PH, 0, 0, INFINITY, 60.0f }), "endless tolerance accepted");
+    CHECK(!r.recipe.set_step(0, { RECIPE_STABLE, RECIPE_PH, 0, 0, 0.1f, NAN }), "NaN timeout accepted");
+    CHECK(r.recipe.set_step(0, { RECIPE_WAIT, 0, 0, 0, RECIPE_MAX_S - 1.0f, 0.0f }), "wait just under a day refused");
+    CHECK(r.recipe.clear(), "clear");
+
+    r.add(0, { RECIPE_WAIT, 0, 0, 0, 60.0f, 0.0f });
+    r.recipe.start(r.now);
+    CHECK(!r.recipe.set_step(1, { RECIPE_WAIT, 0, 0, 0, 1.0f, 0.0f }), "edited while running");
+    CHECK(!r.recipe.clear(), "cleared while running");
+
+    r.run_for(1000);
+    r.recipe.abort("test");
+    CHECK(r.recipe.status() == RecipeState::ABORTED, "abort");
+    CHECK(count(RecipeEvent::ABORTED) == 1, "aborted event");
+    CHECK(strcmp(r.recipe.reason(), "test") == 0, "reason %s", r.recipe.reason());
+
+    // A full queue aborts instead of skipping the dose
+    Rig r2;
+    r2.add(0, { RECIPE_DOSE, PUMP_PH_UP, 0, 0, 0.5f, 0.0f });
+    queue_full = true;
+    r2.recipe.start(r2.now);
+    r2.run_for(1000);
+    CHECK(r2.recipe.status() == RecipeState::ABORTED, "ran past a dose it couldn't queue");
+
+    // The table survives a run and can be restarted
+    queue_full = false;
+    CHECK(r2.recipe.start(r2.now), "restart");
+    r2.run_for(5000);
+    CHECK(r2.recipe.status() == RecipeState::DONE, "restart didn't finish");
+}
+
+int main() {
+    test_steps_run_in_order();
+    test_stable_waits_for_a_quiet_window();
+    test_stable_timeout_moves_on();
+    test_branch_limit_bounds_a_recheck_loop();
+    test_jump_loop_does_not_stall();
+    test_table_edits_and_aborts();
+
+    return check_report();
+}
@@ -0,0 +1,97 @@
+// Host test: bridge-side sensor history buckets and slot reuse.
+// pio run -e native_sensor_history_test && .pio/build/native_sensor_history_test/program
+
+#include <cstdio>
+
+#include "sensor_history.hpp"
+#include "check.hpp"
+
+static SensorHistory history;
+
+void test_bucket_averages() {
+    HistoryRing r;
+    // A reading every 2 s for one bucket, then one into the next to close it
+    for (unsigned long t = 0; t < HISTORY_BUCKET_MS; t += 2000) r.add(t, 6.0f, 1.2f, 21.0f);
+    CHECK(r.size() == 0, "bucket closed early");
+    r.add(HISTORY_BUCKET_MS, 7.0f, 1.0f, 22.0f);
+    CHECK(r.size() == 1, "%u buckets", r.size());
+    CHECK(r.at(0).ph == 600 && r.at(0).temp == 2100, "ph %d temp %d", r.at(0).ph, r.at(0).temp);
+    CHECK(r.at(0).ec > 1.199f && r.at(0).ec < 1.201f, "ec %.3f", r.at(0).ec);
+    CHECK(r.age(HISTORY_BUCKET_MS + 500) == 500, "age %lu", r.age(HISTORY_BUCKET_MS + 500));
+}
+
+void test_gap_leaves_empty_buckets() {
+    HistoryRing r;
+    r.add(0, 6.0f, 1.0f, 20.0f);
+    r.add(4 * HISTORY_BUCKET_MS + 10, 6.5f, 1.0f, 20.0f);
+    CHECK(r.size() == 4, "%u buckets", r.size());
+    CHECK(r.at(0).ph == 600, "first bucket lost");
+    for (uint16_t i = 1; i < 4; ++i) CHECK(r.at(i).ph == HISTORY_EMPTY, "bucket %u not empty", i);
+    CHECK(r.age(4 * HISTORY_BUCKET_MS + 10) == 10, "bucket times drifted");
+}
+
+void test_ring_keeps_newest() {
+    HistoryRing r;
+    unsigned long t = 0;
+    for (uint16_t i = 0; i < HISTORY_LEN + 10; ++i, t += HISTORY_BUCKET_MS) r.add(t, (i % 100) / 10.0f, 1.0f, 20.0f);
+    CHECK(r.size() == HISTORY_LEN, "%u buckets", r.size());
+    // Newest closed bucket is the second-last reading's
+    uint16_t last = HISTORY_LEN + 8;
+    CHECK(r.at(HISTORY_LEN - 1).ph == lroundf((last % 100) * 10.0f), "newest %d", r.at(HISTORY_LEN - 1).ph);
+    CHECK(r.at(0).ph == lroundf(((last - HISTORY_LEN + 1) % 100) * 10.0f), "oldest %d", r.at(0).ph);
+
+    // A gap longer than the ring leaves it all empty, still full length
+    r.add(t + 10 * HISTORY_LEN * HISTORY_BUCKET_MS, 6.0f, 1.0f, 20.0f);
+    CHECK(r.size() == HISTORY_LEN && r.at(HISTORY_LEN - 1).ph == HISTORY_EMPTY, "long gap");
+}
+
+void test_slots_reuse_stalest() {
+    for (uint8_t n = 1; n <= HISTORY_SLOTS; ++n) history.add(n * 1000, n, 0, 6.0f, 1.0f, 20.0f);
+    for (uint8_t n = 1; n <= HISTORY_SLOTS; ++n) CHECK(history.find(n, 0), "node %u has no ring", n);
+    CHECK(!history.find(1, 1), "zone not part of the key");
+
+    // Every ring still in use: a newcomer goes without
+    history.add(10000, 9, 2, 6.0f, 1.0f, 20.0f);
+    CHECK(!history.find(9, 2), "ring taken from a node still reporting");
+
+    // Nodes 1, 3 and 4 carry on, node 2 goes quiet: its ring is the one reused
+    unsigned long t = 10000;
+    for (; t < 2000 + HISTORY_STALE_MS; t += 2000) {
+        for (uint8_t n : { 1, 3, 4 }) history.add(t, n, 0, 6.0f, 1.0f, 20.0f);
+        history.add(t, 9, 2, 6.0f, 1.0f, 20.0f);
+    }
+    CHECK(!history.find(9, 2), "node 2 evicted after %lu ms quiet", t - 2000);
+    history.add(t + 2000, 9, 2, 6.0f, 1.0f, 20.0f);
+    CHECK(history.find(9, 2) && !history.find(2, 0), "wrong slot reused");
+    CHECK(history.find(1, 0), "active node evicted");
+
+    // A backfilled reading older than a slot's last isn't silence
+    history.add(t - HISTORY_STALE_MS, 5, 0, 6.0f, 1.0f, 20.0f);
+    CHECK(!history.find(5, 0), "old backfill evicted a node");
+}
+
+void test_more_sources_than_slots() {
+    // Six nodes every 2 s for an hour: the first to report keep their rings and fill them
+    static SensorHistory six;
+    const uint8_t nodes = HISTORY_SLOTS + 2;
+    for (unsigned long t = 0; t < 3600000UL; t += 2000) {
+        for (uint8_t n = 1; n <= nodes; ++n) six.add(t + n, n, 0, 6.0f, 1.2f, 21.0f);
+    }
+    for (uint8_t n = 1; n <= HISTORY_SLOTS; ++n) {
+        const HistoryRing *r = six.find(n, 0);
+        CHECK(r && r->size() == 3600000UL / HISTORY_BUCKET_MS - 1, "node %u: %u buckets", n, r ? r->size() : 0);
+        HistoryPoint p = {};
+        CHECK(r && r->bucket(r->pushed() - 1, p) && p.ph == 600, "node %u newest bucket pH %d", n, p.ph);
+    }
+    for (uint8_t n = HISTORY_SLOTS + 1; n <= nodes; ++n) CHECK(!six.find(n, 0), "node %u took a ring", n);
+}
+
+int main() {
+    test_bucket_averages();
+    test_gap_leaves_empty_buckets();
+    test_ring_keeps_newest();
+    test_slots_reuse_stalest();
+    test_more_sources_than_slots();
+
+    return check_report();
+}
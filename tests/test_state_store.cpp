@@ -0,0 +1,207 @@
+// Host test: the log-structured state store — appends, compaction, and power lost mid-write.
+// pio run -e native_state_store_test && .pio/build/native_state_store_test/program
+
+#include <cstdio>
+
+#include "state_store.hpp"
+#include "check.hpp"
+
+// HostFlash that can lose power part way through a write, or refuse writes (PROGE)
+class FaultyFlash : public FlashRegion {
+    public:
+        HostFlash mem { 4 };
+        long      power_left  = -1; // bytes still written before the power goes, -1 = never
+        int       fail_writes = 0;  // writes refused from here on
+        long      refuse_at   = -1; // a write starting at this offset is refused
+        unsigned  writes      = 0;
+        unsigned  erases[4]   = {};
+
+        uint32_t block_size() const override { return mem.block_size(); }
+        uint8_t  num_blocks() const override { return mem.num_blocks(); }
+
+        void read(uint32_t offset, void *dst, size_t len) override { mem.read(offset, dst, len); }
+
+        bool write(uint32_t offset, const void *src, size_t len) override {
+            if (power_left == 0 || static_cast<long>(offset) == refuse_at) return false;
+            if (fail_writes > 0) {
+                fail_writes--;
+                return false;
+            }
+            writes++;
+            if (power_left > 0 && static_cast<size_t>(power_left) < len) {
+                mem.write(offset, src, power_left);
+                power_left = 0;
+                return false;
+            }
+            if (power_left > 0) power_left -= len;
+            return mem.write(offset, src, len);
+        }
+
+        bool erase(uint8_t block) override {
+            if (power_left == 0) return false;
+            erases[block]++;
+            return mem.erase(block);
+        }
+
+        // Power back: nothing pending
+        void restore() { power_left = -1; fail_writes = 0; refuse_at = -1; }
+};
+
+static constexpr uint32_t RECORD_BYTES = sizeof(StoreRecordHeader) + STORE_WRITE_UNIT; // a uint32_t value
+
+static uint32_t read_u32(StateStore &store, uint8_t key) {
+    uint32_t v = 0xDEADBEEF;
+    store.get(key, v);
+    return v;
+}
+
+// Puts key 0 until the next put has to compact
+static void fill_active(StateStore &store, uint32_t &counter) {
+    while (store.bytes_free() >= RECORD_BYTES) store.put<uint32_t>(0, ++counter);
+}
+
+void test_values_survive_a_reboot() {
+    FaultyFlash flash;
+    StateStore  store(flash);
+    CHECK(store.begin() && store.generation() == 1, "format, generation %u", store.generation());
+
+    for (uint8_t k = 0; k < 8; ++k) CHECK(store.put<uint32_t>(k, 100 + k), "put %u", k);
+    float f = 6.25f;
+    CHECK(store.put(9, f), "put float");
+    CHECK(!store.put<uint32_t>(STORE_MAX_KEYS, 1), "key past the table accepted");
+
+    unsigned writes = flash.writes;
+    CHECK(store.put<uint32_t>(3, 103), "unchanged put");
+    CHECK(flash.writes == writes, "unchanged value rewritten");
+    CHECK(store.put<uint32_t>(3, 333), "changed put");
+
+    StateStore again(flash);
+    CHECK(again.begin(), "begin");
+    for (uint8_t k = 0; k < 8; ++k) {
+        uint32_t want = k == 3 ? 333 : 100 + k;
+        CHECK(read_u32(again, k) == want, "key %u reads %u, expected %u", k, read_u32(again, k), want);
+    }
+    float g = 0.0f;
+    CHECK(again.get(9, g) && g == 6.25f, "float reads %.2f", g);
+    uint16_t wrong_size;
+    CHECK(!again.get(9, wrong_size), "read with the wrong size");
+    CHECK(!again.get(20, g), "absent key read");
+}
+
+void test_compaction_keeps_the_newest_and_rotates() {
+    FaultyFlash flash;
+    StateStore  store(flash);
+    store.begin();
+
+    for (uint8_t k = 1; k < 6; ++k) store.put<uint32_t>(k, k * 7);
+    uint32_t counter = 0;
+    while (store.generation() < 9) store.put<uint32_t>(0, ++counter);
+
+    StateStore again(flash);
+    CHECK(again.begin() && again.generation() == 9, "generation %u after reboot", again.generation());
+    CHECK(read_u32(again, 0) == counter, "key 0 reads %u, expected %u", read_u32(again, 0), counter);
+    for (uint8_t k = 1; k < 6; ++k) CHECK(read_u32(again, k) == k * 7u, "key %u lost in compaction", k);
+
+    // Eight compactions over four blocks: each erased twice (block 0 once more, by the format)
+    for (uint8_t b = 0; b < 4; ++b) {
+        CHECK(flash.erases[b] == (b == 0 ? 3u : 2u), "block %u erased %u times", b, flash.erases[b]);
+    }
+}
+
+void test_torn_record_keeps_the_previous_copy() {
+    // Power lost inside the header, then inside the value
+    for (long torn_at : { 8L, 18L }) {
+        FaultyFlash flash;
+        StateStore  store(flash);
+        store.begin();
+        store.put<uint32_t>(1, 11);
+        store.put<uint32_t>(2, 22);
+
+        flash.power_left = torn_at;
+        store.put<uint32_t>(1, 12);
+        flash.restore();
+
+        StateStore again(flash);
+        CHECK(again.begin(), "begin");
+        CHECK(read_u32(again, 1) == 11, "torn at %ld: key 1 reads %u", torn_at, read_u32(again, 1));
+        CHECK(read_u32(again, 2) == 22, "torn at %ld: key 2 reads %u", torn_at, read_u32(again, 2));
+
+        // The torn bytes can't be written over: the next put compacts past them
+        uint32_t gen = again.generation();
+        CHECK(again.put<uint32_t>(3, 33), "put after a torn record");
+        CHECK(again.generation() == gen + 1, "no compaction past the torn record");
+
+        StateStore third(flash);
+        third.begin();
+        CHECK(read_u32(third, 1) == 11 && read_u32(third, 3) == 33, "after compaction: %u, %u", read_u32(third, 1),
+              read_u32(third, 3));
+    }
+}
+
+void test_power_lost_mid_compaction() {
+    FaultyFlash flash;
+    StateStore  store(flash);
+    store.begin();
+    for (uint8_t k = 1; k < 6; ++k) store.put<uint32_t>(k, k * 7);
+    uint32_t counter = 0;
+    fill_active(store, counter);
+
+    // Three records into the new block
+    flash.power_left = 3 * RECORD_BYTES + 4;
+    CHECK(!store.put<uint32_t>(0, counter + 1), "put survived a power loss");
+    flash.restore();
+
+    StateStore again(flash);
+    CHECK(again.begin() && again.generation() == 1, "booted generation %u, expected the old block", again.generation());
+    CHECK(read_u32(again, 0) == counter, "key 0 reads %u, expected %u", read_u32(again, 0), counter);
+    for (uint8_t k = 1; k < 6; ++k) CHECK(read_u32(again, k) == k * 7u, "key %u lost", k);
+
+    // The half-written block is erased and done over
+    CHECK(again.put<uint32_t>(0, counter + 1) && again.generation() == 2, "compaction after reboot");
+    StateStore third(flash);
+    third.begin();
+    CHECK(read_u32(third, 0) == counter + 1 && read_u32(third, 5) == 35, "after the redo: %u, %u", read_u32(third, 0),
+          read_u32(third, 5));
+}
+
+void test_failed_compaction_keeps_the_old_block() {
+    FaultyFlash flash;
+    StateStore  store(flash);
+    store.begin();
+    store.put<uint32_t>(1, 7);
+    uint32_t counter = 0;
+    fill_active(store, counter);
+
+    // Every write refused: the copies, then the header
+    flash.fail_writes = 100;
+    CHECK(!store.put<uint32_t>(0, 999), "put reported success");
+    flash.restore();
+    CHECK(store.generation() == 1, "generation %u after a failed compaction", store.generation());
+    CHECK(read_u32(store, 0) == counter && read_u32(store, 1) == 7, "old values unreadable: %u, %u",
+          read_u32(store, 0), read_u32(store, 1));
+
+    // Only the new block's header refused: the copies went in, but the old block is still the newest
+    flash.refuse_at = flash.block_size();
+    CHECK(!store.put<uint32_t>(0, 999), "put reported success without a header");
+    flash.restore();
+    StateStore rebooted(flash);
+    CHECK(rebooted.begin() && rebooted.generation() == 1, "booted generation %u", rebooted.generation());
+    CHECK(read_u32(rebooted, 0) == counter, "key 0 reads %u, expected %u", read_u32(rebooted, 0), counter);
+
+    CHECK(store.put<uint32_t>(0, 999) && store.generation() == 2, "retry failed");
+
+    StateStore again(flash);
+    again.begin();
+    CHECK(read_u32(again, 0) == 999 && read_u32(again, 1) == 7, "after the retry: %u, %u", read_u32(again, 0),
+          read_u32(again, 1));
+}
+
+int main() {
+    test_values_survive_a_reboot();
+    test_compaction_keeps_the_newest_and_rotates();
+    test_torn_record_keeps_the_previous_copy();
+    test_power_lost_mid_compaction();
+    test_failed_compaction_keeps_the_old_block();
+
+    return check_report();
+}
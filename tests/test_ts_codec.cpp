@@ -0,0 +1,258 @@
+// Host test: time-series block codec, sample log, base64 and the packed MQTT series
+// (ts_codec.hpp, mqtt_link.hpp).
+// pio run -e native_ts_codec_test && .pio/build/native_ts_codec_test/program
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ts_codec.hpp"
+#include "mqtt_link.hpp"
+#include "check.hpp"
+
+static bool same(const TsSample &a, const TsSample &b) {
+    return a.t == b.t && a.v[0] == b.v[0] && a.v[1] == b.v[1] && a.v[2] == b.v[2];
+}
+
+// Packs samples into as many blocks as they take, then reads every block back
+static size_t round_trip(const std::vector<TsSample> &in, size_t *bytes = nullptr) {
+    std::vector<std::vector<uint8_t>> blocks;
+    std::vector<uint8_t> buf(TS_BLOCK_BYTES);
+    TsBlockWriter w;
+    w.begin(buf.data());
+    for (const TsSample &s : in) {
+        if (w.append(s)) continue;
+        blocks.emplace_back(buf.begin(), buf.begin() + w.size());
+        w.begin(buf.data());
+        CHECK(w.append(s), "sample refused by an empty block");
+    }
+    if (!w.empty()) blocks.emplace_back(buf.begin(), buf.begin() + w.size());
+
+    size_t i = 0, total = 0;
+    for (const std::vector<uint8_t> &b : blocks) {
+        total += b.size();
+        TsBlockReader r(b.data(), b.size());
+        TsSample s;
+        while (r.next(s)) {
+            if (i < in.size() && !same(s, in[i])) {
+                CHECK(false, "sample %zu: t %u/%u v %d,%d,%d", i, s.t, in[i].t, s.v[0], s.v[1], s.v[2]);
+                return i;
+            }
+            i++;
+        }
+    }
+    if (bytes) *bytes = total;
+    return i;
+}
+
+void test_steady_readings_pack_small() {
+    std::vector<TsSample> in;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> step(-1, 1);
+    TsSample s = ts_sample(123456, 6.2f, 1.45f, 21.3f);
+    for (int i = 0; i < 500; ++i) {
+        in.push_back(s);
+        s.t += 2000;
+        for (int16_t &v : s.v) v += step(rng);
+    }
+    size_t bytes = 0;
+    CHECK(round_trip(in, &bytes) == in.size(), "lost samples");
+    // time 1 bit, values 1 or 5 bits each
+    CHECK(bytes < in.size() * 3, "%zu bytes for %zu samples", bytes, in.size());
+}
+
+void test_irregular_times_and_jumps() {
+    std::vector<TsSample> in;
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<uint32_t> gap(0, 100000);
+    std::uniform_int_distribution<int> value(-32768, 32767);
+    uint32_t t = 0xFFFF0000UL; // wraps in the middle
+    for (int i = 0; i < 400; ++i) {
+        TsSample s = { t, { static_cast<int16_t>(value(rng)), static_cast<int16_t>(i % 7), 2100 } };
+        in.push_back(s);
+        t += (i % 5 == 0) ? gap(rng) : 2000 + (i % 3);
+    }
+    in.push_back({ t - 50000, { 0, 0, 0 } });         // back in time
+    in.push_back({ static_cast<uint32_t>(t + 3000000000UL), { 1, 1, 1 } }); // a long way forward
+    CHECK(round_trip(in) == in.size(), "lost samples");
+}
+
+void test_full_block_refuses_cleanly() {
+    uint8_t block[TS_BLOCK_BYTES];
+    TsBlockWriter w;
+    w.begin(block);
+    TsSample s = ts_sample(0, 6.0f, 1.0f, 20.0f);
+    uint8_t n = 0;
+    // Big jumps: a refused sample has written part of itself
+    while (w.append(s)) {
+        n++;
+        s.t += 1000 + n * 97;
+        s.v[0] = s.v[0] > 0 ? -20000 : 20000;
+    }
+    CHECK(n == w.count() && w.size() <= TS_BLOCK_BYTES, "%u appended, count %u", n, w.count());
+
+    TsBlockReader r(block, w.size());
+    TsSample out;
+    uint8_t  got = 0;
+    while (r.next(out)) got++;
+    CHECK(got == n, "%u of %u read back", got, n);
+
+    // Most samples a block can take: nothing changes
+    w.begin(block);
+    TsSample flat = ts_sample(0, 6.0f, 1.0f, 20.0f);
+    while (w.append(flat)) {}
+    CHECK(w.count() == TS_BLOCK_MAX_SAMPLES, "%u in a flat block", w.count());
+}
+
+void test_damaged_block_stops() {
+    uint8_t block[TS_BLOCK_BYTES];
+    TsBlockWriter w;
+    w.begin(block);
+    for (uint32_t t = 0; t < 100000; t += 2000) w.append(ts_sample(t, 6.0f + t * 1e-5f, 1.2f, 21.0f));
+
+    // Cut short: what is whole still reads, then it stops
+    TsBlockReader cut(block, w.size() / 2);
+    TsSample s;
+    uint8_t  got = 0;
+    while (cut.next(s)) got++;
+    CHECK(got > 0 && got < w.count(), "%u of %u from half a block", got, w.count());
+
+    TsBlockReader tiny(block, 4);
+    CHECK(tiny.count() == 0 && !tiny.next(s), "header-less block read");
+
+    block[0] = 255;
+    TsBlockReader bad(block, w.size());
+    CHECK(bad.count() == 0, "count past the maximum accepted");
+}
+
+void test_quantize() {
+    CHECK(ts_quantize(6.125f) == 613 || ts_quantize(6.125f) == 612, "%d", ts_quantize(6.125f));
+    CHECK(ts_quantize(-1.0f) == -100, "%d", ts_quantize(-1.0f));
+    CHECK(ts_quantize(1e9f) == 32767 && ts_quantize(-1e9f) == -32768, "not clamped");
+    CHECK(ts_quantize(NAN) == 0, "NaN");
+    CHECK(ts_value(2150) > 21.49f && ts_value(2150) < 21.51f, "%.3f", ts_value(2150));
+}
+
+void test_log_numbers_blocks() {
+    TsLog<3> log;
+    const uint8_t *data = nullptr;
+    CHECK(log.block(0, data) == 0, "empty log has a block");
+
+    // pH swinging every sample, so blocks fill in ~70
+    uint32_t t = 0;
+    while (log.newest() < 5) {
+        log.add(ts_sample(t, (t / 1000) % 2 ? 6.0f : 6.3f, 1.0f, 20.0f));
+        t += 1000;
+    }
+    CHECK(log.oldest() == 3, "oldest %u", log.oldest());
+    CHECK(log.block(2, data) == 0, "overwritten block still held");
+    CHECK(log.block(6, data) == 0, "future block");
+
+    size_t len = log.block(3, data);
+    CHECK(len > 0 && len <= TS_BLOCK_BYTES, "block 3 len %zu", len);
+    TsBlockReader r(data, len);
+    TsSample first;
+    CHECK(r.next(first), "block 3 empty");
+
+    // Blocks follow on: 4 starts right after 3 ends
+    TsSample last = first, s;
+    while (r.next(s)) last = s;
+    len = log.block(4, data);
+    TsBlockReader r4(data, len);
+    CHECK(r4.next(s) && s.t == last.t + 1000, "gap between blocks: %u then %u", last.t, s.t);
+}
+
+void test_base64() {
+    uint8_t in[TS_BLOCK_BYTES];
+    for (size_t i = 0; i < sizeof(in); ++i) in[i] = static_cast<uint8_t>(i * 37 + 5);
+    for (size_t n : { size_t(0), size_t(1), size_t(2), size_t(3), size_t(59), sizeof(in) }) {
+        char    text[TS_BLOCK_B64 + 1];
+        uint8_t out[TS_BLOCK_BYTES];
+        size_t  chars = ts_base64(in, n, text, sizeof(text));
+        CHECK(chars == 4 * ((n + 2) / 3) && strlen(text) == chars, "%zu bytes: %zu chars", n, chars);
+        CHECK(ts_unbase64(text, out, sizeof(out)) == n && memcmp(in, out, n) == 0, "%zu bytes back", n);
+    }
+    char small[8];
+    CHECK(ts_base64(in, 6, small, sizeof(small)) == 0, "overran the output");
+    uint8_t out[4];
+    CHECK(ts_unbase64("AB$D", out, sizeof(out)) == 0, "bad character taken");
+    CHECK(ts_unbase64("AAAAAAAA", out, sizeof(out)) == 0, "overran the output buffer");
+}
+
+void test_packed_series_payload() {
+    PackedSeries p;
+    CHECK(p.empty(), "new series not empty");
+    for (unsigned long t = 0; t < 60000; t += 2000) CHECK(p.add(50000 + t, 0, 3, 1, 6.1f, 1.4f, 21.5f), "add at %lu", t);
+    CHECK(!p.due(50000 + 60000) && p.due(50000 + MQTT_PACKED_BATCH_MS), "due");
+
+    uint8_t out[MQTT_PAYLOAD_MAX];
+    size_t  n = p.close(out, 0x1a2b3c4d, 7);
+    std::string payload(reinterpret_cast<char *>(out), n);
+    CHECK(payload.find("{\"boot\":\"1a2b3c4d\",\"seq\":7,\"t0\":50000,\"node\":3,\"zone\":1,\"ts\":[\"") == 0, "%s",
+          payload.c_str());
+    CHECK(payload.compare(payload.size() - 3, 3, "\"]}") == 0, "%s", payload.c_str());
+    CHECK(p.empty(), "close didn't empty the series");
+
+    // 30 rows as JSON would be ~27 bytes each
+    size_t at = payload.find("[\"") + 2;
+    std::string b64 = payload.substr(at, payload.size() - at - 3);
+    uint8_t block[TS_BLOCK_BYTES];
+    size_t  len = ts_unbase64(b64.c_str(), block, sizeof(block));
+    TsBlockReader r(block, len);
+    TsSample s;
+    uint32_t count = 0, t = 0;
+    while (r.next(s)) {
+        CHECK(s.t == t && s.v[0] == 610 && s.v[1] == 140 && s.v[2] == 2150, "sample %u", count);
+        t += 2000;
+        count++;
+    }
+    CHECK(count == 30 && len < 30, "%u samples in %zu bytes", count, len);
+}
+
+void test_packed_series_fills_its_blocks() {
+    PackedSeries p;
+    unsigned long t = 0;
+    // pH swinging: every sample costs bits, so the blocks fill
+    while (p.add(t, 0, 1, 0, (t / 2000) % 2 ? 6.0f : 6.2f, 1.4f, 21.5f)) t += 2000;
+    size_t added = t / 2000;
+    CHECK(added > (MQTT_PACKED_BLOCKS - 1) * 60u, "only %zu samples", added);
+
+    uint8_t out[MQTT_PAYLOAD_MAX];
+    size_t  n = p.close(out, 1, 1);
+    std::string payload(reinterpret_cast<char *>(out), n);
+    CHECK(n < MQTT_PAYLOAD_MAX, "%zu bytes", n);
+
+    // Every block stands on its own, and together they hold every sample in order
+    size_t   got = 0, from = payload.find("[\"") + 1;
+    uint32_t expect = 0;
+    while (from < payload.size() && payload[from] == '"') {
+        size_t      end = payload.find('"', from + 1);
+        std::string b64 = payload.substr(from + 1, end - from - 1);
+        uint8_t block[TS_BLOCK_BYTES];
+        TsBlockReader r(block, ts_unbase64(b64.c_str(), block, sizeof(block)));
+        TsSample s;
+        while (r.next(s)) {
+            CHECK(s.t == expect, "sample %zu at %u", got, s.t);
+            expect += 2000;
+            got++;
+        }
+        from = end + 2;
+    }
+    CHECK(got == added, "%zu of %zu samples", got, added);
+    CHECK(p.add(t, 0, 1, 0, 6.0f, 1.4f, 21.5f), "refused after close");
+}
+
+int main() {
+    test_steady_readings_pack_small();
+    test_irregular_times_and_jumps();
+    test_full_block_refuses_cleanly();
+    test_damaged_block_stops();
+    test_quantize();
+    test_log_numbers_blocks();
+    test_base64();
+    test_packed_series_payload();
+    test_packed_series_fills_its_blocks();
+
+    return check_report();
+}
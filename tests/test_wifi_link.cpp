@@ -0,0 +1,108 @@
+// Host test: WiFi connect / backoff / reconnect state machine.
+// pio run -e native_wifi_link_test && .pio/build/native_wifi_link_test/program
+
+#include <cstdio>
+
+#include "wifi_link.hpp"
+#include "check.hpp"
+
+static int connects = 0, ups = 0, downs = 0;
+
+static void fake_connect() { connects++; }
+static void fake_up()      { ups++; }
+static void fake_down()    { downs++; }
+
+struct Rig {
+    WifiLink      link;
+    unsigned long now = 0;
+
+    Rig() {
+        connects = ups = downs = 0;
+        link.connect = fake_connect;
+        link.on_up   = fake_up;
+        link.on_down = fake_down;
+    }
+
+    // loop() every 10 ms
+    void run_for(unsigned long ms) {
+        for (unsigned long end = now + ms; now < end; now += 10) link.service(now);
+    }
+};
+
+void test_connects_without_waiting() {
+    Rig r;
+    r.link.start(r.now);
+    CHECK(connects == 1 && r.link.status() == WifiState::CONNECTING, "first attempt");
+
+    r.run_for(3000);
+    CHECK(r.link.status() == WifiState::CONNECTING && ups == 0, "up without an IP");
+
+    r.link.link_up();
+    r.run_for(20);
+    CHECK(r.link.status() == WifiState::UP && ups == 1, "not up after the IP");
+    r.run_for(60000);
+    CHECK(connects == 1 && ups == 1, "reconnected while up");
+}
+
+void test_backoff_doubles_to_the_cap() {
+    Rig r;
+    r.link.start(r.now);
+
+    // No AP: every attempt times out. Gaps between attempts: 1 s, 2 s, 4 s ...
+    unsigned long last = 0, gap = 0;
+    int attempts = connects;
+    for (int i = 0; i < 12; ++i) {
+        while (connects == attempts) r.run_for(10);
+        unsigned long started = r.now - 10;
+        gap      = started - last - WIFI_CONNECT_TIMEOUT_MS;
+        last     = started;
+        attempts = connects;
+        if (i < 5) {
+            CHECK(gap >= (WIFI_BACKOFF_MIN_MS << i) && gap <= (WIFI_BACKOFF_MIN_MS << i) + 20,
+                  "gap %d: %lu ms", i, gap);
+        }
+    }
+    CHECK(gap >= WIFI_BACKOFF_MAX_MS && gap <= WIFI_BACKOFF_MAX_MS + 20, "capped gap %lu ms", gap);
+
+    // Success resets it
+    r.link.link_up();
+    r.run_for(WIFI_CONNECT_TIMEOUT_MS + WIFI_BACKOFF_MAX_MS);
+    CHECK(r.link.status() == WifiState::UP && r.link.backoff() == WIFI_BACKOFF_MIN_MS, "backoff not reset");
+}
+
+void test_refused_attempt_fails_fast() {
+    Rig r;
+    r.link.start(r.now);
+    r.run_for(500);
+    r.link.link_down(); // wrong password, AP not found
+    r.run_for(20);
+    CHECK(r.link.status() == WifiState::BACKOFF, "still waiting on a refused attempt");
+    r.run_for(WIFI_BACKOFF_MIN_MS);
+    CHECK(connects == 2, "%d attempts", connects);
+}
+
+void test_drop_reconnects() {
+    Rig r;
+    r.link.start(r.now);
+    r.link.link_up();
+    r.run_for(100);
+
+    r.link.link_down();
+    r.run_for(20);
+    CHECK(downs == 1 && r.link.status() == WifiState::BACKOFF, "drop not seen");
+    r.run_for(WIFI_BACKOFF_MIN_MS);
+    CHECK(connects == 2 && r.link.status() == WifiState::CONNECTING, "no retry after the minimum");
+
+    r.link.link_up();
+    r.run_for(20);
+    CHECK(ups == 2 && r.link.status() == WifiState::UP, "back up");
+}
+
+int main() {
+    test_connects_without_waiting();
+    test_backoff_doubles_to_the_cap();
+    test_refused_attempt_fails_fast();
+    test_drop_reconnects();
+
+    return check_report();
+}
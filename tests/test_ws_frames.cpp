@@ -0,0 +1,59 @@
+// Host test: /ws binary frame layout, both directions.
+// pio run -e native_ws_frames_test && .pio/build/native_ws_frames_test/program
+
+#include <cstdio>
+
+#include "ws_frames.hpp"
+#include "check.hpp"
+
+void test_sample_frame_layout() {
+    WsSampleFrame<2> f;
+    f.begin(0x01020304);
+    CHECK(f.size() == WS_SAMPLE_HEADER && f.count() == 0, "empty frame %zu bytes", f.size());
+    CHECK(f.add(3, 1, 6.25f, 1.5f, 21.0f), "first sample refused");
+    CHECK(f.add(3, 2, 5.5f, 0.75f, 19.5f), "second sample refused");
+    CHECK(!f.add(4, 0, 0.0f, 0.0f, 0.0f), "overfilled");
+    CHECK(f.size() == WS_SAMPLE_HEADER + 2 * WS_SAMPLE_SIZE, "%zu bytes", f.size());
+
+    const uint8_t *d = f.data();
+    CHECK(d[0] == WS_FRAME_SAMPLES && d[1] == 2, "header %u %u", d[0], d[1]);
+    CHECK(d[2] == 0x04 && d[5] == 0x01, "ms not little-endian");
+    const uint8_t *s = d + WS_SAMPLE_HEADER + WS_SAMPLE_SIZE;
+    CHECK(s[0] == 3 && s[1] == 2, "address %u.%u", s[0], s[1]);
+    CHECK(ws_get_f32(s + 2) == 5.5f && ws_get_f32(s + 6) == 0.75f && ws_get_f32(s + 10) == 19.5f, "values");
+}
+
+void test_ack_frame() {
+    uint8_t buf[WS_ACK_SIZE];
+    CHECK(ws_ack_frame(buf, 0xBEEF, WS_ACK_UNKNOWN) == 4, "size");
+    CHECK(buf[0] == WS_FRAME_ACK && buf[1] == 0xEF && buf[2] == 0xBE && buf[3] == WS_ACK_UNKNOWN, "layout");
+}
+
+void test_parse_commands() {
+    WsCommand c;
+    const uint8_t state[] = { WS_CMD_STATE, 0x07, 0x00, 2, 1, 1 };
+    CHECK(ws_parse_command(state, sizeof(state), c), "state refused");
+    CHECK(c.kind == WS_CMD_STATE && c.seq == 7 && c.node == 2 && c.zone == 1 && c.run, "state fields");
+
+    uint8_t dose[WS_CMD_HEADER + 20] = { WS_CMD_DOSE, 0x00, 0x01, 1, 0 };
+    const float ml[5] = { 2.5f, 2.5f, 5.0f, 0.0f, 0.25f };
+    for (uint8_t i = 0; i < 5; ++i) ws_put_f32(dose + WS_CMD_HEADER + 4 * i, ml[i]);
+    CHECK(ws_parse_command(dose, sizeof(dose), c), "dose refused");
+    CHECK(c.seq == 256 && c.ml[2] == 5.0f && c.ml[4] == 0.25f, "dose fields");
+    CHECK(!ws_parse_command(dose, sizeof(dose) - 1, c) && c.seq == 256, "short dose taken, or seq lost");
+
+    const uint8_t select[] = { WS_CMD_SELECT, 0x01, 0x00, 1, 0, 0x34, 0x12 };
+    CHECK(ws_parse_command(select, sizeof(select), c) && c.id == 0x1234, "select id %u", c.id);
+
+    const uint8_t unknown[] = { 0x7F, 0x01, 0x00, 1, 0, 0 };
+    CHECK(!ws_parse_command(unknown, sizeof(unknown), c), "unknown kind taken");
+    CHECK(!ws_parse_command(unknown, 3, c), "truncated header taken");
+}
+
+int main() {
+    test_sample_frame_layout();
+    test_ack_frame();
+    test_parse_commands();
+
+    return check_report();
+}
@@ -0,0 +1,536 @@
+// Host tool: load generator for the bridge's web side. The route handlers and UART logic
+// (include/bridge_core.hpp, as the ESP32 runs them) serve HTTP on a socket stand-in for
+// ESPAsyncWebServer (tools/http_host.hpp); behind them the real MCU firmware (src/main.cpp,
+// built natively) runs in its own process per node, on a pty, as in tools/bus_rig.cpp.
+// pio run -e native_bridge_loadgen && .pio/build/native_bridge_loadgen/program [options]
+//
+//   --seconds S      per load step (default 10)
+//   --clients C      automation clients, closed loop on keep-alive connections (default 4)
+//   --dashboards D   dashboard tabs: /events open, GET /data every second, /history every 10 s (default 10)
+//   --post P         share of automation requests that are command POSTs (default 0.3)
+//   --nodes K        controllers on the bus, addresses 1..K (default 1)
+//   --baud B         wire speed (default 115200)
+//   --sweep          double --clients every step, up to 256
+//
+// Reports requests/s and latency percentiles (request written -> whole reply read), per step and
+// per endpoint; heap per connection, the server thread's heap with every client connected, less
+// what it held before, over the open connections (JSON documents are in "json peak" instead:
+// they live for one request); SSE events delivered per second, every dashboard's together, and
+// those missed; and dropped commands: POSTs answered {"ok":true} whose line never reached the
+// MCU, split into replaced in their slot before loop() took them ("overwr"), refused by a full
+// bus queue ("busfull") and lost on the wire ("lost").
+// The host's cores and loopback are much faster than the ESP32's: compare runs with each other,
+// and read the numbers as where the handlers' costs go, not as the board's capacity.
+
+#include <csignal>
+#include <map>
+#include <new>
+#include <random>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "pty_uart.hpp"
+
+static PtyUart mcuUart;
+
+// The firmware's COMM_UART is Serial1; point it at the pty
+#define Serial1 mcuUart
+#include "../src/main.cpp"
+#undef Serial1
+
+#include "http_host.hpp"
+
+//!##################################################
+//!######## Heap accounting #########################
+//! Every allocation carries its size and whether the
+//! server thread made it; heap_live is what that
+//! thread holds now.
+//!##################################################
+
+static std::atomic<long> heap_live { 0 };
+static thread_local bool counted = false;
+
+void *operator new(size_t n) {
+    size_t *p = static_cast<size_t *>(malloc(n + 2 * sizeof(size_t)));
+    if (!p) throw std::bad_alloc();
+    p[0] = n;
+    p[1] = counted;
+    if (counted) heap_live += n;
+    return p + 2;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (!ptr) return;
+    size_t *p = static_cast<size_t *>(ptr) - 2;
+    if (p[1]) heap_live -= p[0];
+    free(p);
+}
+
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+//!##################################################
+//!######## Node processes ##########################
+//! Lines each node took off the wire, by code, in
+//! memory shared with this process.
+//!##################################################
+
+static constexpr uint16_t CODE_BASE = 2000;
+static constexpr uint16_t CODES     = 32;
+
+struct Delivered {
+    std::atomic<uint32_t> by_code[CODES];
+};
+
+static Delivered *delivered = nullptr; // [NODE_MAX + 1], shared
+static uint8_t    node_addr = 0;
+
+static void count_line(const std::string &line, Clock::time_point) {
+    JsonDocument doc;
+    if (deserializeJson(doc, line) || (doc["N"] | 0) != node_addr) return;
+    uint16_t code = doc["M"] | 0;
+    if (code >= CODE_BASE && code < CODE_BASE + CODES) delivered[node_addr].by_code[code - CODE_BASE]++;
+}
+
+[[noreturn]] static void run_node(int fd, uint8_t addr) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    for (const Board::ZonePins &zp : Board::ZONES) {
+        for (uint8_t pin : zp.ec)   native_adc[pin] = 1240;
+        for (uint8_t pin : zp.ph)   native_adc[pin] = 807;
+        for (uint8_t pin : zp.temp) native_adc[pin] = 2210;
+    }
+
+    node_addr       = addr;
+    mcuUart.on_line = count_line;
+    mcuUart.open(fd, 350);
+    setup();
+    commBus.begin(addr);
+
+    auto t0 = Clock::now();
+    while (true) {
+        unsigned long now = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - t0).count();
+        unsigned long ticks = (now - native_millis) * (STEP_TIMER_HZ / 1000);
+        for (unsigned long i = 0; i < ticks && i < STEP_TIMER_HZ && step_timer_callback; ++i) step_timer_callback();
+        native_millis = now;
+
+        loop();
+        DEBUG_PORT.tx.clear();
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+//!##################################################
+//!######## Bridge ##################################
+//! loop() in a thread: the core's service(), and
+//! each node's lines into mcu_line(). Every line to
+//! the nodes reaches all of them and takes its time
+//! on the wire.
+//!##################################################
+
+struct NodeLink {
+    int         fd  = -1;
+    pid_t       pid = 0;
+    std::string rx;
+};
+
+static BridgeCore            bridge;
+static HttpHost              host;
+static std::vector<NodeLink> links; // by address, [0] unused
+static double                byte_s = 10.0 / 115200;
+static std::atomic<bool>     bridge_running { true };
+
+static void bridge_send(uint8_t, const char *line) {
+    std::string text = std::string(line) + '\n';
+    for (size_t a = 1; a < links.size(); ++a) {
+        ssize_t n = ::write(links[a].fd, text.data(), text.size());
+        (void)n;
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(text.size() * byte_s));
+}
+
+static void bridge_event(const char *event, const char *data) { host.event(event, data); }
+
+static void run_bridge() {
+    auto t0 = Clock::now();
+    char buf[512];
+    while (bridge_running) {
+        unsigned long now = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - t0).count();
+        native_millis = now;
+        bridge.service(now);
+
+        for (size_t a = 1; a < links.size(); ++a) {
+            NodeLink &l = links[a];
+            ssize_t   n;
+            while ((n = ::read(l.fd, buf, sizeof(buf))) > 0) {
+                for (ssize_t i = 0; i < n; ++i) {
+                    if (buf[i] != '\n') {
+                        if (l.rx.size() < COMM_BUF_SIZE) l.rx.push_back(buf[i]);
+                        continue;
+                    }
+                    bridge.mcu_line(l.rx.c_str(), now);
+                    l.rx.clear();
+                }
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+//!##################################################
+//!######## Clients #################################
+//!##################################################
+
+class HttpClient {
+    public:
+        ~HttpClient() { close(); }
+
+        bool connect(uint16_t port) {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr = {};
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port        = htons(port);
+            if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) return false;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return true;
+        }
+
+        void close() {
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+        }
+
+        // One request on the kept-alive connection; the status, or -1 when the connection failed
+        int request(const char *method, const std::string &target, const char *body = nullptr) {
+            char   head[256];
+            size_t blen = body ? strlen(body) : 0;
+            int    n    = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: bridge\r\nContent-Length: %zu\r\n\r\n",
+                                   method, target.c_str(), blen);
+            std::string req = std::string(head, n) + (body ? body : "");
+            if (::send(fd, req.data(), req.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(req.size())) return -1;
+
+            size_t end;
+            while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+                if (!fill()) return -1;
+            }
+            int    status = atoi(in.c_str() + 9);
+            size_t at     = in.find("Content-Length:");
+            size_t len    = at < end ? strtoul(in.c_str() + at + 15, nullptr, 10) : 0;
+            while (in.size() < end + 4 + len) {
+                if (!fill()) return -1;
+            }
+            in.erase(0, end + 4 + len);
+            return status;
+        }
+
+        // /events, once its headers are in: the events that have come in since, waiting up to `ms`
+        size_t drain_events(int ms) {
+            pollfd p = { fd, POLLIN, 0 };
+            if (poll(&p, 1, ms) <= 0) return 0;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            char    buf[4096];
+            ssize_t n;
+            while ((n = ::read(fd, buf, sizeof(buf))) > 0) in.append(buf, n);
+            size_t events = 0, at;
+            while ((at = in.find("\n\n")) != std::string::npos) {
+                if (in.compare(0, 6, "event:") == 0) events++;
+                in.erase(0, at + 2);
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return events;
+        }
+
+    private:
+        int         fd = -1;
+        std::string in;
+
+        bool fill() {
+            char    buf[8192];
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n <= 0) return false;
+            in.append(buf, n);
+            return true;
+        }
+};
+
+struct Samples {
+    std::map<std::string, std::vector<double>> us; // by endpoint
+    std::map<uint16_t, size_t> accepted;           // POSTs answered 200, by the code they become
+    size_t errors = 0;                             // non-200 or failed connections
+    size_t events = 0;                             // SSE received
+};
+
+static std::atomic<bool> clients_running { false };
+
+static double us_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - t).count();
+}
+
+static void timed(HttpClient &c, Samples &s, const char *key, const char *method, const std::string &target,
+                  const char *body = nullptr, uint16_t code = 0) {
+    Clock::time_point t0 = Clock::now();
+    int status = c.request(method, target, body);
+    s.us[key].push_back(us_since(t0));
+    if (status == 200 && code) s.accepted[code]++;
+    if (status != 200) s.errors++;
+}
+
+struct Command {
+    const char *path;
+    uint16_t    code;
+    const char *body;
+};
+
+static const Command COMMANDS[] = {
+    { "/loading-dose", MSG_LOAD_DOSE,    "{\"gro_ml\":0.05,\"micro_ml\":0.05,\"bloom_ml\":0,\"ph_up_ml\":0,\"ph_dn_ml\":0}" },
+    { "/set-state",    MSG_SYSTEM_STATE, "{\"run\":false}" },
+    { "/set-profile",  MSG_SET_PROFILE,  "{\"ec_min\":1.0,\"ec_max\":1.6,\"ec_avg\":1.3,\"ph_min\":5.8,\"ph_max\":6.4,\"ph_avg\":6.1}" },
+    { "/cancel-job",   MSG_CANCEL_JOB,   "{\"id\":0}" },
+};
+
+// Scripts and integrations: the next request as soon as the last is answered
+static void run_automation(unsigned seed, double post_share, unsigned nodes, Samples &s) {
+    HttpClient c;
+    if (!c.connect(host.port())) return;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double>   u(0.0, 1.0);
+    std::uniform_int_distribution<unsigned>  node(1, nodes);
+    std::uniform_int_distribution<size_t>    cmd(0, sizeof(COMMANDS) / sizeof(COMMANDS[0]) - 1);
+
+    while (clients_running) {
+        std::string q = "?node=" + std::to_string(node(rng));
+        double      r = u(rng);
+        if (r < post_share) {
+            const Command &k = COMMANDS[cmd(rng)];
+            timed(c, s, k.path, "POST", k.path + q, k.body, k.code);
+        } else if (r < post_share + (1.0 - post_share) * 0.7) {
+            timed(c, s, "/data", "GET", "/data" + q);
+        } else {
+            timed(c, s, "/nodes", "GET", "/nodes");
+        }
+    }
+}
+
+// A browser tab: the event stream, /data every second, a chart refresh every ten
+static void run_dashboard(unsigned nodes, unsigned tab, Samples &s) {
+    HttpClient events, c;
+    if (!events.connect(host.port()) || !c.connect(host.port())) return;
+    if (events.request("GET", "/events") != 200) s.errors++; // headers only; the stream stays open
+
+    std::string q = "?node=" + std::to_string(tab % nodes + 1);
+    Clock::time_point next_data = Clock::now(), next_chart = Clock::now();
+    while (clients_running) {
+        if (Clock::now() >= next_data) {
+            timed(c, s, "/data", "GET", "/data" + q);
+            next_data += std::chrono::seconds(1);
+        }
+        if (Clock::now() >= next_chart) {
+            timed(c, s, "/history", "GET", "/history" + q);
+            next_chart += std::chrono::seconds(10);
+        }
+        s.events += events.drain_events(20);
+    }
+}
+
+//!##################################################
+//!######## Steps ###################################
+//!##################################################
+
+struct StepConfig {
+    double   seconds    = 10.0;
+    unsigned clients    = 4;
+    unsigned dashboards = 10;
+    double   post_share = 0.3;
+    unsigned nodes      = 1;
+};
+
+struct StepResult {
+    Samples  all;
+    double   rps          = 0.0;
+    size_t   conns        = 0;
+    double   heap_per     = 0.0;
+    uint32_t json_peak    = 0;
+    size_t   sse_missed   = 0;
+    size_t   accepted     = 0;
+    size_t   overwritten  = 0;
+    size_t   bus_full     = 0;
+    size_t   lost         = 0;
+};
+
+static uint32_t delivered_total(uint16_t code) {
+    uint32_t n = 0;
+    for (size_t a = 1; a < links.size(); ++a) n += delivered[a].by_code[code - CODE_BASE];
+    return n;
+}
+
+static StepResult run_step(const StepConfig &cfg) {
+    StepResult r;
+    std::map<uint16_t, uint32_t> delivered0;
+    for (const Command &k : COMMANDS) delivered0[k.code] = delivered_total(k.code);
+    uint32_t overwritten0 = bridge.overwritten;
+    uint32_t bus_full0    = bridge.bus.dropped;
+    size_t   missed0      = host.sse_missed;
+    long     heap0        = heap_live;
+    bridge.webAlloc.peak  = bridge.webAlloc.live;
+
+    std::vector<Samples>     samples(cfg.clients + cfg.dashboards);
+    std::vector<std::thread> threads;
+    clients_running = true;
+    Clock::time_point t0 = Clock::now();
+    for (unsigned i = 0; i < cfg.dashboards; ++i) {
+        threads.emplace_back(run_dashboard, cfg.nodes, i, std::ref(samples[i]));
+    }
+    for (unsigned i = 0; i < cfg.clients; ++i) {
+        threads.emplace_back(run_automation, 100 + i, cfg.post_share, cfg.nodes, std::ref(samples[cfg.dashboards + i]));
+    }
+
+    // Everyone connected and going: what the server holds for them
+    std::this_thread::sleep_for(std::chrono::duration<double>(cfg.seconds / 2));
+    r.conns    = host.open;
+    r.heap_per = r.conns ? static_cast<double>(heap_live - heap0) / r.conns : 0.0;
+    std::this_thread::sleep_for(std::chrono::duration<double>(cfg.seconds / 2));
+
+    clients_running = false;
+    for (std::thread &t : threads) t.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    // Slots and the bus queue empty out, the last lines cross the wire
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    for (Samples &s : samples) {
+        for (auto &e : s.us) r.all.us[e.first].insert(r.all.us[e.first].end(), e.second.begin(), e.second.end());
+        for (auto &a : s.accepted) r.all.accepted[a.first] += a.second;
+        r.all.errors += s.errors;
+        r.all.events += s.events;
+    }
+    size_t total = 0;
+    for (auto &e : r.all.us) total += e.second.size();
+    r.rps = total / elapsed;
+
+    size_t delivered_now = 0;
+    for (const Command &k : COMMANDS) {
+        r.accepted    += r.all.accepted[k.code];
+        delivered_now += delivered_total(k.code) - delivered0[k.code];
+    }
+    r.json_peak   = bridge.webAlloc.peak;
+    r.sse_missed  = host.sse_missed - missed0;
+    r.overwritten = bridge.overwritten - overwritten0;
+    r.bus_full    = bridge.bus.dropped - bus_full0;
+    long lost     = static_cast<long>(r.accepted) - r.overwritten - r.bus_full - delivered_now;
+    r.lost        = lost > 0 ? lost : 0;
+    return r;
+}
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return NAN;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, static_cast<size_t>(p * v.size()))];
+}
+
+int main(int argc, char **argv) {
+    StepConfig cfg;
+    unsigned   baud  = 115200;
+    bool       sweep = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : "";
+        if      (!strcmp(a, "--seconds"))    { cfg.seconds    = atof(v); ++i; }
+        else if (!strcmp(a, "--clients"))    { cfg.clients    = atoi(v); ++i; }
+        else if (!strcmp(a, "--dashboards")) { cfg.dashboards = atoi(v); ++i; }
+        else if (!strcmp(a, "--post"))       { cfg.post_share = atof(v); ++i; }
+        else if (!strcmp(a, "--nodes"))      { cfg.nodes      = atoi(v); ++i; }
+        else if (!strcmp(a, "--baud"))       { baud           = atoi(v); ++i; }
+        else if (!strcmp(a, "--sweep"))      { sweep          = true; }
+        else {
+            fprintf(stderr, "unknown option %s\n", a);
+            return 2;
+        }
+    }
+    if (cfg.nodes < 1 || cfg.nodes > NODE_MAX) {
+        fprintf(stderr, "--nodes must be 1..%u\n", NODE_MAX);
+        return 2;
+    }
+    byte_s = 10.0 / baud;
+
+    delivered = static_cast<Delivered *>(mmap(nullptr, sizeof(Delivered) * (NODE_MAX + 1), PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    links.resize(cfg.nodes + 1);
+    std::vector<int> slaves(cfg.nodes + 1, -1);
+    for (unsigned a = 1; a <= cfg.nodes; ++a) {
+        if (!open_pty(links[a].fd, slaves[a])) {
+            perror("pty");
+            return 1;
+        }
+    }
+    for (unsigned a = 1; a <= cfg.nodes; ++a) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            for (unsigned b = 1; b <= cfg.nodes; ++b) {
+                ::close(links[b].fd);
+                if (b != a) ::close(slaves[b]);
+            }
+            run_node(slaves[a], static_cast<uint8_t>(a));
+        }
+        links[a].pid = pid;
+        ::close(slaves[a]);
+    }
+
+    bridge.begin();
+    bridge.bus.send = bridge_send;
+    bridge.sse      = bridge_event;
+    std::thread loop_thread(run_bridge);
+
+    host.thread_init = [] { counted = true; };
+    if (!host.start(bridge)) {
+        perror("listen");
+        return 1;
+    }
+
+    // Nodes through setup(), the bus's first sweep of every address done
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+    printf("bridge on 127.0.0.1:%u, %u node(s) at %u baud, %u dashboards, %.0f%% POSTs, %.0f s per step\n\n",
+           host.port(), cfg.nodes, baud, cfg.dashboards, cfg.post_share * 100.0, cfg.seconds);
+    printf("clients   req/s    p50    p99  p99.9     max  conns  heap/conn  json peak  sse/s  missed  "
+           "accepted  overwr  busfull  lost  errors\n");
+
+    StepResult last;
+    for (unsigned step = 0; step < (sweep ? 9 : 1); ++step) {
+        StepResult r = run_step(cfg);
+
+        std::vector<double> all;
+        for (auto &e : r.all.us) all.insert(all.end(), e.second.begin(), e.second.end());
+        printf("%7u %7.0f %6.2f %6.2f %6.2f %7.2f %6zu %10.0f %10u %6.1f %7zu %9zu %7zu %8zu %5zu %7zu\n",
+               cfg.clients, r.rps, percentile(all, 0.5) / 1000.0, percentile(all, 0.99) / 1000.0,
+               percentile(all, 0.999) / 1000.0, all.empty() ? NAN : *std::max_element(all.begin(), all.end()) / 1000.0,
+               r.conns, r.heap_per, r.json_peak, r.all.events / cfg.seconds, r.sse_missed, r.accepted,
+               r.overwritten, r.bus_full, r.lost, r.all.errors);
+        fflush(stdout);
+
+        last = r;
+        if (cfg.clients >= 256) break;
+        cfg.clients *= 2;
+    }
+
+    printf("\nendpoint            reqs      p50      p99    p99.9      max   (last step)\n");
+    for (auto &e : last.all.us) {
+        printf("%-16s %7zu %8.2f %8.2f %8.2f %8.2f\n", e.first.c_str(), e.second.size(),
+               percentile(e.second, 0.5) / 1000.0, percentile(e.second, 0.99) / 1000.0,
+               percentile(e.second, 0.999) / 1000.0, *std::max_element(e.second.begin(), e.second.end()) / 1000.0);
+    }
+    printf("(latencies in ms, heap in bytes)\n");
+
+    host.stop();
+    bridge_running = false;
+    loop_thread.join();
+    for (unsigned a = 1; a <= cfg.nodes; ++a) kill(links[a].pid, SIGTERM);
+    while (wait(nullptr) > 0) {}
+    return 0;
+}
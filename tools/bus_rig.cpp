@@ -0,0 +1,288 @@
+// Host tool: several controllers sharing one simulated multi-drop (RS-485) bus. Each node is the
+// real firmware (src/main.cpp, built natively) in its own process on its own pty, with its own bus
+// address. This process is the wire and the bridge: every line the bridge sends reaches every node,
+// every node's line reaches the bridge and the other nodes, and BusMaster (include/bus_master.hpp)
+// decides who talks when, as on the ESP32.
+// pio run -e native_bus_rig && .pio/build/native_bus_rig/program [options]
+//
+//   --nodes K      controllers on the bus, addresses 1..K (default 12)
+//   --seconds S    run time (default 30)
+//   --poll-ms N    per-node poll period (default 2000, the bridge's)
+//   --rate R       commands per second across all nodes, Poisson (default 2)
+//   --baud B       wire speed (default 115200)
+//   --kill A@S     unplug node A S seconds in, to watch it go offline
+//
+// Commands are M:2014 profile selects for ids the node hasn't cached, so each is answered with an
+// M:2015 in the node's next turn; command latency is queued on the bridge -> M:2015 heard.
+// "out of turn" counts lines heard while another node held the bus: collisions on real hardware.
+
+#include <csignal>
+#include <map>
+#include <random>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "pty_uart.hpp"
+
+static PtyUart mcuUart;
+
+// The firmware's COMM_UART is Serial1; point it at the pty
+#define Serial1 mcuUart
+#include "../src/main.cpp"
+#undef Serial1
+
+#include "bus_master.hpp"
+
+//!##################################################
+//!######## Node process ############################
+//!##################################################
+
+[[noreturn]] static void run_node(int fd, uint8_t addr) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    for (const Board::ZonePins &zp : Board::ZONES) {
+        for (uint8_t pin : zp.ec)   native_adc[pin] = 1240;
+        for (uint8_t pin : zp.ph)   native_adc[pin] = 807;
+        for (uint8_t pin : zp.temp) native_adc[pin] = 2210;
+    }
+
+    mcuUart.open(fd, 350);
+    setup();
+    commBus.begin(addr); // NODE_ADDR is per build; one binary plays every node here
+
+    auto t0 = Clock::now();
+    while (true) {
+        unsigned long now = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - t0).count();
+        unsigned long ticks = (now - native_millis) * (STEP_TIMER_HZ / 1000);
+        for (unsigned long i = 0; i < ticks && i < STEP_TIMER_HZ && step_timer_callback; ++i) step_timer_callback();
+        native_millis = now;
+
+        loop();
+        DEBUG_PORT.tx.clear();
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+//!##################################################
+//!######## Wire and bridge #########################
+//!##################################################
+
+struct NodeLink {
+    int         fd  = -1;
+    pid_t       pid = 0;
+    std::string rx;
+
+    std::vector<unsigned long> poll_at;  // when each poll went out
+    std::vector<double>        cmd_ms;   // command latencies
+};
+
+static std::vector<NodeLink> links; // by address, [0] unused
+static BusMaster             bridge;
+static unsigned long         rig_ms = 0;
+
+static double   byte_s     = 10.0 / 115200;
+static double   wire_s     = 0.0;  // time the line was busy, both directions
+static size_t   out_of_turn = 0;
+static size_t   garbled     = 0;
+static size_t   lines_heard = 0;
+
+static std::map<uint16_t, std::pair<uint8_t, unsigned long>> pending_cmds; // profile id -> node, queued at
+
+static unsigned long rig_millis(Clock::time_point t0) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - t0).count();
+}
+
+static void put_on_wire(const std::string &text, int except_fd = -1) {
+    for (size_t a = 1; a < links.size(); ++a) {
+        if (links[a].fd < 0 || links[a].fd == except_fd) continue;
+        ssize_t n = ::write(links[a].fd, text.data(), text.size());
+        (void)n;
+    }
+    wire_s += text.size() * byte_s;
+}
+
+// BusMaster's transmitter: the line takes its time on the wire before the next can start
+static void bridge_send(uint8_t node, const char *line) {
+    std::string text = std::string(line) + '\n';
+    put_on_wire(text);
+    std::this_thread::sleep_for(std::chrono::duration<double>(text.size() * byte_s));
+
+    if (strstr(line, "\"M\":1001") && node < links.size()) links[node].poll_at.push_back(rig_ms);
+}
+
+static void heard(uint8_t from, const std::string &line) {
+    lines_heard++;
+    JsonDocument doc;
+    if (deserializeJson(doc, line) || (doc["N"] | 0) != from) {
+        garbled++;
+        return;
+    }
+    uint16_t code = doc["M"] | 0;
+    if (bridge.turn() != from) out_of_turn++;
+    bridge.received(from, code, rig_ms);
+
+    if (code == MSG_PROFILE_STATUS) {
+        auto it = pending_cmds.find(doc["id"] | 0);
+        if (it != pending_cmds.end() && it->second.first == from) {
+            links[from].cmd_ms.push_back(rig_ms - it->second.second);
+            pending_cmds.erase(it);
+        }
+    }
+}
+
+// Everything the nodes sent since the last pass; it also reaches the other nodes, as on a real bus
+static void listen() {
+    char buf[512];
+    for (size_t a = 1; a < links.size(); ++a) {
+        NodeLink &l = links[a];
+        if (l.fd < 0) continue;
+        ssize_t n;
+        while ((n = ::read(l.fd, buf, sizeof(buf))) > 0) {
+            put_on_wire(std::string(buf, n), l.fd);
+            for (ssize_t i = 0; i < n; ++i) {
+                if (buf[i] != '\n') {
+                    l.rx.push_back(buf[i]);
+                    continue;
+                }
+                heard(static_cast<uint8_t>(a), l.rx);
+                l.rx.clear();
+            }
+        }
+    }
+}
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return NAN;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, static_cast<size_t>(p * v.size()))];
+}
+
+int main(int argc, char **argv) {
+    unsigned nodes    = 12;
+    double   seconds  = 30.0;
+    unsigned poll_ms  = 2000;
+    double   rate     = 2.0;
+    unsigned baud     = 115200;
+    unsigned kill_node = 0;
+    double   kill_at   = 0.0;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : "";
+        if      (!strcmp(a, "--nodes"))   { nodes   = atoi(v); ++i; }
+        else if (!strcmp(a, "--seconds")) { seconds = atof(v); ++i; }
+        else if (!strcmp(a, "--poll-ms")) { poll_ms = atoi(v); ++i; }
+        else if (!strcmp(a, "--rate"))    { rate    = atof(v); ++i; }
+        else if (!strcmp(a, "--baud"))    { baud    = atoi(v); ++i; }
+        else if (!strcmp(a, "--kill"))    { sscanf(v, "%u@%lf", &kill_node, &kill_at); ++i; }
+        else {
+            fprintf(stderr, "unknown option %s\n", a);
+            return 2;
+        }
+    }
+    if (nodes < 1 || nodes > NODE_MAX) {
+        fprintf(stderr, "--nodes must be 1..%u\n", NODE_MAX);
+        return 2;
+    }
+    byte_s = 10.0 / baud;
+
+    links.resize(nodes + 1);
+    std::vector<int> slaves(nodes + 1, -1);
+    for (unsigned a = 1; a <= nodes; ++a) {
+        if (!open_pty(links[a].fd, slaves[a])) {
+            perror("pty");
+            return 1;
+        }
+    }
+
+    for (unsigned a = 1; a <= nodes; ++a) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            for (unsigned b = 1; b <= nodes; ++b) {
+                ::close(links[b].fd);
+                if (b != a) ::close(slaves[b]);
+            }
+            run_node(slaves[a], static_cast<uint8_t>(a));
+        }
+        links[a].pid = pid;
+        ::close(slaves[a]);
+    }
+
+    // Let every node finish setup()
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    printf("%u nodes on a %u baud bus, poll every %u ms, %.1f commands/s, %.0f s\n\n",
+           nodes, baud, poll_ms, rate, seconds);
+
+    bridge.poll_ms = poll_ms;
+    bridge.send    = bridge_send;
+
+    std::mt19937 rng(1);
+    std::exponential_distribution<double>  gap(rate > 0.0 ? rate : 1.0);
+    std::uniform_int_distribution<unsigned> pick(1, nodes);
+    uint16_t next_id = 1;
+
+    Clock::time_point t0 = Clock::now();
+    double next_cmd = rate > 0.0 ? gap(rng) : seconds;
+    bool   killed   = false;
+    size_t dropped  = 0;
+
+    while ((rig_ms = rig_millis(t0)) < seconds * 1000.0) {
+        listen();
+
+        if (rig_ms >= next_cmd * 1000.0) {
+            unsigned a = pick(rng);
+            char line[64];
+            snprintf(line, sizeof(line), "{\"M\":%u,\"N\":%u,\"id\":%u,\"crc\":1}", MSG_PROFILE_SELECT, a, next_id);
+            if (bridge.queue(a, line)) pending_cmds[next_id] = { static_cast<uint8_t>(a), rig_ms };
+            else dropped++;
+            next_id = next_id % 60000 + 1;
+            next_cmd += gap(rng);
+        }
+
+        if (kill_node && !killed && kill_node <= nodes && rig_ms >= kill_at * 1000.0) {
+            kill(links[kill_node].pid, SIGKILL);
+            ::close(links[kill_node].fd);
+            links[kill_node].fd = -1;
+            killed = true;
+        }
+
+        bridge.service(rig_ms);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    printf("node  online  polls  replies  timeouts  period p50  period max  cmds  cmd p50  cmd p99\n");
+    uint32_t min_replies = UINT32_MAX, max_replies = 0;
+    for (unsigned a = 1; a <= nodes; ++a) {
+        const BusNode &n = bridge.node(a);
+        NodeLink      &l = links[a];
+
+        std::vector<double> period;
+        for (size_t i = 1; i < l.poll_at.size(); ++i) period.push_back(l.poll_at[i] - l.poll_at[i - 1]);
+
+        printf("%4u  %6s  %5u  %7u  %8u  %10.0f  %10.0f  %4zu  %7.0f  %7.0f\n",
+               a, n.online ? "yes" : "no", n.polls, n.replies, n.timeouts,
+               percentile(period, 0.5), period.empty() ? NAN : *std::max_element(period.begin(), period.end()),
+               l.cmd_ms.size(), percentile(l.cmd_ms, 0.5), percentile(l.cmd_ms, 0.99));
+
+        if (a != kill_node) {
+            min_replies = std::min(min_replies, n.replies);
+            max_replies = std::max(max_replies, n.replies);
+        }
+    }
+
+    printf("\nwire %.1f%%  lines %zu  out of turn %zu  garbled %zu  unanswered cmds %zu  queue full %zu  "
+           "replies min/max %u/%u\n",
+           wire_s / seconds * 100.0, lines_heard, out_of_turn, garbled, pending_cmds.size(), dropped,
+           min_replies, max_replies);
+    printf("(times in ms)\n");
+
+    for (unsigned a = 1; a <= nodes; ++a) {
+        if (links[a].fd >= 0) kill(links[a].pid, SIGTERM);
+    }
+    while (wait(nullptr) > 0) {}
+    return 0;
+}
@@ -0,0 +1,360 @@
+// Host tools: a stand-in for the ESP32's web server, serving the bridge's routes (BRIDGE_ROUTES
+// in include/bridge_core.hpp) over plain sockets, with /events as server-sent events.
+#pragma once
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "bridge_core.hpp"
+
+//!##################################################
+//!######## HTTP host ###############################
+//! One thread does all the socket work and runs the
+//! handlers, as the async_tcp task does on the
+//! ESP32; the bridge's loop() is another thread.
+//! HTTP/1.1 with keep-alive, one request at a time
+//! per connection, bodies cut at the route's limit
+//! as collect_body() does.
+//!
+//! Events from loop() are queued and handed to the
+//! /events clients by the server thread. A client
+//! that has fallen HTTP_SSE_BACKLOG bytes behind
+//! misses events, like AsyncEventSource's full
+//! queue.
+//!##################################################
+
+static constexpr size_t HTTP_REQUEST_MAX = 8192; // headers and body; more and the client is dropped
+static constexpr size_t HTTP_SSE_BACKLOG = 32 * 1024;
+
+// Query parameters, decoded, and the request body
+class HostRequest : public BridgeRequest {
+    public:
+        std::vector<std::pair<std::string, std::string>> params;
+
+        bool has(const char *name) const override { return find(name) != nullptr; }
+
+        const char *param(const char *name) const override {
+            const std::string *v = find(name);
+            return v ? v->c_str() : "";
+        }
+
+    private:
+        const std::string *find(const char *name) const {
+            for (const auto &p : params) {
+                if (p.first == name) return &p.second;
+            }
+            return nullptr;
+        }
+};
+
+class StringPrint : public Print {
+    public:
+        std::string s;
+
+        size_t write(uint8_t c) override {
+            s.push_back(static_cast<char>(c));
+            return 1;
+        }
+        size_t write(const uint8_t *buf, size_t n) override {
+            s.append(reinterpret_cast<const char *>(buf), n);
+            return n;
+        }
+};
+
+class HttpHost {
+    public:
+        std::atomic<size_t> requests { 0 };
+        std::atomic<size_t> open { 0 };        // connections, /events included
+        std::atomic<size_t> sse_clients { 0 };
+        std::atomic<size_t> sse_sent { 0 };    // events, per client
+        std::atomic<size_t> sse_missed { 0 };
+
+        // Run first thing on the server thread, for a tool's per-thread accounting
+        void (*thread_init)() = nullptr;
+
+        // Port 0 picks a free one; port() has it after
+        bool start(BridgeCore &bridge, uint16_t port = 0);
+        void stop();
+        uint16_t port() const { return bound_port; }
+
+        // From loop(): goes to every /events client
+        void event(const char *name, const char *data);
+
+    private:
+        struct Conn {
+            int         fd;
+            std::string in;
+            std::string out;
+            bool        sse;
+            bool        close_after; // Connection: close
+        };
+
+        BridgeCore       *core       = nullptr;
+        int               listen_fd  = -1;
+        int               wake[2]    = { -1, -1 };
+        uint16_t          bound_port = 0;
+        std::thread       server;
+        std::atomic<bool> running { false };
+        std::vector<Conn> conns;
+
+        std::mutex  event_lock;
+        std::string pending_events; // formatted, for every client
+
+        void serve();
+        void accept_all();
+        bool handle(Conn &c);   // false until a whole request is in
+        void respond(Conn &c, int status, const std::string &body);
+        void send_events();
+};
+
+static std::string url_decode(const std::string &s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '+') {
+            out.push_back(' ');
+        } else if (s[i] == '%' && i + 2 < s.size()) {
+            out.push_back(static_cast<char>(strtol(s.substr(i + 1, 2).c_str(), nullptr, 16)));
+            i += 2;
+        } else {
+            out.push_back(s[i]);
+        }
+    }
+    return out;
+}
+
+static const char *status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        default:  return "Error";
+    }
+}
+
+bool HttpHost::start(BridgeCore &bridge, uint16_t port) {
+    core      = &bridge;
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one   = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr = {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(port);
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 256) != 0 ||
+        pipe(wake) != 0) {
+        return false;
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+    bound_port = ntohs(addr.sin_port);
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    fcntl(wake[0], F_SETFL, fcntl(wake[0], F_GETFL) | O_NONBLOCK);
+
+    running = true;
+    server  = std::thread([this] { serve(); });
+    return true;
+}
+
+void HttpHost::stop() {
+    running = false;
+    char b  = 0;
+    ssize_t n = ::write(wake[1], &b, 1);
+    (void)n;
+    if (server.joinable()) server.join();
+    for (Conn &c : conns) ::close(c.fd);
+    conns.clear();
+    ::close(listen_fd);
+    ::close(wake[0]);
+    ::close(wake[1]);
+}
+
+void HttpHost::event(const char *name, const char *data) {
+    {
+        std::lock_guard<std::mutex> lock(event_lock);
+        if (sse_clients == 0) return;
+        pending_events += "event: ";
+        pending_events += name;
+        pending_events += "\ndata: ";
+        pending_events += data;
+        pending_events += "\n\n";
+    }
+    char b = 0;
+    ssize_t n = ::write(wake[1], &b, 1);
+    (void)n;
+}
+
+void HttpHost::serve() {
+    if (thread_init) thread_init();
+    std::vector<pollfd> fds;
+    while (running) {
+        fds.clear();
+        fds.push_back({ listen_fd, POLLIN, 0 });
+        fds.push_back({ wake[0], POLLIN, 0 });
+        for (const Conn &c : conns) {
+            fds.push_back({ c.fd, static_cast<short>(POLLIN | (c.out.empty() ? 0 : POLLOUT)), 0 });
+        }
+        if (poll(fds.data(), fds.size(), 100) < 0) continue;
+
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (::read(wake[0], buf, sizeof(buf)) > 0) {}
+            send_events();
+        }
+        if (fds[0].revents & POLLIN) accept_all();
+
+        // Connections accepted this pass weren't polled yet
+        size_t polled = fds.size() - 2;
+        for (size_t i = 0; i < polled && i < conns.size(); ++i) {
+            Conn &c    = conns[i];
+            short ev   = fds[i + 2].revents;
+            bool  keep = !(ev & (POLLERR | POLLNVAL));
+
+            if (keep && (ev & (POLLIN | POLLHUP))) {
+                char    buf[4096];
+                ssize_t n = ::read(c.fd, buf, sizeof(buf));
+                if (n <= 0) keep = false;
+                else if (!c.sse) {
+                    c.in.append(buf, n);
+                    while (keep && !c.sse && handle(c)) {}
+                    keep = c.sse || c.in.size() <= HTTP_REQUEST_MAX;
+                }
+            }
+            if (keep && !c.out.empty()) {
+                ssize_t n = ::write(c.fd, c.out.data(), c.out.size());
+                if (n > 0) c.out.erase(0, n);
+                else if (n < 0 && errno != EAGAIN) keep = false;
+            }
+            if (keep && c.close_after && c.out.empty()) keep = false;
+
+            if (!keep) {
+                ::close(c.fd);
+                if (c.sse) sse_clients--;
+                open--;
+                c.fd = -1;
+            }
+        }
+        conns.erase(std::remove_if(conns.begin(), conns.end(), [](const Conn &c) { return c.fd < 0; }), conns.end());
+    }
+}
+
+void HttpHost::accept_all() {
+    int fd;
+    while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        conns.push_back({ fd, {}, {}, false, false });
+        open++;
+    }
+}
+
+// One request, if a whole one is in; false when there isn't
+bool HttpHost::handle(Conn &c) {
+    size_t end = c.in.find("\r\n\r\n");
+    if (end == std::string::npos) return false;
+
+    std::string head = c.in.substr(0, end);
+    size_t      body_len = 0;
+    size_t      at = head.find("Content-Length:");
+    if (at == std::string::npos) at = head.find("content-length:");
+    if (at != std::string::npos) body_len = strtoul(head.c_str() + at + 15, nullptr, 10);
+    if (c.in.size() < end + 4 + body_len) return false;
+
+    std::string body = c.in.substr(end + 4, body_len);
+    c.in.erase(0, end + 4 + body_len);
+    c.close_after = head.find("Connection: close") != std::string::npos;
+    requests++;
+
+    // "GET /path?query HTTP/1.1"
+    size_t      sp1    = head.find(' ');
+    size_t      sp2    = head.find(' ', sp1 + 1);
+    std::string method = head.substr(0, sp1);
+    std::string target = head.substr(sp1 + 1, sp2 - sp1 - 1);
+    size_t      q      = target.find('?');
+    std::string path   = target.substr(0, q);
+
+    if (path == "/events") {
+        c.sse = true;
+        sse_clients++;
+        c.out += "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n\r\n";
+        return false;
+    }
+
+    HostRequest rq;
+    if (q != std::string::npos) {
+        std::string query = target.substr(q + 1);
+        size_t      from  = 0;
+        while (from <= query.size()) {
+            size_t      amp  = query.find('&', from);
+            std::string pair = query.substr(from, amp == std::string::npos ? std::string::npos : amp - from);
+            size_t      eq   = pair.find('=');
+            if (!pair.empty()) {
+                rq.params.push_back({ url_decode(pair.substr(0, eq)),
+                                      eq == std::string::npos ? "" : url_decode(pair.substr(eq + 1)) });
+            }
+            if (amp == std::string::npos) break;
+            from = amp + 1;
+        }
+    }
+
+    bool post = method == "POST";
+    for (const BridgeRoute &r : BRIDGE_ROUTES) {
+        if (r.post != post || (path != r.path && path.compare(0, strlen(r.path) + 1, std::string(r.path) + "/") != 0)) {
+            continue;
+        }
+        if (body.size() > r.body_max) body.resize(r.body_max);
+        rq.body = body.c_str();
+        rq.len  = body.size();
+
+        StringPrint out;
+        int status = (core->*r.handler)(rq, out);
+        respond(c, status, out.s);
+        return true;
+    }
+    respond(c, 404, "");
+    return true;
+}
+
+void HttpHost::respond(Conn &c, int status, const std::string &body) {
+    char head[192];
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\n"
+             "Content-Length: %zu\r\n\r\n",
+             status, status_text(status), body.size());
+    c.out += head;
+    c.out += body;
+}
+
+void HttpHost::send_events() {
+    std::string batch;
+    {
+        std::lock_guard<std::mutex> lock(event_lock);
+        batch.swap(pending_events);
+    }
+    if (batch.empty()) return;
+
+    size_t n = 0;
+    for (size_t at = 0; (at = batch.find("\n\n", at)) != std::string::npos; at += 2) n++;
+    for (Conn &c : conns) {
+        if (!c.sse) continue;
+        if (c.out.size() > HTTP_SSE_BACKLOG) {
+            sse_missed += n;
+            continue;
+        }
+        c.out += batch;
+        sse_sent += n;
+    }
+}
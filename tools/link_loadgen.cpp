@@ -0,0 +1,347 @@
+// Host tool: load generator for the ESP32 <-> MCU link. The real firmware (src/main.cpp,
+// built natively) talks over one end of a pseudo-terminal pair; this tool plays the
+// ESP32 on the other end: M:1001 polls on a fixed period plus M:2001/2002/2003 commands
+// at a configurable rate and mix, paced at the UART baud rate.
+// pio run -e native_link_loadgen && .pio/build/native_link_loadgen/program [options]
+//
+//   --seconds S     per load step (default 10)
+//   --poll-ms N     M:1001 period (default 2000, the bridge's)
+//   --rate R        commands per second, Poisson (default 5)
+//   --burst N       commands sent back to back per arrival (default 1)
+//   --mix A:B:C     relative weights of M:2001, 2002, 2003 (default 1:1:1)
+//   --baud B        wire speed (default 115200)
+//   --rx-buf N      MCU UART receive ring, bytes (default 350, the SAMD51 core's)
+//   --loop-us N     extra time per loop() pass, standing in for the MCU's slower core
+//   --sweep         double --rate every step until the link saturates
+//
+// Reports M:1001 -> M:1002 round trip and command delivery latency (from when the
+// ESP32 meant to send the line to when loop() has the whole line), lines lost,
+// garbled lines, UART overruns and CommReader overflows.
+// wire% is the offered load on the ESP32 -> MCU line; past 100 the ESP32's UART backs up.
+// MCU -> ESP32 replies are not paced, they only add the firmware's own time.
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "pty_uart.hpp"
+
+static PtyUart mcuUart;
+
+// The firmware's COMM_UART is Serial1; point it at the pty
+#define Serial1 mcuUart
+#include "../src/main.cpp"
+#undef Serial1
+
+//!##################################################
+//!######## Bookkeeping shared by the threads #######
+//!##################################################
+
+struct SentLine {
+    uint16_t          code;
+    Clock::time_point due;       // when the ESP32 wanted to send it
+    bool              delivered;
+};
+
+static std::mutex             book;
+static std::vector<SentLine>  sent;          // indexed by seq
+static std::deque<uint32_t>   polls_pending; // delivered M:1001 seqs awaiting their M:1002
+static std::vector<double>    rtt_us;
+static std::map<uint16_t, std::vector<double>> deliver_us;
+static size_t                 garbled_in  = 0; // lines loop() read that we never sent
+static size_t                 garbled_out = 0; // MCU lines that aren't a message
+
+static double us_between(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration<double, std::micro>(b - a).count();
+}
+
+// Firmware thread: loop() has just read a whole line
+static void on_mcu_line(const std::string &line, Clock::time_point at) {
+    JsonDocument doc;
+    bool ok  = parse_message(line.c_str(), doc);
+    long seq = ok ? doc["seq"] | -1L : -1L;
+
+    // Overrun bytes splice two lines together: that is garbage even if it parses
+    std::lock_guard<std::mutex> lock(book);
+    if (seq < 0 || static_cast<size_t>(seq) >= sent.size() || sent[seq].delivered ||
+        (doc["M"] | 0) != sent[seq].code) {
+        garbled_in++;
+        return;
+    }
+    SentLine &l = sent[seq];
+    l.delivered = true;
+    deliver_us[l.code].push_back(us_between(l.due, at));
+    if (l.code == MSG_SENSOR_REQUEST) polls_pending.push_back(seq);
+}
+
+//!##################################################
+//!######## Firmware thread #########################
+//!##################################################
+
+static std::atomic<bool> firmware_running { true };
+
+static void run_firmware(uint32_t loop_us) {
+    // Probes in a healthy, in-band reservoir so loop() does its full sensor pass
+    for (const Board::ZonePins &zp : Board::ZONES) {
+        for (uint8_t pin : zp.ec)   native_adc[pin] = 1240;
+        for (uint8_t pin : zp.ph)   native_adc[pin] = 807;
+        for (uint8_t pin : zp.temp) native_adc[pin] = 2210;
+    }
+
+    setup();
+    auto t0 = Clock::now();
+
+    while (firmware_running) {
+        unsigned long now = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - t0).count();
+
+        // Step timer: 20 kHz worth of ticks since the last pass, bounded
+        unsigned long ticks = (now - native_millis) * (STEP_TIMER_HZ / 1000);
+        for (unsigned long i = 0; i < ticks && i < STEP_TIMER_HZ && step_timer_callback; ++i) step_timer_callback();
+        native_millis = now;
+
+        loop();
+        DEBUG_PORT.tx.clear();
+
+        if (loop_us) {
+            auto until = Clock::now() + std::chrono::microseconds(loop_us);
+            while (Clock::now() < until);
+        }
+    }
+}
+
+//!##################################################
+//!######## ESP32 side ##############################
+//!##################################################
+
+struct LoadConfig {
+    double   seconds = 10.0;
+    unsigned poll_ms = 2000;
+    double   rate    = 5.0;
+    unsigned burst   = 1;
+    double   mix[3]  = { 1.0, 1.0, 1.0 };
+    unsigned baud    = 115200;
+};
+
+static std::string command_line(uint16_t code, uint32_t seq, std::mt19937 &rng) {
+    char buf[192];
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    switch (code) {
+        case MSG_LOAD_DOSE:
+            snprintf(buf, sizeof(buf), "{\"M\":2001,\"gro\":%.2f,\"micro\":%.2f,\"bloom\":%.2f,\"ph_up\":0,\"ph_dn\":0,\"seq\":%u}",
+                     0.05f * u(rng), 0.05f * u(rng), 0.05f * u(rng), seq);
+            break;
+        case MSG_SYSTEM_STATE:
+            snprintf(buf, sizeof(buf), "{\"M\":2002,\"run\":%s,\"seq\":%u}", u(rng) < 0.8f ? "true" : "false", seq);
+            break;
+        case MSG_SET_PROFILE:
+            snprintf(buf, sizeof(buf), "{\"M\":2003,\"ec_min\":0.8,\"ec_max\":1.8,\"ec_avg\":1.3,"
+                     "\"ph_min\":%.2f,\"ph_max\":6.8,\"ph_avg\":6.4,\"seq\":%u}", 5.9f + 0.2f * u(rng), seq);
+            break;
+        default:
+            snprintf(buf, sizeof(buf), "{\"M\":1001,\"seq\":%u}", seq);
+            break;
+    }
+    return std::string(buf) + '\n';
+}
+
+// Reads the MCU's replies and pairs every M:1002 with the oldest delivered M:1001
+static void esp_receive(int fd, std::atomic<bool> &running) {
+    std::string line;
+    char buf[512];
+    while (running) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        auto at = Clock::now();
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buf[i] != '\n') {
+                line.push_back(buf[i]);
+                continue;
+            }
+            const char *m = strstr(line.c_str(), "\"M\":");
+            uint16_t code = m ? static_cast<uint16_t>(atoi(m + 4)) : 0;
+
+            std::lock_guard<std::mutex> lock(book);
+            if (code == 0) garbled_out++;
+            if (code == MSG_SENSOR_RESPONSE && !polls_pending.empty()) {
+                rtt_us.push_back(us_between(sent[polls_pending.front()].due, at));
+                polls_pending.pop_front();
+            }
+            line.clear();
+        }
+    }
+}
+
+struct StepResult {
+    double rate;
+    size_t sent, lost, garbled_in, garbled_out, overruns, overflows;
+    double rtt_p50, rtt_p99, del_p50, del_p99, wire_load;
+};
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return NAN;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, static_cast<size_t>(p * v.size()))];
+}
+
+static StepResult run_step(int fd, const LoadConfig &cfg, std::mt19937 &rng) {
+    {
+        std::lock_guard<std::mutex> lock(book);
+        sent.clear();
+        polls_pending.clear();
+        rtt_us.clear();
+        deliver_us.clear();
+        garbled_in = garbled_out = 0;
+    }
+    size_t overruns0  = mcuUart.overruns;
+    size_t overflows0 = commReader.overflows;
+
+    std::exponential_distribution<double> gap(cfg.rate > 0.0 ? cfg.rate : 1.0);
+    std::discrete_distribution<int>       pick({ cfg.mix[0], cfg.mix[1], cfg.mix[2] });
+    static const uint16_t CODES[3] = { MSG_LOAD_DOSE, MSG_SYSTEM_STATE, MSG_SET_PROFILE };
+
+    const double byte_s = 10.0 / cfg.baud; // start + 8 data + stop
+    Clock::time_point t0        = Clock::now();
+    Clock::time_point end       = t0 + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(cfg.seconds));
+    Clock::time_point next_poll = t0;
+    Clock::time_point next_cmd  = t0 + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap(rng)));
+    Clock::time_point wire_free = t0;
+    double wire_busy = 0.0;
+
+    while (true) {
+        bool poll = next_poll <= next_cmd;
+        Clock::time_point due = poll ? next_poll : next_cmd;
+        if (due >= end) break;
+
+        std::vector<uint16_t> codes;
+        if (poll) {
+            codes.push_back(MSG_SENSOR_REQUEST);
+            next_poll += std::chrono::milliseconds(cfg.poll_ms);
+        } else {
+            for (unsigned b = 0; b < cfg.burst; ++b) codes.push_back(CODES[pick(rng)]);
+            next_cmd += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap(rng)));
+            if (cfg.rate <= 0.0) next_cmd = end;
+        }
+
+        for (uint16_t code : codes) {
+            std::string text;
+            {
+                std::lock_guard<std::mutex> lock(book);
+                text = command_line(code, sent.size(), rng);
+                sent.push_back({ code, due, false });
+            }
+
+            // The UART can't start this line before the previous one has left
+            Clock::time_point start = std::max(due, wire_free);
+            std::this_thread::sleep_until(start);
+            ssize_t n = ::write(fd, text.data(), text.size());
+            (void)n;
+
+            double on_wire = text.size() * byte_s;
+            wire_free  = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(on_wire));
+            wire_busy += on_wire;
+        }
+    }
+
+    // Let the tail drain before counting losses
+    std::this_thread::sleep_until(std::max(end, wire_free) + std::chrono::milliseconds(500));
+
+    StepResult r = {};
+    std::lock_guard<std::mutex> lock(book);
+    std::vector<double> all_deliver;
+    for (auto &d : deliver_us) all_deliver.insert(all_deliver.end(), d.second.begin(), d.second.end());
+    for (const SentLine &l : sent) if (!l.delivered) r.lost++;
+
+    r.rate        = cfg.rate;
+    r.sent        = sent.size();
+    r.garbled_in  = garbled_in;
+    r.garbled_out = garbled_out;
+    r.overruns    = mcuUart.overruns - overruns0;
+    r.overflows   = static_cast<uint16_t>(commReader.overflows - overflows0);
+    r.rtt_p50     = percentile(rtt_us, 0.50) / 1000.0;
+    r.rtt_p99     = percentile(rtt_us, 0.99) / 1000.0;
+    r.del_p50     = percentile(all_deliver, 0.50) / 1000.0;
+    r.del_p99     = percentile(all_deliver, 0.99) / 1000.0;
+    r.wire_load   = wire_busy / cfg.seconds * 100.0;
+    return r;
+}
+
+int main(int argc, char **argv) {
+    LoadConfig cfg;
+    size_t     rx_buf  = 350;
+    uint32_t   loop_us = 0;
+    bool       sweep   = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : "";
+        if      (!strcmp(a, "--seconds")) { cfg.seconds = atof(v); ++i; }
+        else if (!strcmp(a, "--poll-ms")) { cfg.poll_ms = atoi(v); ++i; }
+        else if (!strcmp(a, "--rate"))    { cfg.rate    = atof(v); ++i; }
+        else if (!strcmp(a, "--burst"))   { cfg.burst   = std::max(1, atoi(v)); ++i; }
+        else if (!strcmp(a, "--mix"))     { sscanf(v, "%lf:%lf:%lf", &cfg.mix[0], &cfg.mix[1], &cfg.mix[2]); ++i; }
+        else if (!strcmp(a, "--baud"))    { cfg.baud    = atoi(v); ++i; }
+        else if (!strcmp(a, "--rx-buf"))  { rx_buf     = atoi(v); ++i; }
+        else if (!strcmp(a, "--loop-us")) { loop_us    = atoi(v); ++i; }
+        else if (!strcmp(a, "--sweep"))   { sweep      = true; }
+        else {
+            fprintf(stderr, "unknown option %s\n", a);
+            return 2;
+        }
+    }
+
+    int esp_fd, mcu_fd;
+    if (!open_pty(esp_fd, mcu_fd)) {
+        perror("pty");
+        return 1;
+    }
+
+    mcuUart.on_line = on_mcu_line;
+    mcuUart.open(mcu_fd, rx_buf);
+
+    std::thread firmware(run_firmware, loop_us);
+    std::atomic<bool> esp_running { true };
+    std::thread esp_rx(esp_receive, esp_fd, std::ref(esp_running));
+
+    // Let setup() run and the first poll settle
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    printf("pty link at %u baud, MCU rx ring %zu B, +%u us per loop(), poll every %u ms, burst %u, mix %g:%g:%g\n\n",
+           cfg.baud, rx_buf, loop_us, cfg.poll_ms, cfg.burst, cfg.mix[0], cfg.mix[1], cfg.mix[2]);
+    printf("  cmd/s   sent   wire%%  rtt p50   rtt p99  deliv p50  deliv p99   lost  garbled  overrun  overflow\n");
+
+    std::mt19937 rng(1);
+    for (int step = 0; step < (sweep ? 16 : 1); ++step) {
+        StepResult r = run_step(esp_fd, cfg, rng);
+        printf("%7.1f %6zu %6.1f %8.2f  %8.2f  %9.2f  %9.2f %6zu  %3zu/%-3zu  %7zu  %8zu\n",
+               r.rate, r.sent, r.wire_load, r.rtt_p50, r.rtt_p99, r.del_p50, r.del_p99,
+               r.lost, r.garbled_in, r.garbled_out, r.overruns, r.overflows);
+        fflush(stdout);
+
+        // Saturated: the wire is full or the MCU is losing lines
+        if (sweep && (r.wire_load > 95.0 || r.lost > 0 || r.overruns > 0)) {
+            printf("\nsaturated at ~%.0f commands/s\n", r.rate);
+            break;
+        }
+        cfg.rate *= 2.0;
+    }
+    printf("(latencies in ms; garbled is MCU-read/ESP32-read)\n");
+
+    firmware_running = false;
+    esp_running      = false;
+    firmware.join();
+    esp_rx.join();
+    mcuUart.close();
+    return 0;
+}
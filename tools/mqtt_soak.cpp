@@ -0,0 +1,315 @@
+// Host tool: runs the bridge's MQTT publisher (include/mqtt_link.hpp) against a real broker,
+// e.g. a local mosquitto, with a subscriber on a second connection counting what arrives.
+// Restart the broker while it runs to watch the spool fill and drain.
+// pio run -e native_mqtt_soak && .pio/build/native_mqtt_soak/program [options]
+//
+//   --host H        broker (default 127.0.0.1)
+//   --port P        (default 1883)
+//   --seconds S     run time (default 60)
+//   --speed N       bridge clock at N x real time, so batches close sooner (default 10)
+//   --nodes K       controllers, one sample each per 2 s of bridge time (default 4)
+//   --spool PATH    spool files PATH.0 ... and PATH.ack (default /tmp/mqtt_soak.spool, removed first)
+//   --prefix T      topic prefix (default hydro/soak)
+//
+// After the run it waits up to 10 s for the spool to drain, then reports batches published,
+// acked, replayed, received, missing and duplicated (by the payloads' "seq").
+
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <mutex>
+#include <netdb.h>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "mqtt_link.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// Non-blocking TCP socket; a write waits for the whole packet to go, a local broker keeps up
+class PosixTransport : public MqttTransport {
+    public:
+        bool open(const char *host, uint16_t port) override {
+            close();
+            char service[8];
+            snprintf(service, sizeof(service), "%u", port);
+            addrinfo hints = {}, *res = nullptr;
+            hints.ai_family   = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(host, service, &hints, &res) != 0) return false;
+
+            fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                int rc = connect(fd, res->ai_addr, res->ai_addrlen);
+                state  = (rc == 0) ? MqttSocket::OPEN : (errno == EINPROGRESS ? MqttSocket::CONNECTING : MqttSocket::CLOSED);
+            }
+            freeaddrinfo(res);
+            return fd >= 0 && state != MqttSocket::CLOSED;
+        }
+
+        MqttSocket status() override {
+            if (state == MqttSocket::CONNECTING) {
+                pollfd p = { fd, POLLOUT, 0 };
+                if (poll(&p, 1, 0) == 1) {
+                    int err = 0;
+                    socklen_t n = sizeof(err);
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &n);
+                    state = err ? MqttSocket::CLOSED : MqttSocket::OPEN;
+                }
+            }
+            return state;
+        }
+
+        size_t write(const uint8_t *data, size_t len) override {
+            size_t done = 0;
+            while (state == MqttSocket::OPEN && done < len) {
+                ssize_t n = send(fd, data + done, len - done, MSG_NOSIGNAL);
+                if (n > 0) {
+                    done += n;
+                } else if (n < 0 && errno == EAGAIN) {
+                    pollfd p = { fd, POLLOUT, 0 };
+                    poll(&p, 1, 100);
+                } else {
+                    state = MqttSocket::CLOSED;
+                }
+            }
+            return done == len ? len : 0;
+        }
+
+        size_t read(uint8_t *dst, size_t max) override {
+            if (state != MqttSocket::OPEN) return 0;
+            ssize_t n = recv(fd, dst, max, 0);
+            if (n > 0) return n;
+            if (n == 0 || errno != EAGAIN) state = MqttSocket::CLOSED;
+            return 0;
+        }
+
+        void close() override {
+            if (fd >= 0) ::close(fd);
+            fd    = -1;
+            state = MqttSocket::CLOSED;
+        }
+
+        bool wait_readable(int ms) {
+            pollfd p = { fd, POLLIN, 0 };
+            return state == MqttSocket::OPEN && poll(&p, 1, ms) == 1;
+        }
+
+    private:
+        int        fd    = -1;
+        MqttSocket state = MqttSocket::CLOSED;
+};
+
+// The spool in plain files, <path>.<n> per segment and <path>.ack, as on LittleFS
+class PosixSpoolFiles : public SpoolFiles {
+    public:
+        explicit PosixSpoolFiles(const char *path) : path(path) {}
+
+        bool append(uint16_t segment, const void *src, size_t len) override {
+            int fd = ::open(name(segment).c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+            bool ok = fd >= 0 && ::write(fd, src, len) == static_cast<ssize_t>(len);
+            if (fd >= 0) ::close(fd);
+            return ok;
+        }
+
+        bool read(uint16_t segment, uint32_t offset, void *dst, size_t len) override {
+            int fd = ::open(name(segment).c_str(), O_RDONLY);
+            bool ok = fd >= 0 && pread(fd, dst, len, offset) == static_cast<ssize_t>(len);
+            if (fd >= 0) ::close(fd);
+            return ok;
+        }
+
+        void remove(uint16_t segment) override { unlink(name(segment).c_str()); }
+
+        bool load_cursor(uint32_t &seq) override {
+            int fd = ::open(cursor().c_str(), O_RDONLY);
+            bool ok = fd >= 0 && ::read(fd, &seq, sizeof(seq)) == sizeof(seq);
+            if (fd >= 0) ::close(fd);
+            return ok;
+        }
+
+        bool save_cursor(uint32_t seq) override {
+            int fd = ::open(cursor().c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0644);
+            bool ok = fd >= 0 && ::write(fd, &seq, sizeof(seq)) == sizeof(seq);
+            if (fd >= 0) ::close(fd);
+            return ok;
+        }
+
+        // Left over from an earlier run
+        void clear() {
+            for (uint16_t s = 0; s < MQTT_SPOOL_SEGMENTS; ++s) remove(s);
+            unlink(cursor().c_str());
+        }
+
+    private:
+        std::string path;
+
+        std::string name(uint16_t segment) const { return path + "." + std::to_string(segment); }
+        std::string cursor() const { return path + ".ack"; }
+};
+
+//!##################################################
+//!######## Subscriber ##############################
+//! Its own thread and connection; reconnects every
+//! 200 ms while the broker is away, sooner than the
+//! publisher's backoff lets it back in.
+//!##################################################
+
+static std::set<uint32_t> received;
+static uint32_t           duplicates = 0;
+static std::mutex         book;
+static volatile bool      stopping   = false;
+
+static void subscriber(const char *host, uint16_t port, const char *prefix) {
+    PosixTransport net;
+    MqttParser     parser;
+    uint8_t        tx[MQTT_TOPIC_MAX + 64];
+    char           filter[MQTT_TOPIC_MAX];
+    snprintf(filter, sizeof(filter), "%s/#", prefix);
+
+    while (!stopping) {
+        if (!net.open(host, port)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            continue;
+        }
+        while (net.status() == MqttSocket::CONNECTING) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        parser.reset();
+        net.write(tx, mqtt_connect_packet(tx, "mqtt-soak-sub", MQTT_KEEPALIVE_S));
+        net.write(tx, mqtt_subscribe_packet(tx, 1, filter, 1));
+
+        while (!stopping && net.status() == MqttSocket::OPEN) {
+            if (!net.wait_readable(100)) continue;
+            uint8_t buf[512];
+            size_t  n = net.read(buf, sizeof(buf));
+            MqttPacket pkt;
+            for (size_t i = 0; i < n; ++i) {
+                if (!parser.feed(buf[i], pkt) || pkt.type != MQTT_PUBLISH) continue;
+
+                size_t   tlen = (pkt.body[0] << 8) | pkt.body[1];
+                uint8_t  qos  = (pkt.flags >> 1) & 3;
+                size_t   at   = 2 + tlen + (qos ? 2 : 0);
+                std::string payload(reinterpret_cast<const char *>(pkt.body + at), pkt.len - at);
+                if (qos) net.write(tx, mqtt_puback_packet(tx, (pkt.body[2 + tlen] << 8) | pkt.body[3 + tlen]));
+
+                size_t s = payload.find("\"seq\":");
+                if (s == std::string::npos) continue;
+                uint32_t seq = strtoul(payload.c_str() + s + 6, nullptr, 10);
+                std::lock_guard<std::mutex> lock(book);
+                if (!received.insert(seq).second) duplicates++;
+            }
+        }
+        net.close();
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *host    = "127.0.0.1";
+    uint16_t    port    = 1883;
+    double      seconds = 60.0;
+    double      speed   = 10.0;
+    unsigned    nodes   = 4;
+    const char *path    = "/tmp/mqtt_soak.spool";
+    const char *prefix  = "hydro/soak";
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : "";
+        if      (!strcmp(a, "--host"))    { host    = v; ++i; }
+        else if (!strcmp(a, "--port"))    { port    = atoi(v); ++i; }
+        else if (!strcmp(a, "--seconds")) { seconds = atof(v); ++i; }
+        else if (!strcmp(a, "--speed"))   { speed   = atof(v); ++i; }
+        else if (!strcmp(a, "--nodes"))   { nodes   = atoi(v); ++i; }
+        else if (!strcmp(a, "--spool"))   { path    = v; ++i; }
+        else if (!strcmp(a, "--prefix"))  { prefix  = v; ++i; }
+        else {
+            fprintf(stderr, "unknown option %s\n", a);
+            return 2;
+        }
+    }
+    if (speed <= 0.0 || nodes < 1) {
+        fprintf(stderr, "--speed and --nodes must be positive\n");
+        return 2;
+    }
+
+    PosixSpoolFiles files(path);
+    PosixTransport  net;
+    MqttSpool       spool;
+    MqttLink        link(net, spool);
+    Telemetry       telemetry(link, static_cast<uint32_t>(time(nullptr)));
+    files.clear();
+    spool.open(files);
+    link.cfg = { host, port, "mqtt-soak-pub", prefix, nullptr, nullptr };
+
+    std::thread sub(subscriber, host, port, prefix);
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    Clock::time_point start = Clock::now();
+    auto bridge_ms = [&]() {
+        return static_cast<unsigned long>(std::chrono::duration<double, std::milli>(Clock::now() - start).count() * speed);
+    };
+
+    link.start(bridge_ms());
+    unsigned long next_sample = 0, next_report = 0;
+    uint32_t      samples = 0;
+    MqttState     last    = link.status();
+
+    auto step = [&](unsigned long now) {
+        link.service(now);
+        telemetry.service(now);
+        if (link.status() != last) {
+            printf("%8.1f s  %-10s  spool %u\n", now / 1000.0, link.name(), link.queued());
+            last = link.status();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+
+    while (bridge_ms() < seconds * 1000.0 * speed) {
+        unsigned long now = bridge_ms();
+        if (now >= next_sample) {
+            for (unsigned n = 1; n <= nodes; ++n) {
+                telemetry.sample(now, n, 0, 6.0f + 0.01f * (samples % 50), 1200.0f + samples % 100, 21.5f);
+            }
+            samples++;
+            next_sample += 2000;
+        }
+        if (now >= next_report) {
+            char fields[96];
+            snprintf(fields, sizeof(fields), "\"spool\":%u,\"acked\":%u,\"replays\":%u", link.queued(), link.acked,
+                     link.replays);
+            telemetry.metrics(now, fields);
+            next_report += MQTT_BATCH_MS;
+        }
+        step(now);
+    }
+
+    // Close what's open and let the spool drain
+    telemetry.service(bridge_ms() + MQTT_BATCH_MS);
+    for (Clock::time_point until = Clock::now() + std::chrono::seconds(10); Clock::now() < until;) {
+        step(bridge_ms());
+        if (link.queued() == 0) break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    stopping = true;
+    sub.join();
+    link.stop(bridge_ms());
+
+    uint32_t published = telemetry.messages();
+    uint32_t missing   = 0;
+    {
+        std::lock_guard<std::mutex> lock(book);
+        for (uint32_t seq = 0; seq < published; ++seq) missing += received.count(seq) ? 0 : 1;
+    }
+
+    printf("\nsamples %u x %u nodes, spool %s\n", samples, nodes, path);
+    printf("published %u  acked %u  still spooled %u  lost before the spool %u  spool dropped %u\n",
+           published, link.acked, link.queued(), telemetry.lost, spool.dropped);
+    printf("reconnects %u  replays %u  refused %u\n", link.reconnects, link.replays, link.refused);
+    printf("received %zu  missing %u  duplicates %u\n", received.size(), missing, duplicates);
+    return (missing || link.queued()) ? 1 : 0;
+}
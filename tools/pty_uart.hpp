@@ -0,0 +1,124 @@
+// Host tools: the MCU's UART on one end of a pseudo-terminal pair, for running the real
+// firmware (src/main.cpp, built natively) against a simulated ESP32 / bus on the other end.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+
+#include <Arduino.h>
+
+using Clock = std::chrono::steady_clock;
+
+//!##################################################
+//!######## MCU side of the pty #####################
+//! A receive "ISR" thread moves bytes from the pty
+//! into a ring the size of the real UART's; bytes
+//! that don't fit are lost, as on the hardware.
+//! The firmware reads through Serial1 as usual.
+//!##################################################
+
+class PtyUart : public HardwareSerial {
+    public:
+        std::atomic<size_t> overruns { 0 };
+
+        // Called with every complete line loop() reads, and when it was completed
+        void (*on_line)(const std::string &line, Clock::time_point at) = nullptr;
+
+        void open(int pty_fd, size_t ring_size) {
+            fd       = pty_fd;
+            capacity = ring_size;
+            running  = true;
+            rx_thread = std::thread([this] { receive(); });
+        }
+
+        void close() {
+            running = false;
+            if (rx_thread.joinable()) rx_thread.join();
+        }
+
+        int available() override {
+            std::lock_guard<std::mutex> lock(m);
+            return static_cast<int>(ring.size());
+        }
+
+        int read() override {
+            char c;
+            {
+                std::lock_guard<std::mutex> lock(m);
+                if (ring.empty()) return -1;
+                c = ring.front();
+                ring.pop_front();
+            }
+            if (c == '\n') {
+                if (on_line) on_line(line, Clock::now());
+                line.clear();
+            } else if (line.size() < 1024) {
+                line.push_back(c);
+            }
+            return static_cast<uint8_t>(c);
+        }
+
+        size_t write(uint8_t c) override {
+            out.push_back(static_cast<char>(c));
+            if (c == '\n') {
+                ssize_t n = ::write(fd, out.data(), out.size());
+                (void)n;
+                out.clear();
+            }
+            return 1;
+        }
+        using Print::write;
+
+    private:
+        int    fd       = -1;
+        size_t capacity = 350;
+
+        std::mutex        m;
+        std::deque<char>  ring;
+        std::thread       rx_thread;
+        std::atomic<bool> running { false };
+
+        std::string line; // firmware thread only
+        std::string out;
+
+        void receive() {
+            char buf[256];
+            while (running) {
+                ssize_t n = ::read(fd, buf, sizeof(buf));
+                if (n <= 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(m);
+                for (ssize_t i = 0; i < n; ++i) {
+                    if (ring.size() < capacity) ring.push_back(buf[i]);
+                    else overruns++;
+                }
+            }
+        }
+};
+
+static bool open_pty(int &master, int &slave) {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) return false;
+
+    slave = ::open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) return false;
+
+    // Raw bytes both ways: no echo, no line editing, no CR/LF translation
+    termios t;
+    for (int fd : { master, slave }) {
+        tcgetattr(fd, &t);
+        cfmakeraw(&t);
+        tcsetattr(fd, TCSANOW, &t);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return true;
+}
@@ -0,0 +1,245 @@
+// Host tool: replays a UART capture from the ESP32 (/capture.log, see serial_capture.hpp)
+// into the real firmware. Every ESP32 -> MCU line goes through CommReader, parse_message
+// and handle_comm_message from src/main.cpp; the dose queue, pump steps and mixes run on
+// the captured clock in between. Reports the per-message processing time and the state
+// the firmware ends up in.
+// pio run -e native_serial_replay && .pio/build/native_serial_replay/program capture.log [options]
+//
+//   --speed N    N x real time; 0 replays as fast as possible (throughput benchmark)
+//   --repeat N   replay the capture N times back to back (default 1)
+//   --verbose    echo the firmware's debug port and replies
+//
+// Sensor reads are not replayed: the ADC stays at zero and the automated dosing path in
+// loop() is not run, only the comm half of it.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/main.cpp"
+#include "serial_capture.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_us(Clock::time_point since) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - since).count();
+}
+
+struct LatencyStats {
+    std::vector<double> us;
+
+    void print(const char *name) {
+        if (us.empty()) return;
+        std::sort(us.begin(), us.end());
+        double sum = 0.0;
+        for (double v : us) sum += v;
+        printf("  %-8s %7zu  %9.2f  %9.2f  %9.2f  %9.2f\n", name, us.size(), sum / us.size(),
+               us[us.size() / 2], us[std::min(us.size() - 1, us.size() * 99 / 100)], us.back());
+    }
+};
+
+// "M" of a line without parsing the rest, 0 if there is none
+static uint16_t message_code(const char *line) {
+    const char *m = strstr(line, "\"M\":");
+    return m ? static_cast<uint16_t>(atoi(m + 4)) : 0;
+}
+
+// Counts the MCU's replies by message code and forgets them
+static void drain_replies(std::map<uint16_t, unsigned> &replies) {
+    size_t start = 0, nl;
+    while ((nl = COMM_UART.tx.find('\n', start)) != std::string::npos) {
+        replies[message_code(COMM_UART.tx.c_str() + start)]++;
+        start = nl + 1;
+    }
+    COMM_UART.tx.erase(0, start);
+    DEBUG_PORT.tx.clear();
+}
+
+// loop() minus the sensors, one captured millisecond at a time while anything is running
+static void run_firmware_until(unsigned long to_ms) {
+    const uint32_t ticks_per_ms = STEP_TIMER_HZ / 1000;
+
+    while (static_cast<long>(to_ms - native_millis) > 0) {
+        bool busy = doseQueue.busy() || recipe.running();
+        for (const Zone &z : zones) busy |= z.calibrating() || z.autoCycle.active;
+        if (!busy) {
+            native_millis = to_ms;
+            break;
+        }
+
+        native_millis++;
+        for (uint32_t i = 0; i < ticks_per_ms && step_timer_callback; ++i) step_timer_callback();
+
+        doseQueue.service(native_millis);
+        service_probe_cal(native_millis);
+        for (Zone &z : zones) {
+            if (z.autoCycle.active && !doseQueue.busy(JobSource::AUTO, z.index)) close_auto_cycle(z, native_millis);
+        }
+
+        // Waits and branches see the cached readings, which don't change here
+        if (recipe.running()) {
+            const Zone &z = zones[recipeZone];
+            const float readings[NUM_RECIPE_SENSORS] = { z.latest_ec, z.latest_ph, z.latest_temp };
+            recipe.service(native_millis, readings, doseQueue.busy(JobSource::RECIPE, z.index));
+        }
+    }
+}
+
+static void print_state() {
+    printf("\nfinal state\n");
+    for (const Zone &z : zones) {
+        const TargetPlant &plant = z.plant;
+        printf("  zone %u      %s\n", z.index, z.running ? "RUNNING" : "STANDBY");
+        printf("  profile     EC [%.2f, %.2f] avg %.2f | pH [%.2f, %.2f] avg %.2f\n",
+               plant.ec_low, plant.ec_high, plant.ec_avg, plant.ph_low, plant.ph_high, plant.ph_avg);
+    }
+    printf("  dose queue  %s\n", doseQueue.busy() ? "busy" : "idle");
+    printf("  pump cal    %s\n", pumpCalibrator.active() ? "in progress" : "idle");
+    printf("  recipe      %s at step %u of %u\n", RECIPE_STATE_NAMES[static_cast<uint8_t>(recipe.status())],
+           recipe.step(), recipe.size());
+
+    for (uint8_t i = 0; i < NUM_PUMPS; ++i) {
+        const PumpCalibration &cal = pumps[i].calibration();
+        printf("  %-10s  %.1f steps/mL @ %.0f steps/s\n", PUMP_NAMES[i], cal.steps_per_ml, cal.profile.max_speed);
+    }
+
+    for (const Zone &z : zones) {
+        printf("  EC probes %u", z.index);
+        for (size_t i = 0; i < Board::NUM_EC; ++i) printf(" %.6g*raw%+.4f", z.ecProbes.cal.scale[i], z.ecProbes.cal.offset[i]);
+        printf("\n  pH probes %u", z.index);
+        for (size_t i = 0; i < Board::NUM_PH; ++i) printf(" %.6g*raw%+.4f", z.phProbes.cal.scale[i], z.phProbes.cal.offset[i]);
+        printf("\n");
+    }
+    printf("  store       generation %u, %u bytes free in block\n",
+           static_cast<unsigned>(store.generation()), static_cast<unsigned>(store.bytes_free()));
+}
+
+int main(int argc, char **argv) {
+    const char *path    = nullptr;
+    double      speed   = 1.0;
+    int         repeat  = 1;
+    bool        verbose = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if      (!strcmp(argv[i], "--speed") && i + 1 < argc)  speed  = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) repeat = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--verbose"))                verbose = true;
+        else if (!path)                                        path = argv[i];
+        else {
+            fprintf(stderr, "usage: %s capture.log [--speed N] [--repeat N] [--verbose]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s capture.log [--speed N] [--repeat N] [--verbose]\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+
+    std::vector<std::string>   text;
+    std::vector<CaptureRecord> records;
+    for (std::string line; std::getline(in, line);) text.push_back(line);
+
+    size_t malformed = 0;
+    for (const std::string &t : text) {
+        CaptureRecord rec;
+        if (parse_capture_record(t.c_str(), rec)) records.push_back(rec);
+        else malformed++;
+    }
+    if (records.empty()) {
+        fprintf(stderr, "%s: no records\n", path);
+        return 1;
+    }
+
+    DEBUG_PORT.echo = verbose;
+    COMM_UART.echo  = verbose;
+    setup();
+
+    std::map<uint16_t, LatencyStats> handled;   // ESP32 -> MCU, through handle_comm_message
+    LatencyStats                     rx_parse;  // MCU -> ESP32, parse_message only
+    std::map<uint16_t, unsigned>     captured_replies, replayed_replies;
+
+    unsigned long span_ms   = records.back().ms - records.front().ms;
+    size_t        bytes     = 0;
+    double        busy_us   = 0.0;
+    auto          wall_t0   = Clock::now();
+
+    for (int r = 0; r < repeat; ++r) {
+        unsigned long base_ms  = native_millis;
+        auto          pass_t0  = Clock::now();
+
+        for (const CaptureRecord &rec : records) {
+            unsigned long offset = rec.ms - records.front().ms;
+
+            if (speed > 0.0) {
+                std::this_thread::sleep_until(pass_t0 + std::chrono::duration<double, std::milli>(offset / speed));
+            }
+
+            auto t0 = Clock::now();
+            run_firmware_until(base_ms + offset);
+            busy_us += elapsed_us(t0);
+
+            uint16_t code = message_code(rec.line);
+            bytes += strlen(rec.line) + 1;
+
+            if (rec.dir == CAPTURE_FROM_MCU) {
+                if (r == 0) captured_replies[code]++; // once; the report scales by repeat
+                JsonDocument doc;
+                auto p0 = Clock::now();
+                parse_message(rec.line, doc);
+                rx_parse.us.push_back(elapsed_us(p0));
+                continue;
+            }
+
+            COMM_UART.feed(rec.line);
+            COMM_UART.feed("\n");
+
+            auto h0 = Clock::now();
+            if (commReader.poll(COMM_PORT)) handle_comm_message(commReader.buf);
+            double us = elapsed_us(h0);
+
+            handled[code].us.push_back(us);
+            busy_us += us;
+            drain_replies(replayed_replies);
+        }
+
+        // Let whatever the last message queued finish
+        auto t0 = Clock::now();
+        run_firmware_until(native_millis + 10UL * 60UL * 1000UL);
+        busy_us += elapsed_us(t0);
+        drain_replies(replayed_replies);
+    }
+
+    double wall_s = std::chrono::duration<double>(Clock::now() - wall_t0).count();
+
+    char pace[24] = "full speed";
+    if (speed > 0.0) snprintf(pace, sizeof(pace), "%gx", speed);
+    printf("%zu records (%zu malformed skipped), %.1f s of capture x %d at %s in %.2f s\n",
+           records.size(), malformed, span_ms / 1000.0, repeat, pace, wall_s);
+    printf("firmware busy %.1f ms: %.0f records/s, %.2f MB/s of UART traffic\n", busy_us / 1000.0,
+           records.size() * repeat / (busy_us / 1e6), bytes / busy_us);
+
+    printf("\nprocessing time, us        n       mean        p50        p99        max\n");
+    for (auto &h : handled) h.second.print(h.first ? std::to_string(h.first).c_str() : "no M");
+    rx_parse.print("reply");
+
+    printf("\nreplies      captured  replayed\n");
+    std::map<uint16_t, bool> codes;
+    for (auto &c : captured_replies) codes[c.first] = true;
+    for (auto &c : replayed_replies) codes[c.first] = true;
+    for (auto &c : codes) {
+        printf("  %-8u  %9u  %8u\n", c.first, captured_replies[c.first] * repeat, replayed_replies[c.first]);
+    }
+
+    print_state();
+    return 0;
+}
@@ -0,0 +1,378 @@
+// Host tool: controller tuning sweep. Runs the real filter, scheduler, gain estimator
+// and planner against a simulated reservoir over a grid of tuning parameters, in
+// parallel, and prints the settings ranked by settling time, overshoot and chemical use.
+// pio run -e native_tune_sweep && .pio/build/native_tune_sweep/program [options]
+//
+//   --seeds N     simulated grow cycles per grid point (default 4)
+//   --hours H     length of each cycle (default 24)
+//   --threads N   worker threads (default: all cores)
+//   --top N       rows to print (default 20)
+//   --csv FILE    also write every grid point to FILE
+//   --ec-gain G   true nutrient gain of the simulated reservoir, e.g. after a
+//                 nutrient change (default 0.35 mS/cm per mL/L)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "kalman.hpp"
+#include "dose_planner.hpp"
+#include "dose_scheduler.hpp"
+#include "gain_estimator.hpp"
+#include "reservoir_sim.hpp"
+#include "work_stealing_pool.hpp"
+
+//!##################################################
+//!######## Simulated grow cycle ####################
+//! Starts out of band, takes a top-up with fresh
+//! water half way through, and runs loop()'s AUTO
+//! path on the filtered probe readings. A dose only
+//! reaches the probes as it mixes in: fast while the
+//! mixer runs, slowly once it stops, so a short mix
+//! shows up as a misread settle and a bad gain fit.
+//!##################################################
+
+static const unsigned long SAMPLE_MS      = 2000;   // coarser than loop(); the filter configs are rescaled to it
+static const float         MIX_TAU_S      = 8.0f;   // mixing time constant, mixer on
+static const float         PASSIVE_TAU_S  = 900.0f; // ...and off
+static const float         PUMP_ML_PER_S  = 1.0f;   // dispense time before the mix starts
+static const unsigned long HOLD_MS        = 30UL * 60UL * 1000UL; // in band this long counts as settled
+
+struct TuneParams {
+    unsigned long min_settle_ms;
+    unsigned long max_interval_ms;
+    unsigned long lookahead_ms;
+    float         q_scale;     // Kalman process noise, multiple of the shipped config
+    float         gain_prior;  // initial EC/pH actuator gain guess, multiple of the shipped prior
+    unsigned long mix_ms;
+};
+
+struct TuneResult {
+    TuneParams p;
+    float settle_min;  // mean time from a disturbance to staying in band
+    float overshoot;   // worst excursion outside the band once reached, % of band width
+    float ml;          // chemicals dosed per cycle
+    float doses;       // dosing cycles per grow cycle
+    float score;
+};
+
+static TargetPlant make_plant() {
+    TargetPlant p;
+    p.ec_low = 0.8f; p.ec_high = 1.8f; p.ec_avg = 1.3f;
+    p.ph_low = 6.0f; p.ph_high = 6.8f; p.ph_avg = 6.4f;
+    p.gro_amount = 1; p.micro_amount = 1; p.bloom_amount = 1;
+    return p;
+}
+
+// Reservoir whose doses sit in an unmixed pool until they mix in
+struct MixingReservoir {
+    ReservoirSim sim;
+    float pool_ec = 0.0f;
+    float pool_ph = 0.0f;
+
+    float ec() const { return sim.ec + pool_ec; } // well mixed truth
+    float ph() const { return sim.ph + pool_ph; }
+
+    void dose(float nut, float up, float down) {
+        float ec0 = sim.ec, ph0 = sim.ph;
+        sim.dose(nut, up, down);
+        pool_ec += sim.ec - ec0;
+        pool_ph += sim.ph - ph0;
+        sim.ec = ec0;
+        sim.ph = ph0;
+    }
+
+    void advance(float seconds, bool mixing) {
+        sim.advance(seconds / 60.0f);
+        float k = 1.0f - expf(-seconds / (mixing ? MIX_TAU_S : PASSIVE_TAU_S));
+        sim.ec  += k * pool_ec; pool_ec -= k * pool_ec;
+        sim.ph  += k * pool_ph; pool_ph -= k * pool_ph;
+    }
+};
+
+struct SettleTracker {
+    unsigned long disturbed_ms = 0;
+    unsigned long in_band_ms   = 0;
+    bool          in_band      = false;
+    bool          settled      = false;
+    float         total_ms     = 0.0f;
+    int           disturbances = 0;
+
+    void disturb(unsigned long now) {
+        if (disturbances > 0 && !settled) total_ms += now - disturbed_ms;
+        disturbed_ms = now;
+        settled      = false;
+        disturbances++;
+    }
+
+    void update(bool ok, unsigned long now) {
+        if (ok && !in_band) in_band_ms = now;
+        in_band = ok;
+        if (!settled && ok && now - in_band_ms >= HOLD_MS) {
+            settled   = true;
+            total_ms += in_band_ms - disturbed_ms;
+        }
+    }
+
+    // A disturbance never settled counts until the end of the run
+    float mean_min(unsigned long end) const {
+        float t = total_ms + (settled ? 0.0f : float(end - disturbed_ms));
+        return t / disturbances / 60000.0f;
+    }
+};
+
+static float band_excess(float v, float lo, float hi) {
+    if (v < lo) return (lo - v) / (hi - lo);
+    if (v > hi) return (v - hi) / (hi - lo);
+    return 0.0f;
+}
+
+static TuneResult simulate(const TuneParams &tp, uint32_t seed, float hours, float ec_gain) {
+    const TargetPlant plant = make_plant();
+
+    MixingReservoir res;
+    res.sim.rng.seed(seed);
+    res.sim.ec_gain = ec_gain;
+
+    // Start out of band somewhere different each seed
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    res.sim.ec = 0.4f + 0.3f * u(res.sim.rng);
+    res.sim.ph = u(res.sim.rng) < 0.5f ? 5.4f + 0.4f * u(res.sim.rng) : 7.0f + 0.5f * u(res.sim.rng);
+
+    KalmanFilter   ec_k { NAN, NAN };
+    KalmanFilter   ph_k { NAN, NAN };
+    ProbeHealth<4> ec_h { filter_config_at(EC_FILTER_CONFIG, SAMPLE_MS) };
+    ProbeHealth<2> ph_h { filter_config_at(PH_FILTER_CONFIG, SAMPLE_MS) };
+    ec_h.cfg.process_noise *= tp.q_scale;
+    ph_h.cfg.process_noise *= tp.q_scale;
+
+    PlantGains gains;
+    for (GainEstimator *g : { &gains.ec, &gains.ph_up, &gains.ph_down }) {
+        g->cfg.prior *= tp.gain_prior;
+        g->reset();
+    }
+
+    SchedulerConfig cfg = DEFAULT_SCHEDULER_CONFIG;
+    cfg.min_settle_ms   = tp.min_settle_ms;
+    cfg.max_interval_ms = tp.max_interval_ms;
+    cfg.lookahead_ms    = tp.lookahead_ms;
+    DoseScheduler scheduler(cfg);
+    scheduler.begin(0);
+
+    DoseObservation obs {};
+    unsigned long   obs_ms     = 0;
+    unsigned long   busy_until = 0; // pumping + mixing, loop() skips the scheduler
+    unsigned long   mix_from   = 0;
+    bool            cycle_open = false;
+
+    SettleTracker settle;
+    settle.disturb(0);
+
+    const unsigned long end_ms   = static_cast<unsigned long>(hours * 3600000.0f);
+    const unsigned long topup_ms = end_ms / 2;
+
+    float overshoot = 0.0f;
+    float ml        = 0.0f;
+    int   doses     = 0;
+
+    for (unsigned long now = 0; now < end_ms; now += SAMPLE_MS) {
+        if (now == topup_ms - topup_ms % SAMPLE_MS) {
+            // 30 % fresh water at pH 7.5
+            res.sim.ec *= 0.7f;
+            res.sim.ph  = 0.7f * res.sim.ph + 0.3f * 7.5f;
+            settle.disturb(now);
+        }
+
+        bool mixing = now >= mix_from && now < busy_until;
+        res.advance(SAMPLE_MS / 1000.0f, mixing);
+
+        bool ok = res.ec() >= plant.ec_low && res.ec() <= plant.ec_high &&
+                  res.ph() >= plant.ph_low && res.ph() <= plant.ph_high;
+        settle.update(ok, now);
+        if (settle.settled) {
+            overshoot = std::max(overshoot, band_excess(res.ec(), plant.ec_low, plant.ec_high));
+            overshoot = std::max(overshoot, band_excess(res.ph(), plant.ph_low, plant.ph_high));
+        }
+
+        float ec = ec_filter(res.sim.read_ec(), ec_k, ec_h);
+        float ph = ph_filter(res.sim.read_ph(), ph_k, ph_h);
+
+        if (now < busy_until) continue;
+
+        if (cycle_open) {
+            scheduler.evaluated(now, true);
+            obs_ms     = now;
+            cycle_open = false;
+        }
+        if (obs.pending && now - obs_ms >= cfg.min_settle_ms) {
+            gains.observe(obs, ec, ph);
+            obs.pending = false;
+        }
+
+        scheduler.update(ec, ph, now);
+        if (scheduler.due(plant, now) == DoseTrigger::NONE) continue;
+
+        float cycle_min  = static_cast<float>(cfg.max_interval_ms) / 60000.0f;
+        PlantModel model = gains.model(scheduler.ec_rate() * cycle_min, scheduler.ph_rate() * cycle_min);
+        float vol        = res.sim.volume_l;
+        DosePlan plan    = plan_doses(model, DEFAULT_ACTUATOR_LIMITS, plant, vol,
+                                      scheduler.ec_for_dosing(), scheduler.ph_for_dosing());
+
+        if (!plan.any()) {
+            scheduler.evaluated(now, false);
+            continue;
+        }
+
+        float total = plan.nutrient() + plan.ph_up + plan.ph_down;
+        res.dose(plan.nutrient(), plan.ph_up, plan.ph_down);
+        obs        = { true, ec, ph, plan.nutrient(), plan.ph_up, plan.ph_down, vol };
+        mix_from   = now + static_cast<unsigned long>(total / PUMP_ML_PER_S * 1000.0f);
+        busy_until = mix_from + tp.mix_ms;
+        cycle_open = true;
+        ml        += total;
+        doses++;
+    }
+
+    return { tp, settle.mean_min(end_ms), overshoot * 100.0f, ml, float(doses), 0.0f };
+}
+
+static std::vector<TuneParams> make_grid() {
+    const unsigned long MIN = 60UL * 1000UL;
+
+    std::vector<TuneParams> grid;
+    for (unsigned long settle : { 2 * MIN, 3 * MIN, 5 * MIN, 8 * MIN })
+    for (unsigned long interval : { 30 * MIN, 60 * MIN })
+    for (unsigned long lookahead : { 5 * MIN, 10 * MIN, 20 * MIN })
+    for (float q : { 0.1f, 1.0f, 10.0f })
+    for (float prior : { 0.5f, 1.0f, 2.0f })
+    for (unsigned long mix : { 4000UL, 7000UL, 15000UL }) {
+        grid.push_back({ settle, interval, lookahead, q, prior, mix });
+    }
+    return grid;
+}
+
+static float median_of(std::vector<TuneResult> &r, float TuneResult::*field) {
+    std::vector<float> v;
+    for (const TuneResult &x : r) v.push_back(x.*field);
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+// Settle time, overshoot and mL, each divided by its own median over the grid and summed;
+// lower is better. The overshoot median is floored at 1 %, so when hardly anything
+// overshoots the ranking comes from the other two.
+static void score(std::vector<TuneResult> &results) {
+    float m_settle = std::max(median_of(results, &TuneResult::settle_min), 1e-3f);
+    float m_over   = std::max(median_of(results, &TuneResult::overshoot), 1.0f);
+    float m_ml     = std::max(median_of(results, &TuneResult::ml), 1e-3f);
+
+    for (TuneResult &r : results) {
+        r.score = r.settle_min / m_settle + r.overshoot / m_over + r.ml / m_ml;
+    }
+    std::sort(results.begin(), results.end(),
+              [](const TuneResult &a, const TuneResult &b) { return a.score < b.score; });
+}
+
+static void print_row(FILE *f, const char *fmt, size_t rank, const TuneResult &r) {
+    fprintf(f, fmt, rank, r.score, r.settle_min, r.overshoot, r.ml, r.doses,
+            r.p.min_settle_ms / 60000UL, r.p.max_interval_ms / 60000UL, r.p.lookahead_ms / 60000UL,
+            r.p.q_scale, r.p.gain_prior, r.p.mix_ms / 1000UL);
+}
+
+int main(int argc, char **argv) {
+    int         seeds   = 4;
+    float       hours   = 24.0f;
+    unsigned    threads = std::thread::hardware_concurrency();
+    size_t      top     = 20;
+    const char *csv     = nullptr;
+    float       ec_gain = ReservoirSim().ec_gain;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if      (!strcmp(argv[i], "--seeds"))   seeds   = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--hours"))   hours   = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--threads")) {
+            int n = atoi(argv[i + 1]);
+            if (n < 1) {
+                fprintf(stderr, "--threads needs at least 1\n");
+                return 2;
+            }
+            threads = n;
+        }
+        else if (!strcmp(argv[i], "--top")) {
+            int n = atoi(argv[i + 1]);
+            if (n < 0) {
+                fprintf(stderr, "--top can't be negative\n");
+                return 2;
+            }
+            top = n;
+        }
+        else if (!strcmp(argv[i], "--csv"))     csv     = argv[i + 1];
+        else if (!strcmp(argv[i], "--ec-gain")) ec_gain = atof(argv[i + 1]);
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (seeds < 1) seeds = 1;
+
+    std::vector<TuneParams> grid = make_grid();
+    std::vector<TuneResult> runs(grid.size() * seeds);
+
+    auto t0 = std::chrono::steady_clock::now();
+    size_t steals = 0;
+    unsigned workers = 0;
+    {
+        WorkStealingPool pool(threads);
+        workers = pool.size();
+        // One task per grow cycle; cycles that dose more run longer, stealing evens that out
+        for (size_t g = 0; g < grid.size(); ++g) {
+            for (int s = 0; s < seeds; ++s) {
+                pool.submit([&, g, s] {
+                    runs[g * seeds + s] = simulate(grid[g], 1000u + s, hours, ec_gain);
+                });
+            }
+        }
+        pool.wait();
+        steals = pool.steals();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // Mean over the seeds of each grid point
+    std::vector<TuneResult> results;
+    for (size_t g = 0; g < grid.size(); ++g) {
+        TuneResult m = { grid[g], 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int s = 0; s < seeds; ++s) {
+            const TuneResult &r = runs[g * seeds + s];
+            m.settle_min += r.settle_min / seeds;
+            m.overshoot  += r.overshoot / seeds;
+            m.ml         += r.ml / seeds;
+            m.doses      += r.doses / seeds;
+        }
+        results.push_back(m);
+    }
+    score(results);
+
+    printf("%zu cycles of %.0f h (%zu settings x %d seeds) on %u threads in %.1f s, %zu steals\n\n",
+           runs.size(), hours, grid.size(), seeds, workers, secs, steals);
+
+    printf("rank  score  settle_min  overshoot%%      mL  doses | settle_min interval_min lookahead_min  q_scale  gain_prior  mix_s\n");
+    const char *row = "%4zu  %5.2f  %10.1f  %10.1f  %6.1f  %5.1f | %10lu %12lu %13lu  %7.1f  %10.1f  %5lu\n";
+    for (size_t i = 0; i < results.size() && i < top; ++i) print_row(stdout, row, i + 1, results[i]);
+
+    if (csv) {
+        FILE *f = fopen(csv, "w");
+        if (!f) {
+            fprintf(stderr, "cannot write %s\n", csv);
+            return 1;
+        }
+        fprintf(f, "rank,score,settle_min,overshoot_pct,ml,doses,min_settle_min,max_interval_min,lookahead_min,q_scale,gain_prior,mix_s\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            print_row(f, "%zu,%.3f,%.2f,%.2f,%.2f,%.2f,%lu,%lu,%lu,%.2f,%.2f,%lu\n", i + 1, results[i]);
+        }
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*#################################################*/
+/* Work-stealing thread pool for the host tools.   */
+/* Each worker owns a deque: it pops its own work  */
+/* from the back and, when empty, steals from the  */
+/* front of another worker's deque.                */
+/*#################################################*/
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+    public:
+        using Task = std::function<void()>;
+
+        explicit WorkStealingPool(unsigned threads = std::thread::hardware_concurrency()) {
+            if (threads == 0) threads = 1;
+            for (unsigned i = 0; i < threads; ++i) queues.emplace_back(new Queue);
+            for (unsigned i = 0; i < threads; ++i) workers.emplace_back([this, i] { run(i); });
+        }
+
+        ~WorkStealingPool() {
+            {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                stopping = true;
+            }
+            idle_cv.notify_all();
+            for (std::thread &t : workers) t.join();
+        }
+
+        unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+        // Round-robin onto the workers' deques; stealing evens out the rest. Counted before it is
+        // queued, or a worker could finish it and take pending through zero first.
+        void submit(Task task) {
+            {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                pending++;
+            }
+            Queue &q = *queues[next_queue++ % queues.size()];
+            {
+                std::lock_guard<std::mutex> lock(q.mutex);
+                q.tasks.push_back(std::move(task));
+            }
+            idle_cv.notify_one();
+        }
+
+        // Blocks until every submitted task has finished
+        void wait() {
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            done_cv.wait(lock, [this] { return pending == 0; });
+        }
+
+        // Tasks taken from another worker's deque, for tuning the chunk size
+        size_t steals() const { return steal_count; }
+
+    private:
+        struct Queue {
+            std::mutex       mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread>            workers;
+
+        std::mutex              idle_mutex;
+        std::condition_variable idle_cv;
+        std::condition_variable done_cv;
+        size_t                  pending  = 0;
+        bool                    stopping = false;
+
+        std::atomic<size_t> next_queue{ 0 };
+        std::atomic<size_t> steal_count{ 0 };
+
+        bool pop_own(unsigned self, Task &task) {
+            Queue &q = *queues[self];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) return false;
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+
+        bool steal(unsigned self, Task &task) {
+            for (size_t k = 1; k < queues.size(); ++k) {
+                Queue &q = *queues[(self + k) % queues.size()];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (q.tasks.empty()) continue;
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                steal_count++;
+                return true;
+            }
+            return false;
+        }
+
+        void run(unsigned self) {
+            for (;;) {
+                Task task;
+                if (pop_own(self, task) || steal(self, task)) {
+                    task();
+
+                    std::lock_guard<std::mutex> lock(idle_mutex);
+                    if (--pending == 0) done_cv.notify_all();
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(idle_mutex);
+                if (stopping) return;
+                // Work may have been queued between the failed steal and taking the lock
+                idle_cv.wait_for(lock, std::chrono::milliseconds(5));
+                if (stopping && pending == 0) return;
+            }
+        }
+};